@@ -0,0 +1,113 @@
+/**
+ * @file content_table.h
+ * @brief Content hashes of watched files, for dropping no-op rewrites
+ *
+ * Formatters, touch and build tools rewrite files with the bytes they
+ * already held, and each rewrite is a MODIFIED event. The table keeps a
+ * 64-bit XXH64 hash and the size of every file it has seen, keyed by
+ * device and inode so the entry follows the file through renames. A
+ * MODIFIED whose file still hashes the same can then be dropped.
+ *
+ * Files are read with pread() in CONTENT_CHUNK_BYTES pieces into one
+ * buffer owned by the table, and files over the caller's size cap are not
+ * hashed at all, so a check costs at most cap bytes of reading. A file
+ * whose size moved since the last check has changed whatever it holds, so
+ * it only gets its new size recorded and is hashed by the next check that
+ * finds that size again; a growing log costs one fstat() per check rather
+ * than a read of everything written so far. A table at
+ * CONTENT_MAX_ENTRIES starts over empty rather than grow further.
+ *
+ * The table does no locking of its own; callers serialize access with the
+ * owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef CONTENT_TABLE_H
+#define CONTENT_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Content_Table Content Table
+ * @brief Per-inode content hashes
+ * @{
+ */
+
+/** Files tracked before the table is cleared */
+#define CONTENT_MAX_ENTRIES 65536
+
+/** Bytes read per pread() while hashing (a multiple of 32) */
+#define CONTENT_CHUNK_BYTES (64 * 1024)
+
+/** Size cap used when the caller asks for the default */
+#define CONTENT_DEFAULT_MAX_BYTES (4 * 1024 * 1024)
+
+/** @brief What a check found */
+typedef enum {
+    CONTENT_UNKNOWN = 0, /**< Not hashed: gone, not a regular file, over the cap or unreadable */
+    CONTENT_CHANGED,     /**< New to the table, or its hash or size differs; now recorded */
+    CONTENT_UNCHANGED    /**< Same size and hash as last recorded */
+} ContentResult;
+
+/** @brief What the table knows about one file */
+typedef struct {
+    uint64_t dev;   /**< st_dev */
+    uint64_t ino;   /**< st_ino, 0 for a free slot */
+    uint64_t size;  /**< File size when hashed */
+    uint64_t hash;  /**< XXH64 of the contents, seed 0 */
+    uint8_t hashed; /**< hash matches size; 0 after a size change, until the next check */
+} ContentEntry;
+
+/** @brief Open-addressed table of ContentEntry */
+typedef struct {
+    ContentEntry *entries; /**< capacity slots, NULL until the first check */
+    uint32_t capacity;     /**< Power of two */
+    uint32_t count;        /**< Used slots */
+    uint8_t *buffer;       /**< CONTENT_CHUNK_BYTES read buffer */
+} ContentTable;
+
+/**
+ * @brief XXH64 of a buffer
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @param seed Seed
+ * @return 64-bit hash
+ */
+uint64_t content_hash64(const void *data, size_t len, uint64_t seed);
+
+/**
+ * @brief Initialize an empty table
+ * @param table Table to initialize
+ */
+void content_table_init(ContentTable *table);
+
+/**
+ * @brief Free everything the table holds
+ * @param table Table to destroy
+ */
+void content_table_destroy(ContentTable *table);
+
+/**
+ * @brief Hash a file and compare it with what was last recorded for it
+ * @param table Table
+ * @param path File to hash
+ * @param max_bytes Files larger than this are not hashed
+ * @return ContentResult
+ */
+ContentResult content_table_check(ContentTable *table, const char *path, uint64_t max_bytes);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CONTENT_TABLE_H
@@ -0,0 +1,150 @@
+/**
+ * @file dir_snapshot.h
+ * @brief Per-directory listings used to recover from queue overflow
+ *
+ * Keeps, for every watched directory, a compact sorted listing of its
+ * entries with inode, mtime and size. The listing is kept current as
+ * events are parsed, so when the kernel queue overflows the directories
+ * can be listed again and diffed against it to recover the exact
+ * CREATED/MODIFIED/DELETED events that were dropped.
+ *
+ * Entries are 32 bytes each; names live in one string blob per directory.
+ * The table does no locking of its own; callers serialize access with the
+ * owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef DIR_SNAPSHOT_H
+#define DIR_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Dir_Snapshot Directory Snapshot
+ * @brief Listings diffed after IN_Q_OVERFLOW
+ * @{
+ */
+
+/** @brief One directory entry */
+typedef struct {
+    uint64_t ino;       /**< Inode number */
+    int64_t mtime_ns;   /**< Modification time in ns since the epoch */
+    int64_t size;       /**< Size in bytes */
+    uint32_t name_off;  /**< Offset of the name in the directory's blob */
+    uint16_t name_len;  /**< Length of the name */
+    uint8_t is_dir;     /**< Entry is a directory */
+    uint8_t reserved;   /**< Zero */
+} SnapshotEntry;
+
+/** @brief Listing of one watched directory */
+typedef struct {
+    int wd;                  /**< Watch descriptor of the directory */
+    SnapshotEntry *entries;  /**< Entries sorted by name */
+    uint32_t count;          /**< Used entries */
+    uint32_t capacity;       /**< Allocated entries */
+    char *names;             /**< Name storage */
+    uint32_t names_len;      /**< Bytes used in names */
+    uint32_t names_cap;      /**< Bytes allocated for names */
+    uint32_t names_dead;     /**< Bytes of names no entry refers to */
+} DirSnapshot;
+
+/** @brief Snapshots of all watched directories, keyed by wd */
+typedef struct {
+    DirSnapshot **slots;  /**< Open-addressing table */
+    uint32_t capacity;    /**< Slots (power of two) */
+    uint32_t count;       /**< Live snapshots */
+    uint32_t used;        /**< Live snapshots plus tombstones */
+} SnapshotTable;
+
+/**
+ * @brief Called for every difference found by snapshot_rescan()
+ * @param ctx Caller context
+ * @param kind RING_CREATED, RING_MODIFIED or RING_DELETED
+ * @param is_dir Entry is (or was) a directory
+ * @param name Entry name, not NUL-terminated
+ * @param name_len Length of name
+ */
+typedef void (*SnapshotDiffFn)(void *ctx, uint8_t kind, int is_dir, const char *name, size_t name_len);
+
+/**
+ * @brief Initialize an empty table
+ * @param table Table to initialize
+ * @return 0 on success, -1 on allocation failure
+ */
+int snapshot_table_init(SnapshotTable *table);
+
+/**
+ * @brief Free every snapshot
+ * @param table Table to destroy
+ */
+void snapshot_table_destroy(SnapshotTable *table);
+
+/**
+ * @brief Whether a directory has a snapshot
+ * @param table Table
+ * @param wd Watch descriptor
+ * @return 1 if a snapshot exists
+ */
+int snapshot_table_has(const SnapshotTable *table, int wd);
+
+/**
+ * @brief Forget a directory
+ * @param table Table
+ * @param wd Watch descriptor
+ */
+void snapshot_table_remove(SnapshotTable *table, int wd);
+
+/**
+ * @brief List a directory and store it as the snapshot for wd
+ * @param table Table
+ * @param wd Watch descriptor
+ * @param path Directory path
+ * @return 0 on success, -1 with errno set if it could not be listed
+ */
+int snapshot_scan(SnapshotTable *table, int wd, const char *path);
+
+/**
+ * @brief Refresh one entry after an event named it
+ *
+ * Stats dir/name and updates, inserts or (if it is gone) removes the
+ * entry. Directories without a snapshot are left alone.
+ *
+ * @param table Table
+ * @param wd Watch descriptor of the directory
+ * @param dir Directory path
+ * @param name Entry name
+ * @param name_len Length of name
+ * @return 0 on success, -1 on allocation failure
+ */
+int snapshot_update(SnapshotTable *table, int wd, const char *dir, const char *name, size_t name_len);
+
+/**
+ * @brief List a directory again, report what changed, and keep the new listing
+ *
+ * Regular files count as modified when their inode, mtime or size differ.
+ * Directories are only reported as created or deleted.
+ *
+ * @param table Table
+ * @param wd Watch descriptor
+ * @param path Directory path
+ * @param fn Difference callback
+ * @param ctx Passed to fn
+ * @return Number of differences, -1 with errno set if it could not be listed
+ */
+int snapshot_rescan(SnapshotTable *table, int wd, const char *path, SnapshotDiffFn fn, void *ctx);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIR_SNAPSHOT_H
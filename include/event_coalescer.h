@@ -0,0 +1,134 @@
+/**
+ * @file event_coalescer.h
+ * @brief Debounce stage between inotify parsing and event delivery
+ *
+ * Holds one pending entry per path and folds new events into it: repeated
+ * MODIFY events collapse into one, CREATE followed by DELETE cancels out,
+ * DELETE followed by CREATE becomes MODIFY. An entry is released once its
+ * path has been quiet for the configured window.
+ *
+ * Entries are kept in order of their last update, so the ones that are
+ * ready always form a prefix of the list. Ordering between different
+ * paths therefore follows their most recent event rather than their first.
+ *
+ * The coalescer does no locking of its own; callers serialize access with
+ * the owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef EVENT_COALESCER_H
+#define EVENT_COALESCER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Event_Coalescer Event Coalescer
+ * @brief Per-path event folding with a quiet window
+ * @{
+ */
+
+/** Pending paths held before the oldest is released early */
+#define COALESCE_MAX_ENTRIES 65536
+
+/** @brief A pending, already folded event */
+typedef struct {
+    uint64_t last_ns;   /**< Time of the most recent event for this path */
+    uint32_t hash;      /**< Hash of path */
+    uint8_t kind;       /**< RingEventKind after folding */
+    uint8_t flags;      /**< RING_FLAG_* of the latest event */
+    uint16_t path_len;  /**< Length of path */
+    uint32_t cookie;    /**< inotify cookie of the latest event */
+    char *path;         /**< Full path, NULL when the entry is free */
+    int prev;           /**< Older entry in update order, -1 at the head */
+    int next;           /**< Newer entry in update order, -1 at the tail */
+} CoalescedEvent;
+
+/** @brief Coalescer state */
+typedef struct {
+    CoalescedEvent *entries; /**< Entry pool */
+    int pool_size;           /**< Allocated entries */
+    int free_head;           /**< First free entry (linked through next), -1 if none */
+    int *index;              /**< path hash -> entry table */
+    uint32_t index_capacity; /**< Slots in index (power of two) */
+    uint32_t index_used;     /**< Live slots plus tombstones */
+    int count;               /**< Pending entries */
+    int head;                /**< Least recently updated entry, -1 if empty */
+    int tail;                /**< Most recently updated entry, -1 if empty */
+    uint64_t window_ns;      /**< Quiet time before an entry is released */
+} EventCoalescer;
+
+/**
+ * @brief Initialize an empty coalescer
+ * @param coalescer Coalescer to initialize
+ * @param window_ns Quiet window in nanoseconds
+ * @return 0 on success, -1 on allocation failure
+ */
+int event_coalescer_init(EventCoalescer *coalescer, uint64_t window_ns);
+
+/**
+ * @brief Free all pending entries and tables
+ * @param coalescer Coalescer to destroy
+ */
+void event_coalescer_destroy(EventCoalescer *coalescer);
+
+/**
+ * @brief Fold an event into the pending set
+ * @param coalescer Coalescer
+ * @param kind RingEventKind
+ * @param flags RING_FLAG_* bits
+ * @param cookie inotify cookie
+ * @param path Full path (need not be NUL-terminated)
+ * @param path_len Length of path
+ * @param now_ns Current CLOCK_MONOTONIC time
+ * @return 0 on success, -1 if full (COALESCE_MAX_ENTRIES) or out of memory
+ */
+int event_coalescer_add(EventCoalescer *coalescer, uint8_t kind, uint8_t flags, uint32_t cookie,
+                        const char *path, size_t path_len, uint64_t now_ns);
+
+/**
+ * @brief Pending entry for a path
+ * @param coalescer Coalescer
+ * @param path Full path
+ * @param path_len Length of path
+ * @return Entry, or NULL if the path has nothing pending. Valid until the next add/pop.
+ */
+const CoalescedEvent *event_coalescer_find(const EventCoalescer *coalescer, const char *path, size_t path_len);
+
+/**
+ * @brief Oldest entry whose window has passed
+ * @param coalescer Coalescer
+ * @param now_ns Current CLOCK_MONOTONIC time
+ * @param force Return the oldest entry even if it is not quiet yet
+ * @return Entry, or NULL if none is ready. Valid until the next add/pop.
+ */
+const CoalescedEvent *event_coalescer_peek(const EventCoalescer *coalescer, uint64_t now_ns, int force);
+
+/**
+ * @brief Release an entry returned by event_coalescer_peek() or event_coalescer_find()
+ * @param coalescer Coalescer
+ * @param entry Entry to release
+ */
+void event_coalescer_pop(EventCoalescer *coalescer, const CoalescedEvent *entry);
+
+/**
+ * @brief When the oldest pending entry becomes ready
+ * @param coalescer Coalescer
+ * @return CLOCK_MONOTONIC deadline in ns, or UINT64_MAX if nothing is pending
+ */
+uint64_t event_coalescer_deadline(const EventCoalescer *coalescer);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVENT_COALESCER_H
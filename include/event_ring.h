@@ -0,0 +1,246 @@
+/**
+ * @file event_ring.h
+ * @brief Binary event ring shared between native code and Java
+ *
+ * Parsed events are stored as compact variable-length records in a single
+ * producer byte ring. One consumer can decode records in place
+ * (event_ring_peek() / event_ring_pop()); several consumers instead copy
+ * a record out and claim it with a compare-and-swap on tail
+ * (event_ring_copy() / event_ring_claim()), and the two styles must not
+ * be mixed on one ring. The whole ring (header plus data)
+ * is one mapping that can be handed to Java with NewDirectByteBuffer, so a
+ * Java consumer can decode records in place and only build path strings
+ * for events it actually wants.
+ *
+ * Layout (native byte order, all offsets in bytes):
+ *
+ *     0    RingHeader   magic, version, data offset, capacity
+ *     16   head         u32, producer position (store-release)
+ *     64   tail         u32, consumer position (store-release)
+ *     128  data         capacity bytes of RingRecord
+ *
+ * Positions increase monotonically and wrap at 2^32; a record starts at
+ * `data[pos & (capacity - 1)]`. Records are 8-byte aligned. A record with
+ * RING_FLAG_PAD fills the space up to the end of the data area and is
+ * skipped. The consumer loads head with acquire semantics, decodes records
+ * up to it, then publishes its new tail with release semantics.
+ *
+ * A RING_MOVED record always has RING_FLAG_PATH; its name holds the old
+ * path (old_len bytes) immediately followed by the new path.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Event_Ring Event Ring
+ * @brief Shared-memory event queue
+ * @{
+ */
+
+/** Header magic, "FWRG" in little-endian */
+#define RING_MAGIC 0x47525746u
+/** Ring format version */
+#define RING_VERSION 1
+/** Byte offset of the head index (for Java) */
+#define RING_HEAD_OFFSET 16
+/** Byte offset of the tail index (for Java) */
+#define RING_TAIL_OFFSET 64
+/** Byte offset of the first data byte */
+#define RING_DATA_OFFSET 128
+/** Default data capacity in bytes */
+#define RING_DEFAULT_CAPACITY (64 * 1024)
+/** Smallest data capacity accepted, room for two of the largest records */
+#define RING_MIN_CAPACITY (16 * 1024)
+/** Longest full path a record can carry, PATH_MAX on Linux */
+#define RING_MAX_PATH 4096
+/** Longest name a record can carry (room for both paths of a move) */
+#define RING_MAX_NAME (2 * RING_MAX_PATH)
+
+/** @brief Event kinds, numbered like FileWatcher.EventKind ordinals */
+typedef enum {
+    RING_CREATED = 0,   /**< IN_CREATE, IN_MOVED_TO */
+    RING_MODIFIED = 1,  /**< IN_MODIFY and anything unclassified */
+    RING_DELETED = 2,   /**< IN_DELETE, IN_MOVED_FROM */
+    RING_OVERFLOW = 3,  /**< IN_Q_OVERFLOW */
+    RING_MOVED = 4      /**< Paired IN_MOVED_FROM + IN_MOVED_TO */
+} RingEventKind;
+
+/** Record is wrap padding, not an event */
+#define RING_FLAG_PAD 0x01
+/** Event refers to a directory (IN_ISDIR) */
+#define RING_FLAG_DIR 0x02
+/** name is the full path, already resolved by the producer */
+#define RING_FLAG_PATH 0x04
+/** Event was synthesized by overflow recovery rather than read from inotify */
+#define RING_FLAG_SYNTH 0x08
+
+/** @brief Ring header at the start of the mapping */
+typedef struct {
+    uint32_t magic;            /**< RING_MAGIC */
+    uint16_t version;          /**< RING_VERSION */
+    uint16_t data_offset;      /**< RING_DATA_OFFSET */
+    uint32_t capacity;         /**< Data bytes, power of two */
+    uint32_t reserved;         /**< Zero */
+    _Atomic uint32_t head;     /**< Producer position */
+    uint8_t pad_head[RING_TAIL_OFFSET - RING_HEAD_OFFSET - sizeof(uint32_t)];
+    _Atomic uint32_t tail;     /**< Consumer position */
+    uint8_t pad_tail[RING_DATA_OFFSET - RING_TAIL_OFFSET - sizeof(uint32_t)];
+} RingHeader;
+
+/** @brief One event record (16-byte header followed by the name) */
+typedef struct {
+    uint16_t size;       /**< Record bytes including header and padding */
+    uint8_t kind;        /**< RingEventKind */
+    uint8_t flags;       /**< RING_FLAG_* */
+    int32_t wd;          /**< Watch descriptor naming the directory, -1 if none */
+    uint32_t cookie;     /**< inotify cookie for rename halves, else 0 */
+    uint16_t name_len;   /**< Bytes of name, no terminator */
+    uint16_t old_len;    /**< Bytes of old path at the start of name (RING_MOVED), else 0 */
+    char name[];         /**< Name relative to the wd's directory, or full path with RING_FLAG_PATH */
+} RingRecord;
+
+/** Bytes of RingRecord before the name */
+#define RING_RECORD_HEADER 16
+
+/** Largest record, padding included */
+#define RING_MAX_RECORD ((RING_RECORD_HEADER + RING_MAX_NAME + 7) & ~7)
+
+/** @brief Ring handle */
+typedef struct {
+    RingHeader *header;  /**< Start of the shared mapping */
+    uint8_t *data;       /**< Record area */
+    uint32_t capacity;   /**< Copy of header->capacity */
+    size_t map_size;     /**< Size of the mapping */
+    _Atomic uint32_t high_water; /**< Most bytes ever in use */
+} EventRing;
+
+/**
+ * @brief Map and initialize a ring
+ * @param ring Ring to initialize
+ * @param capacity Requested data bytes, rounded up to a power of two
+ * @return 0 on success, -1 on allocation failure
+ */
+int event_ring_init(EventRing *ring, uint32_t capacity);
+
+/**
+ * @brief Unmap a ring
+ * @param ring Ring to destroy
+ */
+void event_ring_destroy(EventRing *ring);
+
+/**
+ * @brief Check whether a record with this name length fits right now
+ * @param ring Ring (producer side)
+ * @param name_len Name bytes
+ * @return 1 if event_ring_push() would succeed
+ */
+int event_ring_can_push(const EventRing *ring, size_t name_len);
+
+/**
+ * @brief Append a record (producer side)
+ * @param ring Ring
+ * @param kind RingEventKind
+ * @param flags RING_FLAG_* (not PAD)
+ * @param wd Watch descriptor, -1 if none
+ * @param cookie inotify cookie
+ * @param name Entry name, may be NULL when name_len is 0
+ * @param name_len Bytes of name, at most RING_MAX_NAME
+ * @return 0 on success, -1 if the ring is full
+ */
+int event_ring_push(EventRing *ring, uint8_t kind, uint8_t flags, int32_t wd,
+                    uint32_t cookie, const char *name, size_t name_len);
+
+/**
+ * @brief Append a RING_MOVED record (producer side)
+ * @param ring Ring
+ * @param flags RING_FLAG_* (RING_FLAG_PATH is added)
+ * @param wd Watch descriptor of the destination directory, -1 if none
+ * @param cookie inotify cookie shared by both halves
+ * @param from Old full path
+ * @param from_len Bytes of from
+ * @param to New full path
+ * @param to_len Bytes of to; from_len + to_len is at most RING_MAX_NAME
+ * @return 0 on success, -1 if the ring is full
+ */
+int event_ring_push_move(EventRing *ring, uint8_t flags, int32_t wd, uint32_t cookie,
+                         const char *from, size_t from_len, const char *to, size_t to_len);
+
+/**
+ * @brief Peek at the oldest record (consumer side)
+ * @param ring Ring
+ * @return Record, or NULL if the ring is empty. Valid until popped.
+ */
+const RingRecord *event_ring_peek(EventRing *ring);
+
+/**
+ * @brief Release the record returned by event_ring_peek()
+ * @param ring Ring
+ * @param record Record to release
+ */
+void event_ring_pop(EventRing *ring, const RingRecord *record);
+
+/**
+ * @brief Copy out the oldest record without releasing it (shared consumers)
+ *
+ * Skips padding. The copy is only known to be intact once
+ * event_ring_claim() succeeds for it; until then another consumer may have
+ * taken the record and the producer reused its space.
+ *
+ * @param ring Ring
+ * @param out Receives the record, RING_MAX_RECORD bytes, 8-byte aligned
+ * @param pos Receives the position to claim
+ * @return 1 if a record was copied, 0 if the ring is empty
+ */
+int event_ring_copy(EventRing *ring, RingRecord *out, uint32_t *pos);
+
+/**
+ * @brief Release a copied record if no other consumer has (shared consumers)
+ * @param ring Ring
+ * @param pos Position from event_ring_copy()
+ * @param copy The copy
+ * @return 1 if this consumer now owns the event, 0 if it lost the race and
+ *         should copy again
+ */
+int event_ring_claim(EventRing *ring, uint32_t pos, const RingRecord *copy);
+
+/**
+ * @brief Current consumer position
+ * @param ring Ring
+ * @return tail index
+ */
+uint32_t event_ring_tail(const EventRing *ring);
+
+/**
+ * @brief Current producer position
+ * @param ring Ring
+ * @return head index
+ */
+uint32_t event_ring_head(const EventRing *ring);
+
+/**
+ * @brief Peak occupancy since init
+ * @param ring Ring
+ * @return Largest number of bytes (records and padding) buffered at once
+ */
+uint32_t event_ring_high_water(const EventRing *ring);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVENT_RING_H
@@ -0,0 +1,152 @@
+/**
+ * @file fanotify_source.h
+ * @brief fanotify event source for whole-filesystem recursive watches
+ *
+ * Marks the filesystem under a recursive root once with fanotify instead
+ * of adding an inotify watch per directory, so setup cost and kernel
+ * memory no longer grow with the size of the tree. Needs a kernel with
+ * FAN_REPORT_DFID_NAME (5.9+) and CAP_SYS_ADMIN plus CAP_DAC_READ_SEARCH,
+ * i.e. root on a rooted device or desktop Linux; without them opening or
+ * marking fails and the caller stays on inotify.
+ *
+ * Events are translated into struct inotify_event records so the regular
+ * parse loop handles them. The kernel reports each event's directory as a
+ * file handle; it is resolved to a path (cached per handle) and handed to
+ * a callback that decides whether the directory is watched and which wd
+ * it goes by. With FAN_RENAME (5.17+) a rename becomes an IN_MOVED_FROM /
+ * IN_MOVED_TO pair sharing a cookie; on older kernels the halves come
+ * separately with cookie 0 and cannot be paired.
+ *
+ * Paths are resolved when the event is read, not when it happened, so an
+ * event in a directory that has been renamed since reports the new path.
+ * The source does no locking of its own; callers serialize access with
+ * the owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef FANOTIFY_SOURCE_H
+#define FANOTIFY_SOURCE_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Fanotify_Source Fanotify Source
+ * @brief Filesystem marks translated into inotify records
+ * @{
+ */
+
+/** Kernel read buffer size */
+#define FANOTIFY_BUF_LEN 16384
+
+/** Handle -> path cache slots; the cache is cleared when it fills */
+#define FANOTIFY_CACHE_SLOTS 1024
+
+/** Most translated bytes a single kernel event can produce: one record per merged event bit */
+#define FANOTIFY_MAX_RECORD (5 * (sizeof(struct inotify_event) + NAME_MAX + 4))
+
+/**
+ * @brief Decide whether events in a directory are delivered
+ * @param ctx Caller context
+ * @param dir Directory path
+ * @param len Length of dir
+ * @return wd the directory's events are reported under, -1 to drop them
+ */
+typedef int (*FanotifyDirFn)(void *ctx, const char *dir, size_t len);
+
+/** @brief A marked filesystem */
+typedef struct {
+    int32_t fsid[2];  /**< Filesystem id events carry */
+    int mount_fd;     /**< Directory on it, for open_by_handle_at() */
+} FanotifyMount;
+
+/** @brief One cached directory handle */
+typedef struct {
+    uint32_t hash;  /**< Hash of key, 0 for a free slot */
+    uint32_t key_len; /**< Length of key */
+    unsigned char *key; /**< fsid + handle type + handle bytes */
+    char *path;     /**< Resolved directory path, in key's allocation */
+    uint32_t path_len; /**< Length of path */
+} FanotifyCacheEntry;
+
+/** @brief fanotify group state */
+typedef struct {
+    int fd;                     /**< fanotify group, -1 when not open */
+    uint64_t mask;              /**< Event bits every mark subscribes to */
+    FanotifyMount *mounts;      /**< Marked filesystems */
+    int mount_count;            /**< Used slots in mounts */
+    int mount_capacity;         /**< Allocated slots in mounts */
+    FanotifyCacheEntry *cache;  /**< Handle -> path table, FANOTIFY_CACHE_SLOTS long */
+    uint32_t cache_count;       /**< Used cache slots */
+    uint32_t next_cookie;       /**< Cookie for the next paired rename */
+    char *buffer;               /**< Raw kernel events, FANOTIFY_BUF_LEN bytes while open */
+    int buffer_pos;             /**< Next unread byte in buffer */
+    int buffer_len;             /**< Valid bytes in buffer */
+} FanotifySource;
+
+/**
+ * @brief Create a fanotify group that reports directory handles and names
+ * @param src Source to initialize; fd is -1 on failure
+ * @return 0 on success, -1 with errno set (ENOSYS if not built in, EPERM
+ *         or EINVAL if the kernel or caller does not allow it)
+ */
+int fanotify_source_open(FanotifySource *src);
+
+/**
+ * @brief Mark the whole filesystem a directory lives on
+ *
+ * Marking a filesystem twice is harmless. Fails unless directory handles
+ * on it can be resolved back to paths.
+ *
+ * @param src Open source
+ * @param path Directory on the filesystem
+ * @return 0 on success, -1 with errno set
+ */
+int fanotify_source_mark(FanotifySource *src, const char *path);
+
+/**
+ * @brief Remove every filesystem mark; the group stays open
+ * @param src Open source
+ */
+void fanotify_source_unmark_all(FanotifySource *src);
+
+/**
+ * @brief Read pending events and translate them into inotify records
+ *
+ * Keeps reading while the kernel has events and none of them were
+ * delivered, so events outside every watched directory cost no wakeups
+ * of the parse loop. A queue overflow becomes an IN_Q_OVERFLOW record
+ * with wd -1.
+ *
+ * @param src Open source
+ * @param out Receives struct inotify_event records
+ * @param size Size of out, at least FANOTIFY_MAX_RECORD
+ * @param dir_fn Maps an event's directory to a wd
+ * @param ctx Passed to dir_fn
+ * @return Bytes written to out, 0 if nothing is pending
+ */
+int fanotify_source_read(FanotifySource *src, char *out, size_t size, FanotifyDirFn dir_fn, void *ctx);
+
+/**
+ * @brief Close the group and free the cache
+ * @param src Source, may already be closed
+ */
+void fanotify_source_close(FanotifySource *src);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FANOTIFY_SOURCE_H
@@ -0,0 +1,89 @@
+/**
+ * @file filewatcher_backend.h
+ * @brief Choosing how the library watches files on this device
+ *
+ * One library build carries every backend. JNI_OnLoad picks one with
+ * filewatcher_backend_select(), from FILEWATCHER_BACKEND or, by default,
+ * by probing the kernel: fanotify where the caller may use it, else
+ * inotify, else polling. The probes open and close a real inotify
+ * instance and fanotify group, and mark the filesystem holding / with
+ * the group, so limits are honored as they stand: a user at
+ * max_user_instances or a process at its fd limit gets polling, and a
+ * caller without CAP_SYS_ADMIN gets inotify even where the kernel lets
+ * it create the group.
+ *
+ * The stub backend binds the JNI natives to no-op versions; the other
+ * three share the real natives and differ only in how each watcher the
+ * core creates gets its events.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef FILEWATCHER_BACKEND_H
+#define FILEWATCHER_BACKEND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Backend_Selection Backend Selection
+ * @brief Runtime choice between stub, inotify, fanotify and polling
+ * @{
+ */
+
+/** Environment variable naming the backend: stub, inotify, fanotify, poll or auto */
+#define FILEWATCHER_BACKEND_ENV "FILEWATCHER_BACKEND"
+
+/** @brief Ways of watching */
+typedef enum {
+    FILEWATCHER_BACKEND_STUB = 0, /**< No-op natives that never report anything */
+    FILEWATCHER_BACKEND_INOTIFY,  /**< inotify watches, directories past the limit polled */
+    FILEWATCHER_BACKEND_FANOTIFY, /**< fanotify marks for recursive roots, inotify for the rest */
+    FILEWATCHER_BACKEND_POLL,     /**< Every directory polled; files cannot be watched */
+    FILEWATCHER_BACKEND_COUNT     /**< Number of backends */
+} FileWatcherBackend;
+
+/**
+ * @brief Name of a backend, as FILEWATCHER_BACKEND spells it
+ * @param backend Backend
+ * @return Static name, "unknown" if out of range
+ */
+const char *filewatcher_backend_name(FileWatcherBackend backend);
+
+/**
+ * @brief Backend with the given name
+ * @param name Backend name, case-insensitive
+ * @return Backend, or -1 if the name is unknown (including "auto")
+ */
+int filewatcher_backend_parse(const char *name);
+
+/**
+ * @brief Whether a backend works in this process right now
+ * @param backend Backend to probe
+ * @return 1 if it does
+ */
+int filewatcher_backend_available(FileWatcherBackend backend);
+
+/**
+ * @brief The backend to run with
+ *
+ * A named backend that does not work here steps down fanotify -> inotify
+ * -> poll until one does, with an error logged; the stub and polling
+ * always work. NULL, "" or "auto" picks the fastest that works, and an
+ * unknown name is logged and treated as "auto".
+ *
+ * @param requested Value of FILEWATCHER_BACKEND, may be NULL
+ * @return Backend to use
+ */
+FileWatcherBackend filewatcher_backend_select(const char *requested);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILEWATCHER_BACKEND_H
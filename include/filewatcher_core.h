@@ -0,0 +1,617 @@
+/**
+ * @file filewatcher_core.h
+ * @brief JNI-free watcher core
+ *
+ * The inotify reading, parsing and delivery pipeline behind the JNI
+ * library, usable from plain C: benchmarks, fuzzers and native tools link
+ * libfilewatcher_core directly, and real_filewatcher.c is a thin JNI shim
+ * over it.
+ *
+ * A FileWatcher is safe to use from several threads. Without the reader
+ * thread, consumers take turns on the watcher mutex and parse for each
+ * other; with it, parsing happens once on the reader and any number of
+ * threads take events through filewatcher_poll() without locking.
+ * Functions return 0 (or a count) on success and -1 with errno set on
+ * failure unless stated otherwise.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef FILEWATCHER_CORE_H
+#define FILEWATCHER_CORE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include "content_table.h"
+#include "dir_snapshot.h"
+#include "event_coalescer.h"
+#include "event_ring.h"
+#include "fanotify_source.h"
+#include "filewatcher_backend.h"
+#include "glob_filter.h"
+#include "poll_scheduler.h"
+#include "rename_table.h"
+#include "tree_crawler.h"
+#include "watch_engine.h"
+#include "watch_journal.h"
+#include "watch_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Watcher_Core Watcher Core
+ * @brief Watcher lifecycle and event delivery without a JVM
+ * @{
+ */
+
+/** Buffer size for records translated from a fanotify read */
+#define EVENT_SIZE (sizeof(struct inotify_event))
+#define BUF_LEN (1024 * (EVENT_SIZE + 16))
+
+/** Events every watched directory subscribes to */
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO)
+
+/** Event bits filewatcher_watch_filtered() accepts */
+#define FILTER_MASK (WATCH_MASK | IN_CLOSE_WRITE)
+
+/** How long a settled file may stay open after its last write before MODIFIED is reported anyway */
+#define SETTLE_DEFAULT_TIMEOUT_MS 2000
+
+/** How often the reader thread wakes to drop watches whose directories are gone */
+#define RETIRED_SWEEP_MS 100
+
+/** Watch descriptors from here up are handed out for directories under fanotify roots */
+#define FANOTIFY_WD_BASE (1 << 30)
+
+/**
+ * @brief Slots of the array filewatcher_get_stats() fills
+ *
+ * Counters run from the watcher's creation. The slots from
+ * STAT_EVENTS_PER_READ on are computed when the stats are taken. The Java
+ * string cache slots belong to the JNI layer, which shares one cache
+ * between all watchers; filewatcher_get_stats() leaves them 0.
+ */
+typedef enum {
+    STAT_EVENTS_READ = 0,   /**< Raw inotify (or translated fanotify) records parsed */
+    STAT_EVENTS_DELIVERED,  /**< Events handed out by filewatcher_poll() */
+    STAT_EVENTS_COALESCED,  /**< Events folded into one already pending for their path */
+    STAT_EVENTS_FILTERED,   /**< Events a watch filter dropped */
+    STAT_OVERFLOWS,         /**< Queue overflows, from the kernel or the engine inbox */
+    STAT_READ_CALLS,        /**< Batches of records taken from the engine inbox, a fanotify read() or the poll scheduler */
+    STAT_BYTES_READ,        /**< Bytes in those batches */
+    STAT_LOCK_CONTENTION,   /**< Times the watcher mutex was found already held */
+    STAT_COUNTERS,          /**< Number of running counters */
+    STAT_EVENTS_PER_READ = STAT_COUNTERS, /**< STAT_EVENTS_READ / STAT_READ_CALLS */
+    STAT_MAX_QUEUE_BYTES,   /**< Event ring high-water mark */
+    STAT_ACTIVE_WATCHES,    /**< Watch descriptors in the registry */
+    STAT_STRING_HITS,       /**< Event paths served from the Java string cache */
+    STAT_STRING_MISSES,     /**< Event paths that needed a new Java string */
+    STAT_WATCH_LIMIT,       /**< max_user_watches, 0 if it could not be read */
+    STAT_POLLED_DIRS,       /**< Directories polled because the watch limit was reached */
+    STAT_BACKEND,           /**< FileWatcherBackend the watcher was created with */
+    STAT_EVENTS_UNCHANGED,  /**< MODIFIED events dropped because the file's contents did not change */
+    STAT_COUNT              /**< Slots filewatcher_get_stats() fills */
+} FileWatcherStat;
+
+/** @brief A watch whose IN_IGNORED arrived, kept until the consumer catches up */
+typedef struct {
+    int wd;             /**< Watch descriptor to drop from the registry */
+    uint32_t ring_pos;  /**< Ring head when it was retired */
+} RetiredWatch;
+
+/** @brief An event rebuilt by overflow recovery, waiting for ring space */
+typedef struct {
+    uint8_t kind;       /**< RingEventKind */
+    uint8_t flags;      /**< RING_FLAG_* */
+    uint16_t path_len;  /**< Length of path */
+    char *path;         /**< Full path, NULL for RING_OVERFLOW */
+} RecoveredEvent;
+
+/** @brief Delivery thread behind filewatcher_set_listener(), private to filewatcher_core.c */
+typedef struct ListenerThread ListenerThread;
+
+/** @brief Per-watch event filter set by filewatcher_watch_filtered() */
+typedef struct {
+    int wd;               /**< Watch the filter applies to */
+    uint32_t mask;        /**< inotify event bits to deliver; IN_CLOSE_WRITE settles writes */
+    GlobFilter includes;  /**< Names to deliver; empty delivers every name */
+    GlobFilter excludes;  /**< Names to drop even if included */
+} WatchFilter;
+
+/** @brief Events filewatcher_set_priority() sends through the priority lane */
+typedef struct {
+    GlobFilter names;  /**< File names that qualify; empty for any name */
+    char **roots;      /**< Directory trees that qualify; none for anywhere */
+    size_t *root_lens; /**< Length of each root */
+    int root_count;    /**< Entries in roots */
+} PriorityClass;
+
+/**
+ * @brief FileWatcher instance state
+ * 
+ * Contains all state needed for a file watcher instance including
+ * its subscription to the shared inotify engine, synchronization, event
+ * buffering, and the registry that maps watch descriptors back to watched
+ * paths.
+ *
+ * Raw inotify records are taken from the engine inbox (or read from the
+ * fanotify group) into event_buffer and parsed into the
+ * shared event ring, which every delivery path (filewatcher_poll(), or a
+ * consumer reading the exported ring directly) drains. Parsing runs on the
+ * consumer's thread, or on the reader thread after
+ * filewatcher_start_reader(). Events filewatcher_set_priority() singles
+ * out go to a second ring instead, which filewatcher_poll() drains first.
+ * Fields are private to filewatcher_core.c.
+ */
+typedef struct {
+    WatchEngine *engine;      /**< Shared inotify engine, NULL once closed */
+    EngineSubscriber sub;     /**< This watcher's watches and inbox in the engine */
+    int inotify_fd;           /**< The engine's inotify fd, polled to pump it; -1 once closed */
+    int wake_fd;              /**< eventfd signalled by close() to wake waiters */
+    _Atomic int closed;       /**< Set once close() has run */
+    _Atomic int waiters;      /**< Threads inside filewatcher_wait() */
+    pthread_t reader;         /**< Background reader thread */
+    _Atomic int reader_running; /**< Reader thread owns fill_ring() */
+    _Atomic int reader_stalled; /**< Reader is waiting for ring space */
+    int ready_fd;             /**< eventfd: reader added events */
+    int space_fd;             /**< eventfd: consumer freed ring space */
+    int ring_exported;        /**< filewatcher_export_ring() handed out the mapping */
+    pthread_mutex_t mutex;    /**< Thread synchronization mutex */
+    pthread_cond_t crawl_done; /**< Broadcast when a recursive root's crawl ends, with mutex */
+    char *event_buffer;       /**< Raw inotify records being parsed, swapped with the inbox */
+    char *path_buffer;        /**< Full paths being built while parsing, grown to fit */
+    size_t path_capacity;     /**< Allocated bytes of path_buffer */
+    size_t event_capacity;    /**< Allocated bytes of event_buffer */
+    int buffer_pos;           /**< Current position in buffer */
+    int buffer_len;           /**< Current buffer length */
+    int counted_pos;          /**< Events before this offset are already in the stats */
+    WatchRegistry registry;   /**< wd <-> path table, guarded by mutex */
+    RecursiveRoot **roots;    /**< Recursive roots; registry root id N is roots[N - 1] */
+    int root_count;           /**< Used slots in roots */
+    int root_capacity;        /**< Allocated slots in roots */
+    WatchFilter *filters;     /**< Filters of plain watches, unordered */
+    int filter_count;         /**< Used slots in filters */
+    int filter_capacity;      /**< Allocated slots in filters */
+    EventRing ring;           /**< Parsed events awaiting delivery */
+    EventRing priority_ring;  /**< Priority lane, mapped by the first filewatcher_set_priority() */
+    _Atomic int priority_mapped; /**< priority_ring is mapped and must be drained */
+    int prioritizing;         /**< A priority class is set */
+    PriorityClass priority;   /**< What goes to the priority lane */
+    EventCoalescer coalescer; /**< Events held back until their path is quiet */
+    int coalescing;           /**< Coalescing window is non-zero */
+    EventCoalescer writes;    /**< Writes on settled watches awaiting IN_CLOSE_WRITE */
+    ContentTable contents;    /**< Content hashes of files seen while hashing is on */
+    uint64_t content_max_bytes; /**< Files larger than this are not hashed; 0 while hashing is off */
+    uint64_t unchanged;       /**< MODIFIED events dropped as rewrites of the same contents */
+    RenameTable renames;      /**< IN_MOVED_FROM halves awaiting their IN_MOVED_TO */
+    uint64_t rename_timeout_ns; /**< How long a source half waits */
+    int pairing;              /**< Rename pairing timeout is non-zero */
+    uint64_t ring_records;    /**< Records ever pushed into the ring */
+    _Atomic uint64_t stats[STAT_COUNTERS]; /**< Running FileWatcherStat counters, relaxed */
+    SnapshotTable snapshots;  /**< Directory listings for overflow recovery */
+    int recovery;             /**< Overflow recovery is on */
+    RecoveredEvent *recovered; /**< Recovered events not yet in the ring */
+    int recovered_head;       /**< Next recovered event to deliver */
+    int recovered_count;      /**< Used slots in recovered */
+    int recovered_capacity;   /**< Allocated slots in recovered */
+    RetiredWatch *retired;    /**< Watches to forget once the ring drains past them */
+    int retired_count;        /**< Used slots in retired */
+    int retired_capacity;     /**< Allocated slots in retired */
+    FileWatcherBackend backend; /**< How this watcher gets its events, fixed at creation */
+    FanotifySource fanotify;  /**< Filesystem marks for recursive roots, fd -1 until first used */
+    int fanotify_allowed;     /**< Recursive roots may use fanotify */
+    int fanotify_failed;      /**< The fanotify group could not be opened */
+    int read_turn;            /**< Event source read_events() tries first next time */
+    int marked_roots;         /**< Recursive roots covered by fanotify marks */
+    int next_marked_wd;       /**< Next wd for a directory under a marked root */
+    PollScheduler poller;     /**< Directories past the watch limit, polled instead of watched */
+    WatchJournal journal;     /**< Persistent tree state, fd -1 until filewatcher_open_journal() */
+    pthread_mutex_t listener_lock; /**< Serializes starting and stopping the listener */
+    ListenerThread *listener; /**< Push delivery thread, NULL if none, guarded by listener_lock */
+} FileWatcher;
+
+/** Buffer size that always holds at least one polled event: a watched directory plus name, or both paths of a move */
+#define FILEWATCHER_MAX_EVENT_BYTES (PATH_MAX + RING_MAX_NAME + 2)
+
+/** @brief An event returned by filewatcher_poll() */
+typedef struct {
+    uint8_t kind;          /**< RingEventKind */
+    uint8_t flags;         /**< RING_FLAG_* of the record */
+    const char *path;      /**< Full path (destination for RING_MOVED), in the caller's buffer */
+    const char *old_path;  /**< Source path for RING_MOVED, else "" */
+    uint32_t path_len;     /**< Length of path without the terminator */
+    uint32_t old_len;      /**< Length of old_path without the terminator */
+} FileWatcherEvent;
+
+/**
+ * @brief Callbacks run by the delivery thread of filewatcher_set_listener()
+ *
+ * All three run on that thread, never concurrently. stop is always called
+ * once, even if start failed, and is the place to free context.
+ */
+typedef struct {
+    int (*start)(void *context);   /**< Thread setup before any batch; non-zero ends the thread */
+    void (*deliver)(void *context, const FileWatcherEvent *events, int count); /**< One batch, count >= 1 */
+    void (*stop)(void *context);   /**< Thread teardown, may be NULL */
+    void *context;                 /**< Passed to every callback */
+} FileWatcherListener;
+
+/**
+ * @brief Set the backend later filewatcher_create() calls use
+ *
+ * FILEWATCHER_BACKEND_FANOTIFY until changed; JNI_OnLoad sets what
+ * filewatcher_backend_select() chose. Watchers already created keep theirs.
+ *
+ * @param backend FILEWATCHER_BACKEND_INOTIFY, _FANOTIFY or _POLL
+ * @return 0 on success, -1 with errno EINVAL for the stub or an unknown value
+ */
+int filewatcher_set_default_backend(FileWatcherBackend backend);
+
+/**
+ * @brief Create a watcher on the default backend
+ *
+ * Under inotify and fanotify the watcher subscribes to the process-wide
+ * inotify engine; under polling it uses no kernel watches at all and
+ * polls every directory it is asked to watch.
+ *
+ * @return Watcher, or NULL with errno set
+ */
+FileWatcher *filewatcher_create(void);
+
+/**
+ * @brief Watch one path (not recursive)
+ *
+ * A directory refused a watch because max_user_watches is used up is
+ * polled instead (see poll_scheduler.h) and its changes arrive as usual,
+ * seconds late at worst. A file in that situation still fails with ENOSPC.
+ *
+ * @param watcher Watcher
+ * @param path File or directory
+ * @return 0 on success, -1 with errno set
+ */
+int filewatcher_watch(FileWatcher *watcher, const char *path);
+
+/**
+ * @brief Watch many paths (not recursive) under one lock
+ *
+ * Same as filewatcher_watch() on each path in turn, without releasing the
+ * watcher in between. A NULL path fails with EINVAL.
+ *
+ * @param watcher Watcher
+ * @param paths Files or directories
+ * @param count Number of paths
+ * @param errors Receives 0 for each path watched, else its errno
+ * @return Number of paths watched
+ */
+size_t filewatcher_watch_all(FileWatcher *watcher, const char *const *paths, size_t count, int *errors);
+
+/**
+ * @brief Watch one path, delivering only the events a filter lets through
+ *
+ * The mask narrows the kernel watch itself; the globs are matched against
+ * event names in native code before anything is queued. A directory that
+ * is part of a recursive root keeps delivering what the root delivers.
+ * Calling filewatcher_watch() on the same path removes the filter.
+ *
+ * With IN_CLOSE_WRITE in the mask the watch reports writes once they are
+ * complete: the IN_MODIFY events of a file are held and a single MODIFIED
+ * goes out when the writer closes it, or after the settle timeout for
+ * writers (such as mmap) that keep it open.
+ *
+ * @param watcher Watcher
+ * @param path File or directory
+ * @param mask inotify event bits to deliver, within FILTER_MASK
+ * @param includes Patterns a name must match, may be NULL to admit every name
+ * @param include_count Number of include patterns
+ * @param excludes Patterns that drop a name even if included, may be NULL
+ * @param exclude_count Number of exclude patterns
+ * @return 0 on success, -1 with errno set (EINVAL if mask selects nothing)
+ */
+int filewatcher_watch_filtered(FileWatcher *watcher, const char *path, uint32_t mask,
+                               const char *const *includes, size_t include_count,
+                               const char *const *excludes, size_t exclude_count);
+
+/**
+ * @brief Watch a directory tree, following new subdirectories as they appear
+ *
+ * Where fanotify with FAN_REPORT_DFID_NAME is permitted (root with
+ * CAP_SYS_ADMIN on Linux 5.9+), the root's filesystem is marked once
+ * instead of adding an inotify watch per directory, and result reports no
+ * watches added. Otherwise, or after filewatcher_set_fanotify(watcher, 0),
+ * the tree is crawled with inotify as before. Directories of the crawl
+ * that find the watch limit used up are polled instead, and result counts
+ * them in watches_polled. A polled directory that keeps changing gets a
+ * real watch once one is free. A path that already is a recursive root
+ * fails with EEXIST, and a root unwatched before its crawl is done fails
+ * with ECANCELED.
+ *
+ * @param watcher Watcher
+ * @param path Root directory
+ * @param excludes Gitignore-style patterns for directories to skip, may be NULL
+ * @param exclude_count Number of patterns
+ * @param result Filled with crawl counters, may be NULL
+ * @return 0 on success, -1 with errno set
+ */
+int filewatcher_watch_recursive(FileWatcher *watcher, const char *path, const char *const *excludes,
+                                size_t exclude_count, CrawlResult *result);
+
+/**
+ * @brief Whether a recursive root is covered by a fanotify mark
+ * @param watcher Watcher
+ * @param path Path given to filewatcher_watch_recursive()
+ * @return 1 for a fanotify root, 0 for an inotify root, -1 if path is not a recursive root
+ */
+int filewatcher_root_marked(FileWatcher *watcher, const char *path);
+
+/**
+ * @brief Stop watching a path; unwatching a recursive root drops its whole tree
+ *
+ * A recursive root whose crawl is still running is cancelled; the call
+ * returns once the crawl has stopped and everything it added is gone.
+ *
+ * @param watcher Watcher
+ * @param path Path given to filewatcher_watch() or filewatcher_watch_recursive()
+ */
+void filewatcher_unwatch(FileWatcher *watcher, const char *path);
+
+/**
+ * @brief Take up to max events without blocking
+ *
+ * Paths are copied into buf, which must stay alive while the events are
+ * used. Stops early when the next event would not fit. Once the reader
+ * thread runs, concurrent callers claim each event with a
+ * compare-and-swap, so every event goes to exactly one of them.
+ *
+ * @param watcher Watcher
+ * @param events Filled with the events taken
+ * @param max Capacity of events
+ * @param buf Path storage
+ * @param buf_size Size of buf; FILEWATCHER_MAX_EVENT_BYTES always fits one event
+ * @return Number of events, 0 if none are ready, -1 with errno ENOBUFS if
+ *         buf cannot hold the next event (it stays queued)
+ */
+int filewatcher_poll(FileWatcher *watcher, FileWatcherEvent *events, int max, char *buf, size_t buf_size);
+
+/**
+ * @brief Block until events are ready
+ * @param watcher Watcher
+ * @param timeout_ms Maximum wait, negative to wait forever
+ * @return 1 if events are ready, 0 on timeout or filewatcher_close()
+ */
+int filewatcher_wait(FileWatcher *watcher, int64_t timeout_ms);
+
+/**
+ * @brief Hand out the event ring for a consumer that reads it in place
+ *
+ * The ring can no longer be resized by filewatcher_start_reader() afterwards.
+ *
+ * @param watcher Watcher
+ * @return The ring, valid until filewatcher_destroy()
+ */
+EventRing *filewatcher_export_ring(FileWatcher *watcher);
+
+/**
+ * @brief Parse pending inotify events into the ring
+ * @param watcher Watcher
+ * @return Records added (0 when the reader thread does the parsing)
+ */
+int filewatcher_fill_ring(FileWatcher *watcher);
+
+/**
+ * @brief Directory path registered for a watch descriptor
+ * @param watcher Watcher
+ * @param wd Watch descriptor from a ring record
+ * @param buf Receives the NUL-terminated path, truncated to size
+ * @param size Size of buf
+ * @return Full path length, or -1 if wd is unknown
+ */
+int filewatcher_watch_path(FileWatcher *watcher, int wd, char *buf, size_t size);
+
+/**
+ * @brief Move parsing onto a background thread
+ * @param watcher Watcher
+ * @param queue_bytes New ring size, 0 to keep the current one
+ * @return 0 on success, -1 if already started, closed, or the ring cannot be resized
+ */
+int filewatcher_start_reader(FileWatcher *watcher, uint32_t queue_bytes);
+
+/**
+ * @brief Push events to a callback from a dedicated thread
+ *
+ * The thread sleeps in filewatcher_wait() while nothing happens. Once an
+ * event is ready it takes up to max_batch of them, waits at most
+ * max_delay_ms for more to fill the batch, and hands them to
+ * listener->deliver. It takes events like any other filewatcher_poll()
+ * caller, so it also works alongside the reader thread.
+ *
+ * Replaces the current listener, whose thread has delivered its last
+ * batch by the time this returns. Called from inside deliver, the old
+ * thread instead finishes once the callback returns. filewatcher_close()
+ * stops the listener the same way, so deliver may also close or destroy
+ * the watcher.
+ *
+ * @param watcher Watcher
+ * @param listener Callbacks, copied; NULL to stop delivery
+ * @param max_batch Most events per batch, at least 1
+ * @param max_delay_ms How long a partial batch waits for more, 0 to deliver at once
+ * @return 0 on success, -1 with errno set (EINVAL, or EBADF once closed);
+ *         listener->stop has run if starting failed
+ */
+int filewatcher_set_listener(FileWatcher *watcher, const FileWatcherListener *listener,
+                             int max_batch, uint32_t max_delay_ms);
+
+/**
+ * @brief Keep the watched trees in an on-disk journal for the next run
+ *
+ * Call before filewatcher_watch_recursive(). Each inotify root watched
+ * afterwards is diffed against what the journal recorded for it last
+ * time: entries created, modified or deleted since then are queued as
+ * RING_FLAG_SYNTH events once its crawl is done, and from then on the
+ * journal follows its events. A root the journal has not seen before is
+ * only recorded. fanotify roots are not journaled.
+ *
+ * A change counts as seen once it is parsed, so a client that dies
+ * before handling the events it already took should rescan those.
+ *
+ * @param watcher Watcher
+ * @param path Journal file, created if missing
+ * @param generation Receives how many times the file has been opened, this time included; may be NULL
+ * @return 0 on success, -1 with errno set (EBUSY if a journal is already
+ *         open, EWOULDBLOCK if another process holds the file)
+ */
+int filewatcher_open_journal(FileWatcher *watcher, const char *path, uint64_t *generation);
+
+/**
+ * @brief Deliver some events ahead of everything else
+ *
+ * Events for files matching one of names (glob_filter.h patterns, matched
+ * against the last path component like watch filter includes) and lying
+ * under one of roots go to a separate priority lane. filewatcher_poll()
+ * and everything built on it empties that lane before taking anything
+ * from the main one, so an edited source file is not stuck behind a
+ * build's output. An empty list does not restrict; both empty turns the
+ * lane off. Order is kept within each lane but not across them (a file
+ * can be reported before the directory it was created in).
+ *
+ * Only events already parsed can overtake: parsing still stops when
+ * either lane is full. A consumer reading the exported ring directly
+ * never sees the priority lane, so it is not used once the ring has been
+ * exported.
+ *
+ * @param watcher Watcher
+ * @param names File name patterns, may be NULL when name_count is 0
+ * @param name_count Number of names
+ * @param roots Directory paths, may be NULL when root_count is 0
+ * @param root_count Number of roots
+ * @return 0 on success, -1 with errno set (EBUSY if the ring was
+ *         exported, ENOMEM)
+ */
+int filewatcher_set_priority(FileWatcher *watcher, const char *const *names, size_t name_count,
+                             const char *const *roots, size_t root_count);
+
+/**
+ * @brief Peak bytes buffered in the ring
+ * @param watcher Watcher
+ * @return High-water mark in bytes
+ */
+uint32_t filewatcher_queue_high_water(const FileWatcher *watcher);
+
+/**
+ * @brief Snapshot the watcher's counters
+ *
+ * Counters are relaxed atomics bumped on paths that already hold the
+ * watcher mutex, so keeping them costs a plain store. Taking them only
+ * briefly holds the mutex, for the watch count.
+ *
+ * @param watcher Watcher
+ * @param out Receives STAT_COUNT values indexed by FileWatcherStat
+ */
+void filewatcher_get_stats(FileWatcher *watcher, uint64_t out[STAT_COUNT]);
+
+/**
+ * @brief Cap the buffer the shared inotify instance is read into
+ *
+ * The buffer is sized from FIONREAD on each read so a burst is drained in
+ * one syscall, grows up to this cap, and shrinks once the burst is over.
+ * Every watcher shares the instance, so the cap is process-wide.
+ *
+ * @param watcher Any open watcher
+ * @param max_bytes Largest read buffer, raised to ENGINE_READ_MIN_BYTES
+ */
+void filewatcher_set_read_limit(FileWatcher *watcher, uint32_t max_bytes);
+
+/**
+ * @brief Set the per-path coalescing window
+ * @param watcher Watcher
+ * @param window_ms Quiet time before an event is delivered, 0 to turn coalescing off
+ */
+void filewatcher_set_coalescing(FileWatcher *watcher, uint32_t window_ms);
+
+/**
+ * @brief Set how long IN_MOVED_FROM waits for its IN_MOVED_TO
+ * @param watcher Watcher
+ * @param timeout_ms Pairing timeout, 0 to deliver renames as DELETED + CREATED
+ */
+void filewatcher_set_rename_pairing(FileWatcher *watcher, uint32_t timeout_ms);
+
+/**
+ * @brief Set how long a settled write waits for IN_CLOSE_WRITE
+ * @param watcher Watcher
+ * @param timeout_ms Quiet time after the last write before MODIFIED is
+ *                   reported without a close, 0 to report writes right away
+ */
+void filewatcher_set_settle_timeout(FileWatcher *watcher, uint32_t timeout_ms);
+
+/**
+ * @brief Allow or forbid fanotify for later recursive watches
+ *
+ * On by default, except on the inotify backend; the poll backend never
+ * uses it. Roots already marked stay on fanotify until unwatched.
+ * fanotify roots report what the filesystem mark sees: each event's
+ * directory is resolved when the event is read, renames pair only on
+ * Linux 5.17+ (FAN_RENAME), and a queue overflow is always delivered as
+ * OVERFLOW since their directories have no snapshots.
+ *
+ * @param watcher Watcher
+ * @param enabled Non-zero to try fanotify first
+ */
+void filewatcher_set_fanotify(FileWatcher *watcher, int enabled);
+
+/**
+ * @brief Drop MODIFIED events that left a file's contents as they were
+ *
+ * Off by default. While on, the CREATED and MODIFIED events that come
+ * out of the coalescer, and the MODIFIED a settled watch reports on
+ * close, hash the file's contents (XXH64, see content_table.h), and a
+ * MODIFIED whose file has the size and hash last seen for its inode is
+ * dropped and counted as STAT_EVENTS_UNCHANGED. Without coalescing, only
+ * settled watches are checked: raw writes go out as they are, since
+ * hashing each one would reread the file per write. The first MODIFIED
+ * of a file not seen before is always delivered, and a file whose size
+ * changed is reported without being read. Files over the size cap, and
+ * files that change size while being hashed, are never dropped. Hashing
+ * reads the file on the thread filling the ring, so the cap bounds what
+ * one event can cost.
+ *
+ * @param watcher Watcher
+ * @param max_file_bytes Largest file to hash, 0 to turn hashing off and
+ *                       forget every hash
+ */
+void filewatcher_set_content_hashing(FileWatcher *watcher, uint64_t max_file_bytes);
+
+/**
+ * @brief Turn snapshot-based overflow recovery on or off
+ * @param watcher Watcher
+ * @param enabled Non-zero to keep directory snapshots
+ */
+void filewatcher_set_overflow_recovery(FileWatcher *watcher, int enabled);
+
+/**
+ * @brief Wake waiters, stop the reader thread and close the inotify instance
+ *
+ * Safe to call more than once and from any thread.
+ *
+ * @param watcher Watcher
+ */
+void filewatcher_close(FileWatcher *watcher);
+
+/**
+ * @brief Close the watcher and free it
+ * @param watcher Watcher, may be NULL
+ */
+void filewatcher_destroy(FileWatcher *watcher);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILEWATCHER_CORE_H
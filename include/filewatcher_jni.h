@@ -3,7 +3,8 @@
  * @brief Termux FileWatcher JNI Interface
  * 
  * JNI interface definitions for the Termux-compatible FileWatcher library.
- * Provides both stub and real implementations for file system monitoring.
+ * One library carries both the stub and the real implementation for file
+ * system monitoring; JNI_OnLoad picks one at load time.
  * 
  * @author yamsergey
  * @version 1.0.0
@@ -18,8 +19,10 @@
 #include <jni.h>
 #include <pthread.h>
 
+#include "filewatcher_log.h"
+
 #ifdef REAL_IMPLEMENTATION
-#include <sys/inotify.h>
+#include "filewatcher_core.h"
 #endif
 
 #ifdef __cplusplus
@@ -34,6 +37,11 @@ extern "C" {
 
 /**
  * @brief Create a new FileWatcher instance
+ *
+ * Every instance in the process shares one inotify instance; watches on
+ * the same path from several instances share one kernel watch, and each
+ * instance still gets only the events it asked for.
+ *
  * @param env JNI environment pointer
  * @param clazz FileWatcher class
  * @return Watcher handle (pointer cast to jlong), 0 on failure
@@ -46,13 +54,55 @@ Java_com_jetbrains_analyzer_filewatcher_FileWatcher_create(JNIEnv *env, jclass c
  * @param env JNI environment pointer
  * @param clazz FileWatcher class
  * @param watcherPtr Watcher handle from create()
- * @param path Java string containing path to watch
+ * @param path Java string containing path to watch (a directory past the
+ *             watch limit is polled instead)
  * @return JNI_TRUE on success, JNI_FALSE on failure
  */
 JNIEXPORT jboolean JNICALL
 Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watch(JNIEnv *env, jclass clazz, 
                                                           jlong watcherPtr, jstring path);
 
+/**
+ * @brief Add many paths to watch in one JNI crossing
+ *
+ * Each path is watched as by watch(), all under one lock. The result
+ * starts with a bitmap of ceil(n / 32) ints, bit (i % 32) of int (i / 32)
+ * set if paths[i] is watched, followed by the errno of every path that
+ * failed, in order. A null element fails with EINVAL.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param paths Java String[] of paths to watch
+ * @return Bitmap and error codes, or NULL if the paths could not be copied
+ */
+JNIEXPORT jintArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchAll(JNIEnv *env, jclass clazz,
+                                                             jlong watcherPtr, jobjectArray paths);
+
+/**
+ * @brief Add a path to watch, delivering only events that pass a filter
+ *
+ * The mask narrows the kernel watch; the globs are matched against event
+ * names natively, so dropped events never become Java objects. A later
+ * watch() of the same path removes the filter.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param path Java string containing path to watch
+ * @param mask inotify bits to deliver (IN_CREATE, IN_DELETE, IN_MODIFY,
+ *             IN_MOVED_FROM, IN_MOVED_TO); IN_CLOSE_WRITE reports one
+ *             MODIFIED per completed write instead of one per write()
+ * @param includes Glob patterns a name must match (e.g. "*.kt"), NULL or empty for all
+ * @param excludes Glob patterns to drop (e.g. "*.class", "build/"), may be NULL
+ * @return JNI_TRUE on success, JNI_FALSE on failure or an empty mask
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchFiltered(JNIEnv *env, jclass clazz,
+                                                                  jlong watcherPtr, jstring path, jint mask,
+                                                                  jobjectArray includes, jobjectArray excludes);
+
 /**
  * @brief Remove a path from watching
  * @param env JNI environment pointer
@@ -64,6 +114,28 @@ JNIEXPORT void JNICALL
 Java_com_jetbrains_analyzer_filewatcher_FileWatcher_unwatch(JNIEnv *env, jclass clazz,
                                                             jlong watcherPtr, jstring path);
 
+/**
+ * @brief Watch a directory tree
+ *
+ * Adds a watch for the directory and every subdirectory not matched by
+ * excludes, crawling in parallel. Directories created later under the
+ * tree are watched automatically. Where fanotify is permitted the root's
+ * filesystem is marked instead and no watches are added (see setFanotify()).
+ * Directories past the kernel's max_user_watches are polled for changes
+ * instead of being left out, and are not counted as watches added.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param path Java string containing root directory
+ * @param excludes Glob patterns to skip (e.g. "build/", ".gradle/"), may be NULL
+ * @return long[] {watches added, crawl time in ns}, NULL on failure
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchRecursive(JNIEnv *env, jclass clazz,
+                                                                   jlong watcherPtr, jstring path,
+                                                                   jobjectArray excludes);
+
 /**
  * @brief Get next file system event (non-blocking)
  * @param env JNI environment pointer
@@ -75,6 +147,354 @@ JNIEXPORT jobject JNICALL
 Java_com_jetbrains_analyzer_filewatcher_FileWatcher_nextEvent(JNIEnv *env, jclass clazz,
                                                               jlong watcherPtr);
 
+/**
+ * @brief Get up to max pending events in one JNI crossing (non-blocking)
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param max Maximum number of events to return (capped at MAX_EVENT_BATCH)
+ * @return FileWatcher.Event[] of 1..max events, or NULL if none are available
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_nextEvents(JNIEnv *env, jclass clazz,
+                                                               jlong watcherPtr, jint max);
+
+/** Largest batch nextEvents() returns */
+#define MAX_EVENT_BATCH 4096
+
+/**
+ * @brief Map the watcher's event ring for zero-copy consumption
+ *
+ * The buffer layout is described in event_ring.h. Use it in native byte
+ * order, and never alongside nextEvent()/nextEvents(): the ring has a
+ * single consumer. The buffer is invalid after destroy().
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @return java.nio.ByteBuffer over the ring, NULL on failure
+ */
+JNIEXPORT jobject JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_eventRing(JNIEnv *env, jclass clazz, jlong watcherPtr);
+
+/**
+ * @brief Parse pending inotify events into the ring (non-blocking)
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @return Number of records added
+ */
+JNIEXPORT jint JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_fillRing(JNIEnv *env, jclass clazz, jlong watcherPtr);
+
+/**
+ * @brief Resolve a ring record's watch descriptor to its directory
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param wd Watch descriptor from a ring record
+ * @return Directory path, or NULL if the watch is no longer registered
+ */
+JNIEXPORT jstring JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchPath(JNIEnv *env, jclass clazz,
+                                                              jlong watcherPtr, jint wd);
+
+/**
+ * @brief Start a background thread that drains inotify into the ring
+ *
+ * The thread reads and parses events as fast as the kernel produces them
+ * and stores fully resolved paths, so nextEvent()/nextEvents() pop from
+ * the ring without taking the watcher mutex. Any number of threads may
+ * call them at once; each event is claimed atomically by exactly one of
+ * them. When the ring is full the thread waits
+ * for the consumer rather than dropping events. A Java ring consumer calls
+ * fillRing() after advancing tail to wake it.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param queueBytes Ring capacity in bytes (rounded up to a power of two),
+ *                   0 to keep the current ring. Resizing needs an empty
+ *                   ring that has not been mapped with eventRing().
+ * @return JNI_TRUE if the thread is running, JNI_FALSE on failure
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_startReader(JNIEnv *env, jclass clazz,
+                                                                jlong watcherPtr, jint queueBytes);
+
+/**
+ * @brief Peak ring occupancy
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @return Most bytes ever buffered in the ring; compare with the capacity
+ *         to size queueBytes
+ */
+JNIEXPORT jlong JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_queueHighWater(JNIEnv *env, jclass clazz,
+                                                                   jlong watcherPtr);
+
+/**
+ * @brief Runtime counters for health checks
+ *
+ * Slots, in order: raw events read, events delivered, events coalesced,
+ * events filtered, overflows, read batches, bytes read, lock contention,
+ * average events per batch, ring high-water bytes, active watches,
+ * path string cache hits and misses, the kernel's max_user_watches,
+ * directories polled for lack of watches, the backend the watcher runs
+ * on, and MODIFIED events dropped by content hashing (FileWatcherStat in
+ * filewatcher_core.h). Counting is always on and costs a relaxed store on
+ * paths that already hold the watcher lock. The string cache is shared by
+ * every watcher in the process, and so are its two counters.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @return One value per slot, or null if the watcher is invalid or this
+ *         build has no native watcher
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_getStats(JNIEnv *env, jclass clazz, jlong watcherPtr);
+
+/**
+ * @brief Push events to a listener instead of polling for them
+ *
+ * A native thread, attached to the JVM once as a daemon, sleeps until
+ * events arrive and calls listener.onEvents(Event[]) with up to maxBatch
+ * of them, having waited at most maxDelayMs for a partial batch to fill.
+ * Idle watchers cost no CPU, and with maxDelayMs 0 an event reaches the
+ * listener as soon as it is parsed. Exceptions thrown by onEvents are
+ * printed and the batch is dropped. The listener may call close() itself;
+ * a listener replaced or removed from elsewhere has finished its last
+ * batch when this returns.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param listener FileWatcher.Listener, or null to stop pushing
+ * @param maxBatch Most events per call (capped at MAX_EVENT_BATCH)
+ * @param maxDelayMs How long a partial batch waits for more events
+ * @return JNI_TRUE on success, JNI_FALSE for bad arguments, a closed
+ *         watcher, or Java classes without FileWatcher.Listener
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setListener(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jobject listener, jint maxBatch, jint maxDelayMs);
+
+/**
+ * @brief Cap the buffer inotify events are read into
+ *
+ * The buffer is sized from FIONREAD so an event storm is read in one
+ * syscall; it grows up to maxBytes (1 MiB by default) and shrinks back
+ * once the storm is over. The inotify instance is shared by every watcher,
+ * so the cap applies to the whole process.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param maxBytes Largest read buffer in bytes, raised to 4096
+ * @return JNI_TRUE on success, JNI_FALSE for a non-positive size
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setReadBufferLimit(JNIEnv *env, jclass clazz,
+                                                                       jlong watcherPtr, jint maxBytes);
+
+/**
+ * @brief Keep watched trees in an on-disk journal across restarts
+ *
+ * Call right after create(), before watchRecursive(). Each root watched
+ * afterwards is diffed against what the journal recorded for it in the
+ * previous run, and only what changed meanwhile is delivered, as
+ * CREATED, MODIFIED and DELETED events, once its crawl is done. A root
+ * the journal has not seen is only recorded. fanotify roots are not
+ * journaled.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param path Journal file, created if missing
+ * @return Journal generation (1 for a new journal, one more on every
+ *         open), or 0 if it could not be opened or is held by another process
+ */
+JNIEXPORT jlong JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_openJournal(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jstring path);
+
+/**
+ * @brief Fold bursts of events per path before delivery
+ *
+ * Repeated MODIFY events collapse into one, CREATE followed by DELETE is
+ * dropped, and DELETE followed by CREATE is reported as MODIFIED. A path's
+ * event is delivered once nothing has happened to it for windowMs.
+ * Coalesced events carry full paths (RING_FLAG_PATH) in the ring.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param windowMs Quiet window in milliseconds, 0 to deliver immediately
+ * @return JNI_TRUE on success, JNI_FALSE for a negative window
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setCoalescing(JNIEnv *env, jclass clazz,
+                                                                  jlong watcherPtr, jint windowMs);
+
+/**
+ * @brief Set how long a write on an IN_CLOSE_WRITE watch waits for its close
+ *
+ * Writers that never close the file (mmap, long-lived logs) get their
+ * MODIFIED once the file has been quiet this long.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param timeoutMs Settle timeout in milliseconds, 0 to report writes right away
+ * @return JNI_TRUE on success, JNI_FALSE for a negative timeout
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setSettleTimeout(JNIEnv *env, jclass clazz,
+                                                                     jlong watcherPtr, jint timeoutMs);
+
+/**
+ * @brief Report renames as a single MOVED event
+ *
+ * IN_MOVED_FROM and IN_MOVED_TO with the same cookie become one
+ * EventKind.MOVED event carrying both paths, so a directory rename is a
+ * re-key rather than a subtree delete plus create. Watches below a renamed
+ * directory keep working under the new path. A source half with no
+ * destination after timeoutMs is reported as DELETED, and a destination
+ * with no source as CREATED, as before.
+ *
+ * Requires EventKind.MOVED and an Event(EventKind, String path, String
+ * oldPath) constructor on the Java side.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param timeoutMs Pairing timeout in milliseconds, 0 to turn pairing off
+ * @return JNI_TRUE on success, JNI_FALSE if the Java classes lack MOVED support
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setRenamePairing(JNIEnv *env, jclass clazz,
+                                                                     jlong watcherPtr, jint timeoutMs);
+
+/**
+ * @brief Turn overflow recovery on or off
+ *
+ * While on, every watched directory keeps a snapshot of its entries
+ * (inode, mtime, size) that is refreshed as events arrive. When the kernel
+ * queue overflows, the directories are listed again and the differences
+ * are delivered as CREATED, MODIFIED and DELETED events in place of a bare
+ * OVERFLOW. OVERFLOW is still delivered if some watch could not be diffed,
+ * such as a watched regular file. Turning recovery on lists every watched
+ * directory once; each later event costs one lstat().
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param enabled JNI_TRUE to keep snapshots, JNI_FALSE to drop them
+ * @return JNI_TRUE on success
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setOverflowRecovery(JNIEnv *env, jclass clazz,
+                                                                        jlong watcherPtr, jboolean enabled);
+
+/**
+ * @brief Drop MODIFIED events that rewrote a file with the same contents
+ *
+ * Off by default. Once on, files are hashed as their CREATED and MODIFIED
+ * events leave coalescing, and a MODIFIED is dropped if the file still
+ * has the size and hash last seen for it, as after a formatter, touch or
+ * a build tool rewrites it unchanged. Files larger than maxFileBytes are
+ * not hashed and always reported. Only events that pass through
+ * coalescing (setCoalescing()) or a settled watch (IN_CLOSE_WRITE in
+ * watchFiltered()) are checked; without either, writes are reported as
+ * they come.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param maxFileBytes Largest file to hash, 0 to turn hashing off
+ * @return JNI_TRUE on success, JNI_FALSE if maxFileBytes is negative
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setContentHashing(JNIEnv *env, jclass clazz,
+                                                                      jlong watcherPtr, jlong maxFileBytes);
+
+/**
+ * @brief Deliver events for some files ahead of everything else
+ *
+ * Events for files whose name matches one of names (glob patterns such as
+ * "*.kt", matched against the file name) and that lie under one of roots
+ * go through a separate priority lane. nextEvent(), nextEvents() and
+ * listeners take every event from that lane before any other, so a save
+ * in the editor is not stuck behind thousands of build output events.
+ * Either array may be null or empty to not restrict by it; both empty
+ * turns the lane off. Events stay in order within a lane but not across
+ * lanes. Not available once eventRing() has been called.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param names File name patterns, may be NULL
+ * @param roots Directory trees, may be NULL
+ * @return JNI_TRUE on success, JNI_FALSE if the ring was exported or
+ *         memory ran out
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setPriority(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jobjectArray names, jobjectArray roots);
+
+/**
+ * @brief Let later watchRecursive() calls use fanotify
+ *
+ * On by default. Where fanotify with FAN_REPORT_DFID_NAME is permitted
+ * (root with CAP_SYS_ADMIN on Linux 5.9+), watchRecursive() marks the
+ * root's whole filesystem once instead of crawling it, so setup is
+ * constant time and no inotify watches are used; elsewhere it crawls with
+ * inotify as before. Events on fanotify roots name the directory as it is
+ * when the event is read, renames pair only on Linux 5.17+, and a queue
+ * overflow is always reported as OVERFLOW.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param enabled JNI_FALSE to always crawl with inotify
+ * @return JNI_TRUE on success
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setFanotify(JNIEnv *env, jclass clazz,
+                                                                jlong watcherPtr, jboolean enabled);
+
+/**
+ * @brief Report which backend a recursive root ended up on
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param path Path given to watchRecursive()
+ * @return JNI_TRUE if the root is covered by a fanotify mark, JNI_FALSE
+ *         if it uses inotify watches or is not a recursive root
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_isFanotifyRoot(JNIEnv *env, jclass clazz,
+                                                                   jlong watcherPtr, jstring path);
+
+/**
+ * @brief Block until events are available
+ *
+ * Sleeps in poll() on the inotify fd (or on the reader thread's signal)
+ * instead of spinning in Java. close() from another thread wakes the
+ * waiter promptly.
+ *
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @param watcherPtr Watcher handle from create()
+ * @param timeoutMs Maximum wait in milliseconds, negative to wait forever
+ * @return JNI_TRUE if events are ready, JNI_FALSE on timeout or close
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_waitForEvents(JNIEnv *env, jclass clazz,
+                                                                  jlong watcherPtr, jlong timeoutMs);
+
 /**
  * @brief Close the watcher (stop monitoring)
  * @param env JNI environment pointer
@@ -105,6 +525,13 @@ Java_com_jetbrains_analyzer_filewatcher_FileWatcher_destroy(JNIEnv *env, jclass
 
 /**
  * @brief Called when library is loaded
+ *
+ * Chooses the backend (see filewatcher_backend.h) from FILEWATCHER_BACKEND
+ * or by probing the kernel. The stub is bound to the natives here, once;
+ * the other backends keep the real natives and become the default for
+ * every watcher create() makes. If the stub was asked for but the
+ * FileWatcher class cannot be found, the real natives stay in place.
+ *
  * @param vm Java Virtual Machine pointer
  * @param reserved Reserved parameter (unused)
  * @return JNI version (JNI_VERSION_1_8)
@@ -118,40 +545,27 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved);
  */
 JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved);
 
-/** @} */
-
-#ifdef REAL_IMPLEMENTATION
-
 /**
- * @defgroup Real_Implementation Real Implementation
- * @brief inotify-based real file watching implementation
- * @{
+ * @brief Bind the FileWatcher natives to the stub implementation (stub_filewatcher.c)
+ * @param env JNI environment pointer
+ * @param clazz FileWatcher class
+ * @return Natives bound; ones the class does not declare are skipped
  */
+int stub_register_natives(JNIEnv *env, jclass clazz);
 
-/** Event buffer size for inotify reads */
-#define EVENT_SIZE (sizeof(struct inotify_event))
-#define BUF_LEN (1024 * (EVENT_SIZE + 16))
+/** @} */
 
 /**
- * @brief FileWatcher instance state
- * 
- * Contains all state needed for a file watcher instance including
- * inotify file descriptor, synchronization, and event buffering.
+ * @defgroup JNI_Helpers JNI Helpers
+ * @brief Shared utilities from jni_helpers.c
+ * @{
  */
-typedef struct {
-    int inotify_fd;           /**< inotify file descriptor */
-    pthread_mutex_t mutex;    /**< Thread synchronization mutex */
-    char event_buffer[BUF_LEN]; /**< Event buffer for inotify reads */
-    int buffer_pos;           /**< Current position in buffer */
-    int buffer_len;           /**< Current buffer length */
-} FileWatcher;
 
-// Internal functions are declared static in the implementation file
+/** @brief Describe and clear a pending JNI exception; returns 1 if there was one */
+int check_jni_exception(JNIEnv *env, const char *context);
 
 /** @} */
 
-#endif // REAL_IMPLEMENTATION
-
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,38 @@
+/**
+ * @file filewatcher_log.h
+ * @brief stderr logging shared by the JNI library and the watcher core
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef FILEWATCHER_LOG_H
+#define FILEWATCHER_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Logging Logging
+ * @brief Debug and error messages
+ * @{
+ */
+
+/** @brief Check FILEWATCHER_DEBUG; returns 1 if debug logging is on */
+int is_debug_enabled(void);
+
+/** @brief printf-style debug message to stderr when debugging is on */
+void debug_log(const char *format, ...);
+
+/** @brief printf-style error message to stderr */
+void error_log(const char *format, ...);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILEWATCHER_LOG_H
@@ -0,0 +1,147 @@
+/**
+ * @file filewatcher_trace.h
+ * @brief Binary tracepoints along the event pipeline
+ *
+ * Each tracepoint writes one fixed-size record into a ring owned by the
+ * calling thread, with no lock and no syscall beyond reading the clock;
+ * a flusher thread drains the rings to a file every
+ * TRACE_FLUSH_INTERVAL_MS. While tracing is off a tracepoint is a single
+ * relaxed load and a branch predicted not taken.
+ *
+ * Tracing starts with filewatcher_trace_start(), or on the first
+ * filewatcher_create() when FILEWATCHER_TRACE names a file. The file is a
+ * TraceFileHeader followed by TraceRecords in per-thread order; the
+ * trace-decode tool prints them and sums up the time events spend
+ * between stages.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef FILEWATCHER_TRACE_H
+#define FILEWATCHER_TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Tracing Tracing
+ * @brief Per-stage timing of individual events
+ * @{
+ */
+
+/** Environment variable naming the file to trace into */
+#define FILEWATCHER_TRACE_ENV "FILEWATCHER_TRACE"
+
+/** First bytes of a trace file */
+#define TRACE_MAGIC "FWTRACE1"
+
+/** Trace file format version */
+#define TRACE_VERSION 1
+
+/** Records each thread can hold before the flusher catches up (power of two) */
+#define TRACE_THREAD_RECORDS 4096
+
+/** How often the flusher drains the thread rings */
+#define TRACE_FLUSH_INTERVAL_MS 100
+
+/** @brief Where in the pipeline a record was taken */
+typedef enum {
+    TRACE_READ = 1, /**< A batch was read: mask is the source (0 inotify, 1 fanotify, 2 poller), aux its bytes */
+    TRACE_PARSE,    /**< A kernel event was parsed: wd, mask and cookie as read */
+    TRACE_FILTER,   /**< The event was dropped by its watch's filter */
+    TRACE_COALESCE, /**< The event was folded into one already pending: mask is the ring kind */
+    TRACE_QUEUE,    /**< A record entered a ring: mask is the ring kind, aux its end position */
+    TRACE_DELIVER,  /**< A record left a ring for the caller: mask is the ring kind, aux its end position */
+    TRACE_LOST,     /**< A thread ring was full: aux records were dropped */
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+/** TraceRecord flag: the record went through the priority lane */
+#define TRACE_FLAG_PRIORITY 0x01
+
+/** @brief One tracepoint hit, 32 bytes */
+typedef struct {
+    uint64_t time_ns;  /**< CLOCK_MONOTONIC */
+    int32_t wd;        /**< Watch descriptor, -1 if the record has none */
+    uint32_t mask;     /**< inotify mask, ring kind or source, by stage */
+    uint32_t cookie;   /**< Rename cookie */
+    uint32_t tid;      /**< Kernel thread id of the writer */
+    uint8_t stage;     /**< TraceStage */
+    uint8_t flags;     /**< TRACE_FLAG_* */
+    uint16_t reserved; /**< Zero */
+    uint32_t aux;      /**< Stage-specific value */
+} TraceRecord;
+
+/** @brief Start of a trace file */
+typedef struct {
+    char magic[8];        /**< TRACE_MAGIC, not NUL-terminated */
+    uint32_t version;     /**< TRACE_VERSION */
+    uint32_t record_size; /**< sizeof(TraceRecord) */
+} TraceFileHeader;
+
+/** Nonzero while tracing; read by every tracepoint */
+extern _Atomic int filewatcher_tracing;
+
+/** @brief Out-of-line half of filewatcher_trace(); call that instead */
+void filewatcher_trace_write(TraceStage stage, uint8_t flags, int32_t wd, uint32_t mask,
+                             uint32_t cookie, uint32_t aux);
+
+/**
+ * @brief Whether tracing is on, for tracepoints whose arguments cost something to compute
+ * @return Nonzero while tracing
+ */
+static inline int filewatcher_trace_on(void) {
+    return __builtin_expect(atomic_load_explicit(&filewatcher_tracing, memory_order_relaxed), 0);
+}
+
+/**
+ * @brief Tracepoint
+ * @param stage Pipeline stage
+ * @param flags TRACE_FLAG_* bits
+ * @param wd Watch descriptor, or -1
+ * @param mask Stage-specific mask
+ * @param cookie Rename cookie
+ * @param aux Stage-specific value
+ */
+static inline void filewatcher_trace(TraceStage stage, uint8_t flags, int32_t wd, uint32_t mask,
+                                     uint32_t cookie, uint32_t aux) {
+    if (filewatcher_trace_on()) filewatcher_trace_write(stage, flags, wd, mask, cookie, aux);
+}
+
+/**
+ * @brief Start tracing into a file, truncating it
+ * @param path File to write
+ * @return 0 on success, -1 with errno set (EBUSY if already tracing)
+ */
+int filewatcher_trace_start(const char *path);
+
+/**
+ * @brief Stop tracing, writing out every record taken so far
+ *
+ * Does nothing if tracing is off.
+ */
+void filewatcher_trace_stop(void);
+
+/**
+ * @brief Start tracing from FILEWATCHER_TRACE, once per process
+ *
+ * Tracing started this way stops at exit.
+ */
+void filewatcher_trace_init_from_env(void);
+
+/** @brief Name of a stage, "unknown" if out of range */
+const char *filewatcher_trace_stage_name(unsigned stage);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILEWATCHER_TRACE_H
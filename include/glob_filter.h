@@ -0,0 +1,90 @@
+/**
+ * @file glob_filter.h
+ * @brief Path glob filters for the real implementation
+ *
+ * A small, gitignore-flavoured pattern list used to decide which paths the
+ * watcher ignores:
+ *
+ * - `build/`        trailing slash: matches directories only
+ * - `*.class`       no slash: matched against the last path component
+ * - `app/build`     inner slash: matched against the path relative to the
+ *                   watch root, `*` does not cross `/`
+ * - `/out`          leading slash: anchored to the watch root
+ *
+ * Patterns are classified once when the filter is built: plain names and
+ * `*.ext`-style suffixes are compared directly, and only the rest go
+ * through fnmatch(3).
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef GLOB_FILTER_H
+#define GLOB_FILTER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Glob_Filter Glob Filter
+ * @brief Compiled path pattern lists
+ * @{
+ */
+
+/** @brief How a pattern is matched */
+typedef enum {
+    GLOB_LITERAL = 0,  /**< No wildcards: exact compare */
+    GLOB_SUFFIX = 1,   /**< `*` then a literal: compare the tail */
+    GLOB_GENERIC = 2   /**< Anything else: fnmatch(3) */
+} GlobKind;
+
+/** @brief One parsed pattern */
+typedef struct {
+    char *pattern;   /**< Pattern text without leading/trailing slash */
+    size_t len;      /**< Length of pattern */
+    GlobKind kind;   /**< Matching strategy */
+    int dir_only;    /**< Pattern ended with '/' */
+    int anchored;    /**< Match against the relative path, not the name */
+} GlobPattern;
+
+/** @brief A list of patterns; matches if any pattern matches */
+typedef struct {
+    GlobPattern *patterns;  /**< Parsed patterns */
+    size_t count;           /**< Number of patterns */
+} GlobFilter;
+
+/**
+ * @brief Parse a list of patterns
+ * @param filter Filter to initialize
+ * @param patterns Pattern strings (may be NULL when count is 0)
+ * @param count Number of patterns
+ * @return 0 on success, -1 on allocation failure
+ */
+int glob_filter_init(GlobFilter *filter, const char *const *patterns, size_t count);
+
+/**
+ * @brief Free a filter's patterns
+ * @param filter Filter to destroy
+ */
+void glob_filter_destroy(GlobFilter *filter);
+
+/**
+ * @brief Test a path against the filter
+ * @param filter Filter (an empty filter never matches)
+ * @param rel_path Path relative to the watch root, without leading '/'
+ * @param is_dir Non-zero if the path names a directory
+ * @return 1 if any pattern matches, 0 otherwise
+ */
+int glob_filter_match(const GlobFilter *filter, const char *rel_path, int is_dir);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GLOB_FILTER_H
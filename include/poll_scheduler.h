@@ -0,0 +1,249 @@
+/**
+ * @file poll_scheduler.h
+ * @brief Stat polling for directories that could not get an inotify watch
+ *
+ * Once max_user_watches is used up, inotify_add_watch() fails with ENOSPC
+ * and a directory would go unmonitored. The scheduler covers such
+ * directories instead: each gets a pseudo watch descriptor from
+ * POLL_WD_BASE up, is listed once, and is then listed again on a timer and
+ * diffed (inode, mtime, size) against the previous listing. Every
+ * difference becomes a struct inotify_event record (IN_CREATE, IN_DELETE
+ * or IN_MODIFY, with IN_ISDIR for directories) so the regular parse loop
+ * handles them like any other source. A directory that can no longer be
+ * listed produces IN_IGNORED and is dropped; its parent reports it gone.
+ *
+ * Timers live on a wheel of POLL_WHEEL_SLOTS ticks of POLL_TICK_MS. A
+ * directory that changed is polled again after POLL_MIN_INTERVAL_MS; each
+ * quiet poll doubles its interval up to POLL_MAX_INTERVAL_MS, so cold
+ * trees cost little while active ones are seen within a fraction of a
+ * second. A run lists at most POLL_BATCH_DIRS directories; the rest stay
+ * due and are picked up by the next run.
+ *
+ * Directories that keep changing heat up. The hottest one is offered as a
+ * promotion candidate, so the caller can try to give it a real watch
+ * whenever the watch limit leaves room; failed attempts back off for
+ * everyone, since the limit is per user.
+ *
+ * The scheduler does no locking of its own; callers serialize access with
+ * the owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef POLL_SCHEDULER_H
+#define POLL_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dir_snapshot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Poll_Scheduler Poll Scheduler
+ * @brief Adaptive mtime polling behind pseudo watch descriptors
+ * @{
+ */
+
+/** First pseudo wd, well above any inotify wd and below FANOTIFY_WD_BASE */
+#define POLL_WD_BASE (1 << 29)
+
+/** Timer wheel resolution */
+#define POLL_TICK_MS 125
+
+/** Timer wheel slots; more than the longest interval in ticks */
+#define POLL_WHEEL_SLOTS 128
+
+/** Interval of a directory that just changed */
+#define POLL_MIN_INTERVAL_MS 250
+
+/** Interval a quiet directory backs off to */
+#define POLL_MAX_INTERVAL_MS 8000
+
+/** Directories listed by one poll_scheduler_run() */
+#define POLL_BATCH_DIRS 64
+
+/** Heat at which a directory is offered for a real watch */
+#define POLL_PROMOTE_HEAT 4
+
+/** First wait after a failed promotion, doubled on every further failure */
+#define POLL_PROMOTE_BACKOFF_MS 1000
+
+/** Longest wait between promotion attempts */
+#define POLL_PROMOTE_MAX_BACKOFF_MS (64 * 1000)
+
+/**
+ * @brief Current path of a polled directory
+ *
+ * Paths are looked up on every poll so a directory renamed while polled
+ * is listed under its new name.
+ *
+ * @param ctx Caller context
+ * @param wd Pseudo watch descriptor
+ * @param len Receives the length of the path
+ * @return NUL-terminated path, or NULL if wd is no longer watched
+ */
+typedef const char *(*PollPathFn)(void *ctx, int wd, size_t *len);
+
+/** @brief One polled directory */
+typedef struct {
+    int wd;               /**< Pseudo watch descriptor, -1 for a free slot */
+    uint32_t mask;        /**< inotify event bits records are limited to */
+    uint32_t interval_ms; /**< Current polling interval */
+    uint32_t heat;        /**< Rises on polls that found changes, falls on quiet ones */
+    uint64_t due_tick;    /**< Wheel tick of the next poll */
+    uint32_t prev;        /**< Previous directory in its wheel slot, 1-based, 0 if none */
+    uint32_t next;        /**< Next directory in its wheel slot (or free list), 1-based, 0 if none */
+} PolledDir;
+
+/** @brief Scheduler state */
+typedef struct {
+    PolledDir *dirs;          /**< Directory slots */
+    uint32_t dir_capacity;    /**< Allocated slots in dirs */
+    uint32_t dir_used;        /**< Slots ever handed out */
+    uint32_t free_head;       /**< Free slot list, 1-based, 0 if empty */
+    uint32_t count;           /**< Directories being polled */
+    uint32_t *index;          /**< wd -> dirs slot (1-based), open addressing, 0 empty, UINT32_MAX tombstone */
+    uint32_t index_capacity;  /**< Slots in index, a power of two */
+    uint32_t index_used;      /**< Live entries plus tombstones */
+    uint32_t wheel[POLL_WHEEL_SLOTS]; /**< Head of each tick's list, 1-based, 0 if empty */
+    uint64_t tick;            /**< Next tick to run */
+    int backlog;              /**< The last run stopped at POLL_BATCH_DIRS with more due */
+    int next_wd;              /**< Pseudo wd handed out next */
+    SnapshotTable listings;   /**< Last listing of every directory, keyed by pseudo wd */
+    char *out;                /**< Records awaiting poll_scheduler_take() */
+    size_t out_len;           /**< Valid bytes in out */
+    size_t out_capacity;      /**< Allocated bytes in out */
+    int candidate;            /**< Hottest directory to promote, -1 if none */
+    uint64_t promote_at;      /**< CLOCK_MONOTONIC ns before which no promotion is tried */
+    uint32_t promote_backoff_ms; /**< Wait after the next failed promotion */
+} PollScheduler;
+
+/**
+ * @brief Initialize an empty scheduler
+ * @param poller Scheduler to initialize
+ * @return 0 on success, -1 on allocation failure
+ */
+int poll_scheduler_init(PollScheduler *poller);
+
+/**
+ * @brief Free every directory and pending record
+ * @param poller Scheduler to destroy
+ */
+void poll_scheduler_destroy(PollScheduler *poller);
+
+/**
+ * @brief Start polling a directory
+ *
+ * The directory is listed right away; its first poll follows after
+ * POLL_MIN_INTERVAL_MS.
+ *
+ * @param poller Scheduler
+ * @param path Directory path
+ * @param mask inotify event bits wanted (IN_CREATE, IN_DELETE, IN_MODIFY, ...)
+ * @param now CLOCK_MONOTONIC time in ns
+ * @return Pseudo watch descriptor, or -1 with errno set (ENOTDIR for a file)
+ */
+int poll_scheduler_add(PollScheduler *poller, const char *path, uint32_t mask, uint64_t now);
+
+/**
+ * @brief Stop polling a directory
+ * @param poller Scheduler
+ * @param wd Pseudo watch descriptor; unknown ones are ignored
+ * @param notify Queue IN_IGNORED for wd, as if the kernel had removed a watch
+ */
+void poll_scheduler_remove(PollScheduler *poller, int wd, int notify);
+
+/**
+ * @brief Whether a pseudo wd is being polled
+ * @param poller Scheduler
+ * @param wd Watch descriptor
+ * @return 1 if it is
+ */
+int poll_scheduler_has(const PollScheduler *poller, int wd);
+
+/**
+ * @brief Event bits a polled directory reports
+ * @param poller Scheduler
+ * @param wd Pseudo watch descriptor
+ * @return Its mask, 0 if wd is not polled
+ */
+uint32_t poll_scheduler_mask(const PollScheduler *poller, int wd);
+
+/**
+ * @brief Poll every directory that is due, up to POLL_BATCH_DIRS
+ * @param poller Scheduler
+ * @param now CLOCK_MONOTONIC time in ns
+ * @param path_of Path lookup
+ * @param ctx Passed to path_of
+ * @return Directories listed
+ */
+int poll_scheduler_run(PollScheduler *poller, uint64_t now, PollPathFn path_of, void *ctx);
+
+/**
+ * @brief Take the records produced so far
+ *
+ * Swaps the pending records with the caller's drained buffer, like
+ * watch_engine_take().
+ *
+ * @param poller Scheduler
+ * @param buf Caller's buffer, fully consumed; receives the records
+ * @param capacity Allocated bytes of *buf, updated with it
+ * @return Bytes of records now in *buf, 0 if there were none
+ */
+size_t poll_scheduler_take(PollScheduler *poller, char **buf, size_t *capacity);
+
+/**
+ * @brief When the next run has work
+ * @param poller Scheduler
+ * @param now CLOCK_MONOTONIC time in ns
+ * @return CLOCK_MONOTONIC ns of the next due poll, at most now if records
+ *         are pending or directories are overdue, UINT64_MAX if none are polled
+ */
+uint64_t poll_scheduler_deadline(const PollScheduler *poller, uint64_t now);
+
+/**
+ * @brief The hottest directory, if a promotion may be tried now
+ *
+ * The candidate is handed out once; it is offered again only after it
+ * heats up anew.
+ *
+ * @param poller Scheduler
+ * @param now CLOCK_MONOTONIC time in ns
+ * @return Pseudo wd, or -1 if there is none or failed attempts are backing off
+ */
+int poll_scheduler_candidate(PollScheduler *poller, uint64_t now);
+
+/**
+ * @brief Hand a directory over to a real watch
+ *
+ * Lists the directory a last time so nothing that changed since its
+ * previous poll is lost, reporting the differences under the real wd that
+ * now names the directory. Then queues IN_IGNORED for the pseudo wd and
+ * stops polling it. Clears the promotion backoff.
+ *
+ * @param poller Scheduler
+ * @param wd Pseudo watch descriptor
+ * @param real_wd Watch descriptor of the real watch
+ * @param path Directory path
+ */
+void poll_scheduler_handoff(PollScheduler *poller, int wd, int real_wd, const char *path);
+
+/**
+ * @brief Record a failed promotion and back off
+ * @param poller Scheduler
+ * @param now CLOCK_MONOTONIC time in ns
+ */
+void poll_scheduler_defer(PollScheduler *poller, uint64_t now);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POLL_SCHEDULER_H
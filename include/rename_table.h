@@ -0,0 +1,108 @@
+/**
+ * @file rename_table.h
+ * @brief Cookie table pairing IN_MOVED_FROM with IN_MOVED_TO
+ *
+ * The kernel gives both halves of a rename the same cookie. The source
+ * half is parked here until its destination half arrives, or until a short
+ * timeout passes and it is reported as a plain delete (the entry left the
+ * watched tree). Only a handful of renames are ever in flight, so the
+ * table is a small FIFO array searched linearly.
+ *
+ * The table does no locking of its own; callers serialize access with the
+ * owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef RENAME_TABLE_H
+#define RENAME_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Rename_Table Rename Table
+ * @brief Pending rename halves keyed by cookie
+ * @{
+ */
+
+/** Pending source halves kept before the oldest is expired early */
+#define RENAME_MAX_PENDING 256
+
+/** @brief A source half waiting for its destination */
+typedef struct {
+    uint64_t seen_ns;   /**< When the IN_MOVED_FROM was parsed */
+    uint32_t cookie;    /**< inotify rename cookie */
+    uint8_t flags;      /**< RING_FLAG_* of the source event */
+    uint16_t path_len;  /**< Length of path */
+    char *path;         /**< Full source path */
+} PendingRename;
+
+/** @brief Table of pending renames, oldest first */
+typedef struct {
+    PendingRename *items; /**< Pending halves in arrival order */
+    int count;            /**< Used slots */
+    int capacity;         /**< Allocated slots */
+} RenameTable;
+
+/**
+ * @brief Initialize an empty table
+ * @param table Table to initialize
+ */
+void rename_table_init(RenameTable *table);
+
+/**
+ * @brief Free all pending entries
+ * @param table Table to destroy
+ */
+void rename_table_destroy(RenameTable *table);
+
+/**
+ * @brief Park a source half
+ * @param table Table
+ * @param cookie inotify cookie
+ * @param flags RING_FLAG_* bits
+ * @param path Full source path
+ * @param path_len Length of path
+ * @param now_ns Current CLOCK_MONOTONIC time
+ * @return 0 on success, -1 if full (RENAME_MAX_PENDING) or out of memory
+ */
+int rename_table_add(RenameTable *table, uint32_t cookie, uint8_t flags,
+                     const char *path, size_t path_len, uint64_t now_ns);
+
+/**
+ * @brief Find the source half for a cookie
+ * @param table Table
+ * @param cookie inotify cookie of a destination half
+ * @return Index into items, or -1 if unknown
+ */
+int rename_table_find(const RenameTable *table, uint32_t cookie);
+
+/**
+ * @brief Drop an entry, keeping the rest in order
+ * @param table Table
+ * @param index Index from rename_table_find() (0 for the oldest)
+ */
+void rename_table_remove(RenameTable *table, int index);
+
+/**
+ * @brief When the oldest pending half times out
+ * @param table Table
+ * @param timeout_ns Pairing timeout
+ * @return CLOCK_MONOTONIC deadline in ns, or UINT64_MAX if nothing is pending
+ */
+uint64_t rename_table_deadline(const RenameTable *table, uint64_t timeout_ns);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RENAME_TABLE_H
@@ -0,0 +1,117 @@
+/**
+ * @file tree_crawler.h
+ * @brief Parallel directory crawler for recursive watches
+ *
+ * Walks a directory tree with openat()/getdents64() across a small pool of
+ * worker threads, adding an inotify watch for every directory that is not
+ * excluded and recording it in the watch registry as soon as it is added.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef TREE_CRAWLER_H
+#define TREE_CRAWLER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "glob_filter.h"
+#include "watch_engine.h"
+#include "watch_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Tree_Crawler Tree Crawler
+ * @brief Recursive watch setup
+ * @{
+ */
+
+/** Upper bound on crawler threads, including the calling thread */
+#define CRAWL_MAX_WORKERS 4
+
+/** @brief A recursively watched tree */
+typedef struct {
+    char *path;           /**< Root directory, NULL if the slot is free */
+    size_t path_len;      /**< Length of path */
+    GlobFilter excludes;  /**< Paths under the root that are not watched */
+    int marked;           /**< Covered by a fanotify mark instead of per-directory watches */
+    char *real_path;      /**< Canonical path fanotify reports the root under, NULL unless marked */
+    size_t real_len;      /**< Length of real_path */
+    int journaled;        /**< Changes are recorded in the watcher's journal */
+    int crawling;         /**< Its first crawl is still adding watches; the slot must stay */
+    _Atomic int cancelled; /**< Unwatched mid-crawl; the crawl stops visiting directories */
+} RecursiveRoot;
+
+/**
+ * @brief Cover a directory the watch limit left without a watch
+ *
+ * Called when adding a watch fails with ENOSPC, with the registry lock
+ * held (or by a caller that already holds it). Records the directory in
+ * the registry itself.
+ *
+ * @param ctx CrawlRequest fallback_ctx
+ * @param path Directory path
+ * @param root_id Id to store in the registry entry
+ * @return wd the directory is now registered under, -1 to count it as a failure
+ */
+typedef int (*CrawlFallbackFn)(void *ctx, const char *path, int root_id);
+
+/** @brief Everything a crawl needs to add watches */
+typedef struct {
+    WatchEngine *engine;            /**< Engine watches are added to, NULL to hand every directory to fallback */
+    EngineSubscriber *subscriber;   /**< Subscriber that holds them */
+    uint32_t mask;                  /**< inotify event mask for each directory */
+    WatchRegistry *registry;        /**< Registry new watches are recorded in */
+    pthread_mutex_t *registry_lock; /**< Lock for registry, NULL if already held */
+    const char *root_path;          /**< Root the excludes are relative to, owned by the caller */
+    size_t root_len;                /**< Length of root_path */
+    const GlobFilter *excludes;     /**< Paths under the root that are not watched, owned by the caller */
+    int root_id;                    /**< Id stored in each registry entry */
+    CrawlFallbackFn fallback;       /**< Covers directories past the watch limit, NULL to count them as failures */
+    void *fallback_ctx;             /**< Passed to fallback */
+    const _Atomic int *cancel;      /**< Once non-zero, no further directory is visited; may be NULL */
+} CrawlRequest;
+
+/** @brief Crawl outcome */
+typedef struct {
+    uint32_t watches_added;  /**< Directories now watched */
+    uint32_t watch_failures; /**< Directories that could not be watched */
+    uint32_t watches_polled; /**< Directories handed to the fallback */
+    uint64_t elapsed_ns;     /**< Wall-clock crawl time */
+} CrawlResult;
+
+/**
+ * @brief Watch a directory and every non-excluded directory below it
+ *
+ * Symlinks are not followed. A failure below the top directory (permission,
+ * ENOSPC from the watch limit) is counted and the crawl carries on. With a
+ * fallback, a directory refused with ENOSPC is handed to it instead and
+ * its subdirectories are still crawled.
+ *
+ * @param req Crawl parameters
+ * @param dir Directory to start from (the root itself or a directory under it)
+ * @param workers Thread count, clamped to 1..CRAWL_MAX_WORKERS
+ * @param result Filled with counters
+ * @return 0 on success, -1 with errno set if dir itself could not be watched
+ */
+int tree_crawl(const CrawlRequest *req, const char *dir, int workers, CrawlResult *result);
+
+/**
+ * @brief Default worker count for this device
+ * @return Online CPU count clamped to 1..CRAWL_MAX_WORKERS
+ */
+int tree_crawl_default_workers(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TREE_CRAWLER_H
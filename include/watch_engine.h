@@ -0,0 +1,212 @@
+/**
+ * @file watch_engine.h
+ * @brief Process-wide inotify instance shared by every FileWatcher
+ *
+ * Each watcher used to open its own inotify instance, of which a user
+ * only gets max_user_instances (128 by default), and two watchers on
+ * overlapping trees held two kernel watches per directory. The engine
+ * keeps one instance for the whole process: a watch descriptor is added
+ * once and reference counted by the subscribers holding it, each with
+ * its own event mask, and the kernel watch is only removed when the last
+ * of them lets go.
+ *
+ * There is no engine thread. Whichever subscriber finds the shared fd
+ * readable pumps it, fanning each record out to the inboxes of the
+ * subscribers holding its wd whose mask wants it. An inbox is a growable
+ * buffer of raw struct inotify_event records with an eventfd that is
+ * readable while it holds any; a subscriber that falls more than
+ * ENGINE_INBOX_MAX_EVENTS behind gets an IN_Q_OVERFLOW record of its own,
+ * exactly as if it had its own kernel queue. A kernel IN_Q_OVERFLOW goes
+ * to everyone.
+ *
+ * The kernel read buffer is sized from FIONREAD on every pump, so a
+ * storm is drained in one read() of up to the read limit rather than in
+ * fixed 32 KiB chunks. It grows in powers of two and drops back to
+ * ENGINE_READ_KEEP_BYTES once a pump finds the queue quiet again.
+ *
+ * Lock order is owner lock (FileWatcher mutex), then the engine lock,
+ * then an inbox lock; inbox locks are leaves.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef WATCH_ENGINE_H
+#define WATCH_ENGINE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Watch_Engine Watch Engine
+ * @brief Shared inotify instance with per-subscriber inboxes
+ * @{
+ */
+
+/** Smallest kernel read buffer; holds any single record with room to spare */
+#define ENGINE_READ_MIN_BYTES 4096
+
+/** Kernel read buffer kept between bursts; larger ones shrink back to this */
+#define ENGINE_READ_KEEP_BYTES (64 * 1024)
+
+/** Default cap on the kernel read buffer, about a full default-length queue of short names */
+#define ENGINE_READ_DEFAULT_LIMIT (1024 * 1024)
+
+/** Records an inbox holds before its subscriber is told it overflowed (the kernel's default queue length) */
+#define ENGINE_INBOX_MAX_EVENTS 16384
+
+/** Buffers larger than this are freed instead of kept for reuse once drained */
+#define ENGINE_INBOX_KEEP_BYTES (64 * 1024)
+
+/** Kernel reads one pump does at most, so a busy fd cannot pin a caller */
+#define ENGINE_PUMP_READS 16
+
+/** @brief One watcher's view of the engine */
+typedef struct {
+    pthread_mutex_t lock;     /**< Guards the inbox */
+    char *inbox;              /**< Raw inotify records awaiting the subscriber */
+    size_t inbox_len;         /**< Valid bytes in inbox */
+    size_t inbox_capacity;    /**< Allocated bytes in inbox */
+    uint32_t inbox_events;    /**< Records in inbox */
+    int overflowed;           /**< Inbox is full and ends with IN_Q_OVERFLOW */
+    int inbox_fd;             /**< eventfd readable while inbox holds records */
+} EngineSubscriber;
+
+/** @brief A subscriber's claim on a watch descriptor */
+typedef struct {
+    EngineSubscriber *sub;  /**< Holder */
+    uint32_t mask;          /**< Event bits it wants from this wd */
+} EngineRef;
+
+/** @brief A kernel watch and who holds it */
+typedef struct {
+    int wd;             /**< Watch descriptor, -1 for a free slot, -2 for a tombstone */
+    int ref_count;      /**< Used slots in refs */
+    int ref_capacity;   /**< Allocated slots in refs */
+    EngineRef *refs;    /**< Holders */
+} EngineWatch;
+
+/** @brief The shared instance */
+typedef struct {
+    pthread_mutex_t lock;            /**< Guards everything below */
+    int inotify_fd;                  /**< Shared inotify instance, -1 while nobody subscribes */
+    EngineSubscriber **subscribers;  /**< Every subscriber, for broadcasts */
+    int subscriber_count;            /**< Used slots in subscribers */
+    int subscriber_capacity;         /**< Allocated slots in subscribers */
+    EngineWatch *watches;            /**< wd -> holders, open addressing */
+    uint32_t watch_capacity;         /**< Slots in watches, a power of two */
+    uint32_t watch_count;            /**< Live watches */
+    uint32_t watch_used;             /**< Live watches plus tombstones */
+    char *buffer;                    /**< Kernel read buffer, NULL until the first read */
+    size_t buffer_capacity;          /**< Allocated bytes of buffer */
+    size_t read_limit;               /**< Largest buffer_capacity may grow to */
+    long watch_limit;                /**< max_user_watches when the instance opened, 0 if unknown */
+} WatchEngine;
+
+/**
+ * @brief Join the process-wide engine, opening its inotify instance on first use
+ * @param sub Subscriber to initialize
+ * @return The engine, or NULL with errno set
+ */
+WatchEngine *watch_engine_subscribe(EngineSubscriber *sub);
+
+/**
+ * @brief Leave the engine, dropping every watch the subscriber holds
+ *
+ * Closes the inotify instance when the last subscriber leaves. The
+ * subscriber's inbox is freed.
+ *
+ * @param engine Engine
+ * @param sub Subscriber
+ */
+void watch_engine_unsubscribe(WatchEngine *engine, EngineSubscriber *sub);
+
+/**
+ * @brief Watch a path for a subscriber
+ *
+ * The kernel watch is added with IN_MASK_ADD so other subscribers keep
+ * what they asked for; the subscriber itself only sees mask. Adding a
+ * path it already holds replaces its mask. Holds the engine lock across
+ * the syscall so a concurrent last release cannot remove the watch in
+ * between.
+ *
+ * @param engine Engine
+ * @param sub Subscriber
+ * @param path File or directory
+ * @param mask inotify event bits plus IN_ONLYDIR / IN_DONT_FOLLOW
+ * @return Watch descriptor, or -1 with errno set
+ */
+int watch_engine_add(WatchEngine *engine, EngineSubscriber *sub, const char *path, uint32_t mask);
+
+/**
+ * @brief Drop a subscriber's claim on a watch descriptor
+ *
+ * No further records for wd reach the subscriber; with notify it gets an
+ * IN_IGNORED record for it, as if the kernel had removed the watch.
+ *
+ * @param engine Engine
+ * @param sub Subscriber
+ * @param wd Watch descriptor
+ * @param notify Queue IN_IGNORED for wd in the subscriber's inbox
+ */
+void watch_engine_remove(WatchEngine *engine, EngineSubscriber *sub, int wd, int notify);
+
+/**
+ * @brief Read the shared fd and fan its records out to the inboxes
+ * @param engine Engine
+ * @return Records delivered to any inbox
+ */
+int watch_engine_pump(WatchEngine *engine);
+
+/**
+ * @brief Cap the kernel read buffer
+ *
+ * Applies to the whole process, since every watcher shares the engine.
+ * A smaller cap means more read() calls per storm. A buffer already
+ * larger than the cap shrinks right away.
+ *
+ * @param engine Engine
+ * @param bytes Largest read buffer, at least ENGINE_READ_MIN_BYTES
+ */
+void watch_engine_set_read_limit(WatchEngine *engine, size_t bytes);
+
+/**
+ * @brief The kernel watch limit and how much of it the engine uses
+ *
+ * The limit is read from /proc/sys/fs/inotify/max_user_watches when the
+ * instance opens. It is per user, so other processes of the same user
+ * may hold part of it too.
+ *
+ * @param engine Engine
+ * @param in_use Receives the kernel watches the engine holds, may be NULL
+ * @return max_user_watches, 0 if it could not be read
+ */
+long watch_engine_limit(WatchEngine *engine, uint32_t *in_use);
+
+/**
+ * @brief Take everything in a subscriber's inbox
+ *
+ * Swaps the inbox with the caller's drained buffer, so records are never
+ * copied and both buffers are reused.
+ *
+ * @param sub Subscriber
+ * @param buf Caller's buffer, fully consumed; receives the inbox
+ * @param capacity Allocated bytes of *buf, updated with it
+ * @return Bytes of records now in *buf, 0 if the inbox was empty
+ */
+size_t watch_engine_take(EngineSubscriber *sub, char **buf, size_t *capacity);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WATCH_ENGINE_H
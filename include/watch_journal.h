@@ -0,0 +1,200 @@
+/**
+ * @file watch_journal.h
+ * @brief On-disk record of watched trees for warm restarts
+ *
+ * Without it a restarted client re-adds its watches and then has to
+ * rescan the whole project, since nothing tells it what changed while it
+ * was down. The journal remembers every entry under the recursive roots
+ * with its inode, mtime and size. It is kept current from the event
+ * stream as an append-only log, and on the next run a crawled root is
+ * listed once with fstatat and diffed against it, so only what changed
+ * in between is reported.
+ *
+ * The file is a 16-byte header (magic, version, generation) followed by
+ * 8-byte aligned records in native byte order, each with a checksum, so
+ * a write torn by a crash is cut off at the last whole record. It is
+ * mapped to be replayed on open; the generation goes up by one on every
+ * open. When the log holds well over twice the records its entries need,
+ * it is rewritten next to the original and renamed over it.
+ *
+ * The journal only ever suppresses events. An entry it failed to update
+ * shows up as a change on the next run, never as a missed one. Only one
+ * process may hold a journal file open at a time (flock).
+ *
+ * The journal does no locking of its own; callers serialize access with
+ * the owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef WATCH_JOURNAL_H
+#define WATCH_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Watch_Journal Watch Journal
+ * @brief Persistent tree state diffed on restart
+ * @{
+ */
+
+/** @brief One file or directory under a journaled root */
+typedef struct {
+    uint64_t ino;       /**< Inode number */
+    int64_t mtime_ns;   /**< Modification time in ns since the epoch */
+    int64_t size;       /**< Size in bytes */
+    uint32_t path_off;  /**< Offset of the full path in the path blob */
+    uint32_t hash;      /**< Hash of the path */
+    uint32_t mark;      /**< Walk that last saw the entry */
+    uint32_t listed;    /**< Walk that last listed the entry as a directory */
+    uint16_t path_len;  /**< Length of the path */
+    uint8_t is_dir;     /**< Entry is a directory */
+    uint8_t state;      /**< Slot is free, live or a tombstone */
+} JournalEntry;
+
+/** @brief An open journal */
+typedef struct {
+    int fd;                 /**< Journal file, -1 while closed */
+    char *path;             /**< Journal file path */
+    uint64_t generation;    /**< Opens of the file so far, this one included */
+    JournalEntry *slots;    /**< Entries by path, open addressing */
+    uint32_t capacity;      /**< Slots (power of two), 0 until the first entry */
+    uint32_t count;         /**< Live entries */
+    uint32_t used;          /**< Live entries plus tombstones */
+    char *paths;            /**< Path storage */
+    uint32_t paths_len;     /**< Bytes used in paths */
+    uint32_t paths_cap;     /**< Bytes allocated for paths */
+    uint32_t paths_dead;    /**< Bytes of paths no entry refers to */
+    char **roots;           /**< Roots the journal has a baseline for */
+    int root_count;         /**< Used slots in roots */
+    int root_capacity;      /**< Allocated slots in roots */
+    char *pending;          /**< Records not yet written */
+    size_t pending_len;     /**< Bytes used in pending */
+    size_t pending_cap;     /**< Bytes allocated for pending */
+    uint64_t log_end;       /**< File offset the next record goes to */
+    uint64_t log_records;   /**< Records in the file and in pending */
+    uint32_t mark;          /**< Current walk */
+} WatchJournal;
+
+/**
+ * @brief Called for every difference found while walking a root
+ * @param ctx Caller context
+ * @param kind RING_CREATED, RING_MODIFIED or RING_DELETED
+ * @param is_dir Entry is (or was) a directory
+ * @param path Full path, not NUL-terminated
+ * @param path_len Length of path
+ */
+typedef void (*JournalDiffFn)(void *ctx, uint8_t kind, int is_dir, const char *path, size_t path_len);
+
+/**
+ * @brief Open or create a journal file and replay it
+ *
+ * A file that is not a journal, or of another version, starts over empty.
+ *
+ * @param journal Journal to initialize
+ * @param path Journal file
+ * @return 0 on success, -1 with errno set (EWOULDBLOCK if another process holds it)
+ */
+int watch_journal_open(WatchJournal *journal, const char *path);
+
+/**
+ * @brief Write what is pending, close the file and free the journal
+ *
+ * Safe on a journal that was never opened, as long as fd is -1.
+ *
+ * @param journal Journal
+ */
+void watch_journal_close(WatchJournal *journal);
+
+/**
+ * @brief Whether a root has a baseline from an earlier walk
+ * @param journal Journal
+ * @param path Root directory
+ * @param len Length of path
+ * @return 1 if known
+ */
+int watch_journal_has_root(const WatchJournal *journal, const char *path, size_t len);
+
+/**
+ * @brief Remember that a root now has a baseline
+ * @param journal Journal
+ * @param path Root directory
+ * @param len Length of path
+ * @return 0 on success, -1 on allocation failure
+ */
+int watch_journal_add_root(WatchJournal *journal, const char *path, size_t len);
+
+/**
+ * @brief Start a walk; entries scanned from here on count as seen
+ * @param journal Journal
+ */
+void watch_journal_begin(WatchJournal *journal);
+
+/**
+ * @brief List a directory and diff its entries against the journal
+ *
+ * Regular files count as modified when their inode, mtime or size differ.
+ * Directories are only reported as created or deleted, and an entry that
+ * changed type is reported as both. Entries missing from the listing are
+ * left for watch_journal_sweep().
+ *
+ * @param journal Journal
+ * @param dir Directory path
+ * @param fn Difference callback, NULL to record without reporting
+ * @param ctx Passed to fn
+ * @return Number of differences, -1 with errno set if it could not be listed
+ */
+int watch_journal_scan(WatchJournal *journal, const char *dir, JournalDiffFn fn, void *ctx);
+
+/**
+ * @brief Report and forget entries under a root that the walk did not see
+ *
+ * Only entries whose parent directory was listed in this walk count as
+ * deleted; the rest (directories that could not be watched) are kept. A
+ * deleted directory is reported once and takes its subtree with it.
+ *
+ * @param journal Journal
+ * @param root Root directory
+ * @param root_len Length of root
+ * @param fn Difference callback, NULL to forget without reporting
+ * @param ctx Passed to fn
+ * @return Number of entries reported
+ */
+int watch_journal_sweep(WatchJournal *journal, const char *root, size_t root_len, JournalDiffFn fn, void *ctx);
+
+/**
+ * @brief Refresh one entry after an event named it
+ *
+ * Stats dir/name and records it, or forgets it (and everything below it)
+ * if it is gone.
+ *
+ * @param journal Journal
+ * @param dir Directory path
+ * @param dir_len Length of dir
+ * @param name Entry name
+ * @param name_len Length of name
+ * @return 0 on success, -1 on allocation failure
+ */
+int watch_journal_update(WatchJournal *journal, const char *dir, size_t dir_len, const char *name, size_t name_len);
+
+/**
+ * @brief Write pending records to the file, compacting it if it grew too long
+ * @param journal Journal
+ * @return 0 on success, -1 with errno set; the records are dropped either way
+ */
+int watch_journal_flush(WatchJournal *journal);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WATCH_JOURNAL_H
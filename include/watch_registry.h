@@ -0,0 +1,161 @@
+/**
+ * @file watch_registry.h
+ * @brief Watch descriptor registry for the real implementation
+ *
+ * Maps inotify watch descriptors to the directory paths they were added
+ * for, and back again. Both directions are open-addressing hash tables so
+ * event delivery can resolve a full path in constant time without
+ * allocating. Path strings are interned in a chunked arena owned by the
+ * registry.
+ *
+ * The registry does no locking of its own; callers serialize access with
+ * the owning FileWatcher's mutex.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#ifndef WATCH_REGISTRY_H
+#define WATCH_REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup Watch_Registry Watch Registry
+ * @brief wd <-> path lookup tables
+ * @{
+ */
+
+/** Marker for a never-used slot */
+#define WATCH_SLOT_EMPTY (-1)
+/** Marker for a slot whose entry was removed */
+#define WATCH_SLOT_TOMBSTONE (-2)
+
+/** @brief A registered watch: wd plus its interned directory path */
+typedef struct {
+    int wd;                 /**< inotify watch descriptor, or a WATCH_SLOT_* marker */
+    uint32_t path_hash;     /**< Hash of path, cached for the reverse index */
+    const char *path;       /**< NUL-terminated path, owned by the arena */
+    uint32_t path_len;      /**< Length of path without the terminator */
+    int root;               /**< Recursive root id, 0 for a plain watch */
+} WatchEntry;
+
+/** @brief One chunk of interned path storage */
+typedef struct PathArenaChunk {
+    struct PathArenaChunk *next; /**< Previously filled chunk */
+    size_t used;                 /**< Bytes handed out from data */
+    size_t size;                 /**< Capacity of data */
+    char data[];                 /**< String storage */
+} PathArenaChunk;
+
+/**
+ * @brief Registry state
+ *
+ * `entries` is keyed by wd; `path_index` is keyed by path hash and holds
+ * slot numbers into `entries`, where the string compare happens.
+ */
+typedef struct {
+    WatchEntry *entries;     /**< wd -> entry table */
+    int *path_index;         /**< path -> entries slot table */
+    uint32_t capacity;       /**< Slots in both tables (power of two) */
+    uint32_t count;          /**< Live entries */
+    uint32_t used;           /**< Live entries plus tombstones */
+    PathArenaChunk *arena;   /**< Most recent arena chunk */
+    size_t arena_live;       /**< Bytes referenced by live entries */
+    size_t arena_dead;       /**< Bytes left behind by removed entries */
+} WatchRegistry;
+
+/**
+ * @brief Initialize an empty registry
+ * @param reg Registry to initialize
+ * @return 0 on success, -1 on allocation failure
+ */
+int watch_registry_init(WatchRegistry *reg);
+
+/**
+ * @brief Free all tables and interned paths
+ * @param reg Registry to destroy
+ */
+void watch_registry_destroy(WatchRegistry *reg);
+
+/**
+ * @brief Register (or re-register) a watch
+ *
+ * inotify hands out the same wd when an inode is watched twice, so adding
+ * an existing wd replaces its path. Trailing slashes are stripped.
+ *
+ * @param reg Registry
+ * @param wd Watch descriptor returned by inotify_add_watch()
+ * @param path Directory path
+ * @param len Length of path
+ * @param root Recursive root id the watch belongs to, 0 if none
+ * @return 0 on success, -1 on allocation failure
+ */
+int watch_registry_add(WatchRegistry *reg, int wd, const char *path, size_t len, int root);
+
+/**
+ * @brief Look up the entry for a watch descriptor
+ * @param reg Registry
+ * @param wd Watch descriptor from an inotify event
+ * @return Entry, or NULL if wd is unknown. Valid until the next add/remove.
+ */
+const WatchEntry *watch_registry_lookup(const WatchRegistry *reg, int wd);
+
+/**
+ * @brief Reverse lookup: find the wd registered for a path
+ * @param reg Registry
+ * @param path Directory path (trailing slashes ignored)
+ * @param len Length of path
+ * @return Watch descriptor, or -1 if the path is not registered
+ */
+int watch_registry_find_path(const WatchRegistry *reg, const char *path, size_t len);
+
+/**
+ * @brief Forget a watch descriptor
+ * @param reg Registry
+ * @param wd Watch descriptor
+ * @return 0 if removed, -1 if wd was not registered
+ */
+int watch_registry_remove(WatchRegistry *reg, int wd);
+
+/**
+ * @brief Re-key a renamed directory and everything registered below it
+ *
+ * Watches follow inodes, so after a rename the same wds simply need their
+ * paths rewritten: `from` becomes `to`, and `from/x` becomes `to/x`.
+ *
+ * @param reg Registry
+ * @param from Old directory path
+ * @param from_len Length of from
+ * @param to New directory path
+ * @param to_len Length of to
+ * @return Number of entries re-keyed, -1 on allocation failure
+ */
+int watch_registry_rename_prefix(WatchRegistry *reg, const char *from, size_t from_len,
+                                 const char *to, size_t to_len);
+
+/**
+ * @brief Iterate over live entries
+ *
+ * Start with `*cursor = 0`. Entries must not be added while iterating;
+ * removing the entry just returned is allowed.
+ *
+ * @param reg Registry
+ * @param cursor Iteration state
+ * @return Next entry, or NULL when done
+ */
+const WatchEntry *watch_registry_next(const WatchRegistry *reg, uint32_t *cursor);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WATCH_REGISTRY_H
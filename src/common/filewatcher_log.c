@@ -0,0 +1,58 @@
+/**
+ * @file filewatcher_log.c
+ * @brief stderr logging, enabled for debug messages by FILEWATCHER_DEBUG
+ *
+ * Kept free of JNI so the watcher core can use it on its own.
+ */
+
+#include "filewatcher_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+/**
+ * @brief Debug logging flag (set via FILEWATCHER_DEBUG env var)
+ */
+static int debug_enabled = -1;
+
+/**
+ * @brief Check if debug logging is enabled
+ * @return 1 if enabled, 0 if disabled
+ */
+int is_debug_enabled(void) {
+    if (debug_enabled == -1) {
+        const char *debug_env = getenv("FILEWATCHER_DEBUG");
+        debug_enabled = (debug_env != NULL && *debug_env != '0') ? 1 : 0;
+    }
+    return debug_enabled;
+}
+
+/**
+ * @brief Log debug message
+ * @param format Printf-style format string
+ * @param ... Arguments for format string
+ */
+void debug_log(const char *format, ...) {
+    if (!is_debug_enabled()) return;
+    
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[FileWatcher DEBUG] ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+/**
+ * @brief Log error message
+ * @param format Printf-style format string
+ * @param ... Arguments for format string
+ */
+void error_log(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[FileWatcher ERROR] ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
@@ -0,0 +1,310 @@
+/**
+ * @file filewatcher_trace.c
+ * @brief Per-thread trace rings and the thread that writes them out
+ *
+ * Every thread that hits a tracepoint gets its own single-producer ring
+ * on first use, linked into a global list. Only the owning thread writes
+ * a ring and only the flusher drains it, so a tracepoint takes no lock.
+ * A full ring drops the record and counts it; the flusher turns the count
+ * into a TRACE_LOST record. Rings outlive their threads until drained.
+ *
+ * Kept free of JNI so the watcher core can use it on its own.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "filewatcher_trace.h"
+#include "filewatcher_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct TraceBuffer {
+    TraceRecord records[TRACE_THREAD_RECORDS];
+    _Atomic uint32_t head;     // Written by the owning thread
+    _Atomic uint32_t tail;     // Written by the flusher
+    _Atomic uint64_t dropped;  // Records the owning thread could not fit
+    uint64_t reported;         // Drops already written as TRACE_LOST
+    _Atomic int dead;          // Owning thread has exited
+    uint32_t tid;
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+_Atomic int filewatcher_tracing = 0;
+
+static const char *const stage_names[TRACE_STAGE_COUNT] = {
+    "?", "read", "parse", "filter", "coalesce", "queue", "deliver", "lost"
+};
+
+// Every ring, guarded by list_lock
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer *buffers = NULL;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buffer_key;
+static __thread TraceBuffer *thread_buffer = NULL;
+
+// Start/stop state, guarded by control_lock
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t control_cond;
+static int trace_fd = -1;
+static int stopping = 0;
+static pthread_t flusher;
+
+static pthread_once_t env_once = PTHREAD_ONCE_INIT;
+
+const char *filewatcher_trace_stage_name(unsigned stage) {
+    if (stage == 0 || stage >= TRACE_STAGE_COUNT) return "unknown";
+    return stage_names[stage];
+}
+
+// Thread exit: leave the ring for the flusher to drain and free
+static void release_buffer(void *value) {
+    TraceBuffer *buffer = value;
+    atomic_store_explicit(&buffer->dead, 1, memory_order_release);
+}
+
+static void create_key(void) {
+    if (pthread_key_create(&buffer_key, release_buffer) != 0) {
+        error_log("Failed to create trace key: %s", strerror(errno));
+    }
+}
+
+// This thread's ring, created and linked in on first use. NULL if out of memory.
+static TraceBuffer *own_buffer(void) {
+    if (thread_buffer != NULL) return thread_buffer;
+
+    pthread_once(&key_once, create_key);
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    if (buffer == NULL) return NULL;
+    buffer->tid = (uint32_t)syscall(SYS_gettid);
+    pthread_setspecific(buffer_key, buffer);
+
+    pthread_mutex_lock(&list_lock);
+    buffer->next = buffers;
+    buffers = buffer;
+    pthread_mutex_unlock(&list_lock);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+void filewatcher_trace_write(TraceStage stage, uint8_t flags, int32_t wd, uint32_t mask,
+                             uint32_t cookie, uint32_t aux) {
+    TraceBuffer *buffer = own_buffer();
+    if (buffer == NULL) return;
+
+    uint32_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if (head - tail >= TRACE_THREAD_RECORDS) {
+        uint64_t dropped = atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+        atomic_store_explicit(&buffer->dropped, dropped + 1, memory_order_relaxed);
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    TraceRecord *record = &buffer->records[head & (TRACE_THREAD_RECORDS - 1)];
+    record->time_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    record->wd = wd;
+    record->mask = mask;
+    record->cookie = cookie;
+    record->tid = buffer->tid;
+    record->stage = (uint8_t)stage;
+    record->flags = flags;
+    record->reserved = 0;
+    record->aux = aux;
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+// Write all of data. Returns 0, or -1 with errno set.
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Write out one ring's records and drop count. Caller holds list_lock.
+static int drain_buffer(TraceBuffer *buffer, int fd) {
+    uint32_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    int result = 0;
+    while (tail != head) {
+        uint32_t offset = tail & (TRACE_THREAD_RECORDS - 1);
+        uint32_t count = head - tail;
+        if (count > TRACE_THREAD_RECORDS - offset) count = TRACE_THREAD_RECORDS - offset;
+        if (result == 0) result = write_all(fd, &buffer->records[offset], count * sizeof(TraceRecord));
+        tail += count;
+    }
+    atomic_store_explicit(&buffer->tail, tail, memory_order_release);
+
+    uint64_t dropped = atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+    if (dropped != buffer->reported) {
+        TraceRecord lost;
+        memset(&lost, 0, sizeof(lost));
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        lost.time_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+        lost.wd = -1;
+        lost.tid = buffer->tid;
+        lost.stage = TRACE_LOST;
+        lost.aux = (uint32_t)(dropped - buffer->reported);
+        buffer->reported = dropped;
+        if (result == 0) result = write_all(fd, &lost, sizeof(lost));
+    }
+    return result;
+}
+
+// Drain every ring into fd (or discard them with fd -1), freeing those
+// whose thread is gone. Returns 0, or -1 if a write failed.
+static int drain_all(int fd) {
+    int result = 0;
+    pthread_mutex_lock(&list_lock);
+    TraceBuffer **link = &buffers;
+    while (*link != NULL) {
+        TraceBuffer *buffer = *link;
+        int dead = atomic_load_explicit(&buffer->dead, memory_order_acquire);
+        if (fd >= 0) {
+            if (drain_buffer(buffer, fd) != 0) result = -1;
+        } else {
+            atomic_store_explicit(&buffer->tail, atomic_load(&buffer->head), memory_order_release);
+            buffer->reported = atomic_load(&buffer->dropped);
+        }
+        if (dead) {
+            *link = buffer->next;
+            free(buffer);
+        } else {
+            link = &buffer->next;
+        }
+    }
+    pthread_mutex_unlock(&list_lock);
+    return result;
+}
+
+static void *flusher_main(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    int failed = 0;
+    pthread_mutex_lock(&control_lock);
+    while (!stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += TRACE_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&control_cond, &control_lock, &deadline);
+        if (stopping) break;
+
+        pthread_mutex_unlock(&control_lock);
+        if (drain_all(fd) != 0 && !failed) {
+            error_log("Failed to write trace: %s", strerror(errno));
+            failed = 1;
+        }
+        pthread_mutex_lock(&control_lock);
+    }
+    pthread_mutex_unlock(&control_lock);
+    return NULL;
+}
+
+int filewatcher_trace_start(const char *path) {
+    pthread_mutex_lock(&control_lock);
+    if (trace_fd >= 0) {
+        pthread_mutex_unlock(&control_lock);
+        errno = EBUSY;
+        return -1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int saved = errno;
+        pthread_mutex_unlock(&control_lock);
+        errno = saved;
+        return -1;
+    }
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    if (write_all(fd, &header, sizeof(header)) != 0) {
+        int saved = errno;
+        close(fd);
+        pthread_mutex_unlock(&control_lock);
+        errno = saved;
+        return -1;
+    }
+
+    // Whatever a previous session left behind is not part of this one
+    drain_all(-1);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&control_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    trace_fd = fd;
+    stopping = 0;
+    int rc = pthread_create(&flusher, NULL, flusher_main, (void *)(intptr_t)fd);
+    if (rc != 0) {
+        trace_fd = -1;
+        pthread_cond_destroy(&control_cond);
+        close(fd);
+        pthread_mutex_unlock(&control_lock);
+        errno = rc;
+        return -1;
+    }
+    atomic_store(&filewatcher_tracing, 1);
+    pthread_mutex_unlock(&control_lock);
+    debug_log("Tracing into %s", path);
+    return 0;
+}
+
+void filewatcher_trace_stop(void) {
+    pthread_mutex_lock(&control_lock);
+    if (trace_fd < 0) {
+        pthread_mutex_unlock(&control_lock);
+        return;
+    }
+    atomic_store(&filewatcher_tracing, 0);
+    stopping = 1;
+    pthread_cond_signal(&control_cond);
+    pthread_mutex_unlock(&control_lock);
+    pthread_join(flusher, NULL);
+
+    pthread_mutex_lock(&control_lock);
+    if (drain_all(trace_fd) != 0) error_log("Failed to write trace: %s", strerror(errno));
+    close(trace_fd);
+    trace_fd = -1;
+    pthread_cond_destroy(&control_cond);
+    pthread_mutex_unlock(&control_lock);
+}
+
+static void start_from_env(void) {
+    const char *path = getenv(FILEWATCHER_TRACE_ENV);
+    if (path == NULL || path[0] == '\0') return;
+    if (filewatcher_trace_start(path) != 0) {
+        error_log("Failed to start tracing into %s: %s", path, strerror(errno));
+        return;
+    }
+    atexit(filewatcher_trace_stop);
+}
+
+void filewatcher_trace_init_from_env(void) {
+    pthread_once(&env_once, start_from_env);
+}
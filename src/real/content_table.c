@@ -0,0 +1,278 @@
+/**
+ * @file content_table.c
+ * @brief XXH64 and the per-inode content table
+ *
+ * XXH64 keeps four independent 64-bit lanes over each 32-byte stripe, so
+ * the multiplies of one stripe overlap in the pipeline on any 64-bit CPU
+ * without intrinsics. Files are hashed a chunk at a time rather than
+ * through mmap(): a writer truncating the file mid-hash would otherwise
+ * raise SIGBUS in a process (the JVM) that cannot take it.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "content_table.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PRIME1 0x9E3779B185EBCA87ull
+#define PRIME2 0xC2B2AE3D27D4EB4Full
+#define PRIME3 0x165667B19E3779F9ull
+#define PRIME4 0x85EBCA77C2B2AE63ull
+#define PRIME5 0x27D4EB2F165667C5ull
+
+// Running XXH64 over whole stripes
+typedef struct {
+    uint64_t lanes[4];
+    uint64_t total;
+    uint64_t seed;
+} HashState;
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t lane) {
+    acc ^= round64(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+static void hash_begin(HashState *state, uint64_t seed) {
+    state->lanes[0] = seed + PRIME1 + PRIME2;
+    state->lanes[1] = seed + PRIME2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - PRIME1;
+    state->total = 0;
+    state->seed = seed;
+}
+
+// Fold in len bytes, a multiple of 32
+static void hash_stripes(HashState *state, const uint8_t *p, size_t len) {
+    uint64_t v1 = state->lanes[0], v2 = state->lanes[1], v3 = state->lanes[2], v4 = state->lanes[3];
+    for (const uint8_t *end = p + len; p < end; p += 32) {
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+    }
+    state->lanes[0] = v1;
+    state->lanes[1] = v2;
+    state->lanes[2] = v3;
+    state->lanes[3] = v4;
+    state->total += len;
+}
+
+// Fold in the last len (< 32) bytes and finish
+static uint64_t hash_end(const HashState *state, const uint8_t *p, size_t len) {
+    uint64_t total = state->total + len;
+    uint64_t h;
+    if (state->total > 0) {
+        const uint64_t *v = state->lanes;
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++) h = merge_round(h, v[i]);
+    } else {
+        h = state->seed + PRIME5;
+    }
+    h += total;
+
+    for (; len >= 8; p += 8, len -= 8) h = rotl64(h ^ round64(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (len >= 4) {
+        h = rotl64(h ^ ((uint64_t)read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--) h = rotl64(h ^ (*p * PRIME5), 11) * PRIME1;
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t content_hash64(const void *data, size_t len, uint64_t seed) {
+    HashState state;
+    hash_begin(&state, seed);
+    size_t stripes = len & ~(size_t)31;
+    hash_stripes(&state, data, stripes);
+    return hash_end(&state, (const uint8_t *)data + stripes, len - stripes);
+}
+
+void content_table_init(ContentTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+void content_table_destroy(ContentTable *table) {
+    free(table->entries);
+    free(table->buffer);
+    memset(table, 0, sizeof(*table));
+}
+
+// Hash an open file of the given size. Returns 0, or -1 with errno set
+// if it could not be read or changed size while being read.
+static int hash_file(ContentTable *table, int fd, uint64_t size, uint64_t *hash) {
+    HashState state;
+    hash_begin(&state, 0);
+    uint64_t offset = 0;
+    size_t filled = 0;
+    for (;;) {
+        ssize_t n = pread(fd, table->buffer + filled, CONTENT_CHUNK_BYTES - filled, (off_t)(offset + filled));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        filled += (size_t)n;
+        if (n > 0 && filled < CONTENT_CHUNK_BYTES) continue;
+
+        // A full chunk goes in whole; the last one leaves its tail for hash_end
+        size_t stripes = (n == 0) ? (filled & ~(size_t)31) : filled;
+        hash_stripes(&state, table->buffer, stripes);
+        offset += stripes;
+        if (n == 0) {
+            if (offset + (filled - stripes) != size) {
+                errno = EAGAIN; // Still being written: not worth comparing
+                return -1;
+            }
+            *hash = hash_end(&state, table->buffer + stripes, filled - stripes);
+            return 0;
+        }
+        filled = 0;
+        if (offset > size) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+}
+
+static uint32_t slot_for(const ContentTable *table, uint64_t dev, uint64_t ino) {
+    uint64_t key = (ino ^ (dev * PRIME2)) * PRIME1;
+    return (uint32_t)(key >> 32) & (table->capacity - 1);
+}
+
+// Make room for one more entry: grow to CONTENT_MAX_ENTRIES, then start
+// over. Returns 0, or -1 if out of memory.
+static int reserve_entry(ContentTable *table) {
+    int restart = (table->count >= CONTENT_MAX_ENTRIES);
+    if (table->entries != NULL && !restart && (table->count + 1) * 4 <= table->capacity * 3) return 0;
+
+    uint32_t capacity = restart ? table->capacity : (table->capacity ? table->capacity * 2 : 1024);
+    ContentEntry *entries = calloc(capacity, sizeof(ContentEntry));
+    if (entries == NULL) return -1;
+
+    ContentEntry *old = table->entries;
+    uint32_t old_capacity = table->capacity;
+    table->entries = entries;
+    table->capacity = capacity;
+    table->count = 0;
+    for (uint32_t i = 0; !restart && i < old_capacity; i++) {
+        if (old[i].ino == 0) continue;
+        uint32_t slot = slot_for(table, old[i].dev, old[i].ino);
+        while (entries[slot].ino != 0) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = old[i];
+        table->count++;
+    }
+    free(old);
+    return 0;
+}
+
+// Slot holding (dev, ino), or the free slot where it would go
+static uint32_t find_slot(const ContentTable *table, uint64_t dev, uint64_t ino) {
+    uint32_t slot = slot_for(table, dev, ino);
+    while (table->entries[slot].ino != 0 &&
+           (table->entries[slot].ino != ino || table->entries[slot].dev != dev)) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return slot;
+}
+
+// Drop the entry in slot, moving later ones of its probe run back so
+// lookups still find them
+static void remove_slot(ContentTable *table, uint32_t slot) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mask; table->entries[next].ino != 0; next = (next + 1) & mask) {
+        uint32_t home = slot_for(table, table->entries[next].dev, table->entries[next].ino);
+        // Move it only if its home is not between the hole and where it sits
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->entries[hole] = table->entries[next];
+            hole = next;
+        }
+    }
+    table->entries[hole].ino = 0;
+    table->count--;
+}
+
+ContentResult content_table_check(ContentTable *table, const char *path, uint64_t max_bytes) {
+    if (table->buffer == NULL) {
+        table->buffer = malloc(CONTENT_CHUNK_BYTES);
+        if (table->buffer == NULL) return CONTENT_UNKNOWN;
+    }
+    if (reserve_entry(table) != 0) return CONTENT_UNKNOWN;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY);
+    if (fd < 0) return CONTENT_UNKNOWN;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_ino == 0) {
+        close(fd);
+        return CONTENT_UNKNOWN;
+    }
+
+    uint32_t slot = find_slot(table, (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+    ContentEntry *entry = &table->entries[slot];
+
+    // A new size is a change already; the hash waits until one repeats
+    if (entry->ino != 0 && entry->size != (uint64_t)st.st_size && (uint64_t)st.st_size <= max_bytes) {
+        close(fd);
+        entry->size = (uint64_t)st.st_size;
+        entry->hashed = 0;
+        return CONTENT_CHANGED;
+    }
+    uint64_t hash;
+    if ((uint64_t)st.st_size > max_bytes || hash_file(table, fd, (uint64_t)st.st_size, &hash) != 0) {
+        // Whatever it held before says nothing about it now
+        close(fd);
+        if (entry->ino != 0) remove_slot(table, slot);
+        return CONTENT_UNKNOWN;
+    }
+    close(fd);
+
+    if (entry->ino != 0 && entry->hashed && entry->hash == hash) return CONTENT_UNCHANGED;
+    if (entry->ino == 0) table->count++;
+    entry->dev = (uint64_t)st.st_dev;
+    entry->ino = (uint64_t)st.st_ino;
+    entry->size = (uint64_t)st.st_size;
+    entry->hash = hash;
+    entry->hashed = 1;
+    return CONTENT_CHANGED;
+}
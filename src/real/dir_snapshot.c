@@ -0,0 +1,383 @@
+/**
+ * @file dir_snapshot.c
+ * @brief Directory listings kept for overflow recovery
+ *
+ * Each snapshot keeps its entries sorted by name so lookups are a binary
+ * search and a rescan is a single merge walk against the new listing.
+ * Names are appended to a per-directory blob; removed names are reclaimed
+ * when the dead bytes outgrow the live ones. Snapshots are found through a
+ * linear-probing table keyed by wd, rebuilt at 70% load.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "dir_snapshot.h"
+#include "event_ring.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_INITIAL_SLOTS 64
+#define SNAPSHOT_COMPACT_MIN 4096
+
+// Marks a slot whose snapshot was removed
+static DirSnapshot tombstone;
+#define SLOT_TOMBSTONE (&tombstone)
+
+static uint32_t hash_wd(int wd) {
+    return (uint32_t)wd * 2654435761u;
+}
+
+static int name_cmp(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) return c;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static const char *entry_name(const DirSnapshot *snap, const SnapshotEntry *entry) {
+    return snap->names + entry->name_off;
+}
+
+static void snapshot_free(DirSnapshot *snap) {
+    free(snap->entries);
+    free(snap->names);
+    free(snap);
+}
+
+static void fill_stat(SnapshotEntry *entry, const struct stat *st) {
+    entry->ino = (uint64_t)st->st_ino;
+    entry->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    entry->size = (int64_t)st->st_size;
+    entry->is_dir = S_ISDIR(st->st_mode) ? 1 : 0;
+    entry->reserved = 0;
+}
+
+static int reserve_entries(DirSnapshot *snap, uint32_t count) {
+    if (count <= snap->capacity) return 0;
+    uint32_t capacity = snap->capacity ? snap->capacity : 16;
+    while (capacity < count) capacity *= 2;
+    SnapshotEntry *grown = realloc(snap->entries, sizeof(SnapshotEntry) * capacity);
+    if (grown == NULL) return -1;
+    snap->entries = grown;
+    snap->capacity = capacity;
+    return 0;
+}
+
+// Copy a name into the blob, returning its offset or -1
+static int64_t append_name(DirSnapshot *snap, const char *name, size_t len) {
+    if ((uint64_t)snap->names_len + len > UINT32_MAX) return -1;
+    if (snap->names_len + len > snap->names_cap) {
+        uint32_t cap = snap->names_cap ? snap->names_cap : 256;
+        while (cap < snap->names_len + len) cap *= 2;
+        char *grown = realloc(snap->names, cap);
+        if (grown == NULL) return -1;
+        snap->names = grown;
+        snap->names_cap = cap;
+    }
+    memcpy(snap->names + snap->names_len, name, len);
+    uint32_t off = snap->names_len;
+    snap->names_len += (uint32_t)len;
+    return off;
+}
+
+// Bottom-up merge sort by name; qsort has no context argument on every libc
+static int sort_entries(DirSnapshot *snap) {
+    uint32_t n = snap->count;
+    if (n < 2) return 0;
+    SnapshotEntry *tmp = malloc(sizeof(SnapshotEntry) * n);
+    if (tmp == NULL) return -1;
+
+    SnapshotEntry *src = snap->entries, *dst = tmp;
+    for (uint32_t width = 1; width < n; width *= 2) {
+        for (uint32_t lo = 0; lo < n; lo += 2 * width) {
+            uint32_t mid = (lo + width < n) ? lo + width : n;
+            uint32_t hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+            uint32_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                const SnapshotEntry *a = &src[i], *b = &src[j];
+                if (name_cmp(entry_name(snap, a), a->name_len, entry_name(snap, b), b->name_len) <= 0) {
+                    dst[k++] = src[i++];
+                } else {
+                    dst[k++] = src[j++];
+                }
+            }
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi) dst[k++] = src[j++];
+        }
+        SnapshotEntry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != snap->entries) memcpy(snap->entries, src, sizeof(SnapshotEntry) * n);
+    free(tmp);
+    return 0;
+}
+
+// Fresh snapshot of path, or NULL with errno set
+static DirSnapshot *list_dir(int wd, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) return NULL;
+
+    DirSnapshot *snap = calloc(1, sizeof(DirSnapshot));
+    if (snap == NULL) {
+        closedir(dir);
+        errno = ENOMEM;
+        return NULL;
+    }
+    snap->wd = wd;
+
+    struct dirent *de;
+    struct stat st;
+    while ((de = readdir(dir)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        // Raced with a delete; the entry is gone either way
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        size_t len = strlen(name);
+        int64_t off;
+        if (reserve_entries(snap, snap->count + 1) != 0 || (off = append_name(snap, name, len)) < 0) {
+            closedir(dir);
+            snapshot_free(snap);
+            errno = ENOMEM;
+            return NULL;
+        }
+        SnapshotEntry *entry = &snap->entries[snap->count++];
+        fill_stat(entry, &st);
+        entry->name_off = (uint32_t)off;
+        entry->name_len = (uint16_t)len;
+    }
+    closedir(dir);
+
+    if (sort_entries(snap) != 0) {
+        snapshot_free(snap);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return snap;
+}
+
+// Binary search; returns the index of name or, if absent, -(insertion point) - 1
+static int64_t find_entry(const DirSnapshot *snap, const char *name, size_t len) {
+    uint32_t lo = 0, hi = snap->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const SnapshotEntry *entry = &snap->entries[mid];
+        int c = name_cmp(entry_name(snap, entry), entry->name_len, name, len);
+        if (c == 0) return mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -(int64_t)lo - 1;
+}
+
+// Rewrite the blob without the names of removed entries
+static void compact_names(DirSnapshot *snap) {
+    uint32_t live = snap->names_len - snap->names_dead;
+    char *names = malloc(live ? live : 1);
+    if (names == NULL) return; // Keep the dead bytes and retry next time
+
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < snap->count; i++) {
+        SnapshotEntry *entry = &snap->entries[i];
+        memcpy(names + pos, snap->names + entry->name_off, entry->name_len);
+        entry->name_off = pos;
+        pos += entry->name_len;
+    }
+    free(snap->names);
+    snap->names = names;
+    snap->names_len = pos;
+    snap->names_cap = live ? live : 1;
+    snap->names_dead = 0;
+}
+
+static int slots_init(SnapshotTable *table, uint32_t capacity) {
+    DirSnapshot **slots = calloc(capacity, sizeof(DirSnapshot *));
+    if (slots == NULL) return -1;
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        DirSnapshot *snap = table->slots[i];
+        if (snap == NULL || snap == SLOT_TOMBSTONE) continue;
+        uint32_t slot = hash_wd(snap->wd) & (capacity - 1);
+        while (slots[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = snap;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    table->used = table->count;
+    return 0;
+}
+
+int snapshot_table_init(SnapshotTable *table) {
+    memset(table, 0, sizeof(*table));
+    return slots_init(table, SNAPSHOT_INITIAL_SLOTS);
+}
+
+void snapshot_table_destroy(SnapshotTable *table) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        DirSnapshot *snap = table->slots[i];
+        if (snap != NULL && snap != SLOT_TOMBSTONE) snapshot_free(snap);
+    }
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+// Slot holding the snapshot for wd, or -1
+static int64_t find_slot(const SnapshotTable *table, int wd) {
+    if (table->capacity == 0) return -1;
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t slot = hash_wd(wd) & mask;; slot = (slot + 1) & mask) {
+        DirSnapshot *snap = table->slots[slot];
+        if (snap == NULL) return -1;
+        if (snap != SLOT_TOMBSTONE && snap->wd == wd) return slot;
+    }
+}
+
+static DirSnapshot *lookup(const SnapshotTable *table, int wd) {
+    int64_t slot = find_slot(table, wd);
+    return (slot >= 0) ? table->slots[slot] : NULL;
+}
+
+// Store snap, replacing any snapshot for the same wd
+static int store(SnapshotTable *table, DirSnapshot *snap) {
+    int64_t slot = find_slot(table, snap->wd);
+    if (slot >= 0) {
+        snapshot_free(table->slots[slot]);
+        table->slots[slot] = snap;
+        return 0;
+    }
+
+    if ((table->used + 1) * 10 >= table->capacity * 7) {
+        uint32_t capacity = table->capacity ? table->capacity : SNAPSHOT_INITIAL_SLOTS;
+        if ((table->count + 1) * 2 >= capacity) capacity *= 2;
+        if (slots_init(table, capacity) != 0) return -1;
+    }
+
+    uint32_t mask = table->capacity - 1;
+    uint32_t pos = hash_wd(snap->wd) & mask;
+    while (table->slots[pos] != NULL && table->slots[pos] != SLOT_TOMBSTONE) pos = (pos + 1) & mask;
+    if (table->slots[pos] == NULL) table->used++;
+    table->slots[pos] = snap;
+    table->count++;
+    return 0;
+}
+
+int snapshot_table_has(const SnapshotTable *table, int wd) {
+    return find_slot(table, wd) >= 0;
+}
+
+void snapshot_table_remove(SnapshotTable *table, int wd) {
+    int64_t slot = find_slot(table, wd);
+    if (slot < 0) return;
+    snapshot_free(table->slots[slot]);
+    table->slots[slot] = SLOT_TOMBSTONE;
+    table->count--;
+}
+
+int snapshot_scan(SnapshotTable *table, int wd, const char *path) {
+    DirSnapshot *snap = list_dir(wd, path);
+    if (snap == NULL) return -1;
+    if (store(table, snap) != 0) {
+        snapshot_free(snap);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_update(SnapshotTable *table, int wd, const char *dir, const char *name, size_t name_len) {
+    DirSnapshot *snap = lookup(table, wd);
+    if (snap == NULL || name_len == 0 || name_len > UINT16_MAX) return 0;
+
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/%.*s", dir, (int)name_len, name);
+    if (n < 0 || (size_t)n >= sizeof(path)) return 0;
+
+    struct stat st;
+    int exists = (lstat(path, &st) == 0);
+    int64_t at = find_entry(snap, name, name_len);
+
+    if (at >= 0) {
+        if (exists) {
+            fill_stat(&snap->entries[at], &st);
+            return 0;
+        }
+        snap->names_dead += snap->entries[at].name_len;
+        memmove(&snap->entries[at], &snap->entries[at + 1],
+                sizeof(SnapshotEntry) * (snap->count - (uint32_t)at - 1));
+        snap->count--;
+        if (snap->names_dead > SNAPSHOT_COMPACT_MIN && snap->names_dead > snap->names_len - snap->names_dead) {
+            compact_names(snap);
+        }
+        return 0;
+    }
+    if (!exists) return 0;
+
+    uint32_t pos = (uint32_t)(-at - 1);
+    int64_t off;
+    if (reserve_entries(snap, snap->count + 1) != 0 || (off = append_name(snap, name, name_len)) < 0) return -1;
+    memmove(&snap->entries[pos + 1], &snap->entries[pos], sizeof(SnapshotEntry) * (snap->count - pos));
+    SnapshotEntry *entry = &snap->entries[pos];
+    fill_stat(entry, &st);
+    entry->name_off = (uint32_t)off;
+    entry->name_len = (uint16_t)name_len;
+    snap->count++;
+    return 0;
+}
+
+int snapshot_rescan(SnapshotTable *table, int wd, const char *path, SnapshotDiffFn fn, void *ctx) {
+    DirSnapshot *fresh = list_dir(wd, path);
+    if (fresh == NULL) return -1;
+
+    DirSnapshot *old = lookup(table, wd);
+    int changes = 0;
+    uint32_t i = 0, j = 0;
+    uint32_t old_count = old ? old->count : 0;
+
+    while (i < old_count || j < fresh->count) {
+        const SnapshotEntry *a = (i < old_count) ? &old->entries[i] : NULL;
+        const SnapshotEntry *b = (j < fresh->count) ? &fresh->entries[j] : NULL;
+        int c;
+        if (a == NULL) c = 1;
+        else if (b == NULL) c = -1;
+        else c = name_cmp(entry_name(old, a), a->name_len, entry_name(fresh, b), b->name_len);
+
+        if (c < 0) {
+            fn(ctx, RING_DELETED, a->is_dir, entry_name(old, a), a->name_len);
+            changes++;
+            i++;
+        } else if (c > 0) {
+            fn(ctx, RING_CREATED, b->is_dir, entry_name(fresh, b), b->name_len);
+            changes++;
+            j++;
+        } else {
+            if (a->is_dir != b->is_dir) {
+                // Replaced by a different kind of entry
+                fn(ctx, RING_DELETED, a->is_dir, entry_name(old, a), a->name_len);
+                fn(ctx, RING_CREATED, b->is_dir, entry_name(fresh, b), b->name_len);
+                changes += 2;
+            } else if (!b->is_dir && (a->ino != b->ino || a->mtime_ns != b->mtime_ns || a->size != b->size)) {
+                fn(ctx, RING_MODIFIED, 0, entry_name(fresh, b), b->name_len);
+                changes++;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    if (store(table, fresh) != 0) {
+        // Keep the old listing; the changes were still reported
+        snapshot_free(fresh);
+    }
+    return changes;
+}
@@ -0,0 +1,237 @@
+/**
+ * @file event_coalescer.c
+ * @brief Path-keyed event folding with a quiet window
+ *
+ * Entries live in a pool linked in update order. A linear-probing index
+ * keyed by path hash holds pool numbers; it is rebuilt once live slots plus
+ * tombstones reach 70% load.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "event_coalescer.h"
+#include "event_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define COALESCE_INITIAL_ENTRIES 64
+#define INDEX_EMPTY (-1)
+#define INDEX_TOMBSTONE (-2)
+
+// Result of folding an event into a pending one
+#define FOLD_CANCEL 0xFF
+
+// FNV-1a over the path bytes
+static uint32_t hash_path(const char *path, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// What the consumer should see for `pending` followed by `incoming`
+static uint8_t fold_kind(uint8_t pending, uint8_t incoming) {
+    if (pending == RING_OVERFLOW || incoming == RING_OVERFLOW) return RING_OVERFLOW;
+    switch (pending) {
+        case RING_CREATED:
+            // Never seen by the consumer, so a delete undoes it entirely
+            return (incoming == RING_DELETED) ? FOLD_CANCEL : RING_CREATED;
+        case RING_DELETED:
+            // Deleted and recreated: to the consumer the file just changed
+            return (incoming == RING_DELETED) ? RING_DELETED : RING_MODIFIED;
+        default:
+            return (incoming == RING_DELETED) ? RING_DELETED : RING_MODIFIED;
+    }
+}
+
+static int index_init(EventCoalescer *c, uint32_t capacity) {
+    int *index = malloc(sizeof(int) * capacity);
+    if (index == NULL) return -1;
+    for (uint32_t i = 0; i < capacity; i++) index[i] = INDEX_EMPTY;
+
+    // Re-insert every pending entry
+    for (int e = c->head; e >= 0; e = c->entries[e].next) {
+        uint32_t slot = c->entries[e].hash & (capacity - 1);
+        while (index[slot] != INDEX_EMPTY) slot = (slot + 1) & (capacity - 1);
+        index[slot] = e;
+    }
+
+    free(c->index);
+    c->index = index;
+    c->index_capacity = capacity;
+    c->index_used = (uint32_t)c->count;
+    return 0;
+}
+
+int event_coalescer_init(EventCoalescer *coalescer, uint64_t window_ns) {
+    memset(coalescer, 0, sizeof(*coalescer));
+    coalescer->free_head = -1;
+    coalescer->head = -1;
+    coalescer->tail = -1;
+    coalescer->window_ns = window_ns;
+    return index_init(coalescer, COALESCE_INITIAL_ENTRIES * 2);
+}
+
+void event_coalescer_destroy(EventCoalescer *coalescer) {
+    if (coalescer->entries != NULL) {
+        for (int e = coalescer->head; e >= 0; e = coalescer->entries[e].next) {
+            free(coalescer->entries[e].path);
+        }
+    }
+    free(coalescer->entries);
+    free(coalescer->index);
+    memset(coalescer, 0, sizeof(*coalescer));
+    coalescer->free_head = -1;
+    coalescer->head = -1;
+    coalescer->tail = -1;
+}
+
+// Index slot holding the entry for path, or -1
+static int find_slot(const EventCoalescer *c, const char *path, size_t len, uint32_t hash) {
+    uint32_t mask = c->index_capacity - 1;
+    for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        int e = c->index[slot];
+        if (e == INDEX_EMPTY) return -1;
+        if (e == INDEX_TOMBSTONE) continue;
+        const CoalescedEvent *entry = &c->entries[e];
+        if (entry->hash == hash && entry->path_len == len && memcmp(entry->path, path, len) == 0) {
+            return (int)slot;
+        }
+    }
+}
+
+static void list_unlink(EventCoalescer *c, int e) {
+    CoalescedEvent *entry = &c->entries[e];
+    if (entry->prev >= 0) c->entries[entry->prev].next = entry->next;
+    else c->head = entry->next;
+    if (entry->next >= 0) c->entries[entry->next].prev = entry->prev;
+    else c->tail = entry->prev;
+}
+
+static void list_append(EventCoalescer *c, int e) {
+    CoalescedEvent *entry = &c->entries[e];
+    entry->prev = c->tail;
+    entry->next = -1;
+    if (c->tail >= 0) c->entries[c->tail].next = e;
+    else c->head = e;
+    c->tail = e;
+}
+
+// Drop an entry given its index slot
+static void remove_entry(EventCoalescer *c, int slot) {
+    int e = c->index[slot];
+    c->index[slot] = INDEX_TOMBSTONE;
+    list_unlink(c, e);
+    free(c->entries[e].path);
+    c->entries[e].path = NULL;
+    c->entries[e].next = c->free_head;
+    c->free_head = e;
+    c->count--;
+}
+
+// Take a free pool entry, growing the pool if needed
+static int alloc_entry(EventCoalescer *c) {
+    if (c->free_head < 0) {
+        int size = c->pool_size ? c->pool_size * 2 : COALESCE_INITIAL_ENTRIES;
+        if (size > COALESCE_MAX_ENTRIES) size = COALESCE_MAX_ENTRIES;
+        if (size <= c->pool_size) return -1;
+        CoalescedEvent *grown = realloc(c->entries, sizeof(CoalescedEvent) * size);
+        if (grown == NULL) return -1;
+        c->entries = grown;
+        for (int i = size - 1; i >= c->pool_size; i--) {
+            c->entries[i].path = NULL;
+            c->entries[i].next = c->free_head;
+            c->free_head = i;
+        }
+        c->pool_size = size;
+    }
+    int e = c->free_head;
+    c->free_head = c->entries[e].next;
+    return e;
+}
+
+int event_coalescer_add(EventCoalescer *coalescer, uint8_t kind, uint8_t flags, uint32_t cookie,
+                        const char *path, size_t path_len, uint64_t now_ns) {
+    EventCoalescer *c = coalescer;
+    if (path_len > UINT16_MAX) return -1;
+    uint32_t hash = hash_path(path, path_len);
+
+    int slot = find_slot(c, path, path_len, hash);
+    if (slot >= 0) {
+        int e = c->index[slot];
+        uint8_t folded = fold_kind(c->entries[e].kind, kind);
+        if (folded == FOLD_CANCEL) {
+            remove_entry(c, slot);
+            return 0;
+        }
+        CoalescedEvent *entry = &c->entries[e];
+        entry->kind = folded;
+        entry->flags = flags;
+        entry->cookie = cookie;
+        entry->last_ns = now_ns;
+        list_unlink(c, e);
+        list_append(c, e);
+        return 0;
+    }
+
+    // New path: make room in the index first so the slot stays valid
+    if ((c->index_used + 1) * 10 >= c->index_capacity * 7) {
+        uint32_t capacity = c->index_capacity;
+        if ((uint32_t)(c->count + 1) * 2 >= capacity) capacity *= 2;
+        if (index_init(c, capacity) != 0) return -1;
+    }
+
+    char *copy = malloc(path_len + 1);
+    if (copy == NULL) return -1;
+    int e = alloc_entry(c);
+    if (e < 0) {
+        free(copy);
+        return -1;
+    }
+    memcpy(copy, path, path_len);
+    copy[path_len] = '\0';
+
+    CoalescedEvent *entry = &c->entries[e];
+    entry->last_ns = now_ns;
+    entry->hash = hash;
+    entry->kind = kind;
+    entry->flags = flags;
+    entry->path_len = (uint16_t)path_len;
+    entry->cookie = cookie;
+    entry->path = copy;
+    list_append(c, e);
+
+    uint32_t mask = c->index_capacity - 1;
+    uint32_t pos = hash & mask;
+    while (c->index[pos] >= 0) pos = (pos + 1) & mask;
+    if (c->index[pos] == INDEX_EMPTY) c->index_used++;
+    c->index[pos] = e;
+    c->count++;
+    return 0;
+}
+
+const CoalescedEvent *event_coalescer_find(const EventCoalescer *coalescer, const char *path, size_t path_len) {
+    int slot = find_slot(coalescer, path, path_len, hash_path(path, path_len));
+    return (slot >= 0) ? &coalescer->entries[coalescer->index[slot]] : NULL;
+}
+
+const CoalescedEvent *event_coalescer_peek(const EventCoalescer *coalescer, uint64_t now_ns, int force) {
+    if (coalescer->head < 0) return NULL;
+    const CoalescedEvent *entry = &coalescer->entries[coalescer->head];
+    if (!force && now_ns - entry->last_ns < coalescer->window_ns) return NULL;
+    return entry;
+}
+
+void event_coalescer_pop(EventCoalescer *coalescer, const CoalescedEvent *entry) {
+    int slot = find_slot(coalescer, entry->path, entry->path_len, entry->hash);
+    if (slot >= 0) remove_entry(coalescer, slot);
+}
+
+uint64_t event_coalescer_deadline(const EventCoalescer *coalescer) {
+    if (coalescer->head < 0) return UINT64_MAX;
+    return coalescer->entries[coalescer->head].last_ns + coalescer->window_ns;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file event_ring.c
+ * @brief Single producer record ring with single or shared consumers
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "event_ring.h"
+#include <string.h>
+#include <sys/mman.h>
+
+_Static_assert(sizeof(RingHeader) == RING_DATA_OFFSET, "ring header layout");
+_Static_assert(offsetof(RingHeader, head) == RING_HEAD_OFFSET, "ring head offset");
+_Static_assert(offsetof(RingHeader, tail) == RING_TAIL_OFFSET, "ring tail offset");
+_Static_assert(offsetof(RingRecord, name) == RING_RECORD_HEADER, "ring record layout");
+
+static uint32_t record_size(size_t name_len) {
+    return (uint32_t)((RING_RECORD_HEADER + name_len + 7) & ~(size_t)7);
+}
+
+int event_ring_init(EventRing *ring, uint32_t capacity) {
+    uint32_t size = RING_MIN_CAPACITY;
+    while (size < capacity && size < (1u << 30)) size <<= 1;
+
+    size_t map_size = RING_DATA_OFFSET + (size_t)size;
+    void *memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return -1;
+
+    ring->header = memory;
+    ring->data = (uint8_t *)memory + RING_DATA_OFFSET;
+    ring->capacity = size;
+    ring->map_size = map_size;
+
+    ring->header->magic = RING_MAGIC;
+    ring->header->version = RING_VERSION;
+    ring->header->data_offset = RING_DATA_OFFSET;
+    ring->header->capacity = size;
+    atomic_init(&ring->header->head, 0);
+    atomic_init(&ring->header->tail, 0);
+    atomic_init(&ring->high_water, 0);
+    return 0;
+}
+
+void event_ring_destroy(EventRing *ring) {
+    if (ring->header != NULL) munmap(ring->header, ring->map_size);
+    memset(ring, 0, sizeof(*ring));
+}
+
+// Bytes the next push needs, counting wrap padding
+static uint32_t bytes_needed(const EventRing *ring, uint32_t head, uint32_t size) {
+    uint32_t to_end = ring->capacity - (head & (ring->capacity - 1));
+    return (to_end < size) ? to_end + size : size;
+}
+
+int event_ring_can_push(const EventRing *ring, size_t name_len) {
+    uint32_t head = atomic_load_explicit(&ring->header->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+    return bytes_needed(ring, head, record_size(name_len)) <= ring->capacity - (head - tail);
+}
+
+// Write a record with name = a followed by b, or fail if it does not fit
+static int push_record(EventRing *ring, uint8_t kind, uint8_t flags, int32_t wd, uint32_t cookie,
+                       const char *a, size_t a_len, const char *b, size_t b_len) {
+    size_t name_len = a_len + b_len;
+    if (name_len > RING_MAX_NAME) return -1;
+
+    uint32_t size = record_size(name_len);
+    uint32_t head = atomic_load_explicit(&ring->header->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+    if (bytes_needed(ring, head, size) > ring->capacity - (head - tail)) return -1;
+
+    uint32_t offset = head & (ring->capacity - 1);
+    uint32_t to_end = ring->capacity - offset;
+    if (to_end < size) {
+        // Not enough room before the end: pad it out and start over at 0
+        RingRecord *pad = (RingRecord *)(ring->data + offset);
+        pad->size = (uint16_t)to_end;
+        pad->kind = 0;
+        pad->flags = RING_FLAG_PAD;
+        head += to_end;
+        offset = 0;
+    }
+
+    RingRecord *record = (RingRecord *)(ring->data + offset);
+    record->size = (uint16_t)size;
+    record->kind = kind;
+    record->flags = flags;
+    record->wd = wd;
+    record->cookie = cookie;
+    record->name_len = (uint16_t)name_len;
+    record->old_len = (kind == RING_MOVED) ? (uint16_t)a_len : 0;
+    if (a_len > 0) memcpy(record->name, a, a_len);
+    if (b_len > 0) memcpy(record->name + a_len, b, b_len);
+
+    atomic_store_explicit(&ring->header->head, head + size, memory_order_release);
+
+    uint32_t used = head + size - tail;
+    if (used > atomic_load_explicit(&ring->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->high_water, used, memory_order_relaxed);
+    }
+    return 0;
+}
+
+int event_ring_push(EventRing *ring, uint8_t kind, uint8_t flags, int32_t wd,
+                    uint32_t cookie, const char *name, size_t name_len) {
+    return push_record(ring, kind, flags, wd, cookie, name, name_len, NULL, 0);
+}
+
+int event_ring_push_move(EventRing *ring, uint8_t flags, int32_t wd, uint32_t cookie,
+                         const char *from, size_t from_len, const char *to, size_t to_len) {
+    return push_record(ring, RING_MOVED, flags | RING_FLAG_PATH, wd, cookie, from, from_len, to, to_len);
+}
+
+const RingRecord *event_ring_peek(EventRing *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+
+    while (tail != head) {
+        const RingRecord *record = (const RingRecord *)(ring->data + (tail & (ring->capacity - 1)));
+        if (!(record->flags & RING_FLAG_PAD)) return record;
+        tail += record->size;
+        atomic_store_explicit(&ring->header->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+void event_ring_pop(EventRing *ring, const RingRecord *record) {
+    uint32_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->header->tail, tail + record->size, memory_order_release);
+}
+
+int event_ring_copy(EventRing *ring, RingRecord *out, uint32_t *pos) {
+    uint32_t tail = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+        if (tail == head) return 0;
+
+        // The size may be torn if another consumer released this record and
+        // the producer is reusing the space; the tail then has moved on
+        const RingRecord *record = (const RingRecord *)(ring->data + (tail & (ring->capacity - 1)));
+        uint32_t size = record->size;
+        uint8_t flags = record->flags;
+        if (size < 8 || (size & 7) != 0 || size > head - tail || size > RING_MAX_RECORD ||
+            (tail & (ring->capacity - 1)) + size > ring->capacity) {
+            uint32_t now = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+            if (now == tail) return 0; // Not a record; never spin on a corrupt ring
+            tail = now;
+            continue;
+        }
+        if (flags & RING_FLAG_PAD) {
+            // Whoever wins skips the padding; either way tail now points past it
+            uint32_t next = tail + size;
+            if (atomic_compare_exchange_strong_explicit(&ring->header->tail, &tail, next,
+                                                        memory_order_acq_rel, memory_order_acquire)) {
+                tail = next;
+            }
+            continue;
+        }
+
+        // Checked on the copy, which cannot change under us, so a torn
+        // record never sends a decoder outside it
+        memcpy(out, record, size);
+        if (RING_RECORD_HEADER + (size_t)out->name_len <= size && out->old_len <= out->name_len) {
+            *pos = tail;
+            return 1;
+        }
+        uint32_t now = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+        if (now == tail) return 0;
+        tail = now;
+    }
+}
+
+int event_ring_claim(EventRing *ring, uint32_t pos, const RingRecord *copy) {
+    // Release keeps the copy's loads ahead of the claim, so a copy that
+    // raced with the producer can only come with a failed claim
+    return atomic_compare_exchange_strong_explicit(&ring->header->tail, &pos, pos + copy->size,
+                                                   memory_order_acq_rel, memory_order_acquire);
+}
+
+uint32_t event_ring_tail(const EventRing *ring) {
+    return atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+}
+
+uint32_t event_ring_head(const EventRing *ring) {
+    return atomic_load_explicit(&ring->header->head, memory_order_acquire);
+}
+
+uint32_t event_ring_high_water(const EventRing *ring) {
+    return atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+}
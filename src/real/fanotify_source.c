@@ -0,0 +1,441 @@
+/**
+ * @file fanotify_source.c
+ * @brief fanotify group reading and translation into inotify records
+ *
+ * Directory handles are resolved with open_by_handle_at() on a descriptor
+ * kept per marked filesystem and readlink() of /proc/self/fd. Resolved
+ * paths live in a fixed linear-probing table keyed by fsid and handle,
+ * cleared wholesale when it fills or when a directory is renamed (which
+ * may change the path of any cached handle below it).
+ *
+ * Kernel records may be only 4-byte aligned, so every field is copied out
+ * with memcpy() before use.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#define _GNU_SOURCE
+#include "fanotify_source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/fanotify.h>)
+#include <sys/fanotify.h>
+#endif
+#endif
+
+#if defined(FAN_REPORT_DFID_NAME) && defined(FAN_MARK_FILESYSTEM) && defined(MAX_HANDLE_SZ)
+#define FANOTIFY_SUPPORTED 1
+#endif
+
+void fanotify_source_close(FanotifySource *src);
+
+#ifdef FANOTIFY_SUPPORTED
+
+// Events every mark subscribes to. With FAN_RENAME a rename arrives as
+// one event carrying both names instead of two halves.
+#define BASE_MASK (FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_ONDIR)
+#define HALVES_MASK (FAN_MOVED_FROM | FAN_MOVED_TO)
+
+// fsid + handle type + handle bytes
+#define KEY_MAX (8 + sizeof(int) + MAX_HANDLE_SZ)
+
+static const char DELETED_SUFFIX[] = " (deleted)";
+
+static uint32_t hash_bytes(const unsigned char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+// Forget every resolved path
+static void clear_cache(FanotifySource *src) {
+    if (src->cache_count == 0) return;
+    for (uint32_t i = 0; i < FANOTIFY_CACHE_SLOTS; i++) free(src->cache[i].key);
+    memset(src->cache, 0, sizeof(FanotifyCacheEntry) * FANOTIFY_CACHE_SLOTS);
+    src->cache_count = 0;
+}
+
+// Whether handles on this filesystem can be turned back into paths, which
+// needs CAP_DAC_READ_SEARCH and a filesystem that supports file handles
+static int check_handles(int mount_fd, const char *path) {
+    union {
+        struct file_handle handle;
+        char storage[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+    } buf;
+    buf.handle.handle_bytes = MAX_HANDLE_SZ;
+
+    int mount_id;
+    if (name_to_handle_at(AT_FDCWD, path, &buf.handle, &mount_id, 0) != 0) return -1;
+    int fd = open_by_handle_at(mount_fd, &buf.handle, O_PATH | O_CLOEXEC);
+    if (fd < 0) return -1;
+    close(fd);
+    return 0;
+}
+
+int fanotify_source_open(FanotifySource *src) {
+    memset(src, 0, sizeof(*src));
+    src->fd = -1;
+    src->cache = calloc(FANOTIFY_CACHE_SLOTS, sizeof(FanotifyCacheEntry));
+    src->buffer = malloc(FANOTIFY_BUF_LEN);
+    if (src->cache == NULL || src->buffer == NULL) {
+        fanotify_source_close(src);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    src->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+                            O_RDONLY | O_CLOEXEC);
+    if (src->fd < 0) {
+        int saved = errno;
+        fanotify_source_close(src);
+        errno = saved;
+        return -1;
+    }
+
+#ifdef FAN_RENAME
+    src->mask = BASE_MASK | FAN_RENAME;
+#else
+    src->mask = BASE_MASK | HALVES_MASK;
+#endif
+    src->next_cookie = 1;
+    return 0;
+}
+
+int fanotify_source_mark(FanotifySource *src, const char *path) {
+    struct statfs st;
+    if (statfs(path, &st) != 0) return -1;
+    int32_t fsid[2];
+    memcpy(fsid, &st.f_fsid, sizeof(fsid));
+
+    for (int i = 0; i < src->mount_count; i++) {
+        if (memcmp(src->mounts[i].fsid, fsid, sizeof(fsid)) == 0) return 0;
+    }
+
+    if (src->mount_count == src->mount_capacity) {
+        int capacity = src->mount_capacity ? src->mount_capacity * 2 : 4;
+        FanotifyMount *grown = realloc(src->mounts, sizeof(FanotifyMount) * capacity);
+        if (grown == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        src->mounts = grown;
+        src->mount_capacity = capacity;
+    }
+
+    int mount_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mount_fd < 0) return -1;
+    if (check_handles(mount_fd, path) != 0) {
+        int saved = errno;
+        close(mount_fd);
+        errno = saved;
+        return -1;
+    }
+
+    uint64_t mask = src->mask;
+    int marked = fanotify_mark(src->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, path);
+#ifdef FAN_RENAME
+    if (marked != 0 && errno == EINVAL && (mask & FAN_RENAME)) {
+        // Kernels before 5.17 only report the two halves of a rename
+        mask = (mask & ~(uint64_t)FAN_RENAME) | HALVES_MASK;
+        marked = fanotify_mark(src->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, path);
+    }
+#endif
+    if (marked != 0) {
+        int saved = errno;
+        close(mount_fd);
+        errno = saved;
+        return -1;
+    }
+
+    src->mask = mask;
+    memcpy(src->mounts[src->mount_count].fsid, fsid, sizeof(fsid));
+    src->mounts[src->mount_count].mount_fd = mount_fd;
+    src->mount_count++;
+    return 0;
+}
+
+void fanotify_source_unmark_all(FanotifySource *src) {
+    if (src->fd < 0) return;
+
+    fanotify_mark(src->fd, FAN_MARK_FLUSH | FAN_MARK_FILESYSTEM, 0, AT_FDCWD, "/");
+    for (int i = 0; i < src->mount_count; i++) close(src->mounts[i].mount_fd);
+    src->mount_count = 0;
+    clear_cache(src);
+}
+
+// Descriptor to resolve handles of a filesystem with, -1 if it is not marked
+static int mount_fd_for(const FanotifySource *src, const int32_t fsid[2]) {
+    for (int i = 0; i < src->mount_count; i++) {
+        if (memcmp(src->mounts[i].fsid, fsid, sizeof(src->mounts[i].fsid)) == 0) return src->mounts[i].mount_fd;
+    }
+    return -1;
+}
+
+// Current path of the directory a handle names, or NULL if it is gone.
+// Valid until the cache is next changed.
+static const char *resolve_dir(FanotifySource *src, const int32_t fsid[2], const struct file_handle *header,
+                               const unsigned char *bytes, uint32_t *len) {
+    unsigned char key[KEY_MAX];
+    size_t key_len = 8 + sizeof(int) + header->handle_bytes;
+    memcpy(key, fsid, 8);
+    memcpy(key + 8, &header->handle_type, sizeof(int));
+    memcpy(key + 8 + sizeof(int), bytes, header->handle_bytes);
+    uint32_t hash = hash_bytes(key, key_len);
+
+    uint32_t slot = hash & (FANOTIFY_CACHE_SLOTS - 1);
+    while (src->cache[slot].hash != 0) {
+        const FanotifyCacheEntry *entry = &src->cache[slot];
+        if (entry->hash == hash && entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+            *len = entry->path_len;
+            return entry->path;
+        }
+        slot = (slot + 1) & (FANOTIFY_CACHE_SLOTS - 1);
+    }
+
+    int mount_fd = mount_fd_for(src, fsid);
+    if (mount_fd < 0) return NULL;
+
+    union {
+        struct file_handle handle;
+        char storage[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+    } buf;
+    buf.handle = *header;
+    memcpy(buf.handle.f_handle, bytes, header->handle_bytes);
+    int fd = open_by_handle_at(mount_fd, &buf.handle, O_PATH | O_CLOEXEC);
+    if (fd < 0) return NULL; // ESTALE: deleted before we got to it
+
+    char link[32];
+    char path[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(link, path, sizeof(path));
+    close(fd);
+    if (n <= 0 || n >= (ssize_t)sizeof(path)) return NULL;
+
+    // An unlinked directory still resolves, with a marker appended
+    size_t suffix = sizeof(DELETED_SUFFIX) - 1;
+    if ((size_t)n > suffix && memcmp(path + n - suffix, DELETED_SUFFIX, suffix) == 0) n -= (ssize_t)suffix;
+
+    if (src->cache_count >= FANOTIFY_CACHE_SLOTS * 3 / 4) {
+        clear_cache(src);
+        slot = hash & (FANOTIFY_CACHE_SLOTS - 1);
+    }
+    unsigned char *block = malloc(key_len + (size_t)n + 1);
+    if (block == NULL) return NULL;
+    memcpy(block, key, key_len);
+    memcpy(block + key_len, path, (size_t)n);
+    block[key_len + (size_t)n] = '\0';
+
+    FanotifyCacheEntry *entry = &src->cache[slot];
+    entry->hash = hash;
+    entry->key_len = (uint32_t)key_len;
+    entry->key = block;
+    entry->path = (char *)block + key_len;
+    entry->path_len = (uint32_t)n;
+    src->cache_count++;
+    *len = entry->path_len;
+    return entry->path;
+}
+
+// Write one inotify record. Returns its size, 0 if the name is too long.
+static size_t put_record(char *out, int wd, uint32_t mask, uint32_t cookie, const char *name, size_t name_len) {
+    if (name_len > NAME_MAX) return 0;
+
+    struct inotify_event event;
+    event.wd = wd;
+    event.mask = mask;
+    event.cookie = cookie;
+    event.len = name_len ? (uint32_t)((name_len + 4) & ~(size_t)3) : 0;
+    memcpy(out, &event, sizeof(event));
+    memset(out + sizeof(event), 0, event.len);
+    memcpy(out + sizeof(event), name, name_len);
+    return sizeof(event) + event.len;
+}
+
+// Translate one directory-handle-plus-name info record. Returns the bytes
+// written, 0 if its directory is gone or not watched.
+static size_t put_fid_record(FanotifySource *src, const char *info, size_t info_len, uint32_t mask,
+                             uint32_t cookie, char *out, FanotifyDirFn dir_fn, void *ctx) {
+    size_t fixed = sizeof(struct fanotify_event_info_fid) + sizeof(struct file_handle);
+    if (info == NULL || info_len < fixed) return 0;
+
+    struct fanotify_event_info_fid fid;
+    struct file_handle header;
+    memcpy(&fid, info, sizeof(fid));
+    memcpy(&header, info + sizeof(fid), sizeof(header));
+    if (header.handle_bytes > MAX_HANDLE_SZ || fixed + header.handle_bytes >= info_len) return 0;
+
+    const char *name = info + fixed + header.handle_bytes;
+    size_t name_len = strnlen(name, info_len - fixed - header.handle_bytes);
+    if (name_len == 0 || (name_len == 1 && name[0] == '.')) return 0;
+
+    int32_t fsid[2];
+    memcpy(fsid, &fid.fsid, sizeof(fsid));
+    uint32_t dir_len;
+    const char *dir = resolve_dir(src, fsid, &header, (const unsigned char *)info + fixed, &dir_len);
+    if (dir == NULL) return 0;
+
+    int wd = dir_fn(ctx, dir, dir_len);
+    return (wd >= 0) ? put_record(out, wd, mask, cookie, name, name_len) : 0;
+}
+
+// Translate one kernel event. Returns the bytes written.
+static size_t translate(FanotifySource *src, const char *event, const struct fanotify_event_metadata *meta,
+                        char *out, FanotifyDirFn dir_fn, void *ctx) {
+    if (meta->mask & FAN_Q_OVERFLOW) return put_record(out, -1, IN_Q_OVERFLOW, 0, NULL, 0);
+
+    // Pick out the directory records: one, or two for a rename
+    const char *dfid = NULL;
+    size_t dfid_len = 0;
+#ifdef FAN_RENAME
+    const char *old_dfid = NULL, *new_dfid = NULL;
+    size_t old_len = 0, new_len = 0;
+#endif
+    const char *end = event + meta->event_len;
+    const char *info = event + meta->metadata_len;
+    while (info + sizeof(struct fanotify_event_info_header) <= end) {
+        struct fanotify_event_info_header hdr;
+        memcpy(&hdr, info, sizeof(hdr));
+        if (hdr.len < sizeof(hdr) || info + hdr.len > end) break;
+        if (hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+            dfid = info;
+            dfid_len = hdr.len;
+        }
+#ifdef FAN_RENAME
+        else if (hdr.info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME) {
+            old_dfid = info;
+            old_len = hdr.len;
+        } else if (hdr.info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME) {
+            new_dfid = info;
+            new_len = hdr.len;
+        }
+#endif
+        info += hdr.len;
+    }
+
+    uint32_t dir_flag = (meta->mask & FAN_ONDIR) ? IN_ISDIR : 0;
+    size_t used = 0;
+
+#ifdef FAN_RENAME
+    if (meta->mask & FAN_RENAME) {
+        // Either side may fall outside the watched area and be dropped,
+        // leaving the other half unpaired, as inotify would report it
+        uint32_t cookie = 0x80000000u | (src->next_cookie++ & 0x7fffffffu);
+        used += put_fid_record(src, old_dfid, old_len, IN_MOVED_FROM | dir_flag, cookie, out, dir_fn, ctx);
+        used += put_fid_record(src, new_dfid, new_len, IN_MOVED_TO | dir_flag, cookie, out + used, dir_fn, ctx);
+        if (dir_flag) clear_cache(src);
+    }
+#endif
+
+    // Merged events carry several bits for the same name; report them in
+    // the order they can have happened in
+    static const struct { uint64_t fan; uint32_t in; } order[] = {
+        { FAN_CREATE, IN_CREATE }, { FAN_MOVED_TO, IN_MOVED_TO }, { FAN_MODIFY, IN_MODIFY },
+        { FAN_MOVED_FROM, IN_MOVED_FROM }, { FAN_DELETE, IN_DELETE },
+    };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (!(meta->mask & order[i].fan)) continue;
+        used += put_fid_record(src, dfid, dfid_len, order[i].in | dir_flag, 0, out + used, dir_fn, ctx);
+    }
+
+    // A renamed directory invalidates the paths cached below it. Deleted
+    // ones keep theirs, so events read after an rm -rf still resolve.
+    if (dir_flag && (meta->mask & FAN_MOVED_FROM)) clear_cache(src);
+    return used;
+}
+
+int fanotify_source_read(FanotifySource *src, char *out, size_t size, FanotifyDirFn dir_fn, void *ctx) {
+    if (src->fd < 0) return 0;
+
+    size_t used = 0;
+    while (size - used >= FANOTIFY_MAX_RECORD) {
+        if (src->buffer_pos >= src->buffer_len) {
+            if (used > 0) break;
+            ssize_t n = read(src->fd, src->buffer, FANOTIFY_BUF_LEN);
+            if (n <= 0) break;
+            src->buffer_len = (int)n;
+            src->buffer_pos = 0;
+        }
+
+        const char *event = src->buffer + src->buffer_pos;
+        size_t left = (size_t)(src->buffer_len - src->buffer_pos);
+        struct fanotify_event_metadata meta;
+        if (left < sizeof(meta)) {
+            src->buffer_pos = src->buffer_len;
+            continue;
+        }
+        memcpy(&meta, event, sizeof(meta));
+        if (meta.event_len < sizeof(meta) || meta.event_len > left) {
+            src->buffer_pos = src->buffer_len;
+            continue;
+        }
+        src->buffer_pos += (int)meta.event_len;
+
+        // Notification groups reporting handles never get descriptors
+        if (meta.fd >= 0) close(meta.fd);
+        if (meta.vers != FANOTIFY_METADATA_VERSION || meta.metadata_len > meta.event_len) continue;
+        used += translate(src, event, &meta, out + used, dir_fn, ctx);
+    }
+    return (int)used;
+}
+
+#else // !FANOTIFY_SUPPORTED
+
+int fanotify_source_open(FanotifySource *src) {
+    memset(src, 0, sizeof(*src));
+    src->fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+int fanotify_source_mark(FanotifySource *src, const char *path) {
+    (void)src;
+    (void)path;
+    errno = ENOSYS;
+    return -1;
+}
+
+void fanotify_source_unmark_all(FanotifySource *src) {
+    (void)src;
+}
+
+int fanotify_source_read(FanotifySource *src, char *out, size_t size, FanotifyDirFn dir_fn, void *ctx) {
+    (void)src;
+    (void)out;
+    (void)size;
+    (void)dir_fn;
+    (void)ctx;
+    return 0;
+}
+
+#endif // FANOTIFY_SUPPORTED
+
+void fanotify_source_close(FanotifySource *src) {
+    if (src->fd >= 0) close(src->fd);
+    src->fd = -1;
+    for (int i = 0; i < src->mount_count; i++) close(src->mounts[i].mount_fd);
+    free(src->mounts);
+    src->mounts = NULL;
+    src->mount_count = 0;
+    src->mount_capacity = 0;
+    if (src->cache != NULL) {
+        for (uint32_t i = 0; i < FANOTIFY_CACHE_SLOTS; i++) free(src->cache[i].key);
+        free(src->cache);
+        src->cache = NULL;
+    }
+    src->cache_count = 0;
+    free(src->buffer);
+    src->buffer = NULL;
+    src->buffer_pos = src->buffer_len = 0;
+}
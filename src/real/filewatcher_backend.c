@@ -0,0 +1,108 @@
+/**
+ * @file filewatcher_backend.c
+ * @brief Backend names and kernel probes
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "filewatcher_backend.h"
+#include "fanotify_source.h"
+#include "filewatcher_log.h"
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+static const char *const backend_names[FILEWATCHER_BACKEND_COUNT] = { "stub", "inotify", "fanotify", "poll" };
+
+const char *filewatcher_backend_name(FileWatcherBackend backend) {
+    if ((unsigned)backend >= FILEWATCHER_BACKEND_COUNT) return "unknown";
+    return backend_names[backend];
+}
+
+int filewatcher_backend_parse(const char *name) {
+    for (int i = 0; i < FILEWATCHER_BACKEND_COUNT; i++) {
+        if (strcasecmp(name, backend_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Whether this process can open an inotify instance: not past
+// max_user_instances or its fd limit, and not blocked by seccomp
+static int inotify_available(void) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        debug_log("inotify unavailable: %s", strerror(errno));
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+// Whether this process may create the fanotify group recursive roots use
+// and mark a filesystem with it. Since Linux 5.13 anyone may create the
+// group, but only CAP_SYS_ADMIN may mark a filesystem and only
+// CAP_DAC_READ_SEARCH may resolve its handles, so the probe marks the one
+// holding / (closing the group drops the mark). Other failures are about
+// that filesystem, not the caller, and leave roots elsewhere to mark_root().
+static int fanotify_available(void) {
+    FanotifySource probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.fd = -1;
+    if (fanotify_source_open(&probe) != 0) {
+        debug_log("fanotify unavailable: %s", strerror(errno));
+        return 0;
+    }
+    int marked = fanotify_source_mark(&probe, "/");
+    int saved = errno;
+    fanotify_source_close(&probe);
+    if (marked != 0 && saved == EPERM) {
+        debug_log("fanotify unavailable: %s", strerror(saved));
+        return 0;
+    }
+    return 1;
+}
+
+int filewatcher_backend_available(FileWatcherBackend backend) {
+    switch (backend) {
+    case FILEWATCHER_BACKEND_STUB:
+    case FILEWATCHER_BACKEND_POLL:
+        return 1;
+    case FILEWATCHER_BACKEND_INOTIFY:
+        return inotify_available();
+    case FILEWATCHER_BACKEND_FANOTIFY:
+        // Plain watches still go through inotify
+        return inotify_available() && fanotify_available();
+    default:
+        return 0;
+    }
+}
+
+FileWatcherBackend filewatcher_backend_select(const char *requested) {
+    FileWatcherBackend backend = FILEWATCHER_BACKEND_FANOTIFY;
+    int named = 0;
+    if (requested != NULL && requested[0] != '\0' && strcasecmp(requested, "auto") != 0) {
+        int parsed = filewatcher_backend_parse(requested);
+        if (parsed < 0) {
+            error_log("Unknown %s \"%s\", choosing one", FILEWATCHER_BACKEND_ENV, requested);
+        } else {
+            backend = (FileWatcherBackend)parsed;
+            named = 1;
+        }
+    }
+
+    // Step down until one works; the stub and polling always do
+    while (!filewatcher_backend_available(backend)) {
+        FileWatcherBackend next = (backend == FILEWATCHER_BACKEND_FANOTIFY) ? FILEWATCHER_BACKEND_INOTIFY
+                                                                             : FILEWATCHER_BACKEND_POLL;
+        if (named) {
+            error_log("The %s backend does not work here, using %s", filewatcher_backend_name(backend),
+                      filewatcher_backend_name(next));
+        }
+        backend = next;
+    }
+    return backend;
+}
@@ -0,0 +1,2334 @@
+/**
+ * @file filewatcher_core.c
+ * @brief inotify watcher core shared by the JNI library and native tools
+ *
+ * Owns the watcher lifecycle, the inotify read/parse loop that feeds the
+ * event ring (with coalescing, rename pairing and overflow recovery), the
+ * optional reader thread, and event delivery into caller buffers.
+ * Recursive roots on a fanotify-marked filesystem feed the same loop with
+ * translated records (fanotify_source.c), and inotify roots can be
+ * diffed against the previous run's journal (watch_journal.c). Nothing
+ * here touches JNI; real_filewatcher.c wraps these functions for Java.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "filewatcher_core.h"
+#include "filewatcher_log.h"
+#include "filewatcher_trace.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Backend new watchers are created on
+static _Atomic int default_backend = FILEWATCHER_BACKEND_FANOTIFY;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Let a sleeping reader thread pick up new settings
+static void wake_reader(FileWatcher *watcher) {
+    if (!atomic_load(&watcher->reader_running)) return;
+    
+    uint64_t one = 1;
+    if (write(watcher->space_fd, &one, sizeof(one)) < 0) {
+        error_log("Failed to wake reader thread: %s", strerror(errno));
+    }
+}
+
+// Bump a counter. Every caller holds watcher->mutex, so a relaxed load and
+// store do; readers only need each value to be untorn.
+static void stat_add(FileWatcher *watcher, FileWatcherStat stat, uint64_t n) {
+    uint64_t value = atomic_load_explicit(&watcher->stats[stat], memory_order_relaxed);
+    atomic_store_explicit(&watcher->stats[stat], value + n, memory_order_relaxed);
+}
+
+// Take watcher->mutex, counting the times someone else had it
+static void lock_watcher(FileWatcher *watcher) {
+    if (pthread_mutex_trylock(&watcher->mutex) == 0) return;
+    
+    atomic_fetch_add_explicit(&watcher->stats[STAT_LOCK_CONTENTION], 1, memory_order_relaxed);
+    pthread_mutex_lock(&watcher->mutex);
+}
+
+// Free a priority class's patterns and roots
+static void free_priority(PriorityClass *priority) {
+    glob_filter_destroy(&priority->names);
+    for (int i = 0; i < priority->root_count; i++) free(priority->roots[i]);
+    free(priority->roots);
+    free(priority->root_lens);
+    memset(priority, 0, sizeof(*priority));
+}
+
+// Release everything a watcher owns. Safe on a partially built watcher.
+static void release_watcher(FileWatcher *watcher) {
+    if (watcher->engine != NULL) watch_engine_unsubscribe(watcher->engine, &watcher->sub);
+    if (watcher->wake_fd >= 0) close(watcher->wake_fd);
+    if (watcher->ready_fd >= 0) close(watcher->ready_fd);
+    if (watcher->space_fd >= 0) close(watcher->space_fd);
+    watch_registry_destroy(&watcher->registry);
+    event_ring_destroy(&watcher->ring);
+    event_ring_destroy(&watcher->priority_ring);
+    free_priority(&watcher->priority);
+    event_coalescer_destroy(&watcher->coalescer);
+    event_coalescer_destroy(&watcher->writes);
+    content_table_destroy(&watcher->contents);
+    rename_table_destroy(&watcher->renames);
+    snapshot_table_destroy(&watcher->snapshots);
+    poll_scheduler_destroy(&watcher->poller);
+    for (int i = watcher->recovered_head; i < watcher->recovered_count; i++) free(watcher->recovered[i].path);
+    free(watcher->recovered);
+    free(watcher->retired);
+    for (int i = 0; i < watcher->root_count; i++) {
+        free(watcher->roots[i]->path);
+        free(watcher->roots[i]->real_path);
+        glob_filter_destroy(&watcher->roots[i]->excludes);
+        free(watcher->roots[i]);
+    }
+    free(watcher->roots);
+    for (int i = 0; i < watcher->filter_count; i++) {
+        glob_filter_destroy(&watcher->filters[i].includes);
+        glob_filter_destroy(&watcher->filters[i].excludes);
+    }
+    free(watcher->filters);
+    free(watcher->event_buffer);
+    free(watcher->path_buffer);
+    fanotify_source_close(&watcher->fanotify);
+    watch_journal_close(&watcher->journal);
+    pthread_cond_destroy(&watcher->crawl_done);
+    pthread_mutex_destroy(&watcher->mutex);
+    pthread_mutex_destroy(&watcher->listener_lock);
+    free(watcher);
+}
+
+int filewatcher_set_default_backend(FileWatcherBackend backend) {
+    if (backend != FILEWATCHER_BACKEND_INOTIFY && backend != FILEWATCHER_BACKEND_FANOTIFY &&
+        backend != FILEWATCHER_BACKEND_POLL) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    atomic_store(&default_backend, backend);
+    debug_log("New watchers use the %s backend", filewatcher_backend_name(backend));
+    return 0;
+}
+
+FileWatcher *filewatcher_create(void) {
+    filewatcher_trace_init_from_env();
+    FileWatcher *watcher = calloc(1, sizeof(FileWatcher));
+    if (watcher == NULL) return NULL;
+    
+    pthread_mutex_init(&watcher->mutex, NULL);
+    pthread_cond_init(&watcher->crawl_done, NULL);
+    pthread_mutex_init(&watcher->listener_lock, NULL);
+    atomic_init(&watcher->closed, 0);
+    atomic_init(&watcher->waiters, 0);
+    atomic_init(&watcher->reader_running, 0);
+    atomic_init(&watcher->reader_stalled, 0);
+    atomic_init(&watcher->priority_mapped, 0);
+    for (int i = 0; i < STAT_COUNTERS; i++) atomic_init(&watcher->stats[i], 0);
+    watcher->ready_fd = -1;
+    watcher->space_fd = -1;
+    watcher->fanotify.fd = -1;
+    watcher->journal.fd = -1;
+    watcher->backend = (FileWatcherBackend)atomic_load(&default_backend);
+    watcher->fanotify_allowed = (watcher->backend == FILEWATCHER_BACKEND_FANOTIFY);
+    watcher->next_marked_wd = FANOTIFY_WD_BASE;
+    rename_table_init(&watcher->renames);
+    content_table_init(&watcher->contents);
+    // The poll backend takes no kernel watches, so it stays off the engine
+    int polling = (watcher->backend == FILEWATCHER_BACKEND_POLL);
+    watcher->engine = polling ? NULL : watch_engine_subscribe(&watcher->sub);
+    if (polling) watcher->sub.inbox_fd = -1;
+    watcher->inotify_fd = (watcher->engine != NULL) ? watcher->engine->inotify_fd : -1;
+    watcher->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    
+    // Initialize tables and the event ring
+    if ((watcher->engine == NULL && !polling) || watcher->wake_fd == -1 ||
+        watch_registry_init(&watcher->registry) != 0 ||
+        event_ring_init(&watcher->ring, RING_DEFAULT_CAPACITY) != 0 ||
+        event_coalescer_init(&watcher->coalescer, 0) != 0 ||
+        event_coalescer_init(&watcher->writes, SETTLE_DEFAULT_TIMEOUT_MS * 1000000ull) != 0 ||
+        snapshot_table_init(&watcher->snapshots) != 0 ||
+        poll_scheduler_init(&watcher->poller) != 0) {
+        int saved = errno;
+        release_watcher(watcher);
+        errno = saved;
+        return NULL;
+    }
+    
+    return watcher;
+}
+
+// Whether a wd stands for a directory polled past the watch limit
+static int is_polled(int wd) {
+    return wd >= POLL_WD_BASE && wd < FANOTIFY_WD_BASE;
+}
+
+// Drop this watcher's claim on a wd, whichever source it came from. With
+// notify, IN_IGNORED for it follows through the parse loop. Directories
+// under fanotify roots hold nothing. Caller holds watcher->mutex.
+static void release_wd(FileWatcher *watcher, int wd, int notify) {
+    if (is_polled(wd)) {
+        poll_scheduler_remove(&watcher->poller, wd, notify);
+    } else if (wd < FANOTIFY_WD_BASE) {
+        watch_engine_remove(watcher->engine, &watcher->sub, wd, notify);
+    }
+}
+
+// Take a snapshot of every watched directory that lacks one, so a later
+// overflow can be diffed against it. Caller holds watcher->mutex.
+static void ensure_snapshots(FileWatcher *watcher) {
+    if (!watcher->recovery || watcher->snapshots.count + watcher->poller.count >= watcher->registry.count) return;
+    
+    uint32_t cursor = 0;
+    const WatchEntry *entry;
+    while ((entry = watch_registry_next(&watcher->registry, &cursor)) != NULL) {
+        if (snapshot_table_has(&watcher->snapshots, entry->wd)) continue;
+        // fanotify roots report overflow as it is, so their directories need none
+        if (entry->wd >= FANOTIFY_WD_BASE) continue;
+        // Polled directories are diffed by the poller, and never overflow
+        if (is_polled(entry->wd)) continue;
+        // Regular files cannot be listed; recovery falls back to OVERFLOW for them
+        snapshot_scan(&watcher->snapshots, entry->wd, entry->path);
+    }
+}
+
+// Filter of a plain watch, or NULL. Caller holds watcher->mutex.
+static WatchFilter *find_filter(const FileWatcher *watcher, int wd) {
+    for (int i = 0; i < watcher->filter_count; i++) {
+        if (watcher->filters[i].wd == wd) return &watcher->filters[i];
+    }
+    return NULL;
+}
+
+// Drop a watch's filter, if it has one. Caller holds watcher->mutex.
+static void remove_filter(FileWatcher *watcher, int wd) {
+    WatchFilter *filter = find_filter(watcher, wd);
+    if (filter == NULL) return;
+    
+    glob_filter_destroy(&filter->includes);
+    glob_filter_destroy(&filter->excludes);
+    *filter = watcher->filters[--watcher->filter_count];
+}
+
+// Whether a filtered watch wants an event. Names are only matched when
+// there is one; events about the watched path itself pass on mask alone.
+static int filter_accepts(const WatchFilter *filter, uint32_t mask, const char *name, int is_dir) {
+    if (!(mask & filter->mask)) return 0;
+    if (name[0] == '\0') return 1;
+    if (filter->includes.count > 0 && !glob_filter_match(&filter->includes, name, is_dir)) return 0;
+    return !glob_filter_match(&filter->excludes, name, is_dir);
+}
+
+// Filter that applies to a watch's events, or NULL. A watch a recursive
+// root has since claimed delivers everything. Caller holds watcher->mutex.
+static const WatchFilter *active_filter(const FileWatcher *watcher, int wd) {
+    const WatchFilter *filter = find_filter(watcher, wd);
+    if (filter == NULL) return NULL;
+    
+    const WatchEntry *entry = watch_registry_lookup(&watcher->registry, wd);
+    return (entry != NULL && entry->root == 0) ? filter : NULL;
+}
+
+// Stop polling a directory that now has the real watch real_wd, keeping
+// its filter. Its last diff, reported under real_wd since registering that
+// replaced the pseudo wd's entry, goes through the parse loop with an
+// IN_IGNORED. Caller holds watcher->mutex.
+static void hand_off_polled(FileWatcher *watcher, int wd, int real_wd, const char *path) {
+    WatchFilter *filter = find_filter(watcher, wd);
+    if (filter != NULL && find_filter(watcher, real_wd) == NULL) filter->wd = real_wd;
+    poll_scheduler_handoff(&watcher->poller, wd, real_wd, path);
+    debug_log("Watching polled directory %s again (wd %d)", path, real_wd);
+}
+
+// Add or refresh a plain watch with the given kernel mask and return its
+// wd, -1 with errno set on failure. A directory past the watch limit is
+// polled instead. Caller holds watcher->mutex.
+static int add_watch(FileWatcher *watcher, const char *path, uint32_t mask) {
+    // A directory already covered by a recursive root stays part of it and
+    // keeps the full mask its tree relies on
+    int known = watch_registry_find_path(&watcher->registry, path, strlen(path));
+    const WatchEntry *prev = watch_registry_lookup(&watcher->registry, known);
+    if (prev != NULL && prev->root > 0) mask = WATCH_MASK;
+    int polled = (prev != NULL && poll_scheduler_has(&watcher->poller, known)) ? known : -1;
+    int polled_root = (polled >= 0) ? prev->root : 0;
+    
+    // Settling a write needs to see the write as well as the close
+    if (mask & IN_CLOSE_WRITE) mask |= IN_MODIFY;
+    
+    // The poll backend polls every directory, and nothing once closed
+    int polling = (watcher->backend == FILEWATCHER_BACKEND_POLL);
+    if (polling && atomic_load(&watcher->closed)) {
+        errno = EBADF;
+        return -1;
+    }
+    int wd = polling ? -1 : watch_engine_add(watcher->engine, &watcher->sub, path, mask);
+    if (polling || (wd < 0 && errno == ENOSPC)) {
+        // Out of watches: a directory is polled rather than left out
+        wd = (polled >= 0) ? polled : poll_scheduler_add(&watcher->poller, path, mask, monotonic_ns());
+        if (wd < 0) {
+            if (!polling) errno = ENOSPC;
+            return -1;
+        }
+        if (wd != polled) {
+            debug_log(polling ? "Polling %s" : "Watch limit reached, polling %s", path);
+            wake_reader(watcher); // Its sleep has to end in time for the first poll
+        }
+    }
+    if (wd < 0) return -1;
+    
+    // Remember which path this wd belongs to so events can be resolved
+    prev = watch_registry_lookup(&watcher->registry, wd);
+    int root = (prev != NULL) ? prev->root : polled_root;
+    if (watch_registry_add(&watcher->registry, wd, path, strlen(path), root) != 0) {
+        if (wd != polled) release_wd(watcher, wd, 0);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (polled >= 0 && wd != polled) hand_off_polled(watcher, polled, wd, path);
+    remove_filter(watcher, wd);
+    ensure_snapshots(watcher);
+    return wd;
+}
+
+int filewatcher_watch(FileWatcher *watcher, const char *path) {
+    lock_watcher(watcher);
+    
+    // Watch for create, modify, delete, and move events
+    int wd = add_watch(watcher, path, WATCH_MASK);
+    
+    pthread_mutex_unlock(&watcher->mutex);
+    return (wd >= 0) ? 0 : -1;
+}
+
+size_t filewatcher_watch_all(FileWatcher *watcher, const char *const *paths, size_t count, int *errors) {
+    size_t watched = 0;
+    lock_watcher(watcher);
+    for (size_t i = 0; i < count; i++) {
+        if (paths[i] == NULL) {
+            errors[i] = EINVAL;
+        } else if (add_watch(watcher, paths[i], WATCH_MASK) >= 0) {
+            errors[i] = 0;
+            watched++;
+        } else {
+            errors[i] = errno;
+        }
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    debug_log("Watched %zu of %zu paths", watched, count);
+    return watched;
+}
+
+int filewatcher_watch_filtered(FileWatcher *watcher, const char *path, uint32_t mask,
+                               const char *const *includes, size_t include_count,
+                               const char *const *excludes, size_t exclude_count) {
+    mask &= FILTER_MASK;
+    if (mask == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (mask & IN_CLOSE_WRITE) mask |= IN_MODIFY;
+    
+    // Compile the patterns before touching the watch
+    WatchFilter filter = { -1, mask, { NULL, 0 }, { NULL, 0 } };
+    if (glob_filter_init(&filter.includes, includes, include_count) != 0 ||
+        glob_filter_init(&filter.excludes, excludes, exclude_count) != 0) {
+        glob_filter_destroy(&filter.includes);
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    lock_watcher(watcher);
+    int wd = add_watch(watcher, path, mask);
+    const WatchEntry *entry = (wd >= 0) ? watch_registry_lookup(&watcher->registry, wd) : NULL;
+    int keep = (entry != NULL && entry->root == 0);
+    if (keep && watcher->filter_count == watcher->filter_capacity) {
+        int capacity = watcher->filter_capacity ? watcher->filter_capacity * 2 : 4;
+        WatchFilter *grown = realloc(watcher->filters, sizeof(WatchFilter) * capacity);
+        if (grown == NULL) {
+            // Unfiltered would deliver more than was asked for; undo the watch
+            release_wd(watcher, wd, 0);
+            watch_registry_remove(&watcher->registry, wd);
+            wd = -1;
+            keep = 0;
+            errno = ENOMEM;
+        } else {
+            watcher->filters = grown;
+            watcher->filter_capacity = capacity;
+        }
+    }
+    if (keep) {
+        filter.wd = wd;
+        watcher->filters[watcher->filter_count++] = filter;
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    if (!keep) {
+        glob_filter_destroy(&filter.includes);
+        glob_filter_destroy(&filter.excludes);
+    }
+    if (wd >= 0) {
+        debug_log("Watching %s with mask 0x%x, %zu includes, %zu excludes%s", path, mask,
+                  include_count, exclude_count, keep ? "" : " (recursive root, unfiltered)");
+    }
+    return (wd >= 0) ? 0 : -1;
+}
+
+// Register a recursive root and return its id (1-based), 0 on failure.
+// Caller holds watcher->mutex; takes ownership of excludes on success.
+static int add_recursive_root(FileWatcher *watcher, const char *path, size_t len, GlobFilter *excludes) {
+    int slot = -1;
+    for (int i = 0; i < watcher->root_count; i++) {
+        if (watcher->roots[i]->path == NULL) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        if (watcher->root_count == watcher->root_capacity) {
+            int capacity = watcher->root_capacity ? watcher->root_capacity * 2 : 4;
+            RecursiveRoot **grown = realloc(watcher->roots, sizeof(RecursiveRoot *) * capacity);
+            if (grown == NULL) return 0;
+            watcher->roots = grown;
+            watcher->root_capacity = capacity;
+        }
+        RecursiveRoot *fresh = calloc(1, sizeof(RecursiveRoot));
+        if (fresh == NULL) return 0;
+        slot = watcher->root_count++;
+        watcher->roots[slot] = fresh;
+    }
+    
+    RecursiveRoot *root = watcher->roots[slot];
+    root->path = malloc(len + 1);
+    if (root->path == NULL) return 0;
+    memcpy(root->path, path, len);
+    root->path[len] = '\0';
+    root->path_len = len;
+    root->excludes = *excludes;
+    root->marked = 0;
+    root->journaled = 0;
+    root->crawling = 0;
+    atomic_store(&root->cancelled, 0);
+    return slot + 1;
+}
+
+// Cover a recursive root with a fanotify mark on its filesystem. Returns 0
+// on success, -1 to crawl it with inotify instead. Caller holds watcher->mutex.
+static int mark_root(FileWatcher *watcher, int root_id) {
+    if (!watcher->fanotify_allowed || watcher->fanotify_failed) return -1;
+    if (watcher->fanotify.fd < 0 && fanotify_source_open(&watcher->fanotify) != 0) {
+        debug_log("fanotify unavailable (%s), using inotify", strerror(errno));
+        watcher->fanotify_failed = 1;
+        return -1;
+    }
+    
+    // fanotify reports directories by their canonical path, which a
+    // symlinked or relative root does not spell the same way
+    RecursiveRoot *root = watcher->roots[root_id - 1];
+    char *real_path = realpath(root->path, NULL);
+    if (real_path == NULL) {
+        debug_log("Cannot resolve %s (%s), using inotify", root->path, strerror(errno));
+        return -1;
+    }
+    if (fanotify_source_mark(&watcher->fanotify, real_path) != 0) {
+        debug_log("Cannot mark the filesystem of %s (%s), using inotify", root->path, strerror(errno));
+        // Unprivileged callers may open a group but never mark a filesystem
+        if (errno == EPERM && watcher->marked_roots == 0) {
+            fanotify_source_close(&watcher->fanotify);
+            watcher->fanotify_failed = 1;
+        }
+        free(real_path);
+        return -1;
+    }
+    root->real_path = real_path;
+    root->real_len = strlen(real_path);
+    root->marked = 1;
+    watcher->marked_roots++;
+    return 0;
+}
+
+// Drop every watch belonging to a recursive root and free its slot.
+// Caller holds watcher->mutex.
+static void remove_recursive_root(FileWatcher *watcher, int root_id) {
+    uint32_t cursor = 0;
+    const WatchEntry *entry;
+    while ((entry = watch_registry_next(&watcher->registry, &cursor)) != NULL) {
+        if (entry->root != root_id) continue;
+        release_wd(watcher, entry->wd, 0);
+        watch_registry_remove(&watcher->registry, entry->wd);
+    }
+    
+    RecursiveRoot *root = watcher->roots[root_id - 1];
+    if (root->marked) {
+        root->marked = 0;
+        free(root->real_path);
+        root->real_path = NULL;
+        root->real_len = 0;
+        // Marks are per filesystem, so they can only go once no root needs them
+        if (--watcher->marked_roots == 0) fanotify_source_unmark_all(&watcher->fanotify);
+    }
+    root->journaled = 0;
+    free(root->path);
+    root->path = NULL;
+    root->path_len = 0;
+    glob_filter_destroy(&root->excludes);
+}
+
+// Find the recursive root registered for exactly this path. Caller holds watcher->mutex.
+static int find_recursive_root(const FileWatcher *watcher, const char *path, size_t len) {
+    while (len > 1 && path[len - 1] == '/') len--;
+    for (int i = 0; i < watcher->root_count; i++) {
+        const RecursiveRoot *root = watcher->roots[i];
+        if (root->path != NULL && root->path_len == len && memcmp(root->path, path, len) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Queue an event rebuilt by overflow recovery or a journal diff. Returns 0,
+// or -1 on allocation failure. Caller holds watcher->mutex.
+static int queue_recovered(FileWatcher *watcher, uint8_t kind, uint8_t flags, const char *path, size_t len) {
+    if (len > RING_MAX_PATH) return -1;
+    if (watcher->recovered_count == watcher->recovered_capacity) {
+        int capacity = watcher->recovered_capacity ? watcher->recovered_capacity * 2 : 64;
+        RecoveredEvent *grown = realloc(watcher->recovered, sizeof(RecoveredEvent) * capacity);
+        if (grown == NULL) return -1;
+        watcher->recovered = grown;
+        watcher->recovered_capacity = capacity;
+    }
+    
+    char *copy = NULL;
+    if (path != NULL) {
+        copy = malloc(len + 1);
+        if (copy == NULL) return -1;
+        memcpy(copy, path, len);
+        copy[len] = '\0';
+    }
+    RecoveredEvent *event = &watcher->recovered[watcher->recovered_count++];
+    event->kind = kind;
+    event->flags = flags;
+    event->path_len = (uint16_t)len;
+    event->path = copy;
+    return 0;
+}
+
+// State for diffing a crawled root against the journal
+typedef struct {
+    FileWatcher *watcher;
+    int failed;       // An event could not be queued
+} JournalScan;
+
+static void on_journal_diff(void *ctx, uint8_t kind, int is_dir, const char *path, size_t path_len) {
+    JournalScan *scan = ctx;
+    uint8_t flags = RING_FLAG_SYNTH | (is_dir ? RING_FLAG_DIR : 0);
+    if (queue_recovered(scan->watcher, kind, flags, path, path_len) != 0) scan->failed = 1;
+}
+
+// List every directory of a freshly crawled root once and queue what
+// changed since the journal last saw it. A root the journal does not know
+// yet is only recorded. Either way the journal follows the root's events
+// from here on. Caller holds watcher->mutex.
+static void sync_journal(FileWatcher *watcher, int root_id) {
+    RecursiveRoot *root = watcher->roots[root_id - 1];
+    WatchJournal *journal = &watcher->journal;
+    uint64_t start = monotonic_ns();
+    int known = watch_journal_has_root(journal, root->path, root->path_len);
+    JournalDiffFn fn = known ? on_journal_diff : NULL;
+    JournalScan scan = { watcher, 0 };
+    int changes = 0;
+    
+    watch_journal_begin(journal);
+    uint32_t cursor = 0;
+    const WatchEntry *entry;
+    while ((entry = watch_registry_next(&watcher->registry, &cursor)) != NULL) {
+        if (entry->root != root_id) continue;
+        int n = watch_journal_scan(journal, entry->path, fn, &scan);
+        if (n > 0) changes += n;
+    }
+    changes += watch_journal_sweep(journal, root->path, root->path_len, fn, &scan);
+    if (watch_journal_add_root(journal, root->path, root->path_len) != 0) scan.failed = 1;
+    if (watch_journal_flush(journal) != 0) error_log("Failed to write journal: %s", strerror(errno));
+    root->journaled = 1;
+    
+    // Whatever could not be queued is only covered by a rescan
+    if (scan.failed && queue_recovered(watcher, RING_OVERFLOW, 0, NULL, 0) != 0) {
+        error_log("Out of memory reporting a journal diff");
+    }
+    debug_log("%s %s against journal generation %llu: %d changes in %.1f ms", known ? "Diffed" : "Recorded",
+              root->path, (unsigned long long)journal->generation, changes, (monotonic_ns() - start) / 1e6);
+}
+
+// Poll a directory a crawl found no watch left for. The crawler holds
+// watcher->mutex around the call.
+static int poll_fallback(void *ctx, const char *path, int root_id) {
+    FileWatcher *watcher = ctx;
+    if (atomic_load(&watcher->closed)) {
+        errno = EBADF;
+        return -1;
+    }
+    size_t len = strlen(path);
+    int known = watch_registry_find_path(&watcher->registry, path, len);
+    int polled = poll_scheduler_has(&watcher->poller, known);
+    int wd = polled ? known : poll_scheduler_add(&watcher->poller, path, WATCH_MASK | IN_ONLYDIR | IN_DONT_FOLLOW,
+                                                 monotonic_ns());
+    if (wd < 0) return -1;
+    if (watch_registry_add(&watcher->registry, wd, path, len, root_id) != 0) {
+        if (!polled) poll_scheduler_remove(&watcher->poller, wd, 0);
+        return -1;
+    }
+    return wd;
+}
+
+// Watch a directory that appeared under a recursive root. Runs inside
+// fill_ring with watcher->mutex held, so the crawl stays on this thread.
+static void watch_new_directory(FileWatcher *watcher, int root_id, const char *path) {
+    const RecursiveRoot *root = watcher->roots[root_id - 1];
+    if (root->path == NULL || root->marked) return;
+    
+    size_t offset = (root->path_len == 1) ? 1 : root->path_len + 1;
+    if (strlen(path) <= offset) return;
+    if (glob_filter_match(&root->excludes, path + offset, 1)) return;
+    
+    CrawlRequest req = {
+        watcher->engine, &watcher->sub, WATCH_MASK, &watcher->registry, NULL, root->path, root->path_len,
+        &root->excludes, root_id, poll_fallback, watcher, NULL
+    };
+    CrawlResult result;
+    if (tree_crawl(&req, path, 1, &result) == 0) {
+        debug_log("Watching new directory %s (%u watches, %u polled)", path,
+                  result.watches_added, result.watches_polled);
+    }
+    ensure_snapshots(watcher);
+}
+
+int filewatcher_watch_recursive(FileWatcher *watcher, const char *path, const char *const *excludes,
+                                size_t exclude_count, CrawlResult *result) {
+    // The crawl gets its own path and excludes; the root's are only
+    // touched under the mutex
+    GlobFilter filter, crawl_filter;
+    if (glob_filter_init(&filter, excludes, exclude_count) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t path_len = strlen(path);
+    while (path_len > 1 && path[path_len - 1] == '/') path_len--;
+    char *crawl_path = strndup(path, path_len);
+    if (crawl_path == NULL || glob_filter_init(&crawl_filter, excludes, exclude_count) != 0) {
+        free(crawl_path);
+        glob_filter_destroy(&filter);
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    CrawlResult local;
+    if (result == NULL) result = &local;
+    uint64_t start = monotonic_ns();
+    
+    lock_watcher(watcher);
+    // A second root on the same path would survive the first unwatch
+    if (find_recursive_root(watcher, path, path_len) > 0) {
+        pthread_mutex_unlock(&watcher->mutex);
+        glob_filter_destroy(&filter);
+        glob_filter_destroy(&crawl_filter);
+        free(crawl_path);
+        errno = EEXIST;
+        return -1;
+    }
+    int root_id = add_recursive_root(watcher, path, path_len, &filter);
+    RecursiveRoot *root = (root_id > 0) ? watcher->roots[root_id - 1] : NULL;
+    // One filesystem mark replaces the whole crawl where fanotify is permitted
+    int marked = (root_id > 0) && mark_root(watcher, root_id) == 0;
+    // Pinned until the crawl is done, so unwatch cannot free the slot under it
+    if (root_id > 0 && !marked) root->crawling = 1;
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    if (root_id == 0) {
+        glob_filter_destroy(&filter);
+        glob_filter_destroy(&crawl_filter);
+        free(crawl_path);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (marked) {
+        glob_filter_destroy(&crawl_filter);
+        free(crawl_path);
+        memset(result, 0, sizeof(*result));
+        result->elapsed_ns = monotonic_ns() - start;
+        wake_reader(watcher); // Its poll set gains the fanotify group
+        debug_log("Marked the filesystem of %s with fanotify in %.1f ms", path, result->elapsed_ns / 1e6);
+        return 0;
+    }
+    
+    // Crawl outside the mutex; workers take it around each watch they add
+    CrawlRequest req = {
+        watcher->engine, &watcher->sub, WATCH_MASK, &watcher->registry, &watcher->mutex, crawl_path, path_len,
+        &crawl_filter, root_id, poll_fallback, watcher, &root->cancelled
+    };
+    int crawled = tree_crawl(&req, crawl_path, tree_crawl_default_workers(), result);
+    int saved = errno;
+    glob_filter_destroy(&crawl_filter);
+    
+    lock_watcher(watcher);
+    root->crawling = 0;
+    pthread_cond_broadcast(&watcher->crawl_done);
+    if (atomic_load(&root->cancelled)) {
+        // filewatcher_unwatch() is waiting to remove it with whatever was added
+        pthread_mutex_unlock(&watcher->mutex);
+        debug_log("Crawl of %s cancelled by unwatch", crawl_path);
+        free(crawl_path);
+        errno = ECANCELED;
+        return -1;
+    }
+    if (crawled != 0) {
+        remove_recursive_root(watcher, root_id);
+        pthread_mutex_unlock(&watcher->mutex);
+        error_log("watchRecursive failed for %s: %s", crawl_path, strerror(saved));
+        free(crawl_path);
+        errno = saved;
+        return -1;
+    }
+    
+    debug_log("Crawled %s: %u watches, %u polled, %u failures in %.1f ms", crawl_path,
+              result->watches_added, result->watches_polled, result->watch_failures, result->elapsed_ns / 1e6);
+    free(crawl_path);
+    ensure_snapshots(watcher);
+    int journaled = (watcher->journal.fd >= 0);
+    if (journaled) sync_journal(watcher, root_id);
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    // Its next fill delivers the diff, or its sleep has to end in time for the first poll
+    if (journaled || result->watches_polled > 0) wake_reader(watcher);
+    return 0;
+}
+
+int filewatcher_root_marked(FileWatcher *watcher, const char *path) {
+    lock_watcher(watcher);
+    int root_id = find_recursive_root(watcher, path, strlen(path));
+    int marked = (root_id > 0) ? watcher->roots[root_id - 1]->marked : -1;
+    pthread_mutex_unlock(&watcher->mutex);
+    return marked;
+}
+
+void filewatcher_unwatch(FileWatcher *watcher, const char *path) {
+    lock_watcher(watcher);
+    
+    // Unwatching a recursive root releases its whole tree. One still being
+    // crawled is cancelled, and removed once its crawl has stopped.
+    int root_id;
+    while ((root_id = find_recursive_root(watcher, path, strlen(path))) > 0 &&
+           watcher->roots[root_id - 1]->crawling) {
+        atomic_store(&watcher->roots[root_id - 1]->cancelled, 1);
+        pthread_cond_wait(&watcher->crawl_done, &watcher->mutex);
+    }
+    int wd = watch_registry_find_path(&watcher->registry, path, strlen(path));
+    if (root_id > 0) {
+        remove_recursive_root(watcher, root_id);
+    } else if (wd >= 0) {
+        // Other watchers may still hold the kernel watch; the engine removes
+        // it with the last of them
+        release_wd(watcher, wd, 0);
+        watch_registry_remove(&watcher->registry, wd);
+        remove_filter(watcher, wd);
+    }
+    
+    pthread_mutex_unlock(&watcher->mutex);
+}
+
+// Length of an event's full path: the watch's registered path, a slash
+// (except for a watch on the filesystem root), and the name. An unknown
+// watch (overflow, or already unwatched) gives the bare name as before.
+static size_t event_path_length(const WatchEntry *entry, size_t name_len) {
+    if (entry == NULL) return name_len;
+    if (name_len == 0) return entry->path_len;
+    int root = (entry->path_len == 1 && entry->path[0] == '/');
+    return entry->path_len + (root ? 0 : 1) + name_len;
+}
+
+// Write an event's full path and a terminator into out, which holds
+// event_path_length() + 1 bytes. Plain copies of the cached directory
+// prefix and the name; nothing is formatted.
+static void copy_event_path(const WatchEntry *entry, const char *name, size_t name_len, char *out) {
+    if (entry != NULL) {
+        memcpy(out, entry->path, entry->path_len);
+        out += entry->path_len;
+        if (name_len > 0 && !(entry->path_len == 1 && entry->path[0] == '/')) *out++ = '/';
+    }
+    memcpy(out, name, name_len);
+    out[name_len] = '\0';
+}
+
+// The watcher's path buffer with room for len bytes plus a terminator,
+// or NULL on allocation failure. Caller holds watcher->mutex.
+static char *path_scratch(FileWatcher *watcher, size_t len) {
+    if (len + 1 > watcher->path_capacity) {
+        size_t capacity = watcher->path_capacity ? watcher->path_capacity : 1024;
+        while (capacity < len + 1) capacity *= 2;
+        char *grown = realloc(watcher->path_buffer, capacity);
+        if (grown == NULL) return NULL;
+        watcher->path_buffer = grown;
+        watcher->path_capacity = capacity;
+    }
+    return watcher->path_buffer;
+}
+
+// Build the full path of an event in the watcher's path buffer, which is
+// valid until the next call. Returns NULL on allocation failure. Caller
+// holds watcher->mutex.
+static const char *resolve_event_path(FileWatcher *watcher, int wd, const char *name, size_t name_len,
+                                      size_t *len) {
+    const WatchEntry *entry = watch_registry_lookup(&watcher->registry, wd);
+    *len = event_path_length(entry, name_len);
+    char *out = path_scratch(watcher, *len);
+    if (out != NULL) copy_event_path(entry, name, name_len, out);
+    return out;
+}
+
+// Map an inotify mask to the event kind delivered to consumers
+static uint8_t ring_kind_for_mask(uint32_t mask) {
+    if (mask & (IN_CREATE | IN_MOVED_TO)) return RING_CREATED;
+    if (mask & IN_MODIFY) return RING_MODIFIED;
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) return RING_DELETED;
+    if (mask & IN_Q_OVERFLOW) return RING_OVERFLOW;
+    return RING_MODIFIED;
+}
+
+// Forget a watch once the consumer has passed every ring record that may
+// still name it. Caller holds watcher->mutex.
+static void retire_watch(FileWatcher *watcher, int wd) {
+    if (watcher->retired_count == watcher->retired_capacity) {
+        int capacity = watcher->retired_capacity ? watcher->retired_capacity * 2 : 16;
+        RetiredWatch *grown = realloc(watcher->retired, sizeof(RetiredWatch) * capacity);
+        if (grown == NULL) {
+            watch_registry_remove(&watcher->registry, wd);
+            return;
+        }
+        watcher->retired = grown;
+        watcher->retired_capacity = capacity;
+    }
+    watcher->retired[watcher->retired_count].wd = wd;
+    watcher->retired[watcher->retired_count].ring_pos = event_ring_head(&watcher->ring);
+    watcher->retired_count++;
+}
+
+// Drop retired watches the consumer has moved past. Caller holds watcher->mutex.
+static void sweep_retired(FileWatcher *watcher) {
+    uint32_t tail = event_ring_tail(&watcher->ring);
+    int kept = 0;
+    for (int i = 0; i < watcher->retired_count; i++) {
+        if ((int32_t)(tail - watcher->retired[i].ring_pos) >= 0) {
+            watch_registry_remove(&watcher->registry, watcher->retired[i].wd);
+        } else {
+            watcher->retired[kept++] = watcher->retired[i];
+        }
+    }
+    watcher->retired_count = kept;
+}
+
+// Whether the event at path (len bytes, NUL-terminated) is in the
+// priority class. Caller holds watcher->mutex.
+static int is_priority(const FileWatcher *watcher, const char *path, size_t len, int is_dir) {
+    const PriorityClass *priority = &watcher->priority;
+    if (priority->root_count > 0) {
+        int under = 0;
+        for (int i = 0; i < priority->root_count && !under; i++) {
+            size_t root_len = priority->root_lens[i];
+            under = len >= root_len && memcmp(path, priority->roots[i], root_len) == 0 &&
+                    (len == root_len || path[root_len] == '/' || root_len == 1);
+        }
+        if (!under) return 0;
+    }
+    if (priority->names.count == 0) return 1;
+    
+    size_t name = len;
+    while (name > 0 && path[name - 1] != '/') name--;
+    return glob_filter_match(&priority->names, path + name, is_dir);
+}
+
+// Ring a record belongs in: the priority lane if its path is in the
+// priority class, else the main ring. Records that only carry a name stay
+// in the main ring, whose position decides when their wd is retired.
+// Caller holds watcher->mutex.
+static EventRing *lane_for(FileWatcher *watcher, uint8_t flags, const char *path, size_t len) {
+    if (watcher->prioritizing && !watcher->ring_exported && (flags & RING_FLAG_PATH) && len > 0 &&
+        is_priority(watcher, path, len, (flags & RING_FLAG_DIR) != 0)) {
+        return &watcher->priority_ring;
+    }
+    return &watcher->ring;
+}
+
+// Trace a record entering or leaving a lane, identified by where it ends
+// in that lane. end 0 stands for the record just pushed or just popped.
+static void trace_ring(TraceStage stage, const FileWatcher *watcher, const EventRing *lane, uint8_t kind,
+                       int wd, uint32_t cookie, uint32_t end) {
+    if (!filewatcher_trace_on()) return;
+    uint8_t flags = (lane == &watcher->priority_ring) ? TRACE_FLAG_PRIORITY : 0;
+    if (end == 0) end = (stage == TRACE_QUEUE) ? event_ring_head(lane) : event_ring_tail(lane);
+    filewatcher_trace_write(stage, flags, wd, kind, cookie, end);
+}
+
+// Append one record to its lane, counting it. Returns 0, or -1 if full.
+static int push_record(FileWatcher *watcher, uint8_t kind, uint8_t flags, int wd, uint32_t cookie,
+                       const char *name, size_t name_len) {
+    EventRing *lane = lane_for(watcher, flags, name, name_len);
+    if (event_ring_push(lane, kind, flags, wd, cookie, name, name_len) != 0) return -1;
+    watcher->ring_records++;
+    trace_ring(TRACE_QUEUE, watcher, lane, kind, wd, cookie, 0);
+    return 0;
+}
+
+// Whether a file event is a rewrite of the contents the file already
+// had, in which case it should be dropped. CREATED only records the
+// contents for later. Only events out of the coalescer or a settled watch
+// are checked: a raw MODIFIED is one write of many, and hashing each would
+// reread the whole file per write. Checking records the new hash, so an event that
+// would not fit in the ring is left alone until it does; otherwise its
+// retry would find its own hash and be dropped. Caller holds
+// watcher->mutex.
+static int unchanged_content(FileWatcher *watcher, uint8_t kind, uint8_t flags, const char *path, size_t len) {
+    if (watcher->content_max_bytes == 0 || (flags & RING_FLAG_DIR) || len >= PATH_MAX ||
+        (kind != RING_MODIFIED && kind != RING_CREATED) ||
+        !event_ring_can_push(lane_for(watcher, flags | RING_FLAG_PATH, path, len), len)) {
+        return 0;
+    }
+    char file[PATH_MAX];
+    memcpy(file, path, len);
+    file[len] = '\0';
+    if (content_table_check(&watcher->contents, file, watcher->content_max_bytes) != CONTENT_UNCHANGED ||
+        kind != RING_MODIFIED) {
+        return 0;
+    }
+    watcher->unchanged++;
+    return 1;
+}
+
+// Move coalesced events whose quiet window has passed into the ring. With
+// force, release just the oldest one regardless. Caller holds watcher->mutex.
+static int release_coalesced(FileWatcher *watcher, uint64_t now, int force) {
+    int added = 0;
+    const CoalescedEvent *entry;
+    
+    // Once coalescing is switched off, leftovers go out without waiting
+    while ((entry = event_coalescer_peek(&watcher->coalescer, now, force || !watcher->coalescing)) != NULL) {
+        // A rewrite of the same contents is released by dropping it
+        if (!unchanged_content(watcher, entry->kind, entry->flags, entry->path, entry->path_len) &&
+            push_record(watcher, entry->kind, entry->flags | RING_FLAG_PATH, -1,
+                        entry->cookie, entry->path, entry->path_len) != 0) break;
+        event_coalescer_pop(&watcher->coalescer, entry);
+        added++;
+        if (force) break;
+    }
+    return added;
+}
+
+// Deliver an event that already has its full path: through the coalescer
+// when it is on, else straight into the ring. Returns 0, or -1 if there is
+// no room. Caller holds watcher->mutex.
+static int emit_path_event(FileWatcher *watcher, uint8_t kind, uint8_t flags, int wd, uint32_t cookie,
+                           const char *path, size_t path_len, uint64_t now) {
+    if (!watcher->coalescing) {
+        return push_record(watcher, kind, flags | RING_FLAG_PATH, wd, cookie, path, path_len);
+    }
+    int pending = watcher->coalescer.count;
+    while (event_coalescer_add(&watcher->coalescer, kind, flags, cookie, path, path_len, now) != 0) {
+        // Too many pending paths: release the oldest early and retry
+        if (release_coalesced(watcher, now, 1) == 0) return -1;
+        pending = watcher->coalescer.count;
+    }
+    // No new entry means it merged into (or cancelled) one already pending
+    if (watcher->coalescer.count <= pending) {
+        stat_add(watcher, STAT_EVENTS_COALESCED, 1);
+        filewatcher_trace(TRACE_COALESCE, 0, wd, kind, cookie, 0);
+    }
+    return 0;
+}
+
+// Drop the watches on a directory tree that left the watched area. The
+// engine queues IN_IGNORED for each, which retires the registry entries.
+// Caller holds watcher->mutex.
+static void unwatch_subtree(FileWatcher *watcher, const char *path, size_t len) {
+    uint32_t cursor = 0;
+    const WatchEntry *entry;
+    while ((entry = watch_registry_next(&watcher->registry, &cursor)) != NULL) {
+        if (entry->path_len >= len && memcmp(entry->path, path, len) == 0 &&
+            (entry->path_len == len || entry->path[len] == '/')) {
+            release_wd(watcher, entry->wd, 1);
+        }
+    }
+}
+
+// Report source halves whose destination never arrived as plain deletes.
+// With force, expire just the oldest one regardless. Returns -1 if there
+// was no room. Caller holds watcher->mutex.
+static int expire_renames(FileWatcher *watcher, uint64_t now, int force) {
+    while (watcher->renames.count > 0) {
+        const PendingRename *item = &watcher->renames.items[0];
+        // Once pairing is switched off, leftovers go out without waiting
+        if (!force && watcher->pairing && now - item->seen_ns < watcher->rename_timeout_ns) break;
+        if (emit_path_event(watcher, RING_DELETED, item->flags, -1, item->cookie,
+                            item->path, item->path_len, now) != 0) return -1;
+        if (item->flags & RING_FLAG_DIR) unwatch_subtree(watcher, item->path, item->path_len);
+        rename_table_remove(&watcher->renames, 0);
+        if (force) break;
+    }
+    return 0;
+}
+
+// Deliver a paired rename. Returns 0, or -1 if there is no room.
+// Caller holds watcher->mutex.
+static int emit_move(FileWatcher *watcher, const PendingRename *from, int wd, uint32_t cookie,
+                     const char *to, size_t to_len, uint64_t now) {
+    if (watcher->coalescing) {
+        // The consumer never saw the source, so it simply appears at the destination
+        const CoalescedEvent *pending = event_coalescer_find(&watcher->coalescer, from->path, from->path_len);
+        if (pending != NULL && pending->kind == RING_CREATED) {
+            event_coalescer_pop(&watcher->coalescer, pending);
+            return emit_path_event(watcher, RING_CREATED, from->flags, wd, cookie, to, to_len, now);
+        }
+        
+        // Otherwise everything held back goes out first to keep the order
+        while (watcher->coalescer.count > 0) {
+            if (release_coalesced(watcher, now, 1) == 0) return -1;
+        }
+    }
+    
+    // A move goes where its destination belongs
+    EventRing *lane = lane_for(watcher, from->flags | RING_FLAG_PATH, to, to_len);
+    if (event_ring_push_move(lane, from->flags, wd, cookie, from->path, from->path_len,
+                             to, to_len) != 0) return -1;
+    watcher->ring_records++;
+    trace_ring(TRACE_QUEUE, watcher, lane, RING_MOVED, wd, cookie, 0);
+    return 0;
+}
+
+// Deliver the one MODIFIED a settled write comes down to. Past the
+// coalescer it is checked on release like any other; without it, here.
+// Returns 0, or -1 if there is no room. Caller holds watcher->mutex.
+static int emit_settled(FileWatcher *watcher, uint8_t flags, int wd, const char *path, size_t path_len,
+                        uint64_t now) {
+    if (!watcher->coalescing && unchanged_content(watcher, RING_MODIFIED, flags, path, path_len)) return 0;
+    return emit_path_event(watcher, RING_MODIFIED, flags, wd, 0, path, path_len, now);
+}
+
+// Report held writes whose file went quiet without being closed, or with
+// force the oldest one regardless. Returns the number released. Caller
+// holds watcher->mutex.
+static int release_settled(FileWatcher *watcher, uint64_t now, int force) {
+    int added = 0;
+    const CoalescedEvent *entry;
+    while ((entry = event_coalescer_peek(&watcher->writes, now, force)) != NULL) {
+        if (emit_settled(watcher, entry->flags, -1, entry->path, entry->path_len, now) != 0) break;
+        event_coalescer_pop(&watcher->writes, entry);
+        added++;
+        if (force) break;
+    }
+    return added;
+}
+
+// Handle an event on a settled watch. IN_MODIFY is held, IN_CLOSE_WRITE
+// turns a held write into one MODIFIED (a close without writes says
+// nothing), and deleting or moving the file away drops its held write.
+// Returns 1 if the event was consumed, 0 to deliver it as usual, -1 if
+// there is no room. Caller holds watcher->mutex.
+static int settle_write(FileWatcher *watcher, const struct inotify_event *event, size_t name_len, uint64_t now) {
+    if (!(event->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM))) return 0;
+    
+    size_t path_len;
+    const char *full_path = resolve_event_path(watcher, event->wd, event->name, name_len, &path_len);
+    if (full_path == NULL) return 0;
+    const CoalescedEvent *held = event_coalescer_find(&watcher->writes, full_path, path_len);
+    
+    if (event->mask & IN_MODIFY) {
+        while (event_coalescer_add(&watcher->writes, RING_MODIFIED, 0, 0, full_path, path_len, now) != 0) {
+            // Too many open writers: report the oldest early and retry
+            if (release_settled(watcher, now, 1) == 0) return 0;
+        }
+        return 1;
+    }
+    if (event->mask & IN_CLOSE_WRITE) {
+        if (held == NULL) return 1;
+        if (emit_settled(watcher, 0, event->wd, full_path, path_len, now) != 0) return -1;
+        event_coalescer_pop(&watcher->writes, held);
+        return 1;
+    }
+    if (held != NULL) event_coalescer_pop(&watcher->writes, held);
+    return 0;
+}
+
+// Whether events are ready but could not be delivered for lack of ring
+// space. Caller holds watcher->mutex.
+static int has_backlog(const FileWatcher *watcher, uint64_t now) {
+    if (watcher->buffer_pos < watcher->buffer_len) return 1;
+    if (watcher->recovered_head < watcher->recovered_count) return 1;
+    if (event_coalescer_peek(&watcher->coalescer, now, !watcher->coalescing) != NULL) return 1;
+    if (event_coalescer_peek(&watcher->writes, now, 0) != NULL) return 1;
+    return rename_table_deadline(&watcher->renames, watcher->pairing ? watcher->rename_timeout_ns : 0) <= now;
+}
+
+// Milliseconds until held-back events (coalesced, unpaired renames or
+// unsettled writes) or the next poll are due, -1 if none are pending. Caller holds
+// watcher->mutex.
+static int pending_wait_ms(const FileWatcher *watcher, uint64_t now) {
+    uint64_t deadline = event_coalescer_deadline(&watcher->coalescer);
+    uint64_t renames = rename_table_deadline(&watcher->renames, watcher->pairing ? watcher->rename_timeout_ns : 0);
+    uint64_t writes = event_coalescer_deadline(&watcher->writes);
+    uint64_t polls = poll_scheduler_deadline(&watcher->poller, now);
+    if (renames < deadline) deadline = renames;
+    if (writes < deadline) deadline = writes;
+    if (polls < deadline) deadline = polls;
+    
+    if (deadline == UINT64_MAX) return -1;
+    if (deadline <= now) return 0;
+    uint64_t ms = (deadline - now + 999999) / 1000000;
+    return (ms > INT_MAX) ? INT_MAX : (int)ms;
+}
+
+// Move recovered events into the ring (or coalescer). Returns 0 once all
+// are delivered, -1 if the ring filled first. Caller holds watcher->mutex.
+static int drain_recovered(FileWatcher *watcher, uint64_t now) {
+    while (watcher->recovered_head < watcher->recovered_count) {
+        RecoveredEvent *event = &watcher->recovered[watcher->recovered_head];
+        const char *path = (event->path != NULL) ? event->path : "";
+        if (emit_path_event(watcher, event->kind, event->flags, -1, 0, path, event->path_len, now) != 0) return -1;
+        free(event->path);
+        watcher->recovered_head++;
+    }
+    watcher->recovered_head = 0;
+    watcher->recovered_count = 0;
+    return 0;
+}
+
+// State for one directory's diff during overflow recovery
+typedef struct {
+    FileWatcher *watcher;
+    const char *dir;  // Directory being diffed
+    size_t dir_len;
+    const WatchFilter *filter; // Filter of the directory's watch, or NULL
+    int failed;       // An event could not be queued
+} RecoveryScan;
+
+// inotify bits a recovered change would have arrived with
+static uint32_t mask_for_kind(uint8_t kind) {
+    if (kind == RING_CREATED) return IN_CREATE;
+    if (kind == RING_DELETED) return IN_DELETE;
+    return IN_MODIFY;
+}
+
+static void on_snapshot_diff(void *ctx, uint8_t kind, int is_dir, const char *name, size_t name_len) {
+    RecoveryScan *scan = ctx;
+    if (scan->filter != NULL) {
+        char name_buf[NAME_MAX + 1];
+        snprintf(name_buf, sizeof(name_buf), "%.*s", (int)name_len, name);
+        if (!filter_accepts(scan->filter, mask_for_kind(kind), name_buf, is_dir)) return;
+    }
+    
+    size_t dir_len = (scan->dir_len == 1 && scan->dir[0] == '/') ? 0 : scan->dir_len;
+    size_t len = dir_len + 1 + name_len;
+    char *full_path = path_scratch(scan->watcher, len);
+    if (full_path == NULL) {
+        scan->failed = 1;
+        return;
+    }
+    memcpy(full_path, scan->dir, dir_len);
+    full_path[dir_len] = '/';
+    memcpy(full_path + dir_len + 1, name, name_len);
+    
+    uint8_t flags = RING_FLAG_SYNTH | (is_dir ? RING_FLAG_DIR : 0);
+    if (queue_recovered(scan->watcher, kind, flags, full_path, len) != 0) scan->failed = 1;
+}
+
+static int is_retired(const FileWatcher *watcher, int wd) {
+    for (int i = 0; i < watcher->retired_count; i++) {
+        if (watcher->retired[i].wd == wd) return 1;
+    }
+    return 0;
+}
+
+// Length of the parent directory's part of path ("/" for top-level entries)
+static size_t parent_length(const char *path, size_t len) {
+    while (len > 0 && path[len - 1] != '/') len--;
+    return (len > 1) ? len - 1 : len;
+}
+
+// Whether the parent of a watched directory is watched too, so its own
+// diff reports the directory going away
+static int parent_watched(const FileWatcher *watcher, const char *path, size_t len) {
+    size_t parent_len = parent_length(path, len);
+    return parent_len > 0 && watch_registry_find_path(&watcher->registry, path, parent_len) >= 0;
+}
+
+// Rebuild what the dropped events would have said by listing every watched
+// directory again and diffing it against its snapshot. New directories
+// under recursive roots get watched. If some watch could not be diffed a
+// plain OVERFLOW follows the recovered events. Caller holds watcher->mutex.
+static void recover_overflow(FileWatcher *watcher) {
+    uint64_t start = monotonic_ns();
+    int first = watcher->recovered_count;
+    int complete = 1;
+    RecoveryScan scan = { watcher, NULL, 0, NULL, 0 };
+    
+    uint32_t cursor = 0;
+    const WatchEntry *entry;
+    while ((entry = watch_registry_next(&watcher->registry, &cursor)) != NULL) {
+        // Polled directories lose nothing to an overflow
+        if (is_polled(entry->wd)) continue;
+        if (!snapshot_table_has(&watcher->snapshots, entry->wd)) {
+            if (!is_retired(watcher, entry->wd)) complete = 0;
+            continue;
+        }
+        scan.dir = entry->path;
+        scan.dir_len = entry->path_len;
+        scan.filter = (watcher->filter_count > 0) ? active_filter(watcher, entry->wd) : NULL;
+        if (snapshot_rescan(&watcher->snapshots, entry->wd, entry->path, on_snapshot_diff, &scan) >= 0) continue;
+        
+        // A directory that vanished is reported by its parent's diff
+        if (errno == ENOENT && parent_watched(watcher, entry->path, entry->path_len)) {
+            snapshot_table_remove(&watcher->snapshots, entry->wd);
+            continue;
+        }
+        complete = 0;
+    }
+    
+    // Directories created while events were being dropped
+    for (int i = first; i < watcher->recovered_count; i++) {
+        const RecoveredEvent *event = &watcher->recovered[i];
+        if (event->kind != RING_CREATED || !(event->flags & RING_FLAG_DIR)) continue;
+        
+        size_t parent_len = parent_length(event->path, event->path_len);
+        int parent = watch_registry_find_path(&watcher->registry, event->path, parent_len);
+        const WatchEntry *dir = (parent >= 0) ? watch_registry_lookup(&watcher->registry, parent) : NULL;
+        if (dir != NULL && dir->root > 0) watch_new_directory(watcher, dir->root, event->path);
+    }
+    
+    // Changes under fanotify roots cannot be diffed
+    if (watcher->marked_roots > 0) complete = 0;
+    if (!complete || scan.failed) {
+        if (queue_recovered(watcher, RING_OVERFLOW, 0, NULL, 0) != 0) {
+            error_log("Out of memory reporting a queue overflow");
+        }
+    }
+    debug_log("Recovered %d events from a queue overflow in %.1f ms%s",
+              watcher->recovered_count - first, (monotonic_ns() - start) / 1e6,
+              complete && !scan.failed ? "" : " (incomplete)");
+}
+
+// Whether a directory under a root, or one of its parents, is excluded
+static int excluded_below(const RecursiveRoot *root, const char *dir, size_t len) {
+    size_t offset = (root->path_len == 1) ? 1 : root->path_len + 1;
+    if (root->excludes.count == 0 || len < offset) return 0;
+    
+    char rel[PATH_MAX];
+    size_t rel_len = len - offset;
+    if (rel_len >= sizeof(rel)) return 1;
+    memcpy(rel, dir + offset, rel_len);
+    rel[rel_len] = '\0';
+    for (size_t i = 1; i <= rel_len; i++) {
+        if (i < rel_len && rel[i] != '/') continue;
+        char saved = rel[i];
+        rel[i] = '\0';
+        int hit = glob_filter_match(&root->excludes, rel, 1);
+        rel[i] = saved;
+        if (hit) return 1;
+    }
+    return 0;
+}
+
+// Respell a canonical directory under a marked root with the root's path
+// as the caller gave it. Returns the length written to out, 0 if it does
+// not fit in PATH_MAX.
+static size_t respell_marked_dir(const RecursiveRoot *root, const char *dir, size_t len, char *out) {
+    const char *tail = dir + root->real_len;
+    size_t tail_len = len - root->real_len;
+    // Below "/" the tail lost its slash to the root
+    if (root->real_len == 1 && len > 1) {
+        tail = dir;
+        tail_len = len;
+    }
+    size_t prefix_len = (root->path_len == 1 && tail_len > 0) ? 0 : root->path_len;
+    if (prefix_len + tail_len >= PATH_MAX) return 0;
+    memcpy(out, root->path, prefix_len);
+    memcpy(out + prefix_len, tail, tail_len);
+    out[prefix_len + tail_len] = '\0';
+    return prefix_len + tail_len;
+}
+
+// Map a directory fanotify reported to the wd its events go by, handing
+// directories under marked roots a wd of their own the first time they
+// show up. Roots match on their canonical path, and each directory is
+// registered under the root's own spelling so event paths keep it.
+// Returns -1 for directories outside every marked root, excluded ones,
+// and ones an inotify watch already reports. Runs inside fill_ring with
+// watcher->mutex held.
+static int marked_dir_wd(void *ctx, const char *dir, size_t len) {
+    FileWatcher *watcher = ctx;
+    int wd = watch_registry_find_path(&watcher->registry, dir, len);
+    if (wd >= 0 && wd < FANOTIFY_WD_BASE) return -1;
+    // A retired wd belongs to a deleted directory of the same name
+    if (wd >= 0 && !is_retired(watcher, wd)) return wd;
+    
+    char spelled[PATH_MAX];
+    for (int i = 0; i < watcher->root_count; i++) {
+        const RecursiveRoot *root = watcher->roots[i];
+        if (root->path == NULL || !root->marked) continue;
+        if (root->real_len > 1 && (len < root->real_len || memcmp(dir, root->real_path, root->real_len) != 0 ||
+                                   (len > root->real_len && dir[root->real_len] != '/'))) continue;
+        size_t spelled_len = respell_marked_dir(root, dir, len, spelled);
+        if (spelled_len == 0) return -1;
+        wd = watch_registry_find_path(&watcher->registry, spelled, spelled_len);
+        if (wd >= 0 && wd < FANOTIFY_WD_BASE) return -1;
+        if (wd >= 0 && !is_retired(watcher, wd)) return wd;
+        if (excluded_below(root, spelled, spelled_len) || watcher->next_marked_wd == INT_MAX) return -1;
+        
+        wd = watcher->next_marked_wd;
+        if (watch_registry_add(&watcher->registry, wd, spelled, spelled_len, i + 1) != 0) return -1;
+        watcher->next_marked_wd++;
+        return wd;
+    }
+    return -1;
+}
+
+// Pump the shared engine, then take whatever reached this watcher's
+// inbox. Returns the bytes now in event_buffer. Caller holds watcher->mutex.
+static int take_inbox(FileWatcher *watcher) {
+    if (watcher->engine == NULL) return 0;
+    
+    watch_engine_pump(watcher->engine);
+    return (int)watch_engine_take(&watcher->sub, &watcher->event_buffer, &watcher->event_capacity);
+}
+
+// Fill event_buffer from a fanotify read. Returns the bytes read.
+// Caller holds watcher->mutex.
+static int read_fanotify(FileWatcher *watcher) {
+    if (watcher->fanotify.fd < 0) return 0;
+    if (watcher->event_capacity < BUF_LEN) {
+        char *grown = realloc(watcher->event_buffer, BUF_LEN);
+        if (grown == NULL) return 0;
+        watcher->event_buffer = grown;
+        watcher->event_capacity = BUF_LEN;
+    }
+    return fanotify_source_read(&watcher->fanotify, watcher->event_buffer, watcher->event_capacity,
+                                marked_dir_wd, watcher);
+}
+
+// Current path of a polled directory, for the poll scheduler.
+// Caller holds watcher->mutex.
+static const char *polled_path(void *ctx, int wd, size_t *len) {
+    const FileWatcher *watcher = ctx;
+    const WatchEntry *entry = watch_registry_lookup(&watcher->registry, wd);
+    if (entry == NULL) return NULL;
+    *len = entry->path_len;
+    return entry->path;
+}
+
+// Give the hottest polled directory a real watch if the limit leaves
+// room, backing off when the kernel still says no. Caller holds
+// watcher->mutex.
+static void promote_polled(FileWatcher *watcher, uint64_t now) {
+    if (watcher->engine == NULL) return;
+    int wd = poll_scheduler_candidate(&watcher->poller, now);
+    const WatchEntry *entry = (wd >= 0) ? watch_registry_lookup(&watcher->registry, wd) : NULL;
+    if (entry == NULL) return;
+    
+    // The registry entry moves once the real wd is added
+    char *path = path_scratch(watcher, entry->path_len);
+    if (path == NULL) return;
+    memcpy(path, entry->path, entry->path_len + 1);
+    int root = entry->root;
+    
+    // The limit read at open may have been raised since, so let the
+    // kernel decide
+    uint32_t mask = poll_scheduler_mask(&watcher->poller, wd);
+    int real_wd = watch_engine_add(watcher->engine, &watcher->sub, path, mask);
+    if (real_wd < 0) {
+        poll_scheduler_defer(&watcher->poller, now);
+        return;
+    }
+    if (watch_registry_add(&watcher->registry, real_wd, path, strlen(path), root) != 0) {
+        watch_engine_remove(watcher->engine, &watcher->sub, real_wd, 0);
+        poll_scheduler_defer(&watcher->poller, now);
+        return;
+    }
+    hand_off_polled(watcher, wd, real_wd, path);
+    ensure_snapshots(watcher);
+}
+
+// Poll the directories that are due and take what changed. Returns the
+// bytes now in event_buffer. Caller holds watcher->mutex.
+static int take_polled(FileWatcher *watcher) {
+    PollScheduler *poller = &watcher->poller;
+    if (poller->count == 0 && poller->out_len == 0) return 0;
+    
+    // Promote first: records already produced for the candidate would lose
+    // their path once the real wd takes over its registry entry
+    uint64_t now = monotonic_ns();
+    promote_polled(watcher, now);
+    if (poll_scheduler_deadline(poller, now) <= now) poll_scheduler_run(poller, now, polled_path, watcher);
+    return (int)poll_scheduler_take(poller, &watcher->event_buffer, &watcher->event_capacity);
+}
+
+// Refill event_buffer from the engine inbox, the fanotify group or the
+// poll scheduler, taking turns so none can starve the others. Returns the
+// bytes read, 0 if all are empty. Caller holds watcher->mutex.
+static int read_events(FileWatcher *watcher) {
+    for (int i = 0; i < 3; i++) {
+        int source = watcher->read_turn;
+        watcher->read_turn = (source + 1) % 3;
+        int n = (source == 0) ? take_inbox(watcher) : (source == 1) ? read_fanotify(watcher) : take_polled(watcher);
+        if (n > 0) {
+            filewatcher_trace(TRACE_READ, 0, -1, (uint32_t)source, 0, (uint32_t)n);
+            return n;
+        }
+    }
+    return 0;
+}
+
+// Refill event_buffer and count the batch. Caller holds watcher->mutex.
+static int next_batch(FileWatcher *watcher) {
+    int n = read_events(watcher);
+    if (n > 0) {
+        stat_add(watcher, STAT_READ_CALLS, 1);
+        stat_add(watcher, STAT_BYTES_READ, (uint64_t)n);
+    }
+    return n;
+}
+
+// Parse pending inotify events into the ring until either runs dry. Events
+// that do not fit stay buffered (or in the kernel queue) for the next call.
+// With coalescing on they are folded first and reach the ring once quiet;
+// with rename pairing on, IN_MOVED_FROM waits for its IN_MOVED_TO.
+// now is the CLOCK_MONOTONIC time that decides which held-back events are
+// due. Caller holds watcher->mutex. Returns the number of records added.
+static int fill_ring(FileWatcher *watcher, uint64_t now) {
+    uint64_t start_records = watcher->ring_records;
+    sweep_retired(watcher);
+    
+    // Leftovers from a window or pairing that was switched off go first
+    if (!watcher->pairing && watcher->renames.count > 0) {
+        if (expire_renames(watcher, now, 0) != 0) return (int)(watcher->ring_records - start_records);
+    }
+    if (!watcher->coalescing && watcher->coalescer.count > 0) {
+        release_coalesced(watcher, now, 0);
+        if (watcher->coalescer.count > 0) return (int)(watcher->ring_records - start_records);
+    }
+    if (watcher->recovered_count > 0 && drain_recovered(watcher, now) != 0) {
+        return (int)(watcher->ring_records - start_records);
+    }
+    
+    for (;;) {
+        // If no buffered events, try to read new ones
+        if (watcher->buffer_pos >= watcher->buffer_len) {
+            watcher->buffer_len = next_batch(watcher);
+            watcher->buffer_pos = 0;
+            watcher->counted_pos = 0;
+            if (watcher->buffer_len == 0) break; // No events available
+        }
+        
+        // Parse next event from buffer
+        struct inotify_event *event = (struct inotify_event*)&watcher->event_buffer[watcher->buffer_pos];
+        size_t name_len = (event->len > 0) ? strnlen(event->name, event->len) : 0;
+        
+        // An event left buffered for lack of ring space comes back next
+        // call, and only its first look counts, traces and stats the path
+        int fresh = watcher->buffer_pos >= watcher->counted_pos;
+        if (fresh) {
+            watcher->counted_pos = watcher->buffer_pos + (int)(EVENT_SIZE + event->len);
+            filewatcher_trace(TRACE_PARSE, 0, event->wd, event->mask, event->cookie, (uint32_t)name_len);
+            stat_add(watcher, STAT_EVENTS_READ, 1);
+            if (event->mask & IN_Q_OVERFLOW) stat_add(watcher, STAT_OVERFLOWS, 1);
+        }
+        
+        // Watch is gone (unwatch or directory removed): retire its registry entry
+        if (event->mask & IN_IGNORED) {
+            watcher->buffer_pos += EVENT_SIZE + event->len;
+            retire_watch(watcher, event->wd);
+            snapshot_table_remove(&watcher->snapshots, event->wd);
+            remove_filter(watcher, event->wd);
+            continue;
+        }
+        
+        // Dropped events: diff the snapshots instead of reporting a bare overflow
+        if ((event->mask & IN_Q_OVERFLOW) && watcher->recovery) {
+            watcher->buffer_pos += EVENT_SIZE + event->len;
+            recover_overflow(watcher);
+            if (drain_recovered(watcher, now) != 0) break;
+            continue;
+        }
+        
+        // Keep the snapshot current so the next overflow diffs against it
+        if (fresh && watcher->recovery && name_len > 0) {
+            const WatchEntry *dir = watch_registry_lookup(&watcher->registry, event->wd);
+            if (dir != NULL) snapshot_update(&watcher->snapshots, event->wd, dir->path, event->name, name_len);
+        }
+        
+        // Follow the tree in the journal so the next run diffs against it
+        if (fresh && watcher->journal.fd >= 0 && name_len > 0) {
+            const WatchEntry *dir = watch_registry_lookup(&watcher->registry, event->wd);
+            if (dir != NULL && dir->root > 0 && watcher->roots[dir->root - 1]->journaled) {
+                watch_journal_update(&watcher->journal, dir->path, dir->path_len, event->name, name_len);
+            }
+        }
+        
+        // Drop what a filtered watch did not ask for before any path is built
+        const WatchFilter *filter = (watcher->filter_count > 0) ? active_filter(watcher, event->wd) : NULL;
+        if (filter != NULL && !filter_accepts(filter, event->mask, name_len ? event->name : "",
+                                              (event->mask & IN_ISDIR) != 0)) {
+            watcher->buffer_pos += EVENT_SIZE + event->len;
+            stat_add(watcher, STAT_EVENTS_FILTERED, 1);
+            filewatcher_trace(TRACE_FILTER, 0, event->wd, event->mask, event->cookie, 0);
+            continue;
+        }
+        
+        // Settled watches hold writes until the file is closed
+        if (filter != NULL && (filter->mask & IN_CLOSE_WRITE) && !(event->mask & IN_ISDIR)) {
+            int settled = settle_write(watcher, event, name_len, now);
+            if (settled < 0) break;
+            if (settled > 0) {
+                watcher->buffer_pos += EVENT_SIZE + event->len;
+                continue;
+            }
+        }
+        
+        uint8_t kind = ring_kind_for_mask(event->mask);
+        uint8_t flags = (event->mask & IN_ISDIR) ? RING_FLAG_DIR : 0;
+        // fanotify halves reported without FAN_RENAME have no cookie to pair by
+        int pair = watcher->pairing && (event->mask & (IN_MOVED_FROM | IN_MOVED_TO)) && event->cookie != 0;
+        
+        // The reader thread's consumer cannot look at the registry, and
+        // coalesced, paired or prioritized events may outlive their wd, as
+        // may those of a polled directory that gets promoted, so all of
+        // them get the full path
+        const char *full_path = NULL;
+        size_t path_len = 0;
+        int resolve = pair || watcher->coalescing || watcher->prioritizing || is_polled(event->wd) ||
+                      atomic_load_explicit(&watcher->reader_running, memory_order_relaxed);
+        if (resolve) {
+            full_path = resolve_event_path(watcher, event->wd, event->name, name_len, &path_len);
+            if (full_path == NULL) break; // Out of memory: leave it buffered
+            
+            // No record can carry a longer path (only renames of deep trees
+            // build them), so the consumer is told to rescan instead of
+            // getting it cut short
+            if (path_len > RING_MAX_PATH) {
+                if (push_record(watcher, RING_OVERFLOW, 0, -1, 0, "", 0) != 0) break;
+                watcher->buffer_pos += EVENT_SIZE + event->len;
+                continue;
+            }
+        }
+        
+        // Hold the source half of a rename until its destination shows up
+        if (pair && (event->mask & IN_MOVED_FROM)) {
+            if (rename_table_add(&watcher->renames, event->cookie, flags, full_path, path_len, now) == 0) {
+                watcher->buffer_pos += EVENT_SIZE + event->len;
+                continue;
+            }
+            if (watcher->renames.count > 0) {
+                // Table full: expire the oldest early and retry
+                if (expire_renames(watcher, now, 1) != 0) break;
+                continue;
+            }
+            // Out of memory: deliver it unpaired
+        }
+        
+        int index = pair ? rename_table_find(&watcher->renames, event->cookie) : -1;
+        if (index >= 0) {
+            const PendingRename *from = &watcher->renames.items[index];
+            if (emit_move(watcher, from, event->wd, event->cookie, full_path, path_len, now) != 0) break;
+            watcher->buffer_pos += EVENT_SIZE + event->len;
+            
+            // Watches follow the inode, so a moved directory only needs new names
+            if (flags & RING_FLAG_DIR) {
+                watch_registry_rename_prefix(&watcher->registry, from->path, from->path_len,
+                                             full_path, path_len);
+            }
+            rename_table_remove(&watcher->renames, index);
+            continue;
+        }
+        
+        if (resolve) {
+            if (emit_path_event(watcher, kind, flags, event->wd, event->cookie, full_path, path_len, now) != 0) break;
+        } else {
+            if (push_record(watcher, kind, flags, event->wd, event->cookie, event->name, name_len) != 0) break;
+        }
+        watcher->buffer_pos += EVENT_SIZE + event->len;
+        
+        // New subdirectory inside a recursive root: watch it too
+        if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+            const WatchEntry *entry = watch_registry_lookup(&watcher->registry, event->wd);
+            if (entry != NULL && entry->root > 0 && !watcher->roots[entry->root - 1]->marked) {
+                if (!resolve) full_path = resolve_event_path(watcher, event->wd, event->name, name_len, &path_len);
+                if (full_path != NULL) watch_new_directory(watcher, entry->root, full_path);
+            }
+        }
+        
+        // fanotify sends no IN_IGNORED, so a directory deleted under a
+        // marked root retires its entry here
+        if ((event->mask & IN_ISDIR) && (event->mask & IN_DELETE) && event->wd >= FANOTIFY_WD_BASE) {
+            if (!resolve) full_path = resolve_event_path(watcher, event->wd, event->name, name_len, &path_len);
+            int wd = (full_path != NULL) ? watch_registry_find_path(&watcher->registry, full_path, path_len) : -1;
+            if (wd >= FANOTIFY_WD_BASE && !is_retired(watcher, wd)) retire_watch(watcher, wd);
+        }
+    }
+    
+    expire_renames(watcher, now, 0);
+    release_settled(watcher, now, 0);
+    if (watcher->coalescing) release_coalesced(watcher, now, 0);
+    if (watcher->journal.pending_len > 0 && watch_journal_flush(&watcher->journal) != 0) {
+        error_log("Failed to write journal: %s", strerror(errno));
+    }
+    return (int)(watcher->ring_records - start_records);
+}
+
+// Decode a ring record into buf. Returns the bytes used, or 0 if it does
+// not fit. Caller holds watcher->mutex unless the record carries RING_FLAG_PATH.
+static size_t decode_record(const FileWatcher *watcher, const RingRecord *record,
+                            FileWatcherEvent *out, char *buf, size_t size) {
+    out->kind = record->kind;
+    out->flags = record->flags;
+    out->old_path = "";
+    out->old_len = 0;
+    
+    if (record->kind == RING_MOVED) {
+        size_t old_len = record->old_len;
+        size_t new_len = (size_t)(record->name_len - record->old_len);
+        if (old_len + new_len + 2 > size) return 0;
+        memcpy(buf, record->name, old_len);
+        buf[old_len] = '\0';
+        memcpy(buf + old_len + 1, record->name + old_len, new_len);
+        buf[old_len + 1 + new_len] = '\0';
+        out->old_path = buf;
+        out->old_len = (uint32_t)old_len;
+        out->path = buf + old_len + 1;
+        out->path_len = (uint32_t)new_len;
+        return old_len + new_len + 2;
+    }
+    
+    // A full path is copied as it is, a name goes after its directory
+    const WatchEntry *entry = NULL;
+    if (!(record->flags & RING_FLAG_PATH)) entry = watch_registry_lookup(&watcher->registry, record->wd);
+    size_t len = event_path_length(entry, record->name_len);
+    if (len + 1 > size) return 0;
+    
+    copy_event_path(entry, record->name, record->name_len, buf);
+    out->path = buf;
+    out->path_len = (uint32_t)len;
+    return len + 1;
+}
+
+// Let a reader thread that is waiting for ring space carry on
+static void notify_space(FileWatcher *watcher) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&watcher->reader_stalled, memory_order_relaxed) &&
+        atomic_exchange(&watcher->reader_stalled, 0)) {
+        uint64_t one = 1;
+        if (write(watcher->space_fd, &one, sizeof(one)) < 0) {
+            error_log("Failed to wake reader thread: %s", strerror(errno));
+        }
+    }
+}
+
+// Whether the priority lane exists and has to be looked at
+static int priority_mapped(const FileWatcher *watcher) {
+    return atomic_load_explicit(&watcher->priority_mapped, memory_order_acquire);
+}
+
+// Lane to take the next event from, priority first, or NULL if both are
+// empty. Caller holds watcher->mutex.
+static EventRing *next_lane(FileWatcher *watcher) {
+    if (priority_mapped(watcher) && event_ring_peek(&watcher->priority_ring) != NULL) {
+        return &watcher->priority_ring;
+    }
+    return (event_ring_peek(&watcher->ring) != NULL) ? &watcher->ring : NULL;
+}
+
+// Whether either lane holds events
+static int lanes_ready(const FileWatcher *watcher) {
+    if (event_ring_head(&watcher->ring) != event_ring_tail(&watcher->ring)) return 1;
+    return priority_mapped(watcher) &&
+           event_ring_head(&watcher->priority_ring) != event_ring_tail(&watcher->priority_ring);
+}
+
+// Consumer progress over both lanes: changes whenever either tail moves
+static uint32_t lanes_tail(const FileWatcher *watcher) {
+    uint32_t tail = event_ring_tail(&watcher->ring);
+    if (priority_mapped(watcher)) tail += event_ring_tail(&watcher->priority_ring);
+    return tail;
+}
+
+// Take ring events, filling the ring whenever it runs empty. Caller holds
+// watcher->mutex.
+static int poll_ring(FileWatcher *watcher, FileWatcherEvent *events, int max, char *buf, size_t buf_size) {
+    int count = 0;
+    size_t used = 0;
+    while (count < max) {
+        EventRing *lane = next_lane(watcher);
+        if (lane == NULL) {
+            fill_ring(watcher, monotonic_ns());
+            lane = next_lane(watcher);
+            if (lane == NULL) break;
+        }
+        const RingRecord *record = event_ring_peek(lane);
+        size_t n = decode_record(watcher, record, &events[count], buf + used, buf_size - used);
+        if (n == 0) break;
+        uint8_t kind = record->kind;
+        int32_t wd = record->wd;
+        uint32_t cookie = record->cookie;
+        event_ring_pop(lane, record);
+        trace_ring(TRACE_DELIVER, watcher, lane, kind, wd, cookie, 0);
+        used += n;
+        count++;
+    }
+    return count;
+}
+
+// event_ring_copy() from the priority lane, or from the main ring if it
+// is empty. Returns the lane copied from, NULL if both are empty.
+static EventRing *copy_next(FileWatcher *watcher, RingRecord *copy, uint32_t *pos) {
+    if (priority_mapped(watcher) && event_ring_copy(&watcher->priority_ring, copy, pos)) {
+        return &watcher->priority_ring;
+    }
+    return event_ring_copy(&watcher->ring, copy, pos) ? &watcher->ring : NULL;
+}
+
+// Take events the reader thread queued. Runs without the mutex, on any
+// number of consumer threads at once: each record is copied out and
+// decoded, then claimed, and a consumer that loses the claim drops its
+// copy and tries the next record. Returns -1 with ENOBUFS if the first
+// event does not fit.
+static int poll_queued(FileWatcher *watcher, FileWatcherEvent *events, int max, char *buf, size_t buf_size) {
+    _Alignas(8) char scratch[RING_MAX_RECORD];
+    RingRecord *copy = (RingRecord *)scratch;
+    int count = 0;
+    int full = 0;
+    size_t used = 0;
+    uint32_t pos;
+    EventRing *lane;
+    while (count < max && (lane = copy_next(watcher, copy, &pos)) != NULL) {
+        size_t n;
+        if (copy->flags & RING_FLAG_PATH) {
+            n = decode_record(watcher, copy, &events[count], buf + used, buf_size - used);
+        } else {
+            // Parsed before the reader started: resolve it the old way
+            lock_watcher(watcher);
+            n = decode_record(watcher, copy, &events[count], buf + used, buf_size - used);
+            pthread_mutex_unlock(&watcher->mutex);
+        }
+        if (n == 0) {
+            full = 1;
+            break;
+        }
+        if (!event_ring_claim(lane, pos, copy)) continue;
+        trace_ring(TRACE_DELIVER, watcher, lane, copy->kind, copy->wd, copy->cookie, pos + copy->size);
+        used += n;
+        count++;
+    }
+    if (count > 0) notify_space(watcher);
+    if (count == 0 && full) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    return count;
+}
+
+int filewatcher_poll(FileWatcher *watcher, FileWatcherEvent *events, int max, char *buf, size_t buf_size) {
+    if (max <= 0) return 0;
+    
+    int count;
+    if (atomic_load(&watcher->reader_running)) {
+        count = poll_queued(watcher, events, max, buf, buf_size);
+    } else {
+        lock_watcher(watcher);
+        if (atomic_load(&watcher->reader_running)) {
+            // The reader started while we waited; its consumers share the ring
+            pthread_mutex_unlock(&watcher->mutex);
+            count = poll_queued(watcher, events, max, buf, buf_size);
+        } else {
+            count = poll_ring(watcher, events, max, buf, buf_size);
+            if (count == 0 && next_lane(watcher) != NULL) {
+                errno = ENOBUFS;
+                count = -1;
+            }
+            pthread_mutex_unlock(&watcher->mutex);
+        }
+    }
+    
+    // poll_queued runs without the mutex, hence the atomic add
+    if (count > 0) atomic_fetch_add_explicit(&watcher->stats[STAT_EVENTS_DELIVERED], count, memory_order_relaxed);
+    return count;
+}
+
+EventRing *filewatcher_export_ring(FileWatcher *watcher) {
+    lock_watcher(watcher);
+    watcher->ring_exported = 1;
+    pthread_mutex_unlock(&watcher->mutex);
+    return &watcher->ring;
+}
+
+int filewatcher_fill_ring(FileWatcher *watcher) {
+    // The reader thread fills the ring itself; just tell it about freed space
+    if (atomic_load(&watcher->reader_running)) {
+        notify_space(watcher);
+        return 0;
+    }
+    
+    lock_watcher(watcher);
+    int added = fill_ring(watcher, monotonic_ns());
+    pthread_mutex_unlock(&watcher->mutex);
+    return added;
+}
+
+int filewatcher_watch_path(FileWatcher *watcher, int wd, char *buf, size_t size) {
+    lock_watcher(watcher);
+    const WatchEntry *entry = watch_registry_lookup(&watcher->registry, wd);
+    int len = (entry != NULL) ? snprintf(buf, size, "%s", entry->path) : -1;
+    pthread_mutex_unlock(&watcher->mutex);
+    return len;
+}
+
+// Read the next eventfd counter, discarding it
+static void drain_eventfd(int fd) {
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        error_log("Failed to read eventfd: %s", strerror(errno));
+    }
+}
+
+// Sleep until the consumer frees space, close() is called, the timeout
+// passes, or (with watch_inotify) new events arrive on the shared inotify
+// fd, in the inbox, or on the fanotify group (fanotify_fd, -1 if none).
+// Returns 0 on close().
+static int reader_wait(FileWatcher *watcher, int watch_inotify, int fanotify_fd, int timeout_ms) {
+    struct pollfd fds[5] = {
+        { watcher->space_fd, POLLIN, 0 },
+        { watcher->wake_fd, POLLIN, 0 },
+        { watcher->inotify_fd, POLLIN, 0 },
+        { watcher->sub.inbox_fd, POLLIN, 0 },
+        { fanotify_fd, POLLIN, 0 },
+    };
+    while (poll(fds, watch_inotify ? 5 : 2, timeout_ms) < 0) {
+        if (errno != EINTR) return 0;
+    }
+    if ((fds[1].revents & POLLIN) || (fds[2].revents & (POLLERR | POLLNVAL))) return 0;
+    if (fds[0].revents & POLLIN) drain_eventfd(watcher->space_fd);
+    return !atomic_load(&watcher->closed);
+}
+
+// Background reader: keep the kernel queue empty by parsing into the ring
+static void *reader_main(void *arg) {
+    FileWatcher *watcher = arg;
+    uint64_t one = 1;
+    
+    while (!atomic_load(&watcher->closed)) {
+        lock_watcher(watcher);
+        // Judge the backlog by the same clock fill_ring released events
+        // with, or events that came due meanwhile look like a full ring
+        uint64_t now = monotonic_ns();
+        int added = fill_ring(watcher, now);
+        int backlog = has_backlog(watcher, now);
+        int timeout_ms = pending_wait_ms(watcher, monotonic_ns());
+        // Only fill_ring drops retired watches, and no event may come to run it
+        if (watcher->retired_count > 0 && (timeout_ms < 0 || timeout_ms > RETIRED_SWEEP_MS)) {
+            timeout_ms = RETIRED_SWEEP_MS;
+        }
+        uint32_t tail = lanes_tail(watcher);
+        int fanotify_fd = watcher->fanotify.fd;
+        pthread_mutex_unlock(&watcher->mutex);
+        
+        if (added > 0 && write(watcher->ready_fd, &one, sizeof(one)) < 0) {
+            error_log("Failed to signal consumer: %s", strerror(errno));
+        }
+        
+        if (!backlog) {
+            if (!reader_wait(watcher, 1, fanotify_fd, timeout_ms)) break;
+            continue;
+        }
+        
+        // Ring is full: sleep until the consumer pops, unless it already has
+        atomic_store(&watcher->reader_stalled, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (lanes_tail(watcher) != tail) {
+            atomic_store(&watcher->reader_stalled, 0);
+            continue;
+        }
+        if (!reader_wait(watcher, 0, -1, -1)) break;
+    }
+    return NULL;
+}
+
+void filewatcher_set_read_limit(FileWatcher *watcher, uint32_t max_bytes) {
+    lock_watcher(watcher);
+    if (watcher->engine != NULL) watch_engine_set_read_limit(watcher->engine, max_bytes);
+    pthread_mutex_unlock(&watcher->mutex);
+}
+
+void filewatcher_set_coalescing(FileWatcher *watcher, uint32_t window_ms) {
+    lock_watcher(watcher);
+    watcher->coalescer.window_ns = (uint64_t)window_ms * 1000000ull;
+    watcher->coalescing = (window_ms > 0);
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    wake_reader(watcher);
+    debug_log("Coalescing window set to %u ms", window_ms);
+}
+
+void filewatcher_set_rename_pairing(FileWatcher *watcher, uint32_t timeout_ms) {
+    lock_watcher(watcher);
+    watcher->rename_timeout_ns = (uint64_t)timeout_ms * 1000000ull;
+    watcher->pairing = (timeout_ms > 0);
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    wake_reader(watcher);
+    debug_log("Rename pairing timeout set to %u ms", timeout_ms);
+}
+
+void filewatcher_set_settle_timeout(FileWatcher *watcher, uint32_t timeout_ms) {
+    lock_watcher(watcher);
+    watcher->writes.window_ns = (uint64_t)timeout_ms * 1000000ull;
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    wake_reader(watcher);
+    debug_log("Settle timeout set to %u ms", timeout_ms);
+}
+
+void filewatcher_set_fanotify(FileWatcher *watcher, int enabled) {
+    lock_watcher(watcher);
+    watcher->fanotify_allowed = (enabled != 0) && watcher->backend != FILEWATCHER_BACKEND_POLL;
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    debug_log("fanotify %s for new recursive watches", enabled ? "allowed" : "off");
+}
+
+void filewatcher_set_content_hashing(FileWatcher *watcher, uint64_t max_file_bytes) {
+    lock_watcher(watcher);
+    watcher->content_max_bytes = max_file_bytes;
+    if (max_file_bytes == 0) {
+        content_table_destroy(&watcher->contents);
+        content_table_init(&watcher->contents);
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    debug_log("Content hashing %s (files up to %llu bytes)", max_file_bytes ? "on" : "off",
+              (unsigned long long)max_file_bytes);
+}
+
+void filewatcher_set_overflow_recovery(FileWatcher *watcher, int enabled) {
+    lock_watcher(watcher);
+    if (enabled && !watcher->recovery) {
+        watcher->recovery = 1;
+        ensure_snapshots(watcher);
+        debug_log("Overflow recovery on: %u directory snapshots", watcher->snapshots.count);
+    } else if (!enabled && watcher->recovery) {
+        watcher->recovery = 0;
+        snapshot_table_destroy(&watcher->snapshots);
+        if (snapshot_table_init(&watcher->snapshots) != 0) {
+            error_log("Out of memory resetting directory snapshots");
+        }
+        debug_log("Overflow recovery off");
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+}
+
+int filewatcher_set_priority(FileWatcher *watcher, const char *const *names, size_t name_count,
+                             const char *const *roots, size_t root_count) {
+    PriorityClass priority = { 0 };
+    int failed = (glob_filter_init(&priority.names, names, name_count) != 0);
+    if (!failed && root_count > 0) {
+        priority.roots = calloc(root_count, sizeof(char *));
+        priority.root_lens = calloc(root_count, sizeof(size_t));
+        failed = (priority.roots == NULL || priority.root_lens == NULL);
+    }
+    for (size_t i = 0; !failed && i < root_count; i++) {
+        // Stored without a trailing slash so prefixes compare cleanly
+        size_t len = strlen(roots[i]);
+        while (len > 1 && roots[i][len - 1] == '/') len--;
+        priority.roots[i] = strndup(roots[i], len);
+        priority.root_lens[i] = len;
+        priority.root_count++;
+        failed = (priority.roots[i] == NULL);
+    }
+    if (failed) {
+        free_priority(&priority);
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    int enable = (name_count > 0 || root_count > 0);
+    lock_watcher(watcher);
+    int error = 0;
+    if (watcher->ring_exported) {
+        error = EBUSY;
+    } else if (enable && !priority_mapped(watcher)) {
+        // Mapped once and kept: shared consumers may be reading it unlocked
+        if (event_ring_init(&watcher->priority_ring, RING_DEFAULT_CAPACITY) != 0) {
+            error = ENOMEM;
+        } else {
+            atomic_store_explicit(&watcher->priority_mapped, 1, memory_order_release);
+        }
+    }
+    if (error == 0) {
+        free_priority(&watcher->priority);
+        watcher->priority = priority;
+        watcher->prioritizing = enable;
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    if (error != 0) {
+        free_priority(&priority);
+        errno = error;
+        return -1;
+    }
+    debug_log("Priority lane %s: %zu names, %zu roots", enable ? "on" : "off", name_count, root_count);
+    return 0;
+}
+
+int filewatcher_start_reader(FileWatcher *watcher, uint32_t queue_bytes) {
+    lock_watcher(watcher);
+    if (atomic_load(&watcher->reader_running) || atomic_load(&watcher->closed)) {
+        pthread_mutex_unlock(&watcher->mutex);
+        return -1;
+    }
+    
+    // Resize the ring if asked, which only works while nothing refers to it
+    if (queue_bytes > 0) {
+        EventRing resized;
+        if (event_ring_init(&resized, queue_bytes) != 0) {
+            pthread_mutex_unlock(&watcher->mutex);
+            return -1;
+        }
+        if (resized.capacity == watcher->ring.capacity) {
+            event_ring_destroy(&resized);
+        } else if (watcher->ring_exported ||
+                   event_ring_head(&watcher->ring) != event_ring_tail(&watcher->ring)) {
+            event_ring_destroy(&resized);
+            error_log("Cannot resize the event ring while it is mapped or holds events");
+            pthread_mutex_unlock(&watcher->mutex);
+            return -1;
+        } else {
+            sweep_retired(watcher); // Positions refer to the old ring
+            event_ring_destroy(&watcher->ring);
+            watcher->ring = resized;
+        }
+    }
+    
+    if (watcher->ready_fd < 0) watcher->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (watcher->space_fd < 0) watcher->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (watcher->ready_fd < 0 || watcher->space_fd < 0) {
+        error_log("Failed to create reader eventfds: %s", strerror(errno));
+        pthread_mutex_unlock(&watcher->mutex);
+        return -1;
+    }
+    
+    atomic_store(&watcher->reader_running, 1);
+    if (pthread_create(&watcher->reader, NULL, reader_main, watcher) != 0) {
+        atomic_store(&watcher->reader_running, 0);
+        error_log("Failed to start reader thread");
+        pthread_mutex_unlock(&watcher->mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    debug_log("Reader thread started with a %u byte queue", watcher->ring.capacity);
+    return 0;
+}
+
+int filewatcher_open_journal(FileWatcher *watcher, const char *path, uint64_t *generation) {
+    lock_watcher(watcher);
+    int rc = -1;
+    if (atomic_load(&watcher->closed)) {
+        errno = EBADF;
+    } else if (watcher->journal.fd >= 0) {
+        errno = EBUSY;
+    } else {
+        rc = watch_journal_open(&watcher->journal, path);
+    }
+    if (rc == 0 && generation != NULL) *generation = watcher->journal.generation;
+    uint32_t entries = watcher->journal.count;
+    pthread_mutex_unlock(&watcher->mutex);
+    
+    if (rc == 0) debug_log("Journal %s opened: %u entries", path, entries);
+    return rc;
+}
+
+uint32_t filewatcher_queue_high_water(const FileWatcher *watcher) {
+    return event_ring_high_water(&watcher->ring);
+}
+
+void filewatcher_get_stats(FileWatcher *watcher, uint64_t out[STAT_COUNT]) {
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        out[i] = atomic_load_explicit(&watcher->stats[i], memory_order_relaxed);
+    }
+    out[STAT_EVENTS_PER_READ] = out[STAT_READ_CALLS] ? out[STAT_EVENTS_READ] / out[STAT_READ_CALLS] : 0;
+    out[STAT_MAX_QUEUE_BYTES] = event_ring_high_water(&watcher->ring);
+    out[STAT_STRING_HITS] = 0;
+    out[STAT_STRING_MISSES] = 0;
+    
+    lock_watcher(watcher);
+    out[STAT_ACTIVE_WATCHES] = watcher->registry.count;
+    out[STAT_WATCH_LIMIT] = (watcher->engine != NULL) ? (uint64_t)watch_engine_limit(watcher->engine, NULL) : 0;
+    out[STAT_POLLED_DIRS] = watcher->poller.count;
+    out[STAT_BACKEND] = watcher->backend;
+    out[STAT_EVENTS_UNCHANGED] = watcher->unchanged;
+    pthread_mutex_unlock(&watcher->mutex);
+}
+
+// filewatcher_wait(), also giving up once stop_fd (-1 for none) is readable
+static int wait_ready(FileWatcher *watcher, int64_t timeout_ms, int stop_fd) {
+    atomic_fetch_add(&watcher->waiters, 1);
+    if (atomic_load(&watcher->closed)) {
+        atomic_fetch_sub(&watcher->waiters, 1);
+        return 0;
+    }
+    
+    // With a reader thread the inotify fd belongs to it, so wait for its
+    // signal instead. Otherwise parse here, which also releases coalesced
+    // events whose window has passed.
+    int reader = atomic_load(&watcher->reader_running);
+    uint64_t start = monotonic_ns();
+    int ready = 0;
+    
+    for (;;) {
+        int pending_ms = -1;
+        int fanotify_fd = -1;
+        if (reader) {
+            // Every waiter polls the same ready_fd, so it is only cleared by
+            // one that found the lanes empty, and put back if they filled
+            // meanwhile; a drained signal would leave the others asleep
+            ready = lanes_ready(watcher);
+            if (!ready) {
+                drain_eventfd(watcher->ready_fd);
+                ready = lanes_ready(watcher);
+                uint64_t one = 1;
+                if (ready && write(watcher->ready_fd, &one, sizeof(one)) < 0) {
+                    error_log("Failed to signal consumer: %s", strerror(errno));
+                }
+            }
+        } else {
+            lock_watcher(watcher);
+            fill_ring(watcher, monotonic_ns());
+            ready = lanes_ready(watcher);
+            pending_ms = pending_wait_ms(watcher, monotonic_ns());
+            fanotify_fd = watcher->fanotify.fd;
+            pthread_mutex_unlock(&watcher->mutex);
+        }
+        if (ready) break;
+        
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            int64_t elapsed = (int64_t)((monotonic_ns() - start) / 1000000);
+            if (elapsed >= timeout_ms) break;
+            wait_ms = (timeout_ms - elapsed > INT_MAX) ? INT_MAX : (int)(timeout_ms - elapsed);
+        }
+        if (pending_ms >= 0 && (wait_ms < 0 || pending_ms < wait_ms)) wait_ms = pending_ms;
+        
+        // Another watcher's thread may pump our events into the inbox
+        struct pollfd fds[5] = {
+            { reader ? watcher->ready_fd : watcher->inotify_fd, POLLIN, 0 },
+            { watcher->wake_fd, POLLIN, 0 },
+            { fanotify_fd, POLLIN, 0 },
+            { reader ? -1 : watcher->sub.inbox_fd, POLLIN, 0 },
+            { stop_fd, POLLIN, 0 },
+        };
+        int n = poll(fds, 5, wait_ms);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || (fds[1].revents & POLLIN) || (fds[4].revents & POLLIN)) break; // Error, close() or stop
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) break;
+    }
+    
+    int result = ready && !atomic_load(&watcher->closed);
+    atomic_fetch_sub(&watcher->waiters, 1);
+    return result;
+}
+
+int filewatcher_wait(FileWatcher *watcher, int64_t timeout_ms) {
+    return wait_ready(watcher, timeout_ms, -1);
+}
+
+// Push delivery state. Allocated apart from the watcher so a thread told
+// to stop from inside its own callback can finish after the watcher is gone.
+struct ListenerThread {
+    FileWatcher *watcher;         // Not touched once stopping is set
+    FileWatcherListener listener;
+    int max_batch;
+    uint64_t max_delay_ns;
+    FileWatcherEvent *events;     // max_batch slots
+    char *buf;                    // Path storage for one batch
+    size_t buf_size;
+    int stop_fd;                  // eventfd that wakes the thread to stop
+    _Atomic int stopping;
+    int detached;                 // Stopped from its own callback; frees itself
+    pthread_t thread;
+};
+
+static void free_listener_thread(ListenerThread *thread) {
+    if (thread->stop_fd >= 0) close(thread->stop_fd);
+    free(thread->events);
+    free(thread->buf);
+    free(thread);
+}
+
+// Bytes of buf taken by a batch: the last event's path ends it
+static size_t batch_bytes(const ListenerThread *thread, int count) {
+    const FileWatcherEvent *last = &thread->events[count - 1];
+    return (size_t)(last->path - thread->buf) + last->path_len + 1;
+}
+
+// Take one batch: block for the first event, then top the batch up until
+// it is full, the buffer is, or max_delay_ns has passed
+static int collect_batch(ListenerThread *thread) {
+    FileWatcher *watcher = thread->watcher;
+    int count = 0;
+    while (count == 0) {
+        if (!wait_ready(watcher, -1, thread->stop_fd)) return 0;
+        count = filewatcher_poll(watcher, thread->events, thread->max_batch, thread->buf, thread->buf_size);
+        if (count < 0) count = 0;
+    }
+    
+    uint64_t deadline = monotonic_ns() + thread->max_delay_ns;
+    while (count < thread->max_batch && !atomic_load(&thread->stopping)) {
+        size_t used = batch_bytes(thread, count);
+        if (thread->buf_size - used < FILEWATCHER_MAX_EVENT_BYTES) break;
+        int got = filewatcher_poll(watcher, thread->events + count, thread->max_batch - count,
+                                   thread->buf + used, thread->buf_size - used);
+        if (got > 0) {
+            count += got;
+            continue;
+        }
+        
+        uint64_t now = monotonic_ns();
+        if (now >= deadline) break;
+        int64_t remaining_ms = (int64_t)((deadline - now + 999999) / 1000000);
+        if (!wait_ready(watcher, remaining_ms, thread->stop_fd)) break;
+    }
+    return count;
+}
+
+static void *listener_main(void *arg) {
+    ListenerThread *thread = arg;
+    const FileWatcherListener *listener = &thread->listener;
+    
+    if (listener->start == NULL || listener->start(listener->context) == 0) {
+        while (!atomic_load(&thread->stopping) && !atomic_load(&thread->watcher->closed)) {
+            int count = collect_batch(thread);
+            // A batch already taken is delivered even when stopping, or it would be lost
+            if (count > 0) listener->deliver(listener->context, thread->events, count);
+        }
+    }
+    if (listener->stop != NULL) listener->stop(listener->context);
+    if (thread->detached) free_listener_thread(thread);
+    return NULL;
+}
+
+// Stop a delivery thread. Caller holds listener_lock.
+static void stop_listener(ListenerThread *thread) {
+    if (thread == NULL) return;
+    
+    uint64_t one = 1;
+    atomic_store(&thread->stopping, 1);
+    if (write(thread->stop_fd, &one, sizeof(one)) < 0) {
+        error_log("Failed to wake listener thread: %s", strerror(errno));
+    }
+    if (pthread_equal(thread->thread, pthread_self())) {
+        // Called from its own callback: it finishes once that returns
+        thread->detached = 1;
+        pthread_detach(thread->thread);
+        return;
+    }
+    pthread_join(thread->thread, NULL);
+    free_listener_thread(thread);
+}
+
+int filewatcher_set_listener(FileWatcher *watcher, const FileWatcherListener *listener,
+                             int max_batch, uint32_t max_delay_ms) {
+    if (listener != NULL && (listener->deliver == NULL || max_batch < 1)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    pthread_mutex_lock(&watcher->listener_lock);
+    stop_listener(watcher->listener);
+    watcher->listener = NULL;
+    if (listener == NULL) {
+        pthread_mutex_unlock(&watcher->listener_lock);
+        return 0;
+    }
+    
+    // Room for max_batch typical paths, and always for one of full length
+    ListenerThread *thread = calloc(1, sizeof(ListenerThread));
+    int error = 0;
+    if (thread == NULL) {
+        error = ENOMEM;
+    } else {
+        thread->watcher = watcher;
+        thread->listener = *listener;
+        thread->max_batch = max_batch;
+        thread->max_delay_ns = (uint64_t)max_delay_ms * 1000000ull;
+        thread->buf_size = (size_t)max_batch * 128 + FILEWATCHER_MAX_EVENT_BYTES;
+        thread->events = malloc(sizeof(FileWatcherEvent) * (size_t)max_batch);
+        thread->buf = malloc(thread->buf_size);
+        thread->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        atomic_init(&thread->stopping, 0);
+        if (thread->stop_fd < 0) error = errno;
+        else if (thread->events == NULL || thread->buf == NULL) error = ENOMEM;
+    }
+    if (error == 0 && atomic_load(&watcher->closed)) error = EBADF;
+    if (error == 0) error = pthread_create(&thread->thread, NULL, listener_main, thread);
+    if (error == 0) watcher->listener = thread;
+    pthread_mutex_unlock(&watcher->listener_lock);
+    
+    if (error != 0) {
+        if (thread != NULL) free_listener_thread(thread);
+        error_log("Failed to start listener thread: %s", strerror(error));
+        if (listener->stop != NULL) listener->stop(listener->context);
+        errno = error;
+        return -1;
+    }
+    debug_log("Listener started: batches of up to %d events, %u ms delay", max_batch, max_delay_ms);
+    return 0;
+}
+
+void filewatcher_close(FileWatcher *watcher) {
+    if (atomic_exchange(&watcher->closed, 1)) return;
+    
+    // Wake any thread in filewatcher_wait and let it leave before the fd goes away
+    uint64_t one = 1;
+    if (write(watcher->wake_fd, &one, sizeof(one)) < 0) {
+        error_log("Failed to wake waiting threads: %s", strerror(errno));
+    }
+    while (atomic_load(&watcher->waiters) > 0) sched_yield();
+    pthread_mutex_lock(&watcher->listener_lock);
+    stop_listener(watcher->listener);
+    watcher->listener = NULL;
+    pthread_mutex_unlock(&watcher->listener_lock);
+    if (atomic_load(&watcher->reader_running)) pthread_join(watcher->reader, NULL);
+    
+    lock_watcher(watcher);
+    // Leaving the engine releases every kernel watch only this watcher held
+    if (watcher->engine != NULL) watch_engine_unsubscribe(watcher->engine, &watcher->sub);
+    watcher->engine = NULL;
+    watcher->inotify_fd = -1;
+    fanotify_source_close(&watcher->fanotify);
+    // Release the file so the next run can take it
+    watch_journal_close(&watcher->journal);
+    pthread_mutex_unlock(&watcher->mutex);
+}
+
+void filewatcher_destroy(FileWatcher *watcher) {
+    if (watcher == NULL) return;
+    
+    filewatcher_close(watcher);
+    release_watcher(watcher);
+}
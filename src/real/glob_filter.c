@@ -0,0 +1,106 @@
+/**
+ * @file glob_filter.c
+ * @brief Path filters with literal and suffix fast paths over fnmatch
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "glob_filter.h"
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pick the cheapest way to match a pattern. Suffixes only apply to name
+// patterns, where `*` may match anything.
+static GlobKind classify(const char *pattern, int anchored) {
+    if (strpbrk(pattern, "*?[\\") == NULL) return GLOB_LITERAL;
+    if (!anchored && pattern[0] == '*' && strpbrk(pattern + 1, "*?[\\") == NULL) return GLOB_SUFFIX;
+    return GLOB_GENERIC;
+}
+
+int glob_filter_init(GlobFilter *filter, const char *const *patterns, size_t count) {
+    filter->patterns = NULL;
+    filter->count = 0;
+    if (count == 0) return 0;
+
+    filter->patterns = calloc(count, sizeof(GlobPattern));
+    if (filter->patterns == NULL) return -1;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *text = patterns[i];
+        size_t len = strlen(text);
+        int anchored = 0;
+        int dir_only = 0;
+
+        if (len > 0 && text[0] == '/') {
+            anchored = 1;
+            text++;
+            len--;
+        }
+        while (len > 0 && text[len - 1] == '/') {
+            dir_only = 1;
+            len--;
+        }
+        if (len == 0) continue; // "/" or "" would match nothing useful
+
+        if (memchr(text, '/', len) != NULL) anchored = 1;
+
+        GlobPattern *pattern = &filter->patterns[filter->count];
+        pattern->pattern = malloc(len + 1);
+        if (pattern->pattern == NULL) {
+            glob_filter_destroy(filter);
+            return -1;
+        }
+        memcpy(pattern->pattern, text, len);
+        pattern->pattern[len] = '\0';
+        pattern->len = len;
+        pattern->kind = classify(pattern->pattern, anchored);
+        pattern->dir_only = dir_only;
+        pattern->anchored = anchored;
+        filter->count++;
+    }
+    return 0;
+}
+
+void glob_filter_destroy(GlobFilter *filter) {
+    for (size_t i = 0; i < filter->count; i++) {
+        free(filter->patterns[i].pattern);
+    }
+    free(filter->patterns);
+    filter->patterns = NULL;
+    filter->count = 0;
+}
+
+int glob_filter_match(const GlobFilter *filter, const char *rel_path, int is_dir) {
+    if (filter->count == 0) return 0;
+
+    const char *name = strrchr(rel_path, '/');
+    name = (name != NULL) ? name + 1 : rel_path;
+    size_t name_len = strlen(name);
+    size_t rel_len = (size_t)(name - rel_path) + name_len;
+
+    for (size_t i = 0; i < filter->count; i++) {
+        const GlobPattern *pattern = &filter->patterns[i];
+        if (pattern->dir_only && !is_dir) continue;
+
+        const char *subject = pattern->anchored ? rel_path : name;
+        size_t subject_len = pattern->anchored ? rel_len : name_len;
+        switch (pattern->kind) {
+            case GLOB_LITERAL:
+                if (subject_len == pattern->len && memcmp(subject, pattern->pattern, subject_len) == 0) return 1;
+                break;
+            case GLOB_SUFFIX: {
+                size_t tail = pattern->len - 1;
+                if (subject_len >= tail &&
+                    memcmp(subject + subject_len - tail, pattern->pattern + 1, tail) == 0) return 1;
+                break;
+            }
+            default:
+                if (fnmatch(pattern->pattern, subject, pattern->anchored ? FNM_PATHNAME : 0) == 0) return 1;
+                break;
+        }
+    }
+    return 0;
+}
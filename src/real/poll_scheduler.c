@@ -0,0 +1,385 @@
+/**
+ * @file poll_scheduler.c
+ * @brief Timer wheel of directories polled by listing and diffing
+ *
+ * Directories sit in fixed slots linked into the wheel slot of their due
+ * tick, so scheduling, rescheduling and removal are O(1) and a run only
+ * walks the ticks that passed. A wd -> slot table with linear probing
+ * finds a directory by its pseudo wd, rebuilt at 70% load like the watch
+ * registry. Listings are dir_snapshot tables of their own, separate from
+ * the watcher's overflow snapshots.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "poll_scheduler.h"
+#include "event_ring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#define POLL_INDEX_INITIAL 64
+#define POLL_INDEX_TOMBSTONE UINT32_MAX
+#define POLL_TICK_NS ((uint64_t)POLL_TICK_MS * 1000000ull)
+
+static uint32_t hash_wd(int wd) {
+    return (uint32_t)wd * 0x9E3779B1u;
+}
+
+static PolledDir *dir_at(const PollScheduler *poller, uint32_t slot) {
+    return &poller->dirs[slot - 1];
+}
+
+// 1-based dirs slot of wd, 0 if it is not polled
+static uint32_t find_slot(const PollScheduler *poller, int wd) {
+    if (poller->index_capacity == 0 || wd < POLL_WD_BASE) return 0;
+
+    uint32_t mask = poller->index_capacity - 1;
+    uint32_t pos = hash_wd(wd) & mask;
+    while (poller->index[pos] != 0) {
+        uint32_t slot = poller->index[pos];
+        if (slot != POLL_INDEX_TOMBSTONE && dir_at(poller, slot)->wd == wd) return slot;
+        pos = (pos + 1) & mask;
+    }
+    return 0;
+}
+
+static void index_insert(PollScheduler *poller, uint32_t slot) {
+    uint32_t mask = poller->index_capacity - 1;
+    uint32_t pos = hash_wd(dir_at(poller, slot)->wd) & mask;
+    while (poller->index[pos] != 0) pos = (pos + 1) & mask;
+    poller->index[pos] = slot;
+    poller->index_used++;
+}
+
+// Rebuild the index at a new capacity, dropping tombstones
+static int rebuild_index(PollScheduler *poller, uint32_t capacity) {
+    uint32_t *table = calloc(capacity, sizeof(uint32_t));
+    if (table == NULL) return -1;
+
+    uint32_t *old = poller->index;
+    uint32_t old_capacity = poller->index_capacity;
+    poller->index = table;
+    poller->index_capacity = capacity;
+    poller->index_used = 0;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i] != 0 && old[i] != POLL_INDEX_TOMBSTONE) index_insert(poller, old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+static void index_remove(PollScheduler *poller, int wd) {
+    uint32_t mask = poller->index_capacity - 1;
+    uint32_t pos = hash_wd(wd) & mask;
+    while (poller->index[pos] != 0) {
+        uint32_t slot = poller->index[pos];
+        if (slot != POLL_INDEX_TOMBSTONE && dir_at(poller, slot)->wd == wd) {
+            poller->index[pos] = POLL_INDEX_TOMBSTONE;
+            return;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+// Link a directory into the wheel slot of its due tick
+static void schedule(PollScheduler *poller, uint32_t slot) {
+    PolledDir *dir = dir_at(poller, slot);
+    uint32_t *head = &poller->wheel[dir->due_tick % POLL_WHEEL_SLOTS];
+    dir->prev = 0;
+    dir->next = *head;
+    if (*head != 0) dir_at(poller, *head)->prev = slot;
+    *head = slot;
+}
+
+static void unschedule(PollScheduler *poller, uint32_t slot) {
+    PolledDir *dir = dir_at(poller, slot);
+    if (dir->prev != 0) {
+        dir_at(poller, dir->prev)->next = dir->next;
+    } else {
+        poller->wheel[dir->due_tick % POLL_WHEEL_SLOTS] = dir->next;
+    }
+    if (dir->next != 0) dir_at(poller, dir->next)->prev = dir->prev;
+    dir->prev = dir->next = 0;
+}
+
+// Ticks until a directory polled at interval_ms is due again, at least one
+static uint64_t interval_ticks(uint32_t interval_ms) {
+    uint64_t ticks = interval_ms / POLL_TICK_MS;
+    return (ticks > 0) ? ticks : 1;
+}
+
+// Append one record to the pending output. Returns -1 on allocation failure.
+static int queue_record(PollScheduler *poller, int wd, uint32_t mask, const char *name, size_t name_len) {
+    // Names are padded like the kernel's, keeping every record aligned
+    uint32_t len = (name_len > 0) ? (uint32_t)((name_len + 1 + 3) & ~(size_t)3) : 0;
+    size_t size = sizeof(struct inotify_event) + len;
+    if (poller->out_len + size > poller->out_capacity) {
+        size_t capacity = poller->out_capacity ? poller->out_capacity * 2 : 4096;
+        while (capacity < poller->out_len + size) capacity *= 2;
+        char *grown = realloc(poller->out, capacity);
+        if (grown == NULL) return -1;
+        poller->out = grown;
+        poller->out_capacity = capacity;
+    }
+
+    struct inotify_event *event = (struct inotify_event *)(poller->out + poller->out_len);
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = 0;
+    event->len = len;
+    if (len > 0) {
+        memcpy(event->name, name, name_len);
+        memset(event->name + name_len, 0, len - name_len);
+    }
+    poller->out_len += size;
+    return 0;
+}
+
+// State for turning one directory's diff into records
+typedef struct {
+    PollScheduler *poller;
+    const PolledDir *dir;
+    int wd;  // Reported as, the real wd of a directory being handed off
+} PollDiff;
+
+static void on_poll_diff(void *ctx, uint8_t kind, int is_dir, const char *name, size_t name_len) {
+    PollDiff *diff = ctx;
+    uint32_t mask = (kind == RING_CREATED) ? IN_CREATE : (kind == RING_DELETED) ? IN_DELETE : IN_MODIFY;
+    if (!(diff->dir->mask & mask)) return;
+    if (is_dir) mask |= IN_ISDIR;
+    // Lost records are no worse than a missed poll; the next one finds the change again
+    queue_record(diff->poller, diff->wd, mask, name, name_len);
+}
+
+// Stop polling the directory in slot and free it
+static void release_slot(PollScheduler *poller, uint32_t slot) {
+    PolledDir *dir = dir_at(poller, slot);
+    unschedule(poller, slot);
+    index_remove(poller, dir->wd);
+    snapshot_table_remove(&poller->listings, dir->wd);
+    if (poller->candidate == dir->wd) poller->candidate = -1;
+    dir->wd = -1;
+    dir->next = poller->free_head;
+    poller->free_head = slot;
+    poller->count--;
+}
+
+// List one due directory, queue what changed, and reschedule it by how
+// busy it was. Returns 0, or -1 if the directory is gone and was dropped.
+static int poll_dir(PollScheduler *poller, uint32_t slot, uint64_t now_tick, PollPathFn path_of, void *ctx) {
+    PolledDir *dir = dir_at(poller, slot);
+    size_t path_len;
+    const char *path = path_of(ctx, dir->wd, &path_len);
+    if (path == NULL) {
+        release_slot(poller, slot);
+        return -1;
+    }
+
+    PollDiff diff = { poller, dir, dir->wd };
+    int changes = snapshot_rescan(&poller->listings, dir->wd, path, on_poll_diff, &diff);
+    if (changes < 0 && (errno == ENOENT || errno == ENOTDIR)) {
+        queue_record(poller, dir->wd, IN_IGNORED, NULL, 0);
+        release_slot(poller, slot);
+        return -1;
+    }
+
+    // Busy directories are looked at again soon, quiet ones ever more rarely
+    if (changes > 0) {
+        dir->interval_ms = POLL_MIN_INTERVAL_MS;
+        dir->heat++;
+        if (dir->heat >= POLL_PROMOTE_HEAT) {
+            uint32_t best = (poller->candidate >= 0) ? find_slot(poller, poller->candidate) : 0;
+            if (best == 0 || dir_at(poller, best)->heat < dir->heat) poller->candidate = dir->wd;
+        }
+    } else {
+        if (dir->heat > 0) dir->heat--;
+        dir->interval_ms *= 2;
+        if (dir->interval_ms > POLL_MAX_INTERVAL_MS) dir->interval_ms = POLL_MAX_INTERVAL_MS;
+    }
+    dir->due_tick = now_tick + interval_ticks(dir->interval_ms);
+    schedule(poller, slot);
+    return 0;
+}
+
+int poll_scheduler_init(PollScheduler *poller) {
+    memset(poller, 0, sizeof(*poller));
+    poller->next_wd = POLL_WD_BASE;
+    poller->candidate = -1;
+    poller->promote_backoff_ms = POLL_PROMOTE_BACKOFF_MS;
+    return snapshot_table_init(&poller->listings);
+}
+
+void poll_scheduler_destroy(PollScheduler *poller) {
+    snapshot_table_destroy(&poller->listings);
+    free(poller->dirs);
+    free(poller->index);
+    free(poller->out);
+    memset(poller, 0, sizeof(*poller));
+    poller->candidate = -1;
+}
+
+int poll_scheduler_add(PollScheduler *poller, const char *path, uint32_t mask, uint64_t now) {
+    if ((poller->index_used + 1) * 10 >= poller->index_capacity * 7) {
+        uint32_t capacity = poller->index_capacity ? poller->index_capacity : POLL_INDEX_INITIAL;
+        if ((poller->count + 1) * 10 >= capacity * 7 / 2) capacity *= 2;
+        if (rebuild_index(poller, capacity) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    if (poller->free_head == 0 && poller->dir_used == poller->dir_capacity) {
+        uint32_t capacity = poller->dir_capacity ? poller->dir_capacity * 2 : 64;
+        PolledDir *grown = realloc(poller->dirs, sizeof(PolledDir) * capacity);
+        if (grown == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        poller->dirs = grown;
+        poller->dir_capacity = capacity;
+    }
+
+    int wd = poller->next_wd;
+    if (snapshot_scan(&poller->listings, wd, path) != 0) return -1;
+    poller->next_wd++;
+
+    uint32_t slot;
+    if (poller->free_head != 0) {
+        slot = poller->free_head;
+        poller->free_head = dir_at(poller, slot)->next;
+    } else {
+        slot = ++poller->dir_used;
+    }
+    if (poller->count == 0) poller->tick = now / POLL_TICK_NS;
+
+    PolledDir *dir = dir_at(poller, slot);
+    dir->wd = wd;
+    dir->mask = mask;
+    dir->interval_ms = POLL_MIN_INTERVAL_MS;
+    dir->heat = 0;
+    dir->due_tick = now / POLL_TICK_NS + interval_ticks(POLL_MIN_INTERVAL_MS);
+    index_insert(poller, slot);
+    schedule(poller, slot);
+    poller->count++;
+    return wd;
+}
+
+void poll_scheduler_remove(PollScheduler *poller, int wd, int notify) {
+    uint32_t slot = find_slot(poller, wd);
+    if (slot == 0) return;
+
+    release_slot(poller, slot);
+    if (notify) queue_record(poller, wd, IN_IGNORED, NULL, 0);
+}
+
+int poll_scheduler_has(const PollScheduler *poller, int wd) {
+    return find_slot(poller, wd) != 0;
+}
+
+uint32_t poll_scheduler_mask(const PollScheduler *poller, int wd) {
+    uint32_t slot = find_slot(poller, wd);
+    return (slot != 0) ? dir_at(poller, slot)->mask : 0;
+}
+
+int poll_scheduler_run(PollScheduler *poller, uint64_t now, PollPathFn path_of, void *ctx) {
+    uint64_t now_tick = now / POLL_TICK_NS;
+    int polled = 0;
+    poller->backlog = 0;
+    if (poller->count == 0) {
+        poller->tick = now_tick;
+        return 0;
+    }
+
+    // One turn of the wheel visits every slot, however long it sat idle
+    if (now_tick >= poller->tick + POLL_WHEEL_SLOTS) poller->tick = now_tick - POLL_WHEEL_SLOTS + 1;
+
+    for (; poller->tick <= now_tick; poller->tick++) {
+        uint32_t slot = poller->wheel[poller->tick % POLL_WHEEL_SLOTS];
+        while (slot != 0) {
+            PolledDir *dir = dir_at(poller, slot);
+            uint32_t next = dir->next;
+            if (dir->due_tick <= now_tick) {
+                if (polled == POLL_BATCH_DIRS) {
+                    // Leave the rest of this tick for the next run
+                    poller->backlog = 1;
+                    return polled;
+                }
+                unschedule(poller, slot);
+                poll_dir(poller, slot, now_tick, path_of, ctx);
+                polled++;
+            }
+            slot = next;
+        }
+    }
+    return polled;
+}
+
+size_t poll_scheduler_take(PollScheduler *poller, char **buf, size_t *capacity) {
+    size_t len = poller->out_len;
+    if (len == 0) return 0;
+
+    char *spare = *buf;
+    size_t spare_capacity = *capacity;
+    *buf = poller->out;
+    *capacity = poller->out_capacity;
+    poller->out = spare;
+    poller->out_capacity = spare_capacity;
+    poller->out_len = 0;
+    return len;
+}
+
+uint64_t poll_scheduler_deadline(const PollScheduler *poller, uint64_t now) {
+    if (poller->out_len > 0 || poller->backlog) return now;
+    if (poller->count == 0) return UINT64_MAX;
+    // Ticks have passed since the last run, which may have made some due
+    if (now / POLL_TICK_NS >= poller->tick) return now;
+
+    // After a run every directory is due within one turn of the wheel, so
+    // the first occupied slot from the next tick on holds the earliest
+    for (uint64_t tick = poller->tick; tick < poller->tick + POLL_WHEEL_SLOTS; tick++) {
+        uint32_t slot = poller->wheel[tick % POLL_WHEEL_SLOTS];
+        if (slot == 0) continue;
+
+        uint64_t due = UINT64_MAX;
+        for (; slot != 0; slot = dir_at(poller, slot)->next) {
+            if (dir_at(poller, slot)->due_tick < due) due = dir_at(poller, slot)->due_tick;
+        }
+        return due * POLL_TICK_NS;
+    }
+    return UINT64_MAX;
+}
+
+int poll_scheduler_candidate(PollScheduler *poller, uint64_t now) {
+    if (poller->candidate < 0 || now < poller->promote_at) return -1;
+
+    int wd = poller->candidate;
+    poller->candidate = -1;
+    uint32_t slot = find_slot(poller, wd);
+    if (slot == 0) return -1;
+    // It has to earn its next offer
+    dir_at(poller, slot)->heat = 0;
+    return wd;
+}
+
+void poll_scheduler_handoff(PollScheduler *poller, int wd, int real_wd, const char *path) {
+    uint32_t slot = find_slot(poller, wd);
+    if (slot == 0) return;
+
+    PollDiff diff = { poller, dir_at(poller, slot), real_wd };
+    snapshot_rescan(&poller->listings, wd, path, on_poll_diff, &diff);
+    release_slot(poller, slot);
+    queue_record(poller, wd, IN_IGNORED, NULL, 0);
+    poller->promote_backoff_ms = POLL_PROMOTE_BACKOFF_MS;
+    poller->promote_at = 0;
+}
+
+void poll_scheduler_defer(PollScheduler *poller, uint64_t now) {
+    poller->promote_at = now + (uint64_t)poller->promote_backoff_ms * 1000000ull;
+    poller->promote_backoff_ms *= 2;
+    if (poller->promote_backoff_ms > POLL_PROMOTE_MAX_BACKOFF_MS) {
+        poller->promote_backoff_ms = POLL_PROMOTE_MAX_BACKOFF_MS;
+    }
+}
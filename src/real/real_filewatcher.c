@@ -2,9 +2,11 @@
  * @file real_filewatcher.c
  * @brief Real inotify-based FileWatcher JNI implementation
  * 
- * Complete file monitoring implementation using Linux inotify API.
- * Provides thread-safe, high-performance file system event detection
- * with proper Java object creation and memory management.
+ * Thin JNI layer over the watcher core in filewatcher_core.c: converts
+ * Java strings and arrays, and turns delivered events into Java objects.
+ * All watching, parsing and buffering lives in the core. These are the
+ * natives for the inotify, fanotify and poll backends; JNI_OnLoad swaps in
+ * stub_filewatcher.c when the stub is chosen.
  * 
  * @author yamsergey
  * @version 1.0.0
@@ -13,88 +15,388 @@
 
 #define REAL_IMPLEMENTATION
 #include "filewatcher_jni.h"
-#include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/inotify.h>
-#include <sys/select.h>
-#include <errno.h>
-#include <stdarg.h>
-
-// FileWatcher structure is now defined in header file
 
 // Global cache for JNI classes and methods
 static jclass event_class = NULL;
 static jmethodID event_constructor = NULL;
-static jclass eventkind_class = NULL;
-static jfieldID created_field = NULL;
-static jfieldID modified_field = NULL;
-static jfieldID deleted_field = NULL;
-static jfieldID overflow_field = NULL;
+static jmethodID event_moved_constructor = NULL; // Optional: Event(kind, path, oldPath)
+static jmethodID listener_on_events = NULL; // Optional: Listener.onEvents(Event[])
+
+// EventKind constants pinned as global refs, indexed by RingEventKind.
+// MOVED is optional, like the constructor that goes with it.
+static const char *const kind_names[] = { "CREATED", "MODIFIED", "DELETED", "OVERFLOW", "MOVED" };
+static jobject kind_refs[RING_MOVED + 1];
+
+// Drop every cached reference so the next init_jni_cache starts over
+static void release_jni_cache(JNIEnv *env) {
+    for (size_t i = 0; i < sizeof(kind_refs) / sizeof(kind_refs[0]); i++) {
+        if (kind_refs[i] != NULL) (*env)->DeleteGlobalRef(env, kind_refs[i]);
+        kind_refs[i] = NULL;
+    }
+    if (event_class != NULL) (*env)->DeleteGlobalRef(env, event_class);
+    event_class = NULL;
+    event_constructor = NULL;
+    event_moved_constructor = NULL;
+    listener_on_events = NULL;
+}
+
+// Pin one EventKind constant. Returns 0, with NoSuchFieldError pending,
+// if the field is missing.
+static int cache_event_kind(JNIEnv *env, jclass eventkind_class, int kind) {
+    jfieldID field = (*env)->GetStaticFieldID(env, eventkind_class, kind_names[kind],
+        "Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;");
+    if (field == NULL) return 0;
+    jobject value = (*env)->GetStaticObjectField(env, eventkind_class, field);
+    if (value == NULL) return 0;
+    kind_refs[kind] = (*env)->NewGlobalRef(env, value);
+    (*env)->DeleteLocalRef(env, value);
+    return kind_refs[kind] != NULL;
+}
 
-// Initialize JNI classes and method IDs
+// Initialize JNI classes, method IDs and EventKind constants
 static int init_jni_cache(JNIEnv *env) {
     if (event_class != NULL) return 1; // Already initialized
     
     // Find Event class
     jclass local_event_class = (*env)->FindClass(env, "com/jetbrains/analyzer/filewatcher/FileWatcher$Event");
     if (local_event_class == NULL) return 0;
-    event_class = (jclass)(*env)->NewGlobalRef(env, local_event_class);
+    jclass global_event_class = (jclass)(*env)->NewGlobalRef(env, local_event_class);
     (*env)->DeleteLocalRef(env, local_event_class);
+    if (global_event_class == NULL) return 0;
     
     // Get Event constructor
-    event_constructor = (*env)->GetMethodID(env, event_class, "<init>", 
+    event_constructor = (*env)->GetMethodID(env, global_event_class, "<init>", 
         "(Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;Ljava/lang/String;)V");
-    if (event_constructor == NULL) return 0;
     
-    // Find EventKind class
-    jclass local_eventkind_class = (*env)->FindClass(env, "com/jetbrains/analyzer/filewatcher/FileWatcher$EventKind");
-    if (local_eventkind_class == NULL) return 0;
-    eventkind_class = (jclass)(*env)->NewGlobalRef(env, local_eventkind_class);
-    (*env)->DeleteLocalRef(env, local_eventkind_class);
+    // Find EventKind class and pin its constants
+    jclass eventkind_class = (*env)->FindClass(env, "com/jetbrains/analyzer/filewatcher/FileWatcher$EventKind");
+    int ok = (event_constructor != NULL && eventkind_class != NULL);
+    for (int kind = RING_CREATED; ok && kind <= RING_OVERFLOW; kind++) {
+        ok = cache_event_kind(env, eventkind_class, kind);
+    }
     
-    // Get EventKind enum fields
-    created_field = (*env)->GetStaticFieldID(env, eventkind_class, "CREATED", 
-        "Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;");
-    modified_field = (*env)->GetStaticFieldID(env, eventkind_class, "MODIFIED", 
-        "Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;");
-    deleted_field = (*env)->GetStaticFieldID(env, eventkind_class, "DELETED", 
-        "Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;");
-    overflow_field = (*env)->GetStaticFieldID(env, eventkind_class, "OVERFLOW", 
-        "Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;");
+    // Rename pairing needs EventKind.MOVED and the three-argument Event
+    // constructor; older Java classes lack them and simply cannot enable it
+    if (ok && cache_event_kind(env, eventkind_class, RING_MOVED)) {
+        event_moved_constructor = (*env)->GetMethodID(env, global_event_class, "<init>",
+            "(Lcom/jetbrains/analyzer/filewatcher/FileWatcher$EventKind;Ljava/lang/String;Ljava/lang/String;)V");
+    }
+    if (ok && event_moved_constructor == NULL) (*env)->ExceptionClear(env);
+    if (eventkind_class != NULL) (*env)->DeleteLocalRef(env, eventkind_class);
     
-    if (created_field == NULL || modified_field == NULL || 
-        deleted_field == NULL || overflow_field == NULL) return 0;
+    // Push delivery needs FileWatcher.Listener, which older Java classes lack too
+    jclass listener_class = ok ? (*env)->FindClass(env, "com/jetbrains/analyzer/filewatcher/FileWatcher$Listener") : NULL;
+    if (listener_class != NULL) {
+        listener_on_events = (*env)->GetMethodID(env, listener_class, "onEvents",
+            "([Lcom/jetbrains/analyzer/filewatcher/FileWatcher$Event;)V");
+        (*env)->DeleteLocalRef(env, listener_class);
+    }
+    if (ok && listener_on_events == NULL) (*env)->ExceptionClear(env);
     
+    // Publish event_class last: it marks the cache as complete
+    event_class = global_event_class;
+    if (!ok) {
+        release_jni_cache(env);
+        return 0;
+    }
     return 1;
 }
 
-// Create a FileWatcher instance
-JNIEXPORT jlong JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_create(JNIEnv *env, jclass clazz) {
-    FileWatcher *watcher = malloc(sizeof(FileWatcher));
-    if (watcher == NULL) return 0;
+// Paths up to this many UTF-16 units are converted on the stack
+#define PATH_STACK_UNITS 1024
+
+// Build a Java string from a NUL-terminated path of len bytes. ASCII,
+// which almost every path is, is already Modified UTF-8 and goes to
+// NewStringUTF as it is. Anything else is decoded from UTF-8 into UTF-16
+// for NewString: Modified UTF-8 spells supplementary characters as
+// surrogate pairs, so NewStringUTF would garble emoji in file names, and
+// CheckJNI aborts on bytes that are not UTF-8 at all. Those become U+FFFD.
+static jstring new_path_string(JNIEnv *env, const char *path, size_t len) {
+    size_t ascii = 0;
+    while (ascii < len && (unsigned char)path[ascii] < 0x80) ascii++;
+    if (ascii == len) return (*env)->NewStringUTF(env, path);
     
-    watcher->inotify_fd = inotify_init1(IN_NONBLOCK);
-    if (watcher->inotify_fd == -1) {
-        free(watcher);
-        return 0;
+    // Every byte yields at most one unit except four-byte sequences, which yield two
+    jchar stack_units[PATH_STACK_UNITS];
+    jchar *units = (len <= PATH_STACK_UNITS) ? stack_units : malloc(len * sizeof(jchar));
+    if (units == NULL) return NULL;
+    
+    size_t count = 0;
+    for (size_t i = 0; i < len;) {
+        unsigned char lead = (unsigned char)path[i];
+        uint32_t cp = lead;
+        size_t extra = 0;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            cp = lead & 0x1F;
+            extra = 1;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            cp = lead & 0x0F;
+            extra = 2;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            cp = lead & 0x07;
+            extra = 3;
+        } else if (lead >= 0x80) {
+            cp = 0xFFFD;
+        }
+        
+        size_t j = 1;
+        while (j <= extra && i + j < len && ((unsigned char)path[i + j] & 0xC0) == 0x80) {
+            cp = (cp << 6) | ((unsigned char)path[i + j] & 0x3F);
+            j++;
+        }
+        // Truncated, overlong, surrogate or out-of-range sequences are one bad byte
+        if (j <= extra || (extra == 2 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) ||
+            (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF))) {
+            cp = 0xFFFD;
+            extra = 0;
+        }
+        i += extra + 1;
+        
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            units[count++] = (jchar)(0xD800 | (cp >> 10));
+            units[count++] = (jchar)(0xDC00 | (cp & 0x3FF));
+        } else {
+            units[count++] = (jchar)cp;
+        }
     }
     
-    pthread_mutex_init(&watcher->mutex, NULL);
-    watcher->buffer_pos = 0;
-    watcher->buffer_len = 0;
+    jstring result = (*env)->NewString(env, units, (jsize)count);
+    if (units != stack_units) free(units);
+    return result;
+}
+
+// Interned path strings. Build churn reports the same few hundred paths
+// over and over, so recent ones are kept as weak global references and
+// handed out again while Java still holds them, instead of allocating a
+// new String per event. Entries are least-recently-used first to go.
+#define STRING_CACHE_SLOTS 512
+#define STRING_CACHE_BUCKETS 1024 // Power of two
+#define STRING_CACHE_MAX_PATH 1024 // Longer paths bypass the cache
+
+typedef struct {
+    jweak string;
+    char *path;
+    uint32_t len;
+    uint32_t capacity;  // Bytes allocated for path
+    uint32_t hash;
+    int chain;          // Next slot in the bucket, 0 for none
+    int prev, next;     // Recency list, most recent first, 0 for none
+} CachedString;
+
+// Slot 0 is unused so that 0 can mean "none" in the links
+static pthread_mutex_t string_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CachedString string_slots[STRING_CACHE_SLOTS + 1];
+static int string_buckets[STRING_CACHE_BUCKETS];
+static int string_used;
+static int string_newest, string_oldest;
+static uint64_t string_hits, string_misses;
+
+// FNV-1a over the path bytes
+static uint32_t hash_path(const char *path, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding path, or 0. Caller holds string_cache_lock.
+static int find_cached_string(const char *path, size_t len, uint32_t hash) {
+    for (int i = string_buckets[hash & (STRING_CACHE_BUCKETS - 1)]; i != 0; i = string_slots[i].chain) {
+        CachedString *slot = &string_slots[i];
+        if (slot->hash == hash && slot->len == len && memcmp(slot->path, path, len) == 0) return i;
+    }
+    return 0;
+}
+
+static void unlink_recent(int i) {
+    CachedString *slot = &string_slots[i];
+    if (slot->prev != 0) string_slots[slot->prev].next = slot->next;
+    else string_newest = slot->next;
+    if (slot->next != 0) string_slots[slot->next].prev = slot->prev;
+    else string_oldest = slot->prev;
+    slot->prev = slot->next = 0;
+}
+
+static void push_recent(int i) {
+    string_slots[i].next = string_newest;
+    if (string_newest != 0) string_slots[string_newest].prev = i;
+    string_newest = i;
+    if (string_oldest == 0) string_oldest = i;
+}
+
+static void unlink_chain(int i) {
+    int *link = &string_buckets[string_slots[i].hash & (STRING_CACHE_BUCKETS - 1)];
+    while (*link != i) link = &string_slots[*link].chain;
+    *link = string_slots[i].chain;
+}
+
+// Remember string for path, evicting the oldest entry if the cache is
+// full. Returns the reference that is no longer needed, if any, for the
+// caller to delete once the lock is dropped. Caller holds string_cache_lock.
+static jweak store_cached_string(const char *path, size_t len, uint32_t hash, jweak string) {
+    int i = find_cached_string(path, len, hash);
+    if (i != 0) {
+        // Another thread got here first, or the old string was collected
+        jweak old = string_slots[i].string;
+        string_slots[i].string = string;
+        unlink_recent(i);
+        push_recent(i);
+        return old;
+    }
     
-    // Initialize JNI cache
-    if (!init_jni_cache(env)) {
-        close(watcher->inotify_fd);
-        pthread_mutex_destroy(&watcher->mutex);
-        free(watcher);
-        return 0;
+    // Take a fresh slot while there are any, else the oldest one. Its
+    // buffer is grown before anything is unlinked, so a failed allocation
+    // leaves the cache as it was.
+    int fresh = (string_used < STRING_CACHE_SLOTS);
+    i = fresh ? string_used + 1 : string_oldest;
+    CachedString *slot = &string_slots[i];
+    if (slot->capacity < len) {
+        char *grown = realloc(slot->path, len);
+        if (grown == NULL) return string;
+        slot->path = grown;
+        slot->capacity = (uint32_t)len;
+    }
+    
+    jweak evicted = NULL;
+    if (fresh) {
+        string_used++;
+    } else {
+        unlink_recent(i);
+        unlink_chain(i);
+        evicted = slot->string;
+    }
+    memcpy(slot->path, path, len);
+    slot->len = (uint32_t)len;
+    slot->hash = hash;
+    slot->string = string;
+    int *bucket = &string_buckets[hash & (STRING_CACHE_BUCKETS - 1)];
+    slot->chain = *bucket;
+    *bucket = i;
+    push_recent(i);
+    return evicted;
+}
+
+// new_path_string() through the cache
+static jstring cached_path_string(JNIEnv *env, const char *path, size_t len) {
+    if (len > STRING_CACHE_MAX_PATH) return new_path_string(env, path, len);
+    uint32_t hash = hash_path(path, len);
+    
+    pthread_mutex_lock(&string_cache_lock);
+    int i = find_cached_string(path, len, hash);
+    jstring string = (i != 0) ? (*env)->NewLocalRef(env, string_slots[i].string) : NULL;
+    if (string != NULL) {
+        string_hits++;
+        unlink_recent(i);
+        push_recent(i);
+    } else {
+        string_misses++;
+    }
+    pthread_mutex_unlock(&string_cache_lock);
+    if (string != NULL) return string;
+    
+    // Build the string unlocked; only the weak reference goes in
+    string = new_path_string(env, path, len);
+    if (string == NULL) return NULL;
+    jweak weak = (*env)->NewWeakGlobalRef(env, string);
+    if (weak == NULL) {
+        (*env)->ExceptionClear(env);
+        return string;
+    }
+    pthread_mutex_lock(&string_cache_lock);
+    jweak old = store_cached_string(path, len, hash, weak);
+    pthread_mutex_unlock(&string_cache_lock);
+    if (old != NULL) (*env)->DeleteWeakGlobalRef(env, old);
+    return string;
+}
+
+// Forget every cached string
+static void release_string_cache(JNIEnv *env) {
+    pthread_mutex_lock(&string_cache_lock);
+    for (int i = 1; i <= string_used; i++) {
+        if (string_slots[i].string != NULL) (*env)->DeleteWeakGlobalRef(env, string_slots[i].string);
+        free(string_slots[i].path);
+    }
+    memset(string_slots, 0, sizeof(string_slots));
+    memset(string_buckets, 0, sizeof(string_buckets));
+    string_used = string_newest = string_oldest = 0;
+    pthread_mutex_unlock(&string_cache_lock);
+}
+
+// Create a Java Event object from a ring event kind and resolved paths.
+// Leaves no local references behind other than the returned object.
+static jobject create_event_object(JNIEnv *env, const FileWatcherEvent *event) {
+    uint8_t kind = event->kind;
+    jobject event_kind = (kind <= RING_MOVED) ? kind_refs[kind] : kind_refs[RING_MODIFIED];
+    
+    jstring path_string = cached_path_string(env, event->path, event->path_len);
+    if (path_string == NULL) return NULL;
+    
+    // Create Event object
+    jobject event_object;
+    if (kind == RING_MOVED) {
+        jstring old_string = cached_path_string(env, event->old_path, event->old_len);
+        if (old_string == NULL) {
+            (*env)->DeleteLocalRef(env, path_string);
+            return NULL;
+        }
+        event_object = (*env)->NewObject(env, event_class, event_moved_constructor,
+                                         event_kind, path_string, old_string);
+        (*env)->DeleteLocalRef(env, old_string);
+    } else {
+        event_object = (*env)->NewObject(env, event_class, event_constructor, event_kind, path_string);
+    }
+    (*env)->DeleteLocalRef(env, path_string);
+    
+    return event_object;
+}
+
+// Turn native events into an Event[]. The events are already taken from
+// the ring, so if an object cannot be created the ones built so far come
+// back as a shorter array, and only the rest are lost. Returns NULL, with
+// an exception pending, if not even the first one could be built.
+static jobjectArray new_event_array(JNIEnv *env, const FileWatcherEvent *events, int count) {
+    jobjectArray result = (*env)->NewObjectArray(env, count, event_class, NULL);
+    if (result == NULL) return NULL;
+    
+    // One local frame per event keeps the caller's table flat however
+    // large the batch is
+    jsize built = 0;
+    for (; built < count; built++) {
+        if ((*env)->PushLocalFrame(env, 4) != 0) break;
+        jobject item = create_event_object(env, &events[built]);
+        if (item != NULL) (*env)->SetObjectArrayElement(env, result, built, item);
+        (*env)->PopLocalFrame(env, NULL);
+        if (item == NULL) break;
     }
+    if (built == count) return result;
     
-    return (jlong)watcher;
+    error_log("Dropped %d of %d events: their Event objects could not be created", count - built, count);
+    if (built == 0) {
+        (*env)->DeleteLocalRef(env, result);
+        return NULL;
+    }
+    (*env)->ExceptionClear(env);
+    jobjectArray shorter = (*env)->NewObjectArray(env, built, event_class, NULL);
+    for (jsize i = 0; shorter != NULL && i < built; i++) {
+        jobject item = (*env)->GetObjectArrayElement(env, result, i);
+        (*env)->SetObjectArrayElement(env, shorter, i, item);
+        (*env)->DeleteLocalRef(env, item);
+    }
+    (*env)->DeleteLocalRef(env, result);
+    return shorter;
+}
+
+// Create a FileWatcher instance
+JNIEXPORT jlong JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_create(JNIEnv *env, jclass clazz) {
+    if (!init_jni_cache(env)) return 0;
+    return (jlong)filewatcher_create();
 }
 
 // Add a path to watch
@@ -106,13 +408,178 @@ Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watch(JNIEnv *env, jclass cl
     const char *path_str = (*env)->GetStringUTFChars(env, path, NULL);
     if (path_str == NULL) return JNI_FALSE;
     
-    // Watch for create, modify, delete, and move events
-    int wd = inotify_add_watch(watcher->inotify_fd, path_str, 
-        IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO);
-    
+    int result = filewatcher_watch(watcher, path_str);
     (*env)->ReleaseStringUTFChars(env, path, path_str);
     
-    return (wd >= 0) ? JNI_TRUE : JNI_FALSE;
+    return (result == 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Free a string list from copy_string_array (NULL is fine)
+static void free_string_array(char **strings, size_t count) {
+    if (strings == NULL) return;
+    for (size_t i = 0; i < count; i++) free(strings[i]);
+    free(strings);
+}
+
+// Copy a Java String[] into NUL-terminated C strings. Null elements stay
+// NULL in the result. Returns NULL on allocation failure; *count is set
+// to the array length (0 for a null array).
+static char **copy_string_array(JNIEnv *env, jobjectArray array, size_t *count) {
+    jsize length = (array != NULL) ? (*env)->GetArrayLength(env, array) : 0;
+    char **strings = calloc(length > 0 ? length : 1, sizeof(char *));
+    *count = (size_t)length;
+    if (strings == NULL) return NULL;
+    
+    for (jsize i = 0; i < length; i++) {
+        jstring item = (jstring)(*env)->GetObjectArrayElement(env, array, i);
+        if (item == NULL) continue;
+        const char *chars = (*env)->GetStringUTFChars(env, item, NULL);
+        if (chars != NULL) {
+            strings[i] = strdup(chars);
+            (*env)->ReleaseStringUTFChars(env, item, chars);
+        }
+        (*env)->DeleteLocalRef(env, item);
+        if (strings[i] == NULL) {
+            free_string_array(strings, (size_t)i);
+            return NULL;
+        }
+    }
+    return strings;
+}
+
+// Drop null elements so the pattern list is dense
+static size_t compact_strings(char **strings, size_t count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strings[i] != NULL) strings[kept++] = strings[i];
+    }
+    return kept;
+}
+
+// Add many paths to watch. The paths are packed into one buffer, each
+// converted with GetStringUTFRegion, so there is no allocation or release
+// per path, and the core watches them all under one lock.
+JNIEXPORT jintArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchAll(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                             jobjectArray paths) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || paths == NULL) return NULL;
+    
+    jsize length = (*env)->GetArrayLength(env, paths);
+    size_t count = (size_t)length;
+    size_t words = (count + 31) / 32;
+    const char **list = calloc(count > 0 ? count : 1, sizeof(char *));
+    size_t *offsets = calloc(count > 0 ? count : 1, sizeof(size_t));
+    int *errors = calloc(count > 0 ? count : 1, sizeof(int));
+    jint *report = calloc(words + count > 0 ? words + count : 1, sizeof(jint));
+    size_t capacity = 4096, used = 0;
+    char *packed = malloc(capacity);
+    int ok = (list != NULL && offsets != NULL && errors != NULL && report != NULL && packed != NULL);
+    
+    for (jsize i = 0; ok && i < length; i++) {
+        jstring item = (jstring)(*env)->GetObjectArrayElement(env, paths, i);
+        if (item == NULL) {
+            offsets[i] = SIZE_MAX;
+            continue;
+        }
+        size_t len = (size_t)(*env)->GetStringUTFLength(env, item);
+        if (used + len + 1 > capacity) {
+            while (used + len + 1 > capacity) capacity *= 2;
+            char *grown = realloc(packed, capacity);
+            if (grown == NULL) ok = 0;
+            else packed = grown;
+        }
+        if (ok) {
+            (*env)->GetStringUTFRegion(env, item, 0, (*env)->GetStringLength(env, item), packed + used);
+            packed[used + len] = '\0';
+            offsets[i] = used;
+            used += len + 1;
+        }
+        (*env)->DeleteLocalRef(env, item);
+    }
+    
+    jintArray array = NULL;
+    if (ok) {
+        // The buffer has stopped moving, so the pointers can be taken now
+        for (size_t i = 0; i < count; i++) list[i] = (offsets[i] == SIZE_MAX) ? NULL : packed + offsets[i];
+        filewatcher_watch_all(watcher, list, count, errors);
+        
+        size_t failed = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (errors[i] == 0) report[i / 32] |= (jint)(1u << (i % 32));
+            else report[words + failed++] = errors[i];
+        }
+        array = (*env)->NewIntArray(env, (jsize)(words + failed));
+        if (array != NULL) (*env)->SetIntArrayRegion(env, array, 0, (jsize)(words + failed), report);
+    }
+    free(packed);
+    free(report);
+    free(errors);
+    free(offsets);
+    free(list);
+    return array;
+}
+
+// Add a path to watch with an event filter
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchFiltered(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                  jstring path, jint mask,
+                                                                  jobjectArray includes, jobjectArray excludes) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    
+    size_t include_count, exclude_count;
+    char **include_list = copy_string_array(env, includes, &include_count);
+    char **exclude_list = copy_string_array(env, excludes, &exclude_count);
+    const char *path_str = (include_list != NULL && exclude_list != NULL)
+        ? (*env)->GetStringUTFChars(env, path, NULL) : NULL;
+    
+    int result = -1;
+    if (path_str != NULL) {
+        size_t kept_includes = compact_strings(include_list, include_count);
+        size_t kept_excludes = compact_strings(exclude_list, exclude_count);
+        result = filewatcher_watch_filtered(watcher, path_str, (uint32_t)mask,
+                                            (const char *const *)include_list, kept_includes,
+                                            (const char *const *)exclude_list, kept_excludes);
+        (*env)->ReleaseStringUTFChars(env, path, path_str);
+        include_count = kept_includes;
+        exclude_count = kept_excludes;
+    }
+    free_string_array(include_list, include_count);
+    free_string_array(exclude_list, exclude_count);
+    
+    return (result == 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Add watches for a whole directory tree
+JNIEXPORT jlongArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchRecursive(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                   jstring path, jobjectArray excludes) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return NULL;
+    
+    // Copy exclude patterns out of Java strings
+    size_t count;
+    char **patterns = copy_string_array(env, excludes, &count);
+    if (patterns == NULL) return NULL;
+    count = compact_strings(patterns, count);
+    
+    const char *path_str = (*env)->GetStringUTFChars(env, path, NULL);
+    CrawlResult result;
+    int ok = 0;
+    if (path_str != NULL) {
+        ok = (filewatcher_watch_recursive(watcher, path_str, (const char *const *)patterns,
+                                          count, &result) == 0);
+        (*env)->ReleaseStringUTFChars(env, path, path_str);
+    }
+    free_string_array(patterns, count);
+    if (!ok) return NULL;
+    
+    jlong report[2] = { (jlong)result.watches_added, (jlong)result.elapsed_ns };
+    jlongArray array = (*env)->NewLongArray(env, 2);
+    if (array == NULL) return NULL;
+    (*env)->SetLongArrayRegion(env, array, 0, 2, report);
+    return array;
 }
 
 // Remove a path from watching
@@ -121,76 +588,362 @@ Java_com_jetbrains_analyzer_filewatcher_FileWatcher_unwatch(JNIEnv *env, jclass
     FileWatcher *watcher = (FileWatcher*)watcherPtr;
     if (watcher == NULL) return;
     
-    // Note: In a real implementation, you'd need to track watch descriptors
-    // to properly remove specific watches. For simplicity, this is a no-op.
-    // You could maintain a hash map of path -> watch descriptor for this.
-}
-
-// Create a Java Event object from inotify event
-static jobject create_event_object(JNIEnv *env, struct inotify_event *event, const char *base_path) {
-    // Determine event kind
-    jobject event_kind;
-    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
-        event_kind = (*env)->GetStaticObjectField(env, eventkind_class, created_field);
-    } else if (event->mask & IN_MODIFY) {
-        event_kind = (*env)->GetStaticObjectField(env, eventkind_class, modified_field);
-    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
-        event_kind = (*env)->GetStaticObjectField(env, eventkind_class, deleted_field);
-    } else if (event->mask & IN_Q_OVERFLOW) {
-        event_kind = (*env)->GetStaticObjectField(env, eventkind_class, overflow_field);
-    } else {
-        event_kind = (*env)->GetStaticObjectField(env, eventkind_class, modified_field);
+    const char *path_str = (*env)->GetStringUTFChars(env, path, NULL);
+    if (path_str == NULL) return;
+    
+    filewatcher_unwatch(watcher, path_str);
+    (*env)->ReleaseStringUTFChars(env, path, path_str);
+}
+
+// Get next event (non-blocking)
+JNIEXPORT jobject JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_nextEvent(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return NULL;
+    
+    FileWatcherEvent event;
+    char buf[FILEWATCHER_MAX_EVENT_BYTES];
+    if (filewatcher_poll(watcher, &event, 1, buf, sizeof(buf)) != 1) return NULL;
+    return create_event_object(env, &event);
+}
+
+// Get up to max events in one call
+JNIEXPORT jobjectArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_nextEvents(JNIEnv *env, jclass clazz, jlong watcherPtr, jint max) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || max <= 0) return NULL;
+    if (max > MAX_EVENT_BATCH) max = MAX_EVENT_BATCH;
+    
+    // Drain into native storage first so no lock is held across JNI calls.
+    // The batch may come back short if the paths fill the buffer; the rest
+    // stays queued for the next call.
+    size_t buf_size = (size_t)max * 128 + FILEWATCHER_MAX_EVENT_BYTES;
+    FileWatcherEvent *events = malloc(sizeof(FileWatcherEvent) * max);
+    char *buf = malloc(buf_size);
+    if (events == NULL || buf == NULL) {
+        free(events);
+        free(buf);
+        return NULL;
     }
     
-    // Create full path
-    char full_path[1024];
-    if (event->len > 0) {
-        snprintf(full_path, sizeof(full_path), "%s/%s", base_path, event->name);
-    } else {
-        strncpy(full_path, base_path, sizeof(full_path) - 1);
-        full_path[sizeof(full_path) - 1] = '\0';
+    int count = filewatcher_poll(watcher, events, max, buf, buf_size);
+    
+    jobjectArray result = (count > 0) ? new_event_array(env, events, count) : NULL;
+    
+    free(events);
+    free(buf);
+    return result;
+}
+
+// A Java listener driven by the core's delivery thread
+typedef struct {
+    JavaVM *vm;
+    JNIEnv *env;       // The delivery thread's, once attached
+    jobject listener;  // Global reference to the FileWatcher.Listener
+} JavaListener;
+
+// Attach the delivery thread once; it stays attached for every batch
+static int java_listener_start(void *context) {
+    JavaListener *java = context;
+    JavaVMAttachArgs args = { JNI_VERSION_1_8, "filewatcher-listener", NULL };
+    if ((*java->vm)->AttachCurrentThreadAsDaemon(java->vm, (void **)&java->env, &args) != JNI_OK) {
+        error_log("Failed to attach listener thread to the JVM");
+        java->env = NULL;
+        return -1;
     }
+    return 0;
+}
+
+// Hand one batch to Listener.onEvents. An exception from the listener is
+// printed and cleared so delivery carries on.
+static void java_listener_deliver(void *context, const FileWatcherEvent *events, int count) {
+    JavaListener *java = context;
+    JNIEnv *env = java->env;
     
-    jstring path_string = (*env)->NewStringUTF(env, full_path);
-    if (path_string == NULL) return NULL;
+    jobjectArray array = new_event_array(env, events, count);
+    if (array != NULL) {
+        (*env)->CallVoidMethod(env, java->listener, listener_on_events, array);
+        (*env)->DeleteLocalRef(env, array);
+    }
+    if ((*env)->ExceptionCheck(env)) {
+        error_log("Listener dropped a batch of %d events", count);
+        (*env)->ExceptionDescribe(env);
+        (*env)->ExceptionClear(env);
+    }
+}
+
+// Drop the listener reference and detach. Also runs on the caller's
+// thread when the delivery thread could not be started.
+static void java_listener_stop(void *context) {
+    JavaListener *java = context;
+    JNIEnv *env;
     
-    // Create Event object
-    jobject event_object = (*env)->NewObject(env, event_class, event_constructor, event_kind, path_string);
-    (*env)->DeleteLocalRef(env, path_string);
+    if ((*java->vm)->GetEnv(java->vm, (void **)&env, JNI_VERSION_1_8) == JNI_OK) {
+        (*env)->DeleteGlobalRef(env, java->listener);
+    }
+    if (java->env != NULL) (*java->vm)->DetachCurrentThread(java->vm);
+    free(java);
+}
+
+// Push events to a Java listener, or stop pushing
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setListener(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jobject listener, jint maxBatch, jint maxDelayMs) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    if (listener == NULL) {
+        return (filewatcher_set_listener(watcher, NULL, 0, 0) == 0) ? JNI_TRUE : JNI_FALSE;
+    }
+    if (maxBatch <= 0 || maxDelayMs < 0) return JNI_FALSE;
+    if (listener_on_events == NULL) {
+        error_log("Push delivery needs FileWatcher.Listener with onEvents(Event[])");
+        return JNI_FALSE;
+    }
+    if (maxBatch > MAX_EVENT_BATCH) maxBatch = MAX_EVENT_BATCH;
     
-    return event_object;
+    JavaListener *java = calloc(1, sizeof(JavaListener));
+    if (java == NULL) return JNI_FALSE;
+    if ((*env)->GetJavaVM(env, &java->vm) != JNI_OK ||
+        (java->listener = (*env)->NewGlobalRef(env, listener)) == NULL) {
+        free(java);
+        return JNI_FALSE;
+    }
+    
+    // The core calls java_listener_stop, freeing java, even if this fails
+    FileWatcherListener callbacks = {
+        java_listener_start, java_listener_deliver, java_listener_stop, java
+    };
+    int result = filewatcher_set_listener(watcher, &callbacks, (int)maxBatch, (uint32_t)maxDelayMs);
+    return (result == 0) ? JNI_TRUE : JNI_FALSE;
 }
 
-// Get next event (non-blocking)
+// Expose the event ring to Java as a DirectByteBuffer
 JNIEXPORT jobject JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_nextEvent(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_eventRing(JNIEnv *env, jclass clazz, jlong watcherPtr) {
     FileWatcher *watcher = (FileWatcher*)watcherPtr;
     if (watcher == NULL) return NULL;
     
-    pthread_mutex_lock(&watcher->mutex);
+    EventRing *ring = filewatcher_export_ring(watcher);
+    return (*env)->NewDirectByteBuffer(env, ring->header, (jlong)ring->map_size);
+}
+
+// Parse pending inotify events into the ring for a Java consumer
+JNIEXPORT jint JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_fillRing(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return 0;
     
-    // If no buffered events, try to read new ones
-    if (watcher->buffer_pos >= watcher->buffer_len) {
-        watcher->buffer_len = read(watcher->inotify_fd, watcher->event_buffer, BUF_LEN);
-        watcher->buffer_pos = 0;
-        
-        if (watcher->buffer_len <= 0) {
-            pthread_mutex_unlock(&watcher->mutex);
-            return NULL; // No events available
-        }
+    return filewatcher_fill_ring(watcher);
+}
+
+// Directory path for a ring record's wd
+JNIEXPORT jstring JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watchPath(JNIEnv *env, jclass clazz, jlong watcherPtr, jint wd) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return NULL;
+    
+    char stack_path[PATH_MAX];
+    int len = filewatcher_watch_path(watcher, wd, stack_path, sizeof(stack_path));
+    if (len < 0 || (size_t)len < sizeof(stack_path)) {
+        return (len < 0) ? NULL : new_path_string(env, stack_path, (size_t)len);
     }
     
-    // Parse next event from buffer
-    struct inotify_event *event = (struct inotify_event*)&watcher->event_buffer[watcher->buffer_pos];
-    watcher->buffer_pos += EVENT_SIZE + event->len;
+    // Renames can leave a watched directory with a path longer than PATH_MAX
+    char *path = malloc((size_t)len + 1);
+    if (path == NULL) return NULL;
+    jstring result = NULL;
+    int again = filewatcher_watch_path(watcher, wd, path, (size_t)len + 1);
+    if (again >= 0 && again <= len) result = new_path_string(env, path, (size_t)again);
+    free(path);
+    return result;
+}
+
+// Cap the shared inotify read buffer
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setReadBufferLimit(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                       jint maxBytes) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || maxBytes <= 0) return JNI_FALSE;
     
-    pthread_mutex_unlock(&watcher->mutex);
+    filewatcher_set_read_limit(watcher, (uint32_t)maxBytes);
+    return JNI_TRUE;
+}
+
+// Open the warm-restart journal
+JNIEXPORT jlong JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_openJournal(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jstring path) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || path == NULL) return 0;
     
-    // For simplicity, using a dummy base path. In real implementation,
-    // you'd track the path associated with each watch descriptor.
-    jobject result = create_event_object(env, event, "");
+    const char *path_str = (*env)->GetStringUTFChars(env, path, NULL);
+    if (path_str == NULL) return 0;
     
-    return result;
+    uint64_t generation = 0;
+    if (filewatcher_open_journal(watcher, path_str, &generation) != 0) {
+        error_log("Failed to open journal %s: %s", path_str, strerror(errno));
+        generation = 0;
+    }
+    (*env)->ReleaseStringUTFChars(env, path, path_str);
+    return (jlong)generation;
+}
+
+// Set or clear the coalescing window
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setCoalescing(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                  jint windowMs) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || windowMs < 0) return JNI_FALSE;
+    
+    filewatcher_set_coalescing(watcher, (uint32_t)windowMs);
+    return JNI_TRUE;
+}
+
+// Set how long settled writes wait for IN_CLOSE_WRITE
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setSettleTimeout(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                     jint timeoutMs) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || timeoutMs < 0) return JNI_FALSE;
+    
+    filewatcher_set_settle_timeout(watcher, (uint32_t)timeoutMs);
+    return JNI_TRUE;
+}
+
+// Set or clear the rename pairing timeout
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setRenamePairing(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                     jint timeoutMs) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || timeoutMs < 0) return JNI_FALSE;
+    if (timeoutMs > 0 && (kind_refs[RING_MOVED] == NULL || event_moved_constructor == NULL)) {
+        error_log("Rename pairing needs EventKind.MOVED and Event(EventKind, String, String)");
+        return JNI_FALSE;
+    }
+    
+    filewatcher_set_rename_pairing(watcher, (uint32_t)timeoutMs);
+    return JNI_TRUE;
+}
+
+// Send events for some files through the priority lane
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setPriority(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jobjectArray names, jobjectArray roots) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    
+    size_t name_count, root_count;
+    char **name_list = copy_string_array(env, names, &name_count);
+    char **root_list = copy_string_array(env, roots, &root_count);
+    int result = -1;
+    if (name_list != NULL && root_list != NULL) {
+        name_count = compact_strings(name_list, name_count);
+        root_count = compact_strings(root_list, root_count);
+        result = filewatcher_set_priority(watcher, (const char *const *)name_list, name_count,
+                                          (const char *const *)root_list, root_count);
+    }
+    free_string_array(name_list, name_count);
+    free_string_array(root_list, root_count);
+    
+    return (result == 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Turn snapshot-based overflow recovery on or off
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setOverflowRecovery(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                        jboolean enabled) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    
+    filewatcher_set_overflow_recovery(watcher, enabled == JNI_TRUE);
+    return JNI_TRUE;
+}
+
+// Set the size cap for content hashing, 0 to turn it off
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setContentHashing(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                      jlong maxFileBytes) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || maxFileBytes < 0) return JNI_FALSE;
+    
+    filewatcher_set_content_hashing(watcher, (uint64_t)maxFileBytes);
+    return JNI_TRUE;
+}
+
+// Allow or forbid fanotify marks for later recursive watches
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_setFanotify(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jboolean enabled) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    
+    filewatcher_set_fanotify(watcher, enabled == JNI_TRUE);
+    return JNI_TRUE;
+}
+
+// Whether a recursive root is covered by a fanotify mark
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_isFanotifyRoot(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                   jstring path) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    
+    const char *path_str = (*env)->GetStringUTFChars(env, path, NULL);
+    if (path_str == NULL) return JNI_FALSE;
+    
+    int marked = filewatcher_root_marked(watcher, path_str);
+    (*env)->ReleaseStringUTFChars(env, path, path_str);
+    return (marked == 1) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Start draining inotify on a background thread
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_startReader(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                jint queueBytes) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL || queueBytes < 0) return JNI_FALSE;
+    
+    return (filewatcher_start_reader(watcher, (uint32_t)queueBytes) == 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Peak bytes buffered in the ring
+JNIEXPORT jlong JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_queueHighWater(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return 0;
+    
+    return (jlong)filewatcher_queue_high_water(watcher);
+}
+
+// Counter snapshot, indexed by FileWatcherStat
+JNIEXPORT jlongArray JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_getStats(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return NULL;
+    
+    uint64_t stats[STAT_COUNT];
+    filewatcher_get_stats(watcher, stats);
+    pthread_mutex_lock(&string_cache_lock);
+    stats[STAT_STRING_HITS] = string_hits;
+    stats[STAT_STRING_MISSES] = string_misses;
+    pthread_mutex_unlock(&string_cache_lock);
+    jlong values[STAT_COUNT];
+    for (int i = 0; i < STAT_COUNT; i++) values[i] = (jlong)stats[i];
+    
+    jlongArray array = (*env)->NewLongArray(env, STAT_COUNT);
+    if (array == NULL) return NULL;
+    (*env)->SetLongArrayRegion(env, array, 0, STAT_COUNT, values);
+    return array;
+}
+
+// Block until events are available, the timeout expires, or close() is called
+JNIEXPORT jboolean JNICALL
+Java_com_jetbrains_analyzer_filewatcher_FileWatcher_waitForEvents(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                                                                  jlong timeoutMs) {
+    FileWatcher *watcher = (FileWatcher*)watcherPtr;
+    if (watcher == NULL) return JNI_FALSE;
+    
+    return filewatcher_wait(watcher, (int64_t)timeoutMs) ? JNI_TRUE : JNI_FALSE;
 }
 
 // Close the watcher
@@ -199,25 +952,40 @@ Java_com_jetbrains_analyzer_filewatcher_FileWatcher_close(JNIEnv *env, jclass cl
     FileWatcher *watcher = (FileWatcher*)watcherPtr;
     if (watcher == NULL) return;
     
-    close(watcher->inotify_fd);
-    watcher->inotify_fd = -1;
+    filewatcher_close(watcher);
 }
 
 // Destroy the watcher
 JNIEXPORT void JNICALL
 Java_com_jetbrains_analyzer_filewatcher_FileWatcher_destroy(JNIEnv *env, jclass clazz, jlong watcherPtr) {
-    FileWatcher *watcher = (FileWatcher*)watcherPtr;
-    if (watcher == NULL) return;
+    filewatcher_destroy((FileWatcher*)watcherPtr);
+}
+
+// Bind the stub to the natives. Returns 0 on success.
+static int bind_stub(JavaVM *vm) {
+    JNIEnv *env;
+    if ((*vm)->GetEnv(vm, (void**)&env, JNI_VERSION_1_8) != JNI_OK) return -1;
     
-    if (watcher->inotify_fd >= 0) {
-        close(watcher->inotify_fd);
+    jclass clazz = (*env)->FindClass(env, "com/jetbrains/analyzer/filewatcher/FileWatcher");
+    if (clazz == NULL) {
+        (*env)->ExceptionClear(env);
+        return -1;
     }
-    pthread_mutex_destroy(&watcher->mutex);
-    free(watcher);
+    int bound = stub_register_natives(env, clazz);
+    (*env)->DeleteLocalRef(env, clazz);
+    return (bound > 0) ? 0 : -1;
 }
 
-// JNI_OnLoad - called when library is loaded
+// JNI_OnLoad - called when library is loaded; picks the backend once, so
+// no call has to check it
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+    FileWatcherBackend backend = filewatcher_backend_select(getenv(FILEWATCHER_BACKEND_ENV));
+    if (backend == FILEWATCHER_BACKEND_STUB && bind_stub(vm) != 0) {
+        error_log("Could not bind the stub natives, watching for real");
+        backend = filewatcher_backend_select(NULL);
+    }
+    if (backend != FILEWATCHER_BACKEND_STUB) filewatcher_set_default_backend(backend);
+    debug_log("Using the %s backend", filewatcher_backend_name(backend));
     return JNI_VERSION_1_8;
 }
 
@@ -225,13 +993,7 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
 JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved) {
     JNIEnv *env;
     if ((*vm)->GetEnv(vm, (void**)&env, JNI_VERSION_1_8) == JNI_OK) {
-        if (event_class != NULL) {
-            (*env)->DeleteGlobalRef(env, event_class);
-            event_class = NULL;
-        }
-        if (eventkind_class != NULL) {
-            (*env)->DeleteGlobalRef(env, eventkind_class);
-            eventkind_class = NULL;
-        }
+        release_jni_cache(env);
+        release_string_cache(env);
     }
-}
\ No newline at end of file
+}
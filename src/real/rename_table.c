@@ -0,0 +1,67 @@
+/**
+ * @file rename_table.c
+ * @brief FIFO cookie table for rename pairing
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "rename_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+void rename_table_init(RenameTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+void rename_table_destroy(RenameTable *table) {
+    for (int i = 0; i < table->count; i++) free(table->items[i].path);
+    free(table->items);
+    memset(table, 0, sizeof(*table));
+}
+
+int rename_table_add(RenameTable *table, uint32_t cookie, uint8_t flags,
+                     const char *path, size_t path_len, uint64_t now_ns) {
+    if (table->count >= RENAME_MAX_PENDING || path_len > UINT16_MAX) return -1;
+
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 8;
+        PendingRename *grown = realloc(table->items, sizeof(PendingRename) * capacity);
+        if (grown == NULL) return -1;
+        table->items = grown;
+        table->capacity = capacity;
+    }
+
+    char *copy = malloc(path_len + 1);
+    if (copy == NULL) return -1;
+    memcpy(copy, path, path_len);
+    copy[path_len] = '\0';
+
+    PendingRename *item = &table->items[table->count++];
+    item->seen_ns = now_ns;
+    item->cookie = cookie;
+    item->flags = flags;
+    item->path_len = (uint16_t)path_len;
+    item->path = copy;
+    return 0;
+}
+
+int rename_table_find(const RenameTable *table, uint32_t cookie) {
+    for (int i = 0; i < table->count; i++) {
+        if (table->items[i].cookie == cookie) return i;
+    }
+    return -1;
+}
+
+void rename_table_remove(RenameTable *table, int index) {
+    free(table->items[index].path);
+    memmove(&table->items[index], &table->items[index + 1],
+            sizeof(PendingRename) * (size_t)(table->count - index - 1));
+    table->count--;
+}
+
+uint64_t rename_table_deadline(const RenameTable *table, uint64_t timeout_ns) {
+    if (table->count == 0) return UINT64_MAX;
+    return table->items[0].seen_ns + timeout_ns;
+}
@@ -0,0 +1,296 @@
+/**
+ * @file tree_crawler.c
+ * @brief Parallel openat()/getdents64() directory crawler
+ *
+ * Directories to visit sit on a shared LIFO stack. Each worker pops one,
+ * adds its watch and records it in the registry under the registry lock
+ * before listing it (so entries created mid-crawl are still seen, with
+ * their full path), then pushes its subdirectories.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#define _GNU_SOURCE
+#include "tree_crawler.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define DIRENT_BUF_SIZE (32 * 1024)
+
+// Kernel record layout for getdents64(), declared here since libc
+// headers only expose it under differing names
+struct crawl_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    const CrawlRequest *req;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char **stack;          // Directories waiting to be visited
+    size_t stack_len;
+    size_t stack_cap;
+    size_t active;         // Workers currently visiting a directory
+} CrawlState;
+
+typedef struct {
+    CrawlState *state;
+    char *dirent_buf;
+    uint32_t added;
+    uint32_t failures;
+    uint32_t polled;
+} CrawlWorker;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Offset of the root-relative part of a path under the crawl's root
+static size_t rel_offset(const CrawlRequest *req) {
+    return (req->root_len == 1) ? 1 : req->root_len + 1;
+}
+
+static void push_dirs(CrawlState *state, char **dirs, size_t count, uint32_t *failures) {
+    if (count == 0) return;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->stack_len + count > state->stack_cap) {
+        size_t cap = state->stack_cap ? state->stack_cap : 256;
+        while (cap < state->stack_len + count) cap *= 2;
+        char **grown = realloc(state->stack, cap * sizeof(char *));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&state->lock);
+            for (size_t i = 0; i < count; i++) free(dirs[i]);
+            *failures += (uint32_t)count;
+            return;
+        }
+        state->stack = grown;
+        state->stack_cap = cap;
+    }
+    memcpy(state->stack + state->stack_len, dirs, count * sizeof(char *));
+    state->stack_len += count;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Watch one directory and queue its subdirectories. Takes ownership of path.
+static int visit_dir(CrawlWorker *worker, char *path, int is_top) {
+    CrawlState *state = worker->state;
+    const CrawlRequest *req = state->req;
+
+    int fd = openat(AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        free(path);
+        return -1;
+    }
+
+    uint32_t mask = req->mask | (is_top ? 0 : IN_ONLYDIR | IN_DONT_FOLLOW);
+    size_t path_len = strlen(path);
+    // The watch is registered before the lock is dropped, so no event on
+    // it is ever parsed without its path
+    if (req->registry_lock != NULL) pthread_mutex_lock(req->registry_lock);
+    // Without an engine every directory goes to the fallback
+    int wd = -1;
+    if (req->engine != NULL) {
+        wd = watch_engine_add(req->engine, req->subscriber, path, mask);
+    } else {
+        errno = ENOSPC;
+    }
+    int polled = 0;
+    if (wd >= 0 && watch_registry_add(req->registry, wd, path, path_len, req->root_id) != 0) {
+        watch_engine_remove(req->engine, req->subscriber, wd, 0);
+        wd = -1;
+        errno = ENOMEM;
+    } else if (wd < 0 && errno == ENOSPC && req->fallback != NULL) {
+        // Out of watches: the fallback registers it, and the tree below
+        // still gets whatever watches are left
+        wd = req->fallback(req->fallback_ctx, path, req->root_id);
+        if (wd < 0 && req->engine != NULL) errno = ENOSPC;
+        polled = 1;
+    }
+    if (req->registry_lock != NULL) pthread_mutex_unlock(req->registry_lock);
+    if (wd < 0) {
+        int saved = errno;
+        close(fd);
+        free(path);
+        errno = saved;
+        return -1;
+    }
+
+    size_t offset = rel_offset(req);
+    char *children[64];
+    size_t child_count = 0;
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, worker->dirent_buf, DIRENT_BUF_SIZE);
+        if (n <= 0) break;
+
+        for (long pos = 0; pos < n;) {
+            struct crawl_dirent64 *d = (struct crawl_dirent64 *)(worker->dirent_buf + pos);
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            int is_dir = (d->d_type == DT_DIR);
+            if (d->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (!is_dir) continue;
+
+            size_t name_len = strlen(name);
+            int needs_sep = !(path_len == 1 && path[0] == '/');
+            char *child = malloc(path_len + needs_sep + name_len + 1);
+            if (child == NULL) {
+                worker->failures++;
+                continue;
+            }
+            memcpy(child, path, path_len);
+            if (needs_sep) child[path_len] = '/';
+            memcpy(child + path_len + needs_sep, name, name_len + 1);
+
+            const char *rel = (strlen(child) > offset) ? child + offset : "";
+            if (glob_filter_match(req->excludes, rel, 1)) {
+                free(child);
+                continue;
+            }
+
+            children[child_count++] = child;
+            if (child_count == sizeof(children) / sizeof(children[0])) {
+                push_dirs(state, children, child_count, &worker->failures);
+                child_count = 0;
+            }
+        }
+    }
+    close(fd);
+    push_dirs(state, children, child_count, &worker->failures);
+
+    if (polled) {
+        worker->polled++;
+    } else {
+        worker->added++;
+    }
+    free(path);
+    return 0;
+}
+
+static void *crawl_worker(void *arg) {
+    CrawlWorker *worker = arg;
+    CrawlState *state = worker->state;
+
+    pthread_mutex_lock(&state->lock);
+    for (;;) {
+        while (state->stack_len == 0 && state->active > 0) {
+            pthread_cond_wait(&state->cond, &state->lock);
+        }
+        if (state->stack_len == 0) break; // Nothing queued and nobody producing
+
+        char *path = state->stack[--state->stack_len];
+        state->active++;
+        pthread_mutex_unlock(&state->lock);
+
+        // A cancelled crawl only empties the stack
+        if (state->req->cancel != NULL && atomic_load(state->req->cancel)) {
+            free(path);
+        } else if (visit_dir(worker, path, 0) != 0) {
+            worker->failures++;
+        }
+
+        pthread_mutex_lock(&state->lock);
+        state->active--;
+        if (state->stack_len == 0 && state->active == 0) {
+            pthread_cond_broadcast(&state->cond);
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+int tree_crawl_default_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    return (cpus > CRAWL_MAX_WORKERS) ? CRAWL_MAX_WORKERS : (int)cpus;
+}
+
+int tree_crawl(const CrawlRequest *req, const char *dir, int workers, CrawlResult *result) {
+    uint64_t start = monotonic_ns();
+    memset(result, 0, sizeof(*result));
+
+    // Workers insert concurrently, which needs the registry lock
+    if (req->registry_lock == NULL || workers < 1) workers = 1;
+    if (workers > CRAWL_MAX_WORKERS) workers = CRAWL_MAX_WORKERS;
+
+    CrawlState state;
+    memset(&state, 0, sizeof(state));
+    state.req = req;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
+
+    CrawlWorker pool[CRAWL_MAX_WORKERS];
+    memset(pool, 0, sizeof(pool));
+    int ret = 0;
+
+    for (int i = 0; i < workers; i++) {
+        pool[i].state = &state;
+        pool[i].dirent_buf = malloc(DIRENT_BUF_SIZE);
+        if (pool[i].dirent_buf == NULL) {
+            workers = i;
+            break;
+        }
+    }
+
+    char *top = (workers > 0) ? strdup(dir) : NULL;
+    if (top == NULL) {
+        errno = ENOMEM;
+        ret = -1;
+        goto out;
+    }
+
+    // The top directory is visited inline so its failure reaches the caller
+    if (visit_dir(&pool[0], top, 1) != 0) {
+        ret = -1;
+        goto out;
+    }
+
+    pthread_t threads[CRAWL_MAX_WORKERS];
+    int started = 1;
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, crawl_worker, &pool[started]) != 0) break;
+    }
+    crawl_worker(&pool[0]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+
+out:;
+    int saved = errno;
+    for (int i = 0; i < workers; i++) {
+        result->watches_added += pool[i].added;
+        result->watch_failures += pool[i].failures;
+        result->watches_polled += pool[i].polled;
+        free(pool[i].dirent_buf);
+    }
+    for (size_t i = 0; i < state.stack_len; i++) free(state.stack[i]);
+    free(state.stack);
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.lock);
+
+    result->elapsed_ns = monotonic_ns() - start;
+    errno = saved;
+    return ret;
+}
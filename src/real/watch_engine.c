@@ -0,0 +1,433 @@
+/**
+ * @file watch_engine.c
+ * @brief Shared inotify instance with reference-counted watches
+ *
+ * The wd table is open addressing with linear probing and tombstones,
+ * rebuilt at 70% load like the watch registry. Each slot lists its
+ * holders; a wd with no holders left is removed from the kernel.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "watch_engine.h"
+#include "filewatcher_log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define ENGINE_SLOT_EMPTY -1
+#define ENGINE_SLOT_TOMBSTONE -2
+#define ENGINE_INITIAL_CAPACITY 64
+#define ENGINE_INBOX_INITIAL_BYTES 4096
+#define ENGINE_LIMIT_PATH "/proc/sys/fs/inotify/max_user_watches"
+
+static WatchEngine engine_instance = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .inotify_fd = -1,
+    .read_limit = ENGINE_READ_DEFAULT_LIMIT,
+};
+
+// Spread small sequential wds across the table
+static uint32_t hash_wd(int wd) {
+    return (uint32_t)wd * 0x9E3779B1u;
+}
+
+static EngineWatch *find_watch(WatchEngine *engine, int wd) {
+    if (engine->watch_capacity == 0) return NULL;
+
+    uint32_t mask = engine->watch_capacity - 1;
+    uint32_t slot = hash_wd(wd) & mask;
+    while (engine->watches[slot].wd != ENGINE_SLOT_EMPTY) {
+        if (engine->watches[slot].wd == wd) return &engine->watches[slot];
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+// Rebuild the table at a new capacity, dropping tombstones
+static int rebuild_watches(WatchEngine *engine, uint32_t capacity) {
+    EngineWatch *table = malloc(sizeof(EngineWatch) * capacity);
+    if (table == NULL) return -1;
+    for (uint32_t i = 0; i < capacity; i++) table[i].wd = ENGINE_SLOT_EMPTY;
+
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = 0; i < engine->watch_capacity; i++) {
+        if (engine->watches[i].wd < 0) continue;
+        uint32_t slot = hash_wd(engine->watches[i].wd) & mask;
+        while (table[slot].wd != ENGINE_SLOT_EMPTY) slot = (slot + 1) & mask;
+        table[slot] = engine->watches[i];
+    }
+    free(engine->watches);
+    engine->watches = table;
+    engine->watch_capacity = capacity;
+    engine->watch_used = engine->watch_count;
+    return 0;
+}
+
+// Slot for wd, claimed if it was not in the table. NULL if out of memory.
+static EngineWatch *claim_watch(WatchEngine *engine, int wd) {
+    EngineWatch *watch = find_watch(engine, wd);
+    if (watch != NULL) return watch;
+
+    if ((engine->watch_used + 1) * 10 >= engine->watch_capacity * 7) {
+        uint32_t capacity = engine->watch_capacity ? engine->watch_capacity : ENGINE_INITIAL_CAPACITY;
+        if ((engine->watch_count + 1) * 10 >= capacity * 7 / 2) capacity *= 2;
+        if (rebuild_watches(engine, capacity) != 0) return NULL;
+    }
+
+    uint32_t mask = engine->watch_capacity - 1;
+    uint32_t slot = hash_wd(wd) & mask;
+    while (engine->watches[slot].wd != ENGINE_SLOT_EMPTY) slot = (slot + 1) & mask;
+    watch = &engine->watches[slot];
+    watch->wd = wd;
+    watch->ref_count = 0;
+    watch->ref_capacity = 0;
+    watch->refs = NULL;
+    engine->watch_count++;
+    engine->watch_used++;
+    return watch;
+}
+
+static void drop_watch(WatchEngine *engine, EngineWatch *watch) {
+    free(watch->refs);
+    watch->refs = NULL;
+    watch->wd = ENGINE_SLOT_TOMBSTONE;
+    engine->watch_count--;
+}
+
+static EngineRef *find_ref(EngineWatch *watch, const EngineSubscriber *sub) {
+    for (int i = 0; i < watch->ref_count; i++) {
+        if (watch->refs[i].sub == sub) return &watch->refs[i];
+    }
+    return NULL;
+}
+
+// Remove a holder; the last one takes the kernel watch with it.
+// Caller holds engine->lock.
+static void release_ref(WatchEngine *engine, EngineWatch *watch, EngineRef *ref) {
+    *ref = watch->refs[--watch->ref_count];
+    if (watch->ref_count > 0) return;
+
+    // Its IN_IGNORED finds no holders and is dropped
+    inotify_rm_watch(engine->inotify_fd, watch->wd);
+    drop_watch(engine, watch);
+}
+
+// Append a record to an inbox. Past the cap the inbox gets a single
+// IN_Q_OVERFLOW and drops everything else until it is taken; force
+// bypasses the cap for records the subscriber's bookkeeping depends on.
+static int inbox_push(EngineSubscriber *sub, const struct inotify_event *event, int force) {
+    struct inotify_event overflow = { -1, IN_Q_OVERFLOW, 0, 0 };
+
+    pthread_mutex_lock(&sub->lock);
+    if (!force && sub->overflowed) {
+        pthread_mutex_unlock(&sub->lock);
+        return 0;
+    }
+    if (!force && sub->inbox_events >= ENGINE_INBOX_MAX_EVENTS) {
+        sub->overflowed = 1;
+        event = &overflow;
+    }
+
+    size_t size = sizeof(*event) + event->len;
+    if (sub->inbox_len + size > sub->inbox_capacity) {
+        size_t capacity = sub->inbox_capacity ? sub->inbox_capacity * 2 : ENGINE_INBOX_INITIAL_BYTES;
+        while (capacity < sub->inbox_len + size) capacity *= 2;
+        char *grown = realloc(sub->inbox, capacity);
+        if (grown == NULL) {
+            // Out of memory is a lost event like any other
+            sub->overflowed = 1;
+            pthread_mutex_unlock(&sub->lock);
+            return 0;
+        }
+        sub->inbox = grown;
+        sub->inbox_capacity = capacity;
+    }
+
+    int was_empty = (sub->inbox_len == 0);
+    memcpy(sub->inbox + sub->inbox_len, event, size);
+    sub->inbox_len += size;
+    sub->inbox_events++;
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(sub->inbox_fd, &one, sizeof(one)) < 0) {
+            error_log("Failed to signal subscriber: %s", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&sub->lock);
+    return 1;
+}
+
+// Hand one kernel record to everyone who wants it. Caller holds engine->lock.
+static int dispatch(WatchEngine *engine, const struct inotify_event *event) {
+    int delivered = 0;
+    if (event->mask & IN_Q_OVERFLOW) {
+        for (int i = 0; i < engine->subscriber_count; i++) {
+            delivered += inbox_push(engine->subscribers[i], event, 0);
+        }
+        return delivered;
+    }
+
+    EngineWatch *watch = find_watch(engine, event->wd);
+    if (watch == NULL) return 0;
+
+    for (int i = 0; i < watch->ref_count; i++) {
+        const EngineRef *ref = &watch->refs[i];
+        if ((event->mask & ref->mask & IN_ALL_EVENTS) || (event->mask & (IN_IGNORED | IN_UNMOUNT))) {
+            delivered += inbox_push(ref->sub, event, (event->mask & IN_IGNORED) != 0);
+        }
+    }
+    // The kernel dropped the watch (directory deleted or unmounted)
+    if (event->mask & IN_IGNORED) drop_watch(engine, watch);
+    return delivered;
+}
+
+// The per-user watch limit, 0 if it cannot be read
+static long read_watch_limit(void) {
+    FILE *file = fopen(ENGINE_LIMIT_PATH, "re");
+    if (file == NULL) return 0;
+    long limit = 0;
+    if (fscanf(file, "%ld", &limit) != 1 || limit < 0) limit = 0;
+    fclose(file);
+    return limit;
+}
+
+WatchEngine *watch_engine_subscribe(EngineSubscriber *sub) {
+    WatchEngine *engine = &engine_instance;
+
+    memset(sub, 0, sizeof(*sub));
+    sub->inbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sub->inbox_fd < 0) return NULL;
+    pthread_mutex_init(&sub->lock, NULL);
+
+    pthread_mutex_lock(&engine->lock);
+    if (engine->subscriber_count == engine->subscriber_capacity) {
+        int capacity = engine->subscriber_capacity ? engine->subscriber_capacity * 2 : 8;
+        EngineSubscriber **grown = realloc(engine->subscribers, sizeof(EngineSubscriber *) * capacity);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&engine->lock);
+            close(sub->inbox_fd);
+            pthread_mutex_destroy(&sub->lock);
+            errno = ENOMEM;
+            return NULL;
+        }
+        engine->subscribers = grown;
+        engine->subscriber_capacity = capacity;
+    }
+    if (engine->inotify_fd < 0) {
+        engine->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (engine->inotify_fd < 0) {
+            int saved = errno;
+            pthread_mutex_unlock(&engine->lock);
+            close(sub->inbox_fd);
+            pthread_mutex_destroy(&sub->lock);
+            errno = saved;
+            return NULL;
+        }
+        engine->watch_limit = read_watch_limit();
+        debug_log("Opened the shared inotify instance (max_user_watches %ld)", engine->watch_limit);
+    }
+    engine->subscribers[engine->subscriber_count++] = sub;
+    pthread_mutex_unlock(&engine->lock);
+    return engine;
+}
+
+void watch_engine_unsubscribe(WatchEngine *engine, EngineSubscriber *sub) {
+    pthread_mutex_lock(&engine->lock);
+    for (uint32_t i = 0; i < engine->watch_capacity; i++) {
+        EngineWatch *watch = &engine->watches[i];
+        if (watch->wd < 0) continue;
+        EngineRef *ref = find_ref(watch, sub);
+        if (ref != NULL) release_ref(engine, watch, ref);
+    }
+    for (int i = 0; i < engine->subscriber_count; i++) {
+        if (engine->subscribers[i] == sub) {
+            engine->subscribers[i] = engine->subscribers[--engine->subscriber_count];
+            break;
+        }
+    }
+    if (engine->subscriber_count == 0) {
+        // Every watch went with its holders; start afresh next time
+        close(engine->inotify_fd);
+        engine->inotify_fd = -1;
+        free(engine->watches);
+        engine->watches = NULL;
+        engine->watch_capacity = engine->watch_count = engine->watch_used = 0;
+        free(engine->subscribers);
+        engine->subscribers = NULL;
+        engine->subscriber_capacity = 0;
+        free(engine->buffer);
+        engine->buffer = NULL;
+        engine->buffer_capacity = 0;
+        debug_log("Closed the shared inotify instance");
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    close(sub->inbox_fd);
+    sub->inbox_fd = -1;
+    free(sub->inbox);
+    sub->inbox = NULL;
+    sub->inbox_len = sub->inbox_capacity = 0;
+    pthread_mutex_destroy(&sub->lock);
+}
+
+int watch_engine_add(WatchEngine *engine, EngineSubscriber *sub, const char *path, uint32_t mask) {
+    if (engine == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    int wd = inotify_add_watch(engine->inotify_fd, path, mask | IN_MASK_ADD);
+    if (wd < 0) {
+        pthread_mutex_unlock(&engine->lock);
+        return -1;
+    }
+
+    EngineWatch *watch = claim_watch(engine, wd);
+    EngineRef *ref = (watch != NULL) ? find_ref(watch, sub) : NULL;
+    if (watch != NULL && ref == NULL && watch->ref_count == watch->ref_capacity) {
+        int capacity = watch->ref_capacity ? watch->ref_capacity * 2 : 2;
+        EngineRef *grown = realloc(watch->refs, sizeof(EngineRef) * capacity);
+        if (grown != NULL) {
+            watch->refs = grown;
+            watch->ref_capacity = capacity;
+        }
+    }
+    if (watch == NULL || (ref == NULL && watch->ref_count == watch->ref_capacity)) {
+        // Nobody else holds a fresh wd, so it goes straight back
+        if (watch == NULL || watch->ref_count == 0) {
+            inotify_rm_watch(engine->inotify_fd, wd);
+            if (watch != NULL) drop_watch(engine, watch);
+        }
+        pthread_mutex_unlock(&engine->lock);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (ref == NULL) {
+        ref = &watch->refs[watch->ref_count++];
+        ref->sub = sub;
+    }
+    ref->mask = mask & IN_ALL_EVENTS;
+    pthread_mutex_unlock(&engine->lock);
+    return wd;
+}
+
+void watch_engine_remove(WatchEngine *engine, EngineSubscriber *sub, int wd, int notify) {
+    if (engine == NULL) return;
+
+    pthread_mutex_lock(&engine->lock);
+    EngineWatch *watch = find_watch(engine, wd);
+    EngineRef *ref = (watch != NULL) ? find_ref(watch, sub) : NULL;
+    if (ref != NULL) {
+        release_ref(engine, watch, ref);
+        if (notify) {
+            struct inotify_event ignored = { wd, IN_IGNORED, 0, 0 };
+            inbox_push(sub, &ignored, 1);
+        }
+    }
+    pthread_mutex_unlock(&engine->lock);
+}
+
+// Resize the read buffer to the power of two that holds want bytes,
+// within ENGINE_READ_MIN_BYTES and the read limit. Keeps the old buffer
+// if out of memory. Caller holds engine->lock.
+static void size_buffer(WatchEngine *engine, size_t want) {
+    size_t capacity = ENGINE_READ_MIN_BYTES;
+    while (capacity < want && capacity < engine->read_limit) capacity *= 2;
+    if (capacity > engine->read_limit) capacity = engine->read_limit;
+    if (capacity == engine->buffer_capacity) return;
+
+    // Nothing in the buffer survives a pump, so no need to copy it
+    char *resized = malloc(capacity);
+    if (resized == NULL) return;
+    free(engine->buffer);
+    engine->buffer = resized;
+    engine->buffer_capacity = capacity;
+}
+
+int watch_engine_pump(WatchEngine *engine) {
+    int delivered = 0;
+    size_t largest = 0;
+
+    pthread_mutex_lock(&engine->lock);
+    for (int i = 0; i < ENGINE_PUMP_READS && engine->inotify_fd >= 0; i++) {
+        // FIONREAD says how much is queued, so one read drains it and no
+        // trailing read is needed to find the queue empty
+        int pending = 0;
+        if (ioctl(engine->inotify_fd, FIONREAD, &pending) < 0 || pending <= 0) break;
+        if ((size_t)pending > engine->buffer_capacity) size_buffer(engine, (size_t)pending);
+        if (engine->buffer == NULL) break;
+
+        ssize_t n = read(engine->inotify_fd, engine->buffer, engine->buffer_capacity);
+        if (n <= 0) break;
+        if ((size_t)n > largest) largest = (size_t)n;
+
+        for (ssize_t pos = 0; pos < n;) {
+            const struct inotify_event *event = (const struct inotify_event *)(engine->buffer + pos);
+            delivered += dispatch(engine, event);
+            pos += (ssize_t)(sizeof(*event) + event->len);
+        }
+        if (n >= pending) break;
+    }
+    // The burst is over: give back what it grew the buffer to
+    if (largest <= ENGINE_READ_KEEP_BYTES && engine->buffer_capacity > ENGINE_READ_KEEP_BYTES) {
+        size_buffer(engine, ENGINE_READ_KEEP_BYTES);
+    }
+    pthread_mutex_unlock(&engine->lock);
+    return delivered;
+}
+
+void watch_engine_set_read_limit(WatchEngine *engine, size_t bytes) {
+    if (bytes < ENGINE_READ_MIN_BYTES) bytes = ENGINE_READ_MIN_BYTES;
+
+    pthread_mutex_lock(&engine->lock);
+    engine->read_limit = bytes;
+    if (engine->buffer_capacity > bytes) size_buffer(engine, bytes);
+    pthread_mutex_unlock(&engine->lock);
+    debug_log("Kernel read buffer capped at %zu bytes", bytes);
+}
+
+long watch_engine_limit(WatchEngine *engine, uint32_t *in_use) {
+    pthread_mutex_lock(&engine->lock);
+    long limit = engine->watch_limit;
+    if (in_use != NULL) *in_use = engine->watch_count;
+    pthread_mutex_unlock(&engine->lock);
+    return limit;
+}
+
+size_t watch_engine_take(EngineSubscriber *sub, char **buf, size_t *capacity) {
+    pthread_mutex_lock(&sub->lock);
+    size_t len = sub->inbox_len;
+    if (len > 0) {
+        char *spare = *buf;
+        size_t spare_capacity = *capacity;
+        // A buffer grown by a burst is not worth keeping around idle
+        if (spare_capacity > ENGINE_INBOX_KEEP_BYTES) {
+            free(spare);
+            spare = NULL;
+            spare_capacity = 0;
+        }
+        *buf = sub->inbox;
+        *capacity = sub->inbox_capacity;
+        sub->inbox = spare;
+        sub->inbox_capacity = spare_capacity;
+        sub->inbox_len = 0;
+        sub->inbox_events = 0;
+        sub->overflowed = 0;
+
+        uint64_t value;
+        if (read(sub->inbox_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            error_log("Failed to reset subscriber eventfd: %s", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&sub->lock);
+    return len;
+}
@@ -0,0 +1,614 @@
+/**
+ * @file watch_journal.c
+ * @brief Append-only journal of watched trees
+ *
+ * In memory the journal is one linear-probing table of entries keyed by
+ * full path, rebuilt at 70% load, with the paths in a single blob that is
+ * compacted on rebuild once dead bytes outgrow the live ones. Changes
+ * are appended to a pending buffer and written with one pwrite() per
+ * flush.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "watch_journal.h"
+#include "event_ring.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC 0x314A5746u /* "FWJ1" */
+#define JOURNAL_VERSION 1
+#define JOURNAL_INITIAL_SLOTS 1024
+#define JOURNAL_COMPACT_MIN 4096
+#define JOURNAL_PATHS_COMPACT_MIN (64 * 1024)
+
+enum { OP_PUT = 1, OP_DROP = 2, OP_ROOT = 3 };
+enum { SLOT_FREE = 0, SLOT_LIVE = 1, SLOT_DEAD = 2 };
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+} JournalHeader;
+
+// One log record; the path follows, padded to 8 bytes
+typedef struct {
+    uint32_t check;     // FNV-1a of everything after this field, path included
+    uint8_t op;
+    uint8_t is_dir;
+    uint16_t path_len;
+    uint64_t ino;
+    int64_t mtime_ns;
+    int64_t size;
+} JournalRecord;
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t hash_path(const char *path, size_t len) {
+    return fnv1a(2166136261u, path, len);
+}
+
+static uint32_t record_check(const JournalRecord *record, const char *path) {
+    uint32_t h = fnv1a(2166136261u, (const char *)record + sizeof(record->check),
+                       sizeof(*record) - sizeof(record->check));
+    return fnv1a(h, path, record->path_len);
+}
+
+static size_t record_size(size_t path_len) {
+    return (sizeof(JournalRecord) + path_len + 7) & ~(size_t)7;
+}
+
+// Whether path is dir or lies below it
+static int path_under(const char *path, size_t len, const char *dir, size_t dir_len) {
+    if (dir_len == 1 && dir[0] == '/') return len > 0 && path[0] == '/';
+    return len >= dir_len && memcmp(path, dir, dir_len) == 0 && (len == dir_len || path[dir_len] == '/');
+}
+
+// Length of the parent directory's part of path ("/" for top-level entries)
+static size_t parent_length(const char *path, size_t len) {
+    while (len > 0 && path[len - 1] != '/') len--;
+    return (len > 1) ? len - 1 : len;
+}
+
+static const char *entry_path(const WatchJournal *journal, const JournalEntry *entry) {
+    return journal->paths + entry->path_off;
+}
+
+static void fill_stat(JournalEntry *entry, const struct stat *st) {
+    entry->ino = (uint64_t)st->st_ino;
+    entry->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    entry->size = (int64_t)st->st_size;
+    entry->is_dir = S_ISDIR(st->st_mode) ? 1 : 0;
+}
+
+static JournalEntry *find_entry(const WatchJournal *journal, const char *path, size_t len, uint32_t hash) {
+    if (journal->capacity == 0) return NULL;
+
+    uint32_t mask = journal->capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        JournalEntry *entry = &journal->slots[i];
+        if (entry->state == SLOT_FREE) return NULL;
+        if (entry->state == SLOT_LIVE && entry->hash == hash && entry->path_len == len &&
+            memcmp(entry_path(journal, entry), path, len) == 0) return entry;
+    }
+}
+
+// Slot for a path known to be absent, reusing the first tombstone on its probe
+static JournalEntry *free_slot(JournalEntry *slots, uint32_t capacity, uint32_t hash) {
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        if (slots[i].state != SLOT_LIVE) return &slots[i];
+    }
+}
+
+// Rehash into capacity slots and copy the live paths into a fresh blob
+static int rebuild(WatchJournal *journal, uint32_t capacity) {
+    JournalEntry *slots = calloc(capacity, sizeof(JournalEntry));
+    uint32_t paths_cap = journal->paths_len - journal->paths_dead;
+    if (paths_cap < 256) paths_cap = 256;
+    char *paths = malloc(paths_cap);
+    if (slots == NULL || paths == NULL) {
+        free(slots);
+        free(paths);
+        return -1;
+    }
+
+    uint32_t paths_len = 0;
+    for (uint32_t i = 0; i < journal->capacity; i++) {
+        const JournalEntry *entry = &journal->slots[i];
+        if (entry->state != SLOT_LIVE) continue;
+        JournalEntry *slot = free_slot(slots, capacity, entry->hash);
+        *slot = *entry;
+        memcpy(paths + paths_len, entry_path(journal, entry), entry->path_len);
+        slot->path_off = paths_len;
+        paths_len += entry->path_len;
+    }
+    free(journal->slots);
+    free(journal->paths);
+    journal->slots = slots;
+    journal->capacity = capacity;
+    journal->used = journal->count;
+    journal->paths = paths;
+    journal->paths_len = paths_len;
+    journal->paths_cap = paths_cap;
+    journal->paths_dead = 0;
+    return 0;
+}
+
+// Add an entry for a path that has none. Returns it, or NULL on allocation failure.
+static JournalEntry *insert_entry(WatchJournal *journal, const char *path, size_t len, uint32_t hash) {
+    int crowded = (uint64_t)(journal->used + 1) * 10 > (uint64_t)journal->capacity * 7;
+    int wasteful = journal->paths_dead > JOURNAL_PATHS_COMPACT_MIN &&
+                   journal->paths_dead > journal->paths_len - journal->paths_dead;
+    if (crowded || wasteful) {
+        uint32_t capacity = JOURNAL_INITIAL_SLOTS;
+        while ((uint64_t)(journal->count + 1) * 10 > (uint64_t)capacity * 5) capacity *= 2;
+        if (rebuild(journal, capacity) != 0) return NULL;
+    }
+
+    if ((uint64_t)journal->paths_len + len > UINT32_MAX) return NULL;
+    if (journal->paths_len + len > journal->paths_cap) {
+        uint64_t cap = journal->paths_cap;
+        while (cap < (uint64_t)journal->paths_len + len) cap *= 2;
+        if (cap > UINT32_MAX) cap = UINT32_MAX;
+        char *grown = realloc(journal->paths, cap);
+        if (grown == NULL) return NULL;
+        journal->paths = grown;
+        journal->paths_cap = (uint32_t)cap;
+    }
+
+    JournalEntry *entry = free_slot(journal->slots, journal->capacity, hash);
+    if (entry->state == SLOT_FREE) journal->used++;
+    memset(entry, 0, sizeof(*entry));
+    memcpy(journal->paths + journal->paths_len, path, len);
+    entry->path_off = journal->paths_len;
+    entry->path_len = (uint16_t)len;
+    entry->hash = hash;
+    entry->state = SLOT_LIVE;
+    journal->paths_len += len;
+    journal->count++;
+    return entry;
+}
+
+static void kill_entry(WatchJournal *journal, JournalEntry *entry) {
+    entry->state = SLOT_DEAD;
+    journal->paths_dead += entry->path_len;
+    journal->count--;
+}
+
+// Forget an entry and everything below it. Only a directory (or a path the
+// table does not know, which may have had entries below it) needs the walk.
+static void drop_subtree(WatchJournal *journal, const char *path, size_t len) {
+    JournalEntry *self = find_entry(journal, path, len, hash_path(path, len));
+    if (self != NULL && !self->is_dir) {
+        kill_entry(journal, self);
+        return;
+    }
+
+    for (uint32_t i = 0; i < journal->capacity; i++) {
+        JournalEntry *entry = &journal->slots[i];
+        if (entry->state != SLOT_LIVE) continue;
+        if (!path_under(entry_path(journal, entry), entry->path_len, path, len)) continue;
+        kill_entry(journal, entry);
+    }
+}
+
+static int add_root(WatchJournal *journal, const char *path, size_t len) {
+    if (journal->root_count == journal->root_capacity) {
+        int capacity = journal->root_capacity ? journal->root_capacity * 2 : 4;
+        char **grown = realloc(journal->roots, sizeof(char *) * capacity);
+        if (grown == NULL) return -1;
+        journal->roots = grown;
+        journal->root_capacity = capacity;
+    }
+    char *copy = malloc(len + 1);
+    if (copy == NULL) return -1;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    journal->roots[journal->root_count++] = copy;
+    return 0;
+}
+
+// Queue a record for the next flush. Returns 0, or -1 on allocation failure.
+static int log_record(WatchJournal *journal, uint8_t op, const char *path, size_t len, const JournalEntry *entry) {
+    size_t size = record_size(len);
+    if (journal->pending_len + size > journal->pending_cap) {
+        size_t cap = journal->pending_cap ? journal->pending_cap : 4096;
+        while (cap < journal->pending_len + size) cap *= 2;
+        char *grown = realloc(journal->pending, cap);
+        if (grown == NULL) return -1;
+        journal->pending = grown;
+        journal->pending_cap = cap;
+    }
+
+    char *out = journal->pending + journal->pending_len;
+    JournalRecord record = { 0, op, 0, (uint16_t)len, 0, 0, 0 };
+    if (entry != NULL) {
+        record.is_dir = entry->is_dir;
+        record.ino = entry->ino;
+        record.mtime_ns = entry->mtime_ns;
+        record.size = entry->size;
+    }
+    record.check = record_check(&record, path);
+    memcpy(out, &record, sizeof(record));
+    memcpy(out + sizeof(record), path, len);
+    memset(out + sizeof(record) + len, 0, size - sizeof(record) - len);
+    journal->pending_len += size;
+    journal->log_records++;
+    return 0;
+}
+
+// Forget an entry and its subtree, and log that
+static int drop_path(WatchJournal *journal, const char *path, size_t len) {
+    drop_subtree(journal, path, len);
+    return log_record(journal, OP_DROP, path, len, NULL);
+}
+
+// Record what stat found at a path, reporting the difference to fn (may
+// be NULL). Returns the number of differences, -1 on allocation failure.
+static int apply_stat(WatchJournal *journal, const char *path, size_t len, const struct stat *st,
+                      JournalDiffFn fn, void *ctx) {
+    uint32_t hash = hash_path(path, len);
+    JournalEntry *entry = find_entry(journal, path, len, hash);
+    int is_dir = S_ISDIR(st->st_mode) ? 1 : 0;
+    int changes = 0;
+
+    // Replaced by something of the other type: gone, then created
+    if (entry != NULL && entry->is_dir != is_dir) {
+        int was_dir = entry->is_dir;
+        if (drop_path(journal, path, len) != 0) return -1;
+        if (fn != NULL) fn(ctx, RING_DELETED, was_dir, path, len);
+        changes++;
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        entry = insert_entry(journal, path, len, hash);
+        if (entry == NULL) return -1;
+        fill_stat(entry, st);
+        if (fn != NULL) fn(ctx, RING_CREATED, is_dir, path, len);
+        changes++;
+    } else {
+        JournalEntry fresh = *entry;
+        fill_stat(&fresh, st);
+        if (fresh.ino == entry->ino && fresh.mtime_ns == entry->mtime_ns && fresh.size == entry->size) {
+            entry->mark = journal->mark;
+            return changes;
+        }
+        if (!is_dir) {
+            if (fn != NULL) fn(ctx, RING_MODIFIED, 0, path, len);
+            changes++;
+        }
+        *entry = fresh;
+    }
+    entry->mark = journal->mark;
+    if (log_record(journal, OP_PUT, path, len, entry) != 0) return -1;
+    return changes;
+}
+
+// Apply the records of a mapped log. Returns the offset just past the last
+// whole record.
+static size_t replay(WatchJournal *journal, const char *map, size_t size) {
+    size_t pos = sizeof(JournalHeader);
+    while (pos + sizeof(JournalRecord) <= size) {
+        JournalRecord record;
+        memcpy(&record, map + pos, sizeof(record));
+        size_t next = pos + record_size(record.path_len);
+        if (next > size) break;
+
+        const char *path = map + pos + sizeof(record);
+        if (record.check != record_check(&record, path)) break;
+
+        if (record.op == OP_PUT) {
+            uint32_t hash = hash_path(path, record.path_len);
+            JournalEntry *entry = find_entry(journal, path, record.path_len, hash);
+            if (entry == NULL) entry = insert_entry(journal, path, record.path_len, hash);
+            if (entry == NULL) break;
+            entry->ino = record.ino;
+            entry->mtime_ns = record.mtime_ns;
+            entry->size = record.size;
+            entry->is_dir = record.is_dir;
+        } else if (record.op == OP_DROP) {
+            drop_subtree(journal, path, record.path_len);
+        } else if (record.op == OP_ROOT) {
+            if (!watch_journal_has_root(journal, path, record.path_len) &&
+                add_root(journal, path, record.path_len) != 0) break;
+        } else {
+            break;
+        }
+        journal->log_records++;
+        pos = next;
+    }
+    return pos;
+}
+
+static int write_all(int fd, const char *data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int write_header(int fd, uint64_t generation) {
+    JournalHeader header = { JOURNAL_MAGIC, JOURNAL_VERSION, generation };
+    return write_all(fd, (const char *)&header, sizeof(header), 0);
+}
+
+// Rewrite the log as one record per root and entry, next to the file, and
+// rename it over the original
+static int compact(WatchJournal *journal) {
+    size_t path_len = strlen(journal->path);
+    char *tmp = malloc(path_len + 5);
+    if (tmp == NULL) return -1;
+    memcpy(tmp, journal->path, path_len);
+    memcpy(tmp + path_len, ".tmp", 5);
+
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        int saved = errno;
+        if (fd >= 0) close(fd);
+        free(tmp);
+        errno = saved;
+        return -1;
+    }
+
+    // Build the whole log in pending, then write it in one go
+    journal->pending_len = 0;
+    journal->log_records = 0;
+    int failed = 0;
+    for (int i = 0; i < journal->root_count && !failed; i++) {
+        failed = log_record(journal, OP_ROOT, journal->roots[i], strlen(journal->roots[i]), NULL) != 0;
+    }
+    for (uint32_t i = 0; i < journal->capacity && !failed; i++) {
+        const JournalEntry *entry = &journal->slots[i];
+        if (entry->state != SLOT_LIVE) continue;
+        failed = log_record(journal, OP_PUT, entry_path(journal, entry), entry->path_len, entry) != 0;
+    }
+    if (!failed) {
+        failed = write_header(fd, journal->generation) != 0 ||
+                 write_all(fd, journal->pending, journal->pending_len, sizeof(JournalHeader)) != 0 ||
+                 rename(tmp, journal->path) != 0;
+    }
+
+    int saved = errno;
+    if (failed) {
+        close(fd);
+        unlink(tmp);
+    } else {
+        close(journal->fd);
+        journal->fd = fd;
+        journal->log_end = sizeof(JournalHeader) + journal->pending_len;
+    }
+    journal->pending_len = 0;
+    free(tmp);
+    errno = saved;
+    return failed ? -1 : 0;
+}
+
+static int needs_compaction(const WatchJournal *journal) {
+    return journal->log_records > (uint64_t)journal->count * 2 + JOURNAL_COMPACT_MIN;
+}
+
+int watch_journal_open(WatchJournal *journal, const char *path) {
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    journal->path = strdup(path);
+    if (journal->path == NULL) return -1;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+        int saved = errno;
+        if (fd >= 0) close(fd);
+        watch_journal_close(journal);
+        errno = saved;
+        return -1;
+    }
+    journal->fd = fd;
+
+    // Replay whatever a valid log holds; anything else starts over
+    size_t size = (size_t)st.st_size;
+    size_t valid = 0;
+    if (size >= sizeof(JournalHeader)) {
+        char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            JournalHeader header;
+            memcpy(&header, map, sizeof(header));
+            if (header.magic == JOURNAL_MAGIC && header.version == JOURNAL_VERSION) {
+                journal->generation = header.generation;
+                valid = replay(journal, map, size);
+            }
+            munmap(map, size);
+        }
+    }
+    if (valid == 0) valid = sizeof(JournalHeader);
+
+    // A torn tail from a crash is cut off before anything is appended
+    journal->generation++;
+    journal->log_end = valid;
+    if (write_header(fd, journal->generation) != 0 || (valid < size && ftruncate(fd, (off_t)valid) != 0)) {
+        int saved = errno;
+        watch_journal_close(journal);
+        errno = saved;
+        return -1;
+    }
+    if (needs_compaction(journal)) compact(journal);
+    return 0;
+}
+
+void watch_journal_close(WatchJournal *journal) {
+    if (journal->fd >= 0) {
+        watch_journal_flush(journal);
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    for (int i = 0; i < journal->root_count; i++) free(journal->roots[i]);
+    free(journal->roots);
+    free(journal->slots);
+    free(journal->paths);
+    free(journal->pending);
+    free(journal->path);
+    journal->roots = NULL;
+    journal->root_count = 0;
+    journal->root_capacity = 0;
+    journal->slots = NULL;
+    journal->capacity = 0;
+    journal->count = 0;
+    journal->used = 0;
+    journal->paths = NULL;
+    journal->paths_len = 0;
+    journal->paths_cap = 0;
+    journal->paths_dead = 0;
+    journal->pending = NULL;
+    journal->pending_len = 0;
+    journal->pending_cap = 0;
+    journal->path = NULL;
+}
+
+int watch_journal_has_root(const WatchJournal *journal, const char *path, size_t len) {
+    for (int i = 0; i < journal->root_count; i++) {
+        if (strlen(journal->roots[i]) == len && memcmp(journal->roots[i], path, len) == 0) return 1;
+    }
+    return 0;
+}
+
+int watch_journal_add_root(WatchJournal *journal, const char *path, size_t len) {
+    if (watch_journal_has_root(journal, path, len)) return 0;
+    if (add_root(journal, path, len) != 0) return -1;
+    return log_record(journal, OP_ROOT, path, len, NULL);
+}
+
+void watch_journal_begin(WatchJournal *journal) {
+    // 0 is what fresh entries start with, so it never names a walk
+    if (++journal->mark == 0) journal->mark = 1;
+}
+
+int watch_journal_scan(WatchJournal *journal, const char *dir, JournalDiffFn fn, void *ctx) {
+    DIR *handle = opendir(dir);
+    if (handle == NULL) return -1;
+
+    size_t dir_len = strlen(dir);
+    size_t base = (dir_len == 1 && dir[0] == '/') ? 0 : dir_len;
+    if (base + 2 > PATH_MAX) {
+        closedir(handle);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    char path[PATH_MAX];
+    memcpy(path, dir, base);
+    path[base] = '/';
+
+    JournalEntry *self = find_entry(journal, dir, dir_len, hash_path(dir, dir_len));
+    if (self != NULL) self->listed = journal->mark;
+
+    int changes = 0;
+    struct dirent *de;
+    while ((de = readdir(handle)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+        size_t name_len = strlen(name);
+        if (base + 1 + name_len >= sizeof(path)) continue;
+        struct stat st;
+        if (fstatat(dirfd(handle), name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        memcpy(path + base + 1, name, name_len);
+        int n = apply_stat(journal, path, base + 1 + name_len, &st, fn, ctx);
+        if (n < 0) {
+            closedir(handle);
+            errno = ENOMEM;
+            return -1;
+        }
+        changes += n;
+    }
+    closedir(handle);
+    return changes;
+}
+
+int watch_journal_sweep(WatchJournal *journal, const char *root, size_t root_len, JournalDiffFn fn, void *ctx) {
+    int changes = 0;
+    for (uint32_t i = 0; i < journal->capacity; i++) {
+        const JournalEntry *entry = &journal->slots[i];
+        if (entry->state != SLOT_LIVE || entry->mark == journal->mark) continue;
+
+        const char *path = entry_path(journal, entry);
+        size_t len = entry->path_len;
+        if (len == root_len || !path_under(path, len, root, root_len)) continue;
+
+        // Entries of a directory that was not listed may still be there
+        size_t parent_len = parent_length(path, len);
+        if (parent_len != root_len) {
+            const JournalEntry *parent = find_entry(journal, path, parent_len, hash_path(path, parent_len));
+            if (parent == NULL || parent->listed != journal->mark) continue;
+        }
+
+        // Dropping only marks slots dead, so path stays valid and the scan can go on
+        if (fn != NULL) fn(ctx, RING_DELETED, entry->is_dir, path, len);
+        drop_path(journal, path, len);
+        changes++;
+    }
+    return changes;
+}
+
+int watch_journal_update(WatchJournal *journal, const char *dir, size_t dir_len, const char *name, size_t name_len) {
+    char path[PATH_MAX];
+    size_t base = (dir_len == 1 && dir[0] == '/') ? 0 : dir_len;
+    if (base + 1 + name_len >= sizeof(path)) return 0;
+    memcpy(path, dir, base);
+    path[base] = '/';
+    memcpy(path + base + 1, name, name_len);
+    size_t len = base + 1 + name_len;
+    path[len] = '\0';
+
+    struct stat st;
+    if (fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        return (apply_stat(journal, path, len, &st, NULL, NULL) < 0) ? -1 : 0;
+    }
+    if (errno != ENOENT && errno != ENOTDIR) return 0;
+    if (find_entry(journal, path, len, hash_path(path, len)) == NULL) return 0;
+    return drop_path(journal, path, len);
+}
+
+int watch_journal_flush(WatchJournal *journal) {
+    if (journal->fd < 0 || journal->pending_len == 0) return 0;
+    if (needs_compaction(journal)) return compact(journal);
+
+    int rc = write_all(journal->fd, journal->pending, journal->pending_len, journal->log_end);
+    int saved = errno;
+    if (rc == 0) journal->log_end += journal->pending_len;
+    journal->pending_len = 0;
+
+    // Don't keep a storm-sized buffer around
+    if (journal->pending_cap > 256 * 1024) {
+        free(journal->pending);
+        journal->pending = NULL;
+        journal->pending_cap = 0;
+    }
+    errno = saved;
+    return rc;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file watch_registry.c
+ * @brief Open-addressing wd <-> path registry
+ *
+ * Linear probing over power-of-two tables, with tombstones for removal.
+ * Tables are rebuilt once live entries plus tombstones reach 70% load, and
+ * the path arena is compacted during the rebuild when removed paths make up
+ * most of it.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "watch_registry.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REGISTRY_INITIAL_CAPACITY 64
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// Spread small sequential wds across the table
+static uint32_t hash_wd(int wd) {
+    return (uint32_t)wd * 0x9E3779B1u;
+}
+
+// FNV-1a over the path bytes
+static uint32_t hash_path(const char *path, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Drop trailing slashes, keeping a lone "/" intact
+static size_t normalize_len(const char *path, size_t len) {
+    while (len > 1 && path[len - 1] == '/') len--;
+    return len;
+}
+
+static void arena_free(PathArenaChunk *chunk) {
+    while (chunk != NULL) {
+        PathArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+// Copy a string into the arena and return the stable copy
+static const char *arena_intern(PathArenaChunk **arena, const char *str, size_t len) {
+    PathArenaChunk *chunk = *arena;
+    if (chunk == NULL || chunk->size - chunk->used < len + 1) {
+        size_t size = (len + 1 > ARENA_CHUNK_SIZE) ? len + 1 : ARENA_CHUNK_SIZE;
+        PathArenaChunk *fresh = malloc(sizeof(PathArenaChunk) + size);
+        if (fresh == NULL) return NULL;
+        fresh->next = chunk;
+        fresh->used = 0;
+        fresh->size = size;
+        *arena = fresh;
+        chunk = fresh;
+    }
+
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    chunk->used += len + 1;
+    return copy;
+}
+
+static uint32_t find_wd_slot(const WatchRegistry *reg, int wd) {
+    uint32_t mask = reg->capacity - 1;
+    uint32_t slot = hash_wd(wd) & mask;
+    while (reg->entries[slot].wd != WATCH_SLOT_EMPTY) {
+        if (reg->entries[slot].wd == wd) return slot;
+        slot = (slot + 1) & mask;
+    }
+    return UINT32_MAX;
+}
+
+static uint32_t find_path_slot(const WatchRegistry *reg, const char *path,
+                               size_t len, uint32_t hash) {
+    uint32_t mask = reg->capacity - 1;
+    uint32_t slot = hash & mask;
+    while (reg->path_index[slot] != WATCH_SLOT_EMPTY) {
+        int index = reg->path_index[slot];
+        if (index >= 0) {
+            const WatchEntry *entry = &reg->entries[index];
+            if (entry->path_hash == hash && entry->path_len == len &&
+                memcmp(entry->path, path, len) == 0) {
+                return slot;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return UINT32_MAX;
+}
+
+// Insert into both tables; caller guarantees wd is absent and there is room.
+// Tombstones are never reused so both tables fill at the same rate and
+// `used` alone decides when to rebuild.
+static void insert_entry(WatchRegistry *reg, const WatchEntry *entry) {
+    uint32_t mask = reg->capacity - 1;
+
+    uint32_t slot = hash_wd(entry->wd) & mask;
+    while (reg->entries[slot].wd != WATCH_SLOT_EMPTY) slot = (slot + 1) & mask;
+    reg->entries[slot] = *entry;
+
+    uint32_t pslot = entry->path_hash & mask;
+    while (reg->path_index[pslot] != WATCH_SLOT_EMPTY) pslot = (pslot + 1) & mask;
+    reg->path_index[pslot] = (int)slot;
+
+    reg->count++;
+    reg->used++;
+}
+
+static int alloc_tables(WatchRegistry *reg, uint32_t capacity) {
+    reg->entries = malloc(sizeof(WatchEntry) * capacity);
+    reg->path_index = malloc(sizeof(int) * capacity);
+    if (reg->entries == NULL || reg->path_index == NULL) {
+        free(reg->entries);
+        free(reg->path_index);
+        return -1;
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        reg->entries[i].wd = WATCH_SLOT_EMPTY;
+        reg->path_index[i] = WATCH_SLOT_EMPTY;
+    }
+    reg->capacity = capacity;
+    reg->count = 0;
+    reg->used = 0;
+    return 0;
+}
+
+// Rebuild the tables, dropping tombstones and compacting the arena if needed
+static int rehash(WatchRegistry *reg, uint32_t capacity) {
+    WatchRegistry old = *reg;
+    if (alloc_tables(reg, capacity) != 0) {
+        *reg = old;
+        return -1;
+    }
+
+    int compact = old.arena_dead > old.arena_live && old.arena_dead > ARENA_CHUNK_SIZE;
+    if (compact) {
+        reg->arena = NULL;
+        reg->arena_live = 0;
+        reg->arena_dead = 0;
+    }
+
+    for (uint32_t i = 0; i < old.capacity; i++) {
+        WatchEntry entry = old.entries[i];
+        if (entry.wd < 0) continue;
+        if (compact) {
+            const char *copy = arena_intern(&reg->arena, entry.path, entry.path_len);
+            if (copy == NULL) {
+                arena_free(reg->arena);
+                free(reg->entries);
+                free(reg->path_index);
+                *reg = old;
+                return -1;
+            }
+            entry.path = copy;
+            reg->arena_live += entry.path_len + 1;
+        }
+        insert_entry(reg, &entry);
+    }
+
+    if (compact) arena_free(old.arena);
+    free(old.entries);
+    free(old.path_index);
+    return 0;
+}
+
+int watch_registry_init(WatchRegistry *reg) {
+    memset(reg, 0, sizeof(*reg));
+    return alloc_tables(reg, REGISTRY_INITIAL_CAPACITY);
+}
+
+void watch_registry_destroy(WatchRegistry *reg) {
+    free(reg->entries);
+    free(reg->path_index);
+    arena_free(reg->arena);
+    memset(reg, 0, sizeof(*reg));
+}
+
+int watch_registry_add(WatchRegistry *reg, int wd, const char *path, size_t len, int root) {
+    if (wd < 0) return -1;
+    len = normalize_len(path, len);
+
+    // Same wd seen again: the kernel watch now belongs to this path. A stale
+    // wd for the same path (directory deleted and recreated) loses its name.
+    watch_registry_remove(reg, wd);
+    watch_registry_remove(reg, watch_registry_find_path(reg, path, len));
+
+    if ((reg->used + 1) * 10 >= reg->capacity * 7) {
+        uint32_t capacity = reg->capacity;
+        if ((reg->count + 1) * 10 >= capacity * 5) capacity *= 2;
+        if (rehash(reg, capacity) != 0) return -1;
+    }
+
+    WatchEntry entry;
+    entry.wd = wd;
+    entry.path_hash = hash_path(path, len);
+    entry.path_len = (uint32_t)len;
+    entry.root = root;
+    entry.path = arena_intern(&reg->arena, path, len);
+    if (entry.path == NULL) return -1;
+    reg->arena_live += len + 1;
+
+    insert_entry(reg, &entry);
+    return 0;
+}
+
+const WatchEntry *watch_registry_lookup(const WatchRegistry *reg, int wd) {
+    if (wd < 0) return NULL;
+    uint32_t slot = find_wd_slot(reg, wd);
+    return (slot == UINT32_MAX) ? NULL : &reg->entries[slot];
+}
+
+int watch_registry_find_path(const WatchRegistry *reg, const char *path, size_t len) {
+    len = normalize_len(path, len);
+    uint32_t slot = find_path_slot(reg, path, len, hash_path(path, len));
+    if (slot == UINT32_MAX) return -1;
+    return reg->entries[reg->path_index[slot]].wd;
+}
+
+int watch_registry_remove(WatchRegistry *reg, int wd) {
+    if (wd < 0) return -1;
+    uint32_t slot = find_wd_slot(reg, wd);
+    if (slot == UINT32_MAX) return -1;
+
+    WatchEntry *entry = &reg->entries[slot];
+    uint32_t mask = reg->capacity - 1;
+    uint32_t pslot = entry->path_hash & mask;
+    while (reg->path_index[pslot] != WATCH_SLOT_EMPTY) {
+        if (reg->path_index[pslot] == (int)slot) {
+            reg->path_index[pslot] = WATCH_SLOT_TOMBSTONE;
+            break;
+        }
+        pslot = (pslot + 1) & mask;
+    }
+
+    reg->arena_live -= entry->path_len + 1;
+    reg->arena_dead += entry->path_len + 1;
+    entry->wd = WATCH_SLOT_TOMBSTONE;
+    reg->count--;
+    return 0;
+}
+
+const WatchEntry *watch_registry_next(const WatchRegistry *reg, uint32_t *cursor) {
+    while (*cursor < reg->capacity) {
+        const WatchEntry *entry = &reg->entries[(*cursor)++];
+        if (entry->wd >= 0) return entry;
+    }
+    return NULL;
+}
+
+// True if path is prefix itself or lies below it
+static int under_prefix(const char *path, size_t path_len, const char *prefix, size_t prefix_len) {
+    if (path_len < prefix_len || memcmp(path, prefix, prefix_len) != 0) return 0;
+    return path_len == prefix_len || path[prefix_len] == '/' || (prefix_len == 1 && prefix[0] == '/');
+}
+
+int watch_registry_rename_prefix(WatchRegistry *reg, const char *from, size_t from_len,
+                                 const char *to, size_t to_len) {
+    from_len = normalize_len(from, from_len);
+    to_len = normalize_len(to, to_len);
+
+    // Build every new path first: adding may compact the arena under us
+    typedef struct { int wd; int root; char *path; size_t len; } Rekey;
+    Rekey *rekeys = NULL;
+    size_t count = 0, capacity = 0;
+    int ret = 0;
+
+    uint32_t cursor = 0;
+    const WatchEntry *entry;
+    while ((entry = watch_registry_next(reg, &cursor)) != NULL) {
+        if (!under_prefix(entry->path, entry->path_len, from, from_len)) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            Rekey *grown = realloc(rekeys, sizeof(Rekey) * capacity);
+            if (grown == NULL) {
+                ret = -1;
+                goto out;
+            }
+            rekeys = grown;
+        }
+        size_t tail_len = entry->path_len - from_len;
+        char *path = malloc(to_len + tail_len + 1);
+        if (path == NULL) {
+            ret = -1;
+            goto out;
+        }
+        memcpy(path, to, to_len);
+        memcpy(path + to_len, entry->path + from_len, tail_len);
+        path[to_len + tail_len] = '\0';
+        rekeys[count++] = (Rekey){ entry->wd, entry->root, path, to_len + tail_len };
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (watch_registry_add(reg, rekeys[i].wd, rekeys[i].path, rekeys[i].len, rekeys[i].root) != 0) {
+            ret = -1;
+            goto out;
+        }
+        ret++;
+    }
+
+out:
+    for (size_t i = 0; i < count; i++) free(rekeys[i].path);
+    free(rekeys);
+    return ret;
+}
@@ -5,6 +5,11 @@
  * Minimal implementation that satisfies JNI loading requirements but provides
  * no actual file watching functionality. Use when you only need the LSP to
  * start without native library errors.
+ *
+ * Linked into the same library as the real implementation. Nothing here is
+ * exported: when FILEWATCHER_BACKEND=stub, JNI_OnLoad binds these functions
+ * to the FileWatcher natives with RegisterNatives(), which takes precedence
+ * over the real symbols the JVM would otherwise resolve.
  * 
  * @author yamsergey
  * @version 1.0.0
@@ -16,44 +21,247 @@
 #include <string.h>
 
 // Create a dummy watcher pointer
-JNIEXPORT jlong JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_create(JNIEnv *env, jclass clazz) {
+static jlong JNICALL
+stub_create(JNIEnv *env, jclass clazz) {
     // Return a dummy pointer (non-zero to indicate success)
     return (jlong)1;
 }
 
 // Stub watch method - always returns true
-JNIEXPORT jboolean JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_watch(JNIEnv *env, jclass clazz, jlong watcherPtr, jstring path) {
+static jboolean JNICALL
+stub_watch(JNIEnv *env, jclass clazz, jlong watcherPtr, jstring path) {
     return JNI_TRUE;
 }
 
+// Stub watchAll method - reports every path watched
+static jintArray JNICALL
+stub_watchAll(JNIEnv *env, jclass clazz, jlong watcherPtr, jobjectArray paths) {
+    jsize count = (paths != NULL) ? (*env)->GetArrayLength(env, paths) : 0;
+    jsize words = (count + 31) / 32;
+    jintArray array = (*env)->NewIntArray(env, words);
+    if (array == NULL) return NULL;
+    for (jsize i = 0; i < words; i++) {
+        jint bits = (i < count / 32) ? (jint)0xffffffffu : (jint)((1u << (count % 32)) - 1);
+        (*env)->SetIntArrayRegion(env, array, i, 1, &bits);
+    }
+    return array;
+}
+
+// Stub watchFiltered method - always returns success
+static jboolean JNICALL
+stub_watchFiltered(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                   jstring path, jint mask,
+                   jobjectArray includes, jobjectArray excludes) {
+    return JNI_TRUE;
+}
+
+// Stub watchRecursive method - reports zero watches added in zero time
+static jlongArray JNICALL
+stub_watchRecursive(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                    jstring path, jobjectArray excludes) {
+    return (*env)->NewLongArray(env, 2);
+}
+
 // Stub unwatch method - does nothing
-JNIEXPORT void JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_unwatch(JNIEnv *env, jclass clazz, jlong watcherPtr, jstring path) {
+static void JNICALL
+stub_unwatch(JNIEnv *env, jclass clazz, jlong watcherPtr, jstring path) {
     // No-op
 }
 
 // Stub nextEvent method - returns null (no events)
-JNIEXPORT jobject JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_nextEvent(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+static jobject JNICALL
+stub_nextEvent(JNIEnv *env, jclass clazz, jlong watcherPtr) {
     // Return null to indicate no events
     return NULL;
 }
 
+// Stub nextEvents method - returns null (no events)
+static jobjectArray JNICALL
+stub_nextEvents(JNIEnv *env, jclass clazz, jlong watcherPtr, jint max) {
+    return NULL;
+}
+
+// Stub eventRing method - no ring to share
+static jobject JNICALL
+stub_eventRing(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    return NULL;
+}
+
+// Stub fillRing method - nothing to parse
+static jint JNICALL
+stub_fillRing(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    return 0;
+}
+
+// Stub watchPath method - no watches are registered
+static jstring JNICALL
+stub_watchPath(JNIEnv *env, jclass clazz, jlong watcherPtr, jint wd) {
+    return NULL;
+}
+
+// Stub startReader method - there is nothing to read
+static jboolean JNICALL
+stub_startReader(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                 jint queueBytes) {
+    return JNI_FALSE;
+}
+
+// Stub queueHighWater method - nothing is ever queued
+static jlong JNICALL
+stub_queueHighWater(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    return 0;
+}
+
+// Stub getStats method - nothing is counted
+static jlongArray JNICALL
+stub_getStats(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+    return NULL;
+}
+
+// Stub setListener method - accepted, but no events will ever be pushed
+static jboolean JNICALL
+stub_setListener(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                 jobject listener, jint maxBatch, jint maxDelayMs) {
+    return (listener == NULL || (maxBatch > 0 && maxDelayMs >= 0)) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Stub setReadBufferLimit method - accepted, nothing is read
+static jboolean JNICALL
+stub_setReadBufferLimit(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                        jint maxBytes) {
+    return (maxBytes > 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Stub openJournal method - nothing is watched, so nothing is journaled
+static jlong JNICALL
+stub_openJournal(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                 jstring path) {
+    return 0;
+}
+
+// Stub setCoalescing method - accepted, nothing to coalesce
+static jboolean JNICALL
+stub_setCoalescing(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                   jint windowMs) {
+    return (windowMs >= 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Stub setSettleTimeout method - accepted, nothing is written
+static jboolean JNICALL
+stub_setSettleTimeout(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                      jint timeoutMs) {
+    return (timeoutMs >= 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Stub setRenamePairing method - accepted, nothing is renamed
+static jboolean JNICALL
+stub_setRenamePairing(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                      jint timeoutMs) {
+    return (timeoutMs >= 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Stub setPriority method - accepted, there are no events to order
+static jboolean JNICALL
+stub_setPriority(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                 jobjectArray names, jobjectArray roots) {
+    return JNI_TRUE;
+}
+
+// Stub setOverflowRecovery method - accepted, the queue never overflows
+static jboolean JNICALL
+stub_setOverflowRecovery(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                         jboolean enabled) {
+    return JNI_TRUE;
+}
+
+// Stub setContentHashing method - accepted, nothing is ever modified
+static jboolean JNICALL
+stub_setContentHashing(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                       jlong maxFileBytes) {
+    return (maxFileBytes >= 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Stub setFanotify method - accepted, nothing is ever marked
+static jboolean JNICALL
+stub_setFanotify(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                 jboolean enabled) {
+    return JNI_TRUE;
+}
+
+// Stub isFanotifyRoot method - there are no roots
+static jboolean JNICALL
+stub_isFanotifyRoot(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                    jstring path) {
+    return JNI_FALSE;
+}
+
+// Stub waitForEvents method - no events will ever arrive
+static jboolean JNICALL
+stub_waitForEvents(JNIEnv *env, jclass clazz, jlong watcherPtr,
+                   jlong timeoutMs) {
+    return JNI_FALSE;
+}
+
 // Stub close method - does nothing
-JNIEXPORT void JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_close(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+static void JNICALL
+stub_close(JNIEnv *env, jclass clazz, jlong watcherPtr) {
     // No-op
 }
 
 // Stub destroy method - does nothing
-JNIEXPORT void JNICALL
-Java_com_jetbrains_analyzer_filewatcher_FileWatcher_destroy(JNIEnv *env, jclass clazz, jlong watcherPtr) {
+static void JNICALL
+stub_destroy(JNIEnv *env, jclass clazz, jlong watcherPtr) {
     // No-op
 }
 
-// JNI_OnLoad - called when library is loaded
-JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
-    return JNI_VERSION_1_8;
-}
\ No newline at end of file
+#define WATCHER_TYPE "Lcom/jetbrains/analyzer/filewatcher/FileWatcher"
+
+// Every native with its Java signature. JNINativeMethod keeps function
+// pointers as void *, which ISO C does not promise.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+static const JNINativeMethod stub_methods[] = {
+    { "create", "()J", (void*)stub_create },
+    { "watch", "(JLjava/lang/String;)Z", (void*)stub_watch },
+    { "watchAll", "(J[Ljava/lang/String;)[I", (void*)stub_watchAll },
+    { "watchFiltered", "(JLjava/lang/String;I[Ljava/lang/String;[Ljava/lang/String;)Z", (void*)stub_watchFiltered },
+    { "watchRecursive", "(JLjava/lang/String;[Ljava/lang/String;)[J", (void*)stub_watchRecursive },
+    { "unwatch", "(JLjava/lang/String;)V", (void*)stub_unwatch },
+    { "nextEvent", "(J)" WATCHER_TYPE "$Event;", (void*)stub_nextEvent },
+    { "nextEvents", "(JI)[" WATCHER_TYPE "$Event;", (void*)stub_nextEvents },
+    { "eventRing", "(J)Ljava/nio/ByteBuffer;", (void*)stub_eventRing },
+    { "fillRing", "(J)I", (void*)stub_fillRing },
+    { "watchPath", "(JI)Ljava/lang/String;", (void*)stub_watchPath },
+    { "startReader", "(JI)Z", (void*)stub_startReader },
+    { "queueHighWater", "(J)J", (void*)stub_queueHighWater },
+    { "getStats", "(J)[J", (void*)stub_getStats },
+    { "setListener", "(J" WATCHER_TYPE "$Listener;II)Z", (void*)stub_setListener },
+    { "setReadBufferLimit", "(JI)Z", (void*)stub_setReadBufferLimit },
+    { "openJournal", "(JLjava/lang/String;)J", (void*)stub_openJournal },
+    { "setCoalescing", "(JI)Z", (void*)stub_setCoalescing },
+    { "setSettleTimeout", "(JI)Z", (void*)stub_setSettleTimeout },
+    { "setRenamePairing", "(JI)Z", (void*)stub_setRenamePairing },
+    { "setPriority", "(J[Ljava/lang/String;[Ljava/lang/String;)Z", (void*)stub_setPriority },
+    { "setOverflowRecovery", "(JZ)Z", (void*)stub_setOverflowRecovery },
+    { "setContentHashing", "(JJ)Z", (void*)stub_setContentHashing },
+    { "setFanotify", "(JZ)Z", (void*)stub_setFanotify },
+    { "isFanotifyRoot", "(JLjava/lang/String;)Z", (void*)stub_isFanotifyRoot },
+    { "waitForEvents", "(JJ)Z", (void*)stub_waitForEvents },
+    { "close", "(J)V", (void*)stub_close },
+    { "destroy", "(J)V", (void*)stub_destroy },
+};
+#pragma GCC diagnostic pop
+
+int stub_register_natives(JNIEnv *env, jclass clazz) {
+    int registered = 0;
+    for (size_t i = 0; i < sizeof(stub_methods) / sizeof(stub_methods[0]); i++) {
+        // Older FileWatcher classes declare only some of the natives
+        if ((*env)->RegisterNatives(env, clazz, &stub_methods[i], 1) == 0) {
+            registered++;
+        } else {
+            (*env)->ExceptionClear(env);
+            debug_log("FileWatcher has no native %s%s", stub_methods[i].name, stub_methods[i].signature);
+        }
+    }
+    return registered;
+}
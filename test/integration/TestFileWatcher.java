@@ -4,9 +4,18 @@
  */
 
 import java.nio.file.*;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.VarHandle;
 import java.io.File;
 import java.io.FileWriter;
 import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.util.ArrayList;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Set;
 
 public class TestFileWatcher {
     
@@ -30,6 +39,30 @@ public class TestFileWatcher {
         try {
             testBasicFunctionality();
             testFileEvents();
+            testRecursiveWatch();
+            testBatchedEvents();
+            testEventRing();
+            testWaitForEvents();
+            testReaderThread();
+            testCoalescing();
+            testRenamePairing();
+            testOverflowRecovery();
+            testFilteredWatch();
+            testSettledWrites();
+            testFanotifyBackend();
+            testSharedWatchers();
+            testStats();
+            testConcurrentConsumers();
+            testListener();
+            testReadBufferLimit();
+            testJournal();
+            testLongPaths();
+            testStringCache();
+            testPriorityLane();
+            testWatchLimitFallback();
+            testBackendSelection();
+            testWatchAll();
+            testContentHashing();
             System.out.println("\n🎉 All integration tests passed!");
         } catch (Exception e) {
             System.err.println("❌ Integration test failed: " + e.getMessage());
@@ -96,6 +129,9 @@ public class TestFileWatcher {
         FileWatcher.Event event = watcher.nextEvent();
         if (event != null) {
             System.out.println("  ✓ Received event: " + event.getKind() + " - " + event.getPath());
+            if (!event.getPath().equals(testFile.getPath())) {
+                throw new RuntimeException("Expected full path " + testFile.getPath() + ", got " + event.getPath());
+            }
         } else {
             System.out.println("  ⚠️ No events received (stub implementation or event not captured)");
         }
@@ -113,13 +149,1229 @@ public class TestFileWatcher {
             System.out.println("  ✓ Received modification event: " + event.getKind() + " - " + event.getPath());
         }
         
-        // Clean up
+        // Drain the rest of the modification burst, then stop watching
+        while (watcher.nextEvent() != null) { }
+        watcher.unwatch(testDir);
+        
         testFile.delete();
+        Thread.sleep(100);
+        
+        event = watcher.nextEvent();
+        if (event != null) {
+            throw new RuntimeException("Received event after unwatch: " + event);
+        }
+        System.out.println("  ✓ No events after unwatch");
+        
+        // Clean up
         watcher.stop();
         dir.delete();
         
         System.out.println("✅ File events test completed\n");
     }
+    
+    private static void testRecursiveWatch() throws Exception {
+        System.out.println("Testing recursive watch...");
+        
+        File root = new File("/tmp/filewatcher_tree");
+        new File(root, "src/main/kotlin").mkdirs();
+        new File(root, "build/classes").mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.setFanotify(false); // Count the inotify watches the crawl adds
+        long[] report = watcher.watchRecursive(root.getPath(), new String[] { "build/", ".gradle/" });
+        System.out.println("  ✓ Watched " + report[0] + " directories in " + (report[1] / 1000) + " µs");
+        if (report[0] != 4) {
+            throw new RuntimeException("Expected 4 watches (build/ excluded), got " + report[0]);
+        }
+
+        // The same root twice is refused
+        boolean refused = false;
+        try {
+            watcher.watchRecursive(root.getPath(), null);
+        } catch (RuntimeException e) {
+            refused = true;
+        }
+        if (!refused) {
+            throw new RuntimeException("Second recursive watch on the same root succeeded");
+        }
+        System.out.println("  ✓ Duplicate root refused");
+
+        // A directory created after the crawl is picked up on the next event
+        File late = new File(root, "src/test");
+        late.mkdirs();
+        Thread.sleep(100);
+        while (watcher.nextEvent() != null) { }
+        
+        File source = new File(late, "Late.kt");
+        source.createNewFile();
+        Thread.sleep(100);
+        
+        FileWatcher.Event event = watcher.nextEvent();
+        if (event == null || !event.getPath().equals(source.getPath())) {
+            throw new RuntimeException("Expected event for " + source.getPath() + ", got " + event);
+        }
+        System.out.println("  ✓ New subdirectory watched automatically");
+        
+        watcher.stop();
+        source.delete();
+        late.delete();
+        new File(root, "src/main/kotlin").delete();
+        new File(root, "src/main").delete();
+        new File(root, "src").delete();
+        new File(root, "build/classes").delete();
+        new File(root, "build").delete();
+        root.delete();
+        
+        System.out.println("✅ Recursive watch test passed\n");
+    }
+    
+    private static void testBatchedEvents() throws Exception {
+        System.out.println("Testing batched events...");
+        
+        File dir = new File("/tmp/filewatcher_batch");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        
+        for (int i = 0; i < 50; i++) {
+            new File(dir, "f" + i).createNewFile();
+        }
+        Thread.sleep(100);
+        
+        FileWatcher.Event[] events = watcher.nextEvents(64);
+        int count = (events != null) ? events.length : 0;
+        if (count != 50) {
+            throw new RuntimeException("Expected 50 events in one batch, got " + count);
+        }
+        System.out.println("  ✓ Received " + count + " events in one call");
+        
+        if (watcher.nextEvents(64) != null) {
+            throw new RuntimeException("Expected null once drained");
+        }
+        
+        watcher.stop();
+        for (int i = 0; i < 50; i++) {
+            new File(dir, "f" + i).delete();
+        }
+        dir.delete();
+        
+        System.out.println("✅ Batched events test passed\n");
+    }
+    
+    private static void testEventRing() throws Exception {
+        System.out.println("Testing zero-copy event ring...");
+        
+        File dir = new File("/tmp/filewatcher_ring");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        
+        // Layout from include/event_ring.h, in native byte order
+        ByteBuffer ring = watcher.eventRing().order(ByteOrder.nativeOrder());
+        VarHandle index = MethodHandles.byteBufferViewVarHandle(int[].class, ByteOrder.nativeOrder());
+        int dataOffset = ring.getShort(6) & 0xffff;
+        int capacity = ring.getInt(8);
+        
+        for (int i = 0; i < 10; i++) {
+            new File(dir, "r" + i).createNewFile();
+        }
+        Thread.sleep(100);
+        int added = watcher.fillRing();
+        
+        int head = (int) index.getAcquire(ring, 16);
+        int tail = (int) index.getAcquire(ring, 64);
+        int seen = 0;
+        while (tail != head) {
+            int at = dataOffset + (tail & (capacity - 1));
+            int size = ring.getShort(at) & 0xffff;
+            int flags = ring.get(at + 3);
+            if ((flags & 0x01) == 0) {
+                int kind = ring.get(at + 2);
+                int wd = ring.getInt(at + 4);
+                byte[] name = new byte[ring.getShort(at + 12) & 0xffff];
+                ring.get(at + 16, name);
+                if (kind != 0 || !new String(name).equals("r" + seen)) {
+                    throw new RuntimeException("Unexpected record kind=" + kind + " name=" + new String(name));
+                }
+                if (seen == 0 && !dir.getPath().equals(watcher.watchPath(wd))) {
+                    throw new RuntimeException("watchPath(" + wd + ") = " + watcher.watchPath(wd));
+                }
+                seen++;
+            }
+            tail += size;
+        }
+        index.setRelease(ring, 64, tail);
+        
+        if (added != 10 || seen != 10) {
+            throw new RuntimeException("Expected 10 ring records, filled " + added + " and decoded " + seen);
+        }
+        System.out.println("  ✓ Decoded " + seen + " records in place");
+        
+        watcher.stop();
+        for (int i = 0; i < 10; i++) {
+            new File(dir, "r" + i).delete();
+        }
+        dir.delete();
+        
+        System.out.println("✅ Event ring test passed\n");
+    }
+    
+    private static void testWaitForEvents() throws Exception {
+        System.out.println("Testing blocking waitForEvents...");
+        
+        File dir = new File("/tmp/filewatcher_wait");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        
+        long start = System.nanoTime();
+        if (watcher.waitForEvents(100)) {
+            throw new RuntimeException("Expected timeout with no events");
+        }
+        long waitedMs = (System.nanoTime() - start) / 1_000_000;
+        if (waitedMs < 90) {
+            throw new RuntimeException("Returned after " + waitedMs + "ms, expected ~100ms");
+        }
+        System.out.println("  ✓ Timed out after " + waitedMs + "ms");
+        
+        new File(dir, "w0").createNewFile();
+        if (!watcher.waitForEvents(1000) || watcher.nextEvent() == null) {
+            throw new RuntimeException("Expected an event after waking");
+        }
+        System.out.println("  ✓ Woke up for a new event");
+        
+        // close() must interrupt a thread blocked with no timeout
+        Thread waiter = new Thread(() -> watcher.waitForEvents(-1));
+        waiter.start();
+        Thread.sleep(100);
+        watcher.stop();
+        waiter.join(1000);
+        if (waiter.isAlive()) {
+            throw new RuntimeException("close() did not wake the waiting thread");
+        }
+        System.out.println("  ✓ close() woke the waiting thread");
+        
+        new File(dir, "w0").delete();
+        dir.delete();
+        
+        System.out.println("✅ waitForEvents test passed\n");
+    }
+    
+    private static void testReaderThread() throws Exception {
+        System.out.println("Testing background reader thread...");
+        
+        File dir = new File("/tmp/filewatcher_reader");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        if (!watcher.startReader(1 << 20)) {
+            throw new RuntimeException("startReader failed");
+        }
+        System.out.println("  ✓ Reader thread started");
+        
+        // More than the kernel queues by default; the reader keeps up while we create
+        int files = 20000;
+        for (int i = 0; i < files; i++) {
+            new File(dir, "q" + i).createNewFile();
+        }
+        
+        int count = 0;
+        while (count < files && watcher.waitForEvents(2000)) {
+            FileWatcher.Event[] events;
+            while ((events = watcher.nextEvents(256)) != null) {
+                for (FileWatcher.Event event : events) {
+                    if (event.getKind() == FileWatcher.EventKind.OVERFLOW) {
+                        throw new RuntimeException("Kernel queue overflowed with a reader thread");
+                    }
+                }
+                count += events.length;
+            }
+        }
+        if (count != files) {
+            throw new RuntimeException("Expected " + files + " events, got " + count);
+        }
+        System.out.println("  ✓ Received all " + count + " events");
+        
+        long highWater = watcher.queueHighWater();
+        if (highWater <= 0) {
+            throw new RuntimeException("Expected a non-zero high-water mark");
+        }
+        System.out.println("  ✓ Queue high-water mark: " + highWater + " bytes");
+        
+        watcher.stop();
+        for (int i = 0; i < files; i++) {
+            new File(dir, "q" + i).delete();
+        }
+        dir.delete();
+        
+        System.out.println("✅ Reader thread test passed\n");
+    }
+    
+    private static void testCoalescing() throws Exception {
+        System.out.println("Testing event coalescing...");
+        
+        File dir = new File("/tmp/filewatcher_coalesce");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        watcher.setCoalescing(100);
+        
+        // An editor save: write a temp file, then rename it over the target
+        File tmp = new File(dir, "Main.kt.tmp");
+        File target = new File(dir, "Main.kt");
+        try (FileWriter writer = new FileWriter(tmp)) {
+            for (int i = 0; i < 20; i++) {
+                writer.write("line " + i + "\n");
+                writer.flush();
+            }
+        }
+        if (!tmp.renameTo(target)) {
+            throw new RuntimeException("Rename failed");
+        }
+        
+        if (watcher.nextEvent() != null) {
+            throw new RuntimeException("Expected nothing before the quiet window passes");
+        }
+        
+        List<FileWatcher.Event> events = new ArrayList<>();
+        while (watcher.waitForEvents(500)) {
+            FileWatcher.Event event;
+            while ((event = watcher.nextEvent()) != null) events.add(event);
+        }
+        if (events.size() != 1 || !events.get(0).getPath().equals(target.getPath())) {
+            throw new RuntimeException("Expected one event for " + target + ", got " + events.size());
+        }
+        System.out.println("  ✓ Save burst folded into " + events.get(0).getKind() + " " + events.get(0).getPath());
+        
+        watcher.stop();
+        target.delete();
+        dir.delete();
+        
+        System.out.println("✅ Coalescing test passed\n");
+    }
+    
+    private static void testFilteredWatch() throws Exception {
+        System.out.println("Testing filtered watch...");
+        
+        File dir = new File("/tmp/filewatcher_filtered");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watchFiltered(dir.getPath(), FileWatcher.IN_CREATE | FileWatcher.IN_MODIFY,
+                              new String[] { "*.kt", "build" }, new String[] { "Gen*.kt", "build/" });
+        
+        File source = new File(dir, "Main.kt");
+        File generated = new File(dir, "GenMain.kt");
+        File output = new File(dir, "Main.class");
+        File build = new File(dir, "build");
+        try (FileWriter writer = new FileWriter(source)) {
+            writer.write("fun main() {}\n");
+        }
+        generated.createNewFile();
+        output.createNewFile();
+        build.mkdir();
+        source.delete();
+        
+        List<FileWatcher.Event> events = new ArrayList<>();
+        while (watcher.waitForEvents(200)) {
+            FileWatcher.Event event;
+            while ((event = watcher.nextEvent()) != null) events.add(event);
+        }
+        for (FileWatcher.Event event : events) {
+            if (!event.getPath().equals(source.getPath()) || event.getKind() == FileWatcher.EventKind.DELETED) {
+                throw new RuntimeException("Filter let through " + event.getKind() + " " + event.getPath());
+            }
+        }
+        if (events.isEmpty()) {
+            throw new RuntimeException("Expected events for " + source);
+        }
+        System.out.println("  ✓ " + events.size() + " events for Main.kt, none for excluded names or kinds");
+        
+        watcher.stop();
+        generated.delete();
+        output.delete();
+        build.delete();
+        dir.delete();
+        
+        System.out.println("✅ Filtered watch test passed\n");
+    }
+    
+    private static void testSettledWrites() throws Exception {
+        System.out.println("Testing settled writes...");
+        
+        File dir = new File("/tmp/filewatcher_settled");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.setSettleTimeout(300);
+        watcher.watchFiltered(dir.getPath(), FileWatcher.IN_CREATE | FileWatcher.IN_CLOSE_WRITE, null, null);
+        
+        // A large file written in chunks is one MODIFIED, sent on close
+        File file = new File(dir, "Large.kt");
+        try (FileWriter writer = new FileWriter(file)) {
+            for (int i = 0; i < 200; i++) {
+                writer.write("val line" + i + " = " + i + "\n");
+                writer.flush();
+            }
+        }
+        int modified = 0;
+        while (watcher.waitForEvents(200)) {
+            FileWatcher.Event event;
+            while ((event = watcher.nextEvent()) != null) {
+                if (event.getKind() == FileWatcher.EventKind.MODIFIED) modified++;
+            }
+        }
+        if (modified != 1) {
+            throw new RuntimeException("Expected one MODIFIED for a chunked write, got " + modified);
+        }
+        System.out.println("  ✓ 200 writes reported as one MODIFIED on close");
+        
+        // A writer that keeps the file open is reported after the timeout
+        try (RandomAccessFile open = new RandomAccessFile(file, "rw")) {
+            open.write('x');
+            long start = System.nanoTime();
+            FileWatcher.Event event = null;
+            while (event == null && watcher.waitForEvents(1000)) event = watcher.nextEvent();
+            if (event == null || event.getKind() != FileWatcher.EventKind.MODIFIED) {
+                throw new RuntimeException("Expected MODIFIED for an open writer");
+            }
+            System.out.println("  ✓ Open writer reported after " + (System.nanoTime() - start) / 1000000 + " ms");
+        }
+        
+        watcher.stop();
+        file.delete();
+        dir.delete();
+        
+        System.out.println("✅ Settled writes test passed\n");
+    }
+    
+    private static void testFanotifyBackend() throws Exception {
+        System.out.println("Testing fanotify backend...");
+        
+        File root = new File("/tmp/filewatcher_fanotify");
+        File deep = new File(root, "src/main/kotlin");
+        File skipped = new File(root, "build");
+        deep.mkdirs();
+        skipped.mkdirs();
+        
+        // Either backend is fine; both must report the same events
+        FileWatcher watcher = new FileWatcher();
+        long[] report = watcher.watchRecursive(root.getPath(), new String[] { "build/" });
+        boolean marked = watcher.isFanotifyRoot(root.getPath());
+        System.out.println("  ✓ Backend: " + (marked ? "fanotify" : "inotify") + ", " + report[0] + " watches");
+        if (marked && report[0] != 0) {
+            throw new RuntimeException("A fanotify root should add no watches, got " + report[0]);
+        }
+        
+        new File(skipped, "Out.class").createNewFile();
+        File source = new File(deep, "Main.kt");
+        source.createNewFile();
+        if (!watcher.waitForEvents(1000)) {
+            throw new RuntimeException("Expected an event for " + source);
+        }
+        FileWatcher.Event event = watcher.nextEvent();
+        if (event == null || event.getKind() != FileWatcher.EventKind.CREATED ||
+            !event.getPath().equals(source.getPath())) {
+            throw new RuntimeException("Expected CREATED " + source + " (build/ excluded), got " + event);
+        }
+        System.out.println("  ✓ " + event);
+
+        watcher.unwatch(root.getPath());
+        if (watcher.isFanotifyRoot(root.getPath())) {
+            throw new RuntimeException("Unwatched root still reported as a fanotify root");
+        }
+
+        // A root given through a symlink keeps that spelling in event paths
+        File link = new File("/tmp/filewatcher_fanotify_link");
+        link.delete();
+        Files.createSymbolicLink(link.toPath(), root.toPath());
+        watcher.watchRecursive(link.getPath(), new String[] { "build/" });
+        File linked = new File(link, "src/main/kotlin/Linked.kt");
+        linked.createNewFile();
+        if (!watcher.waitForEvents(1000)) {
+            throw new RuntimeException("Expected an event for " + linked);
+        }
+        event = watcher.nextEvent();
+        if (event == null || !event.getPath().equals(linked.getPath())) {
+            throw new RuntimeException("Expected an event for " + linked + ", got " + event);
+        }
+        System.out.println("  ✓ Symlinked root: " + event);
+        watcher.unwatch(link.getPath());
+
+        watcher.stop();
+        linked.delete();
+        link.delete();
+        source.delete();
+        new File(skipped, "Out.class").delete();
+        skipped.delete();
+        deep.delete();
+        new File(root, "src/main").delete();
+        new File(root, "src").delete();
+        root.delete();
+        
+        System.out.println("✅ fanotify backend test passed\n");
+    }
+    
+    private static void testSharedWatchers() throws Exception {
+        System.out.println("Testing watchers sharing one directory...");
+        
+        File dir = new File("/tmp/filewatcher_shared");
+        dir.mkdirs();
+        
+        FileWatcher all = new FileWatcher();
+        FileWatcher creates = new FileWatcher();
+        all.watch(dir.getPath());
+        creates.watchFiltered(dir.getPath(), FileWatcher.IN_CREATE, null, null);
+        
+        File file = new File(dir, "shared.txt");
+        try (FileWriter writer = new FileWriter(file)) {
+            writer.write("both see the create, one sees the write\n");
+        }
+        
+        List<FileWatcher.Event> allEvents = drainEvents(all);
+        List<FileWatcher.Event> createEvents = drainEvents(creates);
+        if (!hasEvent(allEvents, FileWatcher.EventKind.MODIFIED, file.getPath())) {
+            throw new RuntimeException("Unfiltered watcher missed the write to " + file);
+        }
+        if (createEvents.size() != 1 || !hasEvent(createEvents, FileWatcher.EventKind.CREATED, file.getPath())) {
+            throw new RuntimeException("Filtered watcher expected one CREATED, got " + createEvents.size() + " events");
+        }
+        System.out.println("  ✓ Each watcher got its own events from the shared watch");
+        
+        // The remaining watcher keeps the kernel watch alive
+        all.unwatch(dir.getPath());
+        File second = new File(dir, "second.txt");
+        second.createNewFile();
+        if (!hasEvent(drainEvents(creates), FileWatcher.EventKind.CREATED, second.getPath())) {
+            throw new RuntimeException("Watch went away with the other watcher");
+        }
+        if (!drainEvents(all).isEmpty()) {
+            throw new RuntimeException("Unwatched watcher still gets events");
+        }
+        System.out.println("  ✓ Unwatching in one watcher leaves the other watching");
+        
+        all.stop();
+        creates.stop();
+        file.delete();
+        second.delete();
+        dir.delete();
+        
+        System.out.println("✅ Shared watchers test passed\n");
+    }
+    
+    private static void testStats() throws Exception {
+        System.out.println("Testing runtime stats...");
+        
+        File dir = new File("/tmp/filewatcher_stats");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watchFiltered(dir.getPath(), FileWatcher.IN_CREATE, new String[] { "*.kt" }, null);
+        long[] before = watcher.getStats();
+        if (before == null || before[FileWatcher.STAT_ACTIVE_WATCHES] != 1) {
+            throw new RuntimeException("Expected one active watch in the stats");
+        }
+        
+        new File(dir, "Kept.kt").createNewFile();
+        new File(dir, "dropped.txt").createNewFile();
+        int delivered = drainEvents(watcher).size();
+        
+        long[] stats = watcher.getStats();
+        if (stats[FileWatcher.STAT_EVENTS_READ] < 2 || stats[FileWatcher.STAT_EVENTS_FILTERED] < 1 ||
+            stats[FileWatcher.STAT_EVENTS_DELIVERED] != delivered || stats[FileWatcher.STAT_READ_CALLS] < 1 ||
+            stats[FileWatcher.STAT_BYTES_READ] <= 0) {
+            throw new RuntimeException("Unexpected stats: " + java.util.Arrays.toString(stats));
+        }
+        System.out.println("  ✓ " + stats[FileWatcher.STAT_EVENTS_READ] + " read, " +
+                           stats[FileWatcher.STAT_EVENTS_FILTERED] + " filtered, " +
+                           stats[FileWatcher.STAT_EVENTS_DELIVERED] + " delivered");
+        
+        watcher.stop();
+        new File(dir, "Kept.kt").delete();
+        new File(dir, "dropped.txt").delete();
+        dir.delete();
+        
+        System.out.println("✅ Stats test passed\n");
+    }
+    
+    private static void testConcurrentConsumers() throws Exception {
+        System.out.println("Testing concurrent consumers...");
+        
+        File dir = new File("/tmp/filewatcher_consumers");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        if (!watcher.startReader(0)) {
+            throw new RuntimeException("Failed to start reader thread");
+        }
+        
+        int files = 2000;
+        java.util.concurrent.ConcurrentHashMap<String, Integer> seen = new java.util.concurrent.ConcurrentHashMap<>();
+        Thread[] consumers = new Thread[4];
+        for (int t = 0; t < consumers.length; t++) {
+            consumers[t] = new Thread(() -> {
+                while (watcher.waitForEvents(500)) {
+                    FileWatcher.Event event;
+                    while ((event = watcher.nextEvent()) != null) {
+                        if (event.getKind() == FileWatcher.EventKind.CREATED) seen.merge(event.getPath(), 1, Integer::sum);
+                    }
+                }
+            });
+            consumers[t].start();
+        }
+        for (int i = 0; i < files; i++) {
+            new File(dir, "c" + i).createNewFile();
+        }
+        for (Thread consumer : consumers) consumer.join();
+        
+        for (int i = 0; i < files; i++) {
+            Integer count = seen.get(new File(dir, "c" + i).getPath());
+            if (count == null || count != 1) {
+                throw new RuntimeException("c" + i + " delivered " + count + " times");
+            }
+        }
+        System.out.println("  ✓ " + files + " events split across " + consumers.length + " threads, each once");
+        
+        watcher.stop();
+        for (int i = 0; i < files; i++) {
+            new File(dir, "c" + i).delete();
+        }
+        dir.delete();
+        
+        System.out.println("✅ Concurrent consumers test passed\n");
+    }
+    
+    private static void testListener() throws Exception {
+        System.out.println("Testing push delivery to a listener...");
+        
+        File dir = new File("/tmp/filewatcher_listener");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        
+        int files = 500;
+        java.util.concurrent.CountDownLatch first = new java.util.concurrent.CountDownLatch(1);
+        java.util.concurrent.atomic.AtomicInteger created = new java.util.concurrent.atomic.AtomicInteger();
+        java.util.concurrent.atomic.AtomicInteger largest = new java.util.concurrent.atomic.AtomicInteger();
+        if (!watcher.setListener(events -> {
+            largest.accumulateAndGet(events.length, Math::max);
+            for (FileWatcher.Event event : events) {
+                if (event.getKind() == FileWatcher.EventKind.CREATED) created.incrementAndGet();
+            }
+            first.countDown();
+        }, 64, 0)) {
+            throw new RuntimeException("Failed to set listener");
+        }
+        
+        long start = System.nanoTime();
+        new File(dir, "first").createNewFile();
+        if (!first.await(1, java.util.concurrent.TimeUnit.SECONDS)) {
+            throw new RuntimeException("Listener was not called");
+        }
+        System.out.printf("  ✓ First batch after %.3f ms%n", (System.nanoTime() - start) / 1e6);
+        
+        for (int i = 0; i < files; i++) {
+            new File(dir, "l" + i).createNewFile();
+        }
+        long deadline = System.currentTimeMillis() + 2000;
+        while (created.get() < files + 1 && System.currentTimeMillis() < deadline) Thread.sleep(10);
+        if (created.get() != files + 1 || largest.get() > 64) {
+            throw new RuntimeException("Listener got " + created.get() + " creations, batches up to " + largest.get());
+        }
+        System.out.println("  ✓ " + created.get() + " events pushed in batches of at most " + largest.get());
+        
+        // Once removed, events stay queued for nextEvent()
+        watcher.setListener(null);
+        new File(dir, "polled").createNewFile();
+        FileWatcher.Event event = null;
+        while (event == null && watcher.waitForEvents(1000)) event = watcher.nextEvent();
+        if (event == null || created.get() != files + 1) {
+            throw new RuntimeException("Event after removing the listener went to " + (event == null ? "the listener" : "nobody"));
+        }
+        System.out.println("  ✓ Removed listener left the event for nextEvent()");
+        
+        watcher.stop();
+        for (int i = 0; i < files; i++) {
+            new File(dir, "l" + i).delete();
+        }
+        new File(dir, "first").delete();
+        new File(dir, "polled").delete();
+        dir.delete();
+        
+        System.out.println("✅ Listener test passed\n");
+    }
+    
+    private static void testReadBufferLimit() throws Exception {
+        System.out.println("Testing the read buffer limit...");
+        
+        File dir = new File("/tmp/filewatcher_readlimit");
+        dir.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        
+        // A storm read through the smallest buffer still arrives whole,
+        // and so does one read through the default buffer
+        int files = 2000;
+        for (int limit : new int[] { 4096, 1024 * 1024 }) {
+            if (!watcher.setReadBufferLimit(limit)) {
+                throw new RuntimeException("Failed to set read buffer limit " + limit);
+            }
+            for (int i = 0; i < files; i++) {
+                new File(dir, "r" + i).createNewFile();
+            }
+            int created = 0;
+            for (FileWatcher.Event event : drainEvents(watcher)) {
+                if (event.getKind() == FileWatcher.EventKind.CREATED) created++;
+            }
+            if (created != files) {
+                throw new RuntimeException("Read limit " + limit + " delivered " + created + " of " + files);
+            }
+            System.out.println("  ✓ " + files + " creations through a " + limit + " byte limit");
+            for (int i = 0; i < files; i++) {
+                new File(dir, "r" + i).delete();
+            }
+            drainEvents(watcher);
+        }
+        
+        watcher.stop();
+        dir.delete();
+        
+        System.out.println("✅ Read buffer limit test passed\n");
+    }
+    
+    private static void testJournal() throws Exception {
+        System.out.println("Testing the warm-restart journal...");
+        
+        File root = new File("/tmp/filewatcher_journal");
+        File journal = new File("/tmp/filewatcher_journal.fwj");
+        journal.delete();
+        new File(root, "src").mkdirs();
+        File kept = new File(root, "src/kept.kt");
+        File edited = new File(root, "src/edited.kt");
+        File removed = new File(root, "src/removed.kt");
+        for (File file : new File[] { kept, edited, removed }) {
+            try (FileWriter writer = new FileWriter(file)) {
+                writer.write("v1");
+            }
+        }
+        
+        // First run: the tree is only recorded
+        FileWatcher watcher = new FileWatcher();
+        watcher.setFanotify(false);
+        long generation = watcher.openJournal(journal.getPath());
+        if (generation != 1) throw new RuntimeException("New journal has generation " + generation);
+        watcher.watchRecursive(root.getPath(), null);
+        List<FileWatcher.Event> events = drainEvents(watcher);
+        if (!events.isEmpty()) throw new RuntimeException("First run reported " + events.size() + " events");
+        watcher.stop();
+        System.out.println("  ✓ First run recorded the tree silently");
+        
+        // Changes while nothing is watching
+        Thread.sleep(20);
+        try (FileWriter writer = new FileWriter(edited, true)) {
+            writer.write("v2");
+        }
+        removed.delete();
+        File added = new File(root, "src/added.kt");
+        added.createNewFile();
+        
+        // Second run: only what changed is reported
+        watcher = new FileWatcher();
+        watcher.setFanotify(false);
+        generation = watcher.openJournal(journal.getPath());
+        if (generation != 2) throw new RuntimeException("Reopened journal has generation " + generation);
+        watcher.watchRecursive(root.getPath(), null);
+        events = drainEvents(watcher);
+        if (events.size() != 3 ||
+            !hasEvent(events, FileWatcher.EventKind.MODIFIED, edited.getPath()) ||
+            !hasEvent(events, FileWatcher.EventKind.DELETED, removed.getPath()) ||
+            !hasEvent(events, FileWatcher.EventKind.CREATED, added.getPath())) {
+            throw new RuntimeException("Second run reported " + events.size() + " events instead of 3");
+        }
+        System.out.println("  ✓ Second run reported only the 3 offline changes");
+        
+        // The journal is exclusive while open
+        FileWatcher other = new FileWatcher();
+        if (other.openJournal(journal.getPath()) != 0) {
+            throw new RuntimeException("A journal in use was opened twice");
+        }
+        other.stop();
+        watcher.stop();
+        
+        kept.delete();
+        edited.delete();
+        added.delete();
+        new File(root, "src").delete();
+        root.delete();
+        journal.delete();
+        
+        System.out.println("✅ Journal test passed\n");
+    }
+    
+    private static void testLongPaths() throws Exception {
+        System.out.println("Testing long and non-ASCII paths...");
+        
+        // Nest well past the old 1024 byte path buffer
+        File root = new File("/tmp/filewatcher_longpaths");
+        List<File> dirs = new ArrayList<>();
+        File deep = root;
+        while (deep.getPath().length() < 2048) {
+            deep = new File(deep, "directory_name_that_is_quite_long_" + dirs.size());
+            dirs.add(deep);
+        }
+        deep.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(deep.getPath());
+        
+        // A name outside the BMP must come back as a proper surrogate pair
+        File longFile = new File(deep, "file.txt");
+        File emojiFile = new File(deep, "caf\u00e9_\ud83d\ude00.kt");
+        longFile.createNewFile();
+        emojiFile.createNewFile();
+        
+        List<FileWatcher.Event> events = drainEvents(watcher);
+        if (!hasEvent(events, FileWatcher.EventKind.CREATED, longFile.getPath())) {
+            throw new RuntimeException("No intact event for a " + longFile.getPath().length() + " character path");
+        }
+        System.out.println("  ✓ " + longFile.getPath().length() + " character path delivered intact");
+        if (!hasEvent(events, FileWatcher.EventKind.CREATED, emojiFile.getPath())) {
+            throw new RuntimeException("Non-ASCII name was not delivered intact: " + events.size() + " events");
+        }
+        System.out.println("  ✓ Non-ASCII name delivered intact");
+        
+        watcher.stop();
+        longFile.delete();
+        emojiFile.delete();
+        for (int i = dirs.size() - 1; i >= 0; i--) {
+            dirs.get(i).delete();
+        }
+        root.delete();
+        
+        System.out.println("✅ Long path test passed\n");
+    }
+    
+    private static void testStringCache() throws Exception {
+        System.out.println("Testing the path string cache...");
+        
+        File dir = new File("/tmp/filewatcher_strings");
+        dir.mkdirs();
+        File file = new File(dir, "Hot.kt");
+        File other = new File(dir, "Other.kt");
+        file.createNewFile();
+        other.createNewFile();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+        long[] before = watcher.getStats();
+        
+        // Events for one path share one String while Java still holds it.
+        // Writes alternate between two files, since inotify merges
+        // identical events that follow each other.
+        int writes = 20;
+        for (int i = 0; i < writes; i++) {
+            for (File target : new File[] { file, other }) {
+                try (FileWriter writer = new FileWriter(target, true)) {
+                    writer.write("x");
+                }
+            }
+        }
+        List<FileWatcher.Event> events = drainEvents(watcher);
+        String first = null;
+        int modified = 0;
+        for (FileWatcher.Event event : events) {
+            if (event.getKind() != FileWatcher.EventKind.MODIFIED || !event.getPath().equals(file.getPath())) continue;
+            if (first == null) first = event.getPath();
+            if (event.getPath() != first) {
+                throw new RuntimeException("Repeated path was not interned: " + event.getPath());
+            }
+            modified++;
+        }
+        if (modified < 2) {
+            throw new RuntimeException("Expected repeated modifications, got " + modified);
+        }
+        
+        long[] after = watcher.getStats();
+        long hits = after[FileWatcher.STAT_STRING_HITS] - before[FileWatcher.STAT_STRING_HITS];
+        if (hits < modified - 1) {
+            throw new RuntimeException("Expected at least " + (modified - 1) + " cache hits, got " + hits);
+        }
+        System.out.println("  ✓ " + modified + " events shared one path string (" + hits + " hits)");
+        
+        watcher.stop();
+        file.delete();
+        other.delete();
+        dir.delete();
+        
+        System.out.println("✅ String cache test passed\n");
+    }
+    
+    private static void testPriorityLane() throws Exception {
+        System.out.println("Testing the priority lane...");
+        
+        File root = new File("/tmp/filewatcher_priority");
+        File src = new File(root, "src");
+        File build = new File(root, "build");
+        src.mkdirs();
+        build.mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watchRecursive(root.getPath(), null);
+        if (!watcher.setPriority(new String[] { "*.kt" }, new String[] { src.getPath() })) {
+            throw new RuntimeException("setPriority failed");
+        }
+        
+        // A save that lands after a burst of build output is delivered first
+        int outputs = 300;
+        for (int i = 0; i < outputs; i++) {
+            new File(build, "Out" + i + ".class").createNewFile();
+        }
+        File edited = new File(src, "Main.kt");
+        edited.createNewFile();
+        
+        List<FileWatcher.Event> events = drainEvents(watcher);
+        if (events.isEmpty() || !events.get(0).getPath().equals(edited.getPath())) {
+            throw new RuntimeException("Source edit was not delivered first: " +
+                                       (events.isEmpty() ? "no events" : events.get(0).getPath()));
+        }
+        if (events.size() != outputs + 1) {
+            throw new RuntimeException("Expected " + (outputs + 1) + " events, got " + events.size());
+        }
+        System.out.println("  ✓ Source edit overtook " + outputs + " build events");
+        
+        watcher.stop();
+        edited.delete();
+        for (int i = 0; i < outputs; i++) {
+            new File(build, "Out" + i + ".class").delete();
+        }
+        src.delete();
+        build.delete();
+        root.delete();
+        
+        System.out.println("✅ Priority lane test passed\n");
+    }
+    
+    private static void testWatchLimitFallback() throws Exception {
+        System.out.println("Testing the watch limit fallback...");
+        
+        File dir = new File("/tmp/filewatcher_polled");
+        dir.mkdirs();
+        Path limitFile = Paths.get("/proc/sys/fs/inotify/max_user_watches");
+        String limit = new String(Files.readAllBytes(limitFile)).trim();
+        
+        FileWatcher watcher = new FileWatcher();
+        long[] stats = watcher.getStats();
+        if (stats[FileWatcher.STAT_WATCH_LIMIT] != Long.parseLong(limit)) {
+            throw new RuntimeException("Watch limit " + stats[FileWatcher.STAT_WATCH_LIMIT] + ", kernel says " + limit);
+        }
+        System.out.println("  ✓ max_user_watches is " + limit);
+        
+        // Lowering the limit takes root; everyone else stops here
+        if (!Files.isWritable(limitFile)) {
+            watcher.stop();
+            dir.delete();
+            System.out.println("✅ Watch limit test passed (fallback not exercised without root)\n");
+            return;
+        }
+        
+        File created = new File(dir, "Polled.kt");
+        try {
+            // Existing watches survive; the next one is refused with ENOSPC
+            Files.write(limitFile, "1".getBytes());
+            watcher.watch(dir.getPath());
+            if (watcher.getStats()[FileWatcher.STAT_POLLED_DIRS] != 1) {
+                throw new RuntimeException("Directory past the watch limit is not polled");
+            }
+            
+            created.createNewFile();
+            FileWatcher.Event event = null;
+            long deadline = System.currentTimeMillis() + 5000;
+            while (event == null && System.currentTimeMillis() < deadline) {
+                if (watcher.waitForEvents(500)) event = watcher.nextEvent();
+            }
+            if (event == null || event.getKind() != FileWatcher.EventKind.CREATED ||
+                !event.getPath().equals(created.getPath())) {
+                throw new RuntimeException("Polled directory did not report the new file: " + event);
+            }
+            System.out.println("  ✓ Polled directory reported " + event.getPath());
+        } finally {
+            Files.write(limitFile, limit.getBytes());
+            watcher.stop();
+            created.delete();
+            dir.delete();
+        }
+        
+        System.out.println("✅ Watch limit test passed\n");
+    }
+    
+    private static void testBackendSelection() throws Exception {
+        System.out.println("Testing backend selection...");
+        
+        FileWatcher watcher = new FileWatcher();
+        long backend = watcher.getStats()[FileWatcher.STAT_BACKEND];
+        String requested = System.getenv("FILEWATCHER_BACKEND");
+        if (backend < FileWatcher.BACKEND_INOTIFY || backend > FileWatcher.BACKEND_POLL) {
+            throw new RuntimeException("Unexpected backend " + backend);
+        }
+        // Polling works everywhere, so asking for it always gets it
+        if ("poll".equalsIgnoreCase(requested) && backend != FileWatcher.BACKEND_POLL) {
+            throw new RuntimeException("Asked for polling, got backend " + backend);
+        }
+        System.out.println("  ✓ Running on backend " + backend + " (FILEWATCHER_BACKEND=" + requested + ")");
+        
+        if (backend == FileWatcher.BACKEND_POLL) {
+            File dir = new File("/tmp/filewatcher_backend");
+            dir.mkdirs();
+            File created = new File(dir, "Polled.kt");
+            try {
+                watcher.watch(dir.getPath());
+                if (watcher.getStats()[FileWatcher.STAT_POLLED_DIRS] != 1) {
+                    throw new RuntimeException("Poll backend did not poll " + dir);
+                }
+                created.createNewFile();
+                List<FileWatcher.Event> events = drainEvents(watcher);
+                long deadline = System.currentTimeMillis() + 5000;
+                while (!hasEvent(events, FileWatcher.EventKind.CREATED, created.getPath()) &&
+                       System.currentTimeMillis() < deadline) {
+                    events.addAll(drainEvents(watcher));
+                }
+                if (!hasEvent(events, FileWatcher.EventKind.CREATED, created.getPath())) {
+                    throw new RuntimeException("Poll backend did not report " + created);
+                }
+                System.out.println("  ✓ Poll backend reported " + created.getPath());
+            } finally {
+                created.delete();
+                dir.delete();
+            }
+        }
+        watcher.stop();
+        
+        System.out.println("✅ Backend selection test passed\n");
+    }
+    
+    private static void testWatchAll() throws Exception {
+        System.out.println("Testing bulk watch registration...");
+        
+        File root = new File("/tmp/filewatcher_watchall");
+        String[] paths = new String[40];
+        for (int i = 0; i < paths.length; i++) {
+            File dir = new File(root, "dir" + i);
+            dir.mkdirs();
+            paths[i] = dir.getPath();
+        }
+        paths[33] = new File(root, "missing").getPath();
+        paths[35] = null;
+        
+        FileWatcher watcher = new FileWatcher();
+        File created = new File(root, "dir39/Bulk.kt");
+        try {
+            int[] errors = watcher.watchAll(paths);
+            for (int i = 0; i < paths.length; i++) {
+                int expected = (i == 33) ? FileWatcher.ENOENT : (i == 35) ? FileWatcher.EINVAL : 0;
+                if (errors[i] != expected) {
+                    throw new RuntimeException("Path " + i + " gave errno " + errors[i] + ", expected " + expected);
+                }
+            }
+            System.out.println("  ✓ 38 of 40 paths watched, the missing and null ones refused");
+            
+            created.createNewFile();
+            List<FileWatcher.Event> events = drainEvents(watcher);
+            if (!hasEvent(events, FileWatcher.EventKind.CREATED, created.getPath())) {
+                throw new RuntimeException("Bulk-watched directory did not report " + created);
+            }
+            System.out.println("  ✓ Bulk-watched directory reported " + created.getPath());
+        } finally {
+            watcher.stop();
+            created.delete();
+            for (String path : paths) {
+                if (path != null) new File(path).delete();
+            }
+            root.delete();
+        }
+        
+        System.out.println("✅ Bulk watch test passed\n");
+    }
+    
+    private static void testContentHashing() throws Exception {
+        System.out.println("Testing content hash suppression...");
+        
+        File dir = new File("/tmp/filewatcher_hashing");
+        dir.mkdirs();
+        File file = new File(dir, "Same.kt");
+        Files.write(file.toPath(), "class Same\n".getBytes());
+        
+        FileWatcher watcher = new FileWatcher();
+        try {
+            watcher.setCoalescing(50);
+            watcher.setContentHashing(1 << 20);
+            watcher.watch(dir.getPath());
+            
+            // The first write of a file the table has not seen is reported
+            Files.write(file.toPath(), "class Same\n".getBytes());
+            List<FileWatcher.Event> events = drainEvents(watcher);
+            if (!hasEvent(events, FileWatcher.EventKind.MODIFIED, file.getPath())) {
+                throw new RuntimeException("First write was not reported: " + events);
+            }
+            
+            // Writing the same bytes again is not
+            Files.write(file.toPath(), "class Same\n".getBytes());
+            events = drainEvents(watcher);
+            if (hasEvent(events, FileWatcher.EventKind.MODIFIED, file.getPath())) {
+                throw new RuntimeException("Unchanged rewrite was reported");
+            }
+            if (watcher.getStats()[FileWatcher.STAT_EVENTS_UNCHANGED] < 1) {
+                throw new RuntimeException("Unchanged rewrite was not counted");
+            }
+            System.out.println("  ✓ Rewrite with the same contents dropped");
+            
+            Files.write(file.toPath(), "class Changed\n".getBytes());
+            events = drainEvents(watcher);
+            if (!hasEvent(events, FileWatcher.EventKind.MODIFIED, file.getPath())) {
+                throw new RuntimeException("Real change was not reported: " + events);
+            }
+            System.out.println("  ✓ Rewrite with new contents reported");
+        } finally {
+            watcher.stop();
+            file.delete();
+            dir.delete();
+        }
+        
+        System.out.println("✅ Content hashing test passed\n");
+    }
+    
+    private static List<FileWatcher.Event> drainEvents(FileWatcher watcher) {
+        List<FileWatcher.Event> events = new ArrayList<>();
+        while (watcher.waitForEvents(200)) {
+            FileWatcher.Event event;
+            while ((event = watcher.nextEvent()) != null) events.add(event);
+        }
+        return events;
+    }
+    
+    private static boolean hasEvent(List<FileWatcher.Event> events, FileWatcher.EventKind kind, String path) {
+        for (FileWatcher.Event event : events) {
+            if (event.getKind() == kind && event.getPath().equals(path)) return true;
+        }
+        return false;
+    }
+    
+    private static void testOverflowRecovery() throws Exception {
+        System.out.println("Testing overflow recovery...");
+        
+        File root = new File("/tmp/filewatcher_overflow");
+        root.mkdirs();
+        File changed = new File(root, "changed.txt");
+        File removed = new File(root, "removed.txt");
+        Files.write(changed.toPath(), "v1".getBytes());
+        Files.write(removed.toPath(), "v1".getBytes());
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(root.getPath());
+        if (!watcher.setOverflowRecovery(true)) {
+            throw new RuntimeException("setOverflowRecovery failed");
+        }
+        
+        // More events than the default max_queued_events (16384) without reading
+        int count = 17000;
+        for (int i = 0; i < count; i++) {
+            new File(root, "f" + i).createNewFile();
+        }
+        Files.write(changed.toPath(), "v2".getBytes());
+        removed.delete();
+        
+        Set<String> created = new HashSet<>();
+        boolean sawModified = false;
+        boolean sawDeleted = false;
+        while (watcher.waitForEvents(500)) {
+            for (FileWatcher.Event event : watcher.nextEvents(1024)) {
+                if (event.getKind() == FileWatcher.EventKind.OVERFLOW) {
+                    throw new RuntimeException("Overflow was not recovered");
+                } else if (event.getKind() == FileWatcher.EventKind.CREATED) {
+                    created.add(event.getPath());
+                } else if (event.getPath().equals(changed.getPath())) {
+                    sawModified |= event.getKind() == FileWatcher.EventKind.MODIFIED;
+                } else if (event.getPath().equals(removed.getPath())) {
+                    sawDeleted |= event.getKind() == FileWatcher.EventKind.DELETED;
+                }
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (!created.contains(new File(root, "f" + i).getPath())) {
+                throw new RuntimeException("Missing CREATED for f" + i);
+            }
+        }
+        if (!sawModified || !sawDeleted) {
+            throw new RuntimeException("Dropped MODIFIED/DELETED events were not recovered");
+        }
+        System.out.println("  ✓ Recovered " + created.size() + " creates plus the modify and delete");
+        
+        watcher.stop();
+        for (int i = 0; i < count; i++) {
+            new File(root, "f" + i).delete();
+        }
+        changed.delete();
+        root.delete();
+        
+        System.out.println("✅ Overflow recovery test passed\n");
+    }
+    
+    private static void testRenamePairing() throws Exception {
+        System.out.println("Testing rename pairing...");
+        
+        File root = new File("/tmp/filewatcher_rename");
+        File before = new File(root, "src/pkg");
+        File after = new File(root, "src/renamed");
+        new File(before, "deep").mkdirs();
+        
+        FileWatcher watcher = new FileWatcher();
+        watcher.setFanotify(false); // fanotify pairs renames only on Linux 5.17+
+        watcher.watchRecursive(root.getPath(), new String[0]);
+        if (!watcher.setRenamePairing(50)) {
+            throw new RuntimeException("setRenamePairing failed");
+        }
+        
+        if (!before.renameTo(after)) {
+            throw new RuntimeException("Rename failed");
+        }
+        if (!watcher.waitForEvents(1000)) {
+            throw new RuntimeException("Expected a MOVED event");
+        }
+        FileWatcher.Event event = watcher.nextEvent();
+        if (event == null || event.getKind() != FileWatcher.EventKind.MOVED ||
+            !event.getPath().equals(after.getPath()) || !event.getOldPath().equals(before.getPath())) {
+            throw new RuntimeException("Expected MOVED " + before + " -> " + after + ", got " + event);
+        }
+        System.out.println("  ✓ " + event);
+        
+        // Watches below the renamed directory report the new path
+        File inside = new File(after, "deep/A.kt");
+        inside.createNewFile();
+        if (!watcher.waitForEvents(1000)) {
+            throw new RuntimeException("Expected an event under the renamed directory");
+        }
+        event = watcher.nextEvent();
+        if (event == null || !event.getPath().equals(inside.getPath())) {
+            throw new RuntimeException("Expected CREATED " + inside + ", got " + event);
+        }
+        System.out.println("  ✓ Subtree watches follow the rename");
+        
+        watcher.stop();
+        inside.delete();
+        new File(after, "deep").delete();
+        after.delete();
+        new File(root, "src").delete();
+        root.delete();
+        
+        System.out.println("✅ Rename pairing test passed\n");
+    }
 }
 
 /**
@@ -128,6 +1380,42 @@ public class TestFileWatcher {
  */
 class FileWatcher {
     
+    // inotify event bits accepted by watchFiltered()
+    public static final int IN_MODIFY = 0x002;
+    public static final int IN_CLOSE_WRITE = 0x008;
+    public static final int IN_MOVED_FROM = 0x040;
+    public static final int IN_MOVED_TO = 0x080;
+    public static final int IN_CREATE = 0x100;
+    public static final int IN_DELETE = 0x200;
+    
+    // Slots of getStats(), matching FileWatcherStat
+    public static final int STAT_EVENTS_READ = 0;
+    public static final int STAT_EVENTS_DELIVERED = 1;
+    public static final int STAT_EVENTS_COALESCED = 2;
+    public static final int STAT_EVENTS_FILTERED = 3;
+    public static final int STAT_OVERFLOWS = 4;
+    public static final int STAT_READ_CALLS = 5;
+    public static final int STAT_BYTES_READ = 6;
+    public static final int STAT_LOCK_CONTENTION = 7;
+    public static final int STAT_EVENTS_PER_READ = 8;
+    public static final int STAT_MAX_QUEUE_BYTES = 9;
+    public static final int STAT_ACTIVE_WATCHES = 10;
+    public static final int STAT_STRING_HITS = 11;
+    public static final int STAT_STRING_MISSES = 12;
+    public static final int STAT_WATCH_LIMIT = 13;
+    public static final int STAT_POLLED_DIRS = 14;
+    public static final int STAT_BACKEND = 15;
+    public static final int STAT_EVENTS_UNCHANGED = 16;
+    
+    // Values of STAT_BACKEND, matching FileWatcherBackend
+    public static final int BACKEND_INOTIFY = 1;
+    public static final int BACKEND_FANOTIFY = 2;
+    public static final int BACKEND_POLL = 3;
+    
+    // errno values reported by watchAll()
+    public static final int ENOENT = 2;
+    public static final int EINVAL = 22;
+    
     private long nativePtr;
     
     public FileWatcher() {
@@ -143,6 +1431,37 @@ class FileWatcher {
         }
     }
     
+    // Watch every path in one native call. Returns each path's errno, 0 if it is watched.
+    public int[] watchAll(String[] paths) {
+        int[] report = watchAll(nativePtr, paths);
+        if (report == null) {
+            throw new RuntimeException("Failed to add watches for " + paths.length + " paths");
+        }
+        int words = (paths.length + 31) / 32;
+        int[] errors = new int[paths.length];
+        int failed = 0;
+        for (int i = 0; i < paths.length; i++) {
+            if ((report[i / 32] & (1 << (i % 32))) == 0) {
+                errors[i] = (words + failed < report.length) ? report[words + failed++] : -1;
+            }
+        }
+        return errors;
+    }
+    
+    public void watchFiltered(String path, int mask, String[] includes, String[] excludes) {
+        if (!watchFiltered(nativePtr, path, mask, includes, excludes)) {
+            throw new RuntimeException("Failed to add filtered watch for: " + path);
+        }
+    }
+    
+    public long[] watchRecursive(String path, String[] excludes) {
+        long[] report = watchRecursive(nativePtr, path, excludes);
+        if (report == null) {
+            throw new RuntimeException("Failed to add recursive watch for: " + path);
+        }
+        return report;
+    }
+    
     public void unwatch(String path) {
         unwatch(nativePtr, path);
     }
@@ -151,6 +1470,86 @@ class FileWatcher {
         return nextEvent(nativePtr);
     }
     
+    public Event[] nextEvents(int max) {
+        return nextEvents(nativePtr, max);
+    }
+    
+    public ByteBuffer eventRing() {
+        return eventRing(nativePtr);
+    }
+    
+    public int fillRing() {
+        return fillRing(nativePtr);
+    }
+    
+    public String watchPath(int wd) {
+        return watchPath(nativePtr, wd);
+    }
+    
+    public boolean startReader(int queueBytes) {
+        return startReader(nativePtr, queueBytes);
+    }
+    
+    public long queueHighWater() {
+        return queueHighWater(nativePtr);
+    }
+    
+    public long[] getStats() {
+        return getStats(nativePtr);
+    }
+    
+    public boolean setListener(Listener listener) {
+        return setListener(nativePtr, listener, 256, 0);
+    }
+    
+    public boolean setListener(Listener listener, int maxBatch, int maxDelayMs) {
+        return setListener(nativePtr, listener, maxBatch, maxDelayMs);
+    }
+    
+    public boolean setReadBufferLimit(int maxBytes) {
+        return setReadBufferLimit(nativePtr, maxBytes);
+    }
+    
+    public long openJournal(String path) {
+        return openJournal(nativePtr, path);
+    }
+    
+    public boolean setCoalescing(int windowMs) {
+        return setCoalescing(nativePtr, windowMs);
+    }
+    
+    public boolean setSettleTimeout(int timeoutMs) {
+        return setSettleTimeout(nativePtr, timeoutMs);
+    }
+    
+    public boolean setRenamePairing(int timeoutMs) {
+        return setRenamePairing(nativePtr, timeoutMs);
+    }
+    
+    public boolean setPriority(String[] names, String[] roots) {
+        return setPriority(nativePtr, names, roots);
+    }
+    
+    public boolean setOverflowRecovery(boolean enabled) {
+        return setOverflowRecovery(nativePtr, enabled);
+    }
+    
+    public boolean setContentHashing(long maxFileBytes) {
+        return setContentHashing(nativePtr, maxFileBytes);
+    }
+    
+    public boolean setFanotify(boolean enabled) {
+        return setFanotify(nativePtr, enabled);
+    }
+    
+    public boolean isFanotifyRoot(String path) {
+        return isFanotifyRoot(nativePtr, path);
+    }
+    
+    public boolean waitForEvents(long timeoutMs) {
+        return waitForEvents(nativePtr, timeoutMs);
+    }
+    
     public void stop() {
         if (nativePtr != 0) {
             close(nativePtr);
@@ -162,32 +1561,70 @@ class FileWatcher {
     // Native methods
     private static native long create();
     private static native boolean watch(long ptr, String path);
+    private static native int[] watchAll(long ptr, String[] paths);
+    private static native boolean watchFiltered(long ptr, String path, int mask, String[] includes,
+                                                String[] excludes);
+    private static native long[] watchRecursive(long ptr, String path, String[] excludes);
     private static native void unwatch(long ptr, String path);
     private static native Event nextEvent(long ptr);
+    private static native Event[] nextEvents(long ptr, int max);
+    private static native ByteBuffer eventRing(long ptr);
+    private static native int fillRing(long ptr);
+    private static native String watchPath(long ptr, int wd);
+    private static native boolean startReader(long ptr, int queueBytes);
+    private static native long queueHighWater(long ptr);
+    private static native long[] getStats(long ptr);
+    private static native boolean setListener(long ptr, Listener listener, int maxBatch, int maxDelayMs);
+    private static native boolean setReadBufferLimit(long ptr, int maxBytes);
+    private static native long openJournal(long ptr, String path);
+    private static native boolean setCoalescing(long ptr, int windowMs);
+    private static native boolean setSettleTimeout(long ptr, int timeoutMs);
+    private static native boolean setRenamePairing(long ptr, int timeoutMs);
+    private static native boolean setPriority(long ptr, String[] names, String[] roots);
+    private static native boolean setOverflowRecovery(long ptr, boolean enabled);
+    private static native boolean setFanotify(long ptr, boolean enabled);
+    private static native boolean setContentHashing(long ptr, long maxFileBytes);
+    private static native boolean isFanotifyRoot(long ptr, String path);
+    private static native boolean waitForEvents(long ptr, long timeoutMs);
     private static native void close(long ptr);
     private static native void destroy(long ptr);
     
+    // Receives batches on the native delivery thread set up by setListener()
+    public interface Listener {
+        void onEvents(Event[] events);
+    }
+    
     // Event class
     public static class Event {
         private final EventKind kind;
         private final String path;
+        private final String oldPath;
         
         public Event(EventKind kind, String path) {
+            this(kind, path, null);
+        }
+        
+        public Event(EventKind kind, String path, String oldPath) {
             this.kind = kind;
             this.path = path;
+            this.oldPath = oldPath;
         }
         
         public EventKind getKind() { return kind; }
         public String getPath() { return path; }
+        public String getOldPath() { return oldPath; }
         
         @Override
         public String toString() {
+            if (oldPath != null) {
+                return "Event{kind=" + kind + ", path='" + path + "', oldPath='" + oldPath + "'}";
+            }
             return "Event{kind=" + kind + ", path='" + path + "'}";
         }
     }
     
     // EventKind enum
     public enum EventKind {
-        CREATED, MODIFIED, DELETED, OVERFLOW
+        CREATED, MODIFIED, DELETED, OVERFLOW, MOVED
     }
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+/**
+ * Benchmark: single-event nextEvent() loop vs batched nextEvents()
+ *
+ * Queues a burst of CREATED/DELETED events in a watched directory, then
+ * times how long each delivery path takes to drain it. Run with:
+ *
+ *   javac BenchmarkNextEvents.java
+ *   java -Djava.library.path=../../dist BenchmarkNextEvents [files] [rounds] [batch]
+ */
+
+import java.io.File;
+import java.io.IOException;
+
+public class BenchmarkNextEvents {
+
+    static {
+        try {
+            System.loadLibrary("filewatcher_jni");
+        } catch (UnsatisfiedLinkError e) {
+            System.err.println("❌ Failed to load native library: " + e.getMessage());
+            System.exit(1);
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        // Stay under the default max_queued_events (16384) so nothing overflows
+        int files = args.length > 0 ? Integer.parseInt(args[0]) : 10000;
+        int rounds = args.length > 1 ? Integer.parseInt(args[1]) : 10;
+        int batch = args.length > 2 ? Integer.parseInt(args[2]) : 256;
+
+        File dir = new File("/tmp/filewatcher_bench");
+        dir.mkdirs();
+
+        FileWatcher watcher = new FileWatcher();
+        watcher.watch(dir.getPath());
+
+        System.out.println("=== nextEvent vs nextEvents(" + batch + ") ===");
+        System.out.println("files per burst: " + files + ", rounds: " + rounds + "\n");
+
+        long singleNanos = 0, batchNanos = 0;
+        long singleEvents = 0, batchEvents = 0;
+
+        for (int round = 0; round < rounds; round++) {
+            // Alternate which mode drains the create burst and which the delete burst
+            boolean singleFirst = (round % 2 == 0);
+
+            churn(dir, files, true);
+            long start = System.nanoTime();
+            long drained = singleFirst ? drainSingle(watcher) : drainBatch(watcher, batch);
+            long elapsed = System.nanoTime() - start;
+            if (singleFirst) { singleNanos += elapsed; singleEvents += drained; }
+            else { batchNanos += elapsed; batchEvents += drained; }
+
+            churn(dir, files, false);
+            start = System.nanoTime();
+            drained = singleFirst ? drainBatch(watcher, batch) : drainSingle(watcher);
+            elapsed = System.nanoTime() - start;
+            if (singleFirst) { batchNanos += elapsed; batchEvents += drained; }
+            else { singleNanos += elapsed; singleEvents += drained; }
+        }
+
+        report("nextEvent ", singleEvents, singleNanos);
+        report("nextEvents", batchEvents, batchNanos);
+        if (singleEvents > 0 && batchEvents > 0) {
+            double speedup = ((double) singleNanos / singleEvents) / ((double) batchNanos / batchEvents);
+            System.out.printf("%nspeedup: %.2fx per event%n", speedup);
+        }
+
+        watcher.stop();
+        dir.delete();
+    }
+
+    private static void churn(File dir, int files, boolean create) throws IOException {
+        for (int i = 0; i < files; i++) {
+            File file = new File(dir, "f" + i);
+            if (create) file.createNewFile();
+            else file.delete();
+        }
+    }
+
+    private static long drainSingle(FileWatcher watcher) {
+        long count = 0;
+        while (watcher.nextEvent() != null) count++;
+        return count;
+    }
+
+    private static long drainBatch(FileWatcher watcher, int batch) {
+        long count = 0;
+        FileWatcher.Event[] events;
+        while ((events = watcher.nextEvents(batch)) != null) count += events.length;
+        return count;
+    }
+
+    private static void report(String label, long events, long nanos) {
+        double perEvent = events > 0 ? (double) nanos / events : 0;
+        double rate = nanos > 0 ? events * 1e9 / nanos : 0;
+        System.out.printf("%s  %8d events  %8.1f ns/event  %10.0f events/s%n", label, events, perEvent, rate);
+    }
+}
+
+/**
+ * Minimal FileWatcher class for benchmarking
+ * In real usage, this comes from the Kotlin LSP JAR
+ */
+class FileWatcher {
+
+    private long nativePtr;
+
+    public FileWatcher() {
+        this.nativePtr = create();
+        if (this.nativePtr == 0) {
+            throw new RuntimeException("Failed to create native FileWatcher");
+        }
+    }
+
+    public void watch(String path) {
+        if (!watch(nativePtr, path)) {
+            throw new RuntimeException("Failed to add watch for: " + path);
+        }
+    }
+
+    public Event nextEvent() {
+        return nextEvent(nativePtr);
+    }
+
+    public Event[] nextEvents(int max) {
+        return nextEvents(nativePtr, max);
+    }
+
+    public void stop() {
+        if (nativePtr != 0) {
+            close(nativePtr);
+            destroy(nativePtr);
+            nativePtr = 0;
+        }
+    }
+
+    // Native methods
+    private static native long create();
+    private static native boolean watch(long ptr, String path);
+    private static native Event nextEvent(long ptr);
+    private static native Event[] nextEvents(long ptr, int max);
+    private static native void close(long ptr);
+    private static native void destroy(long ptr);
+
+    // Event class
+    public static class Event {
+        private final EventKind kind;
+        private final String path;
+
+        public Event(EventKind kind, String path) {
+            this.kind = kind;
+            this.path = path;
+        }
+
+        public EventKind getKind() { return kind; }
+        public String getPath() { return path; }
+    }
+
+    // EventKind enum
+    public enum EventKind {
+        CREATED, MODIFIED, DELETED, OVERFLOW
+    }
+}
@@ -0,0 +1,294 @@
+/**
+ * Soak test for the JNI layer: memory and descriptor creep over long runs
+ *
+ * Churns files in a directory watched by two watchers, one drained with
+ * nextEvents() on the main thread and one delivering to a listener on its
+ * native thread, which stays attached for the whole run so any local
+ * reference it fails to delete piles up. Every round checks that both saw
+ * every file created and deleted, then samples RSS, open descriptors and
+ * the heap after a GC. Once warmed up, the run fails if events were lost,
+ * descriptors leaked or RSS or the heap grew past the limit. Run with:
+ *
+ *   javac SoakFileWatcher.java
+ *   java -Xcheck:jni -Djava.library.path=../../dist SoakFileWatcher [seconds] [files] [limitKb]
+ *
+ * -Xcheck:jni also warns as soon as a native frame holds more local
+ * references than it asked for.
+ */
+
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.util.List;
+import java.util.concurrent.atomic.AtomicLong;
+
+public class SoakFileWatcher {
+
+    static {
+        try {
+            System.loadLibrary("filewatcher_jni");
+        } catch (UnsatisfiedLinkError e) {
+            System.err.println("❌ Failed to load native library: " + e.getMessage());
+            System.exit(1);
+        }
+    }
+
+    private static final int WARMUP_ROUNDS = 10;
+    private static final long QUIET_MS = 250;
+    private static final long ROUND_TIMEOUT_MS = 5000;
+
+    // Events seen by one watcher since the round started
+    static class Counts {
+        final AtomicLong created = new AtomicLong();
+        final AtomicLong deleted = new AtomicLong();
+        final AtomicLong overflows = new AtomicLong();
+        volatile long lastEventNanos;
+
+        void add(FileWatcher.Event[] events) {
+            for (FileWatcher.Event event : events) {
+                switch (event.getKind()) {
+                    case CREATED: created.incrementAndGet(); break;
+                    case DELETED: deleted.incrementAndGet(); break;
+                    case MOVED: created.incrementAndGet(); deleted.incrementAndGet(); break;
+                    case OVERFLOW: overflows.incrementAndGet(); break;
+                    default: break;
+                }
+            }
+            lastEventNanos = System.nanoTime();
+        }
+
+        void reset() {
+            created.set(0);
+            deleted.set(0);
+            overflows.set(0);
+        }
+
+        boolean complete(int files) {
+            return created.get() >= files && deleted.get() >= files;
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        int seconds = args.length > 0 ? Integer.parseInt(args[0]) : 60;
+        // Stay under the default max_queued_events (16384) so nothing overflows
+        int files = args.length > 1 ? Integer.parseInt(args[1]) : 2000;
+        long limitKb = args.length > 2 ? Long.parseLong(args[2]) : 16384;
+
+        File dir = new File("/tmp/filewatcher_soak_java");
+        dir.mkdirs();
+
+        FileWatcher polled = new FileWatcher();
+        FileWatcher pushed = new FileWatcher();
+        polled.watch(dir.getPath());
+        pushed.watch(dir.getPath());
+        Counts polledCounts = new Counts();
+        Counts pushedCounts = new Counts();
+        if (!pushed.setListener(pushedCounts::add)) {
+            System.err.println("❌ setListener failed");
+            System.exit(1);
+        }
+
+        System.out.println("=== JNI soak: " + seconds + " s, " + files + " files per round, limit " + limitKb + " KiB ===\n");
+        System.out.printf("%8s %7s %10s %10s %10s %6s %10s %8s%n", "seconds", "rounds", "events", "lost",
+                          "rss KiB", "fds", "heap KiB", "strings");
+
+        long start = System.nanoTime();
+        long end = start + seconds * 1_000_000_000L;
+        long nextReport = start + 10_000_000_000L;
+        long events = 0, lost = 0, rescans = 0;
+        long baseRss = 0, baseHeap = 0, rss = 0, heap = 0;
+        int baseFds = -1, fds = 0, rounds = 0;
+
+        do {
+            polledCounts.reset();
+            pushedCounts.reset();
+            churn(dir, files);
+
+            // Drain the polled watcher until both have gone quiet
+            long deadline = System.nanoTime() + ROUND_TIMEOUT_MS * 1_000_000L;
+            long quietSince = System.nanoTime();
+            while (System.nanoTime() < deadline) {
+                FileWatcher.Event[] batch = polled.nextEvents(256);
+                if (batch != null && batch.length > 0) {
+                    polledCounts.add(batch);
+                    quietSince = System.nanoTime();
+                    continue;
+                }
+                long last = Math.max(quietSince, pushedCounts.lastEventNanos);
+                if (System.nanoTime() - last > QUIET_MS * 1_000_000L &&
+                    polledCounts.complete(files) && pushedCounts.complete(files)) {
+                    break;
+                }
+                Thread.sleep(10);
+            }
+
+            for (Counts counts : new Counts[] { polledCounts, pushedCounts }) {
+                events += counts.created.get() + counts.deleted.get();
+                long missing = Math.max(0, files - counts.created.get()) + Math.max(0, files - counts.deleted.get());
+                if (counts.overflows.get() > 0) {
+                    rescans += missing;
+                } else {
+                    lost += missing;
+                }
+            }
+
+            rounds++;
+            System.gc();
+            rss = residentKb();
+            fds = openFds();
+            heap = (Runtime.getRuntime().totalMemory() - Runtime.getRuntime().freeMemory()) / 1024;
+            if (rounds == WARMUP_ROUNDS || baseFds < 0) {
+                baseRss = rss;
+                baseFds = fds;
+                baseHeap = heap;
+            }
+
+            long now = System.nanoTime();
+            if (now >= nextReport || now >= end) {
+                long[] stats = polled.getStats();
+                System.out.printf("%8d %7d %10d %10d %10d %6d %10d %8d%n", (now - start) / 1_000_000_000L, rounds,
+                                  events, lost, rss, fds, heap, stats[FileWatcher.STAT_STRING_MISSES]);
+                nextReport = now + 10_000_000_000L;
+            }
+        } while (System.nanoTime() < end);
+
+        pushed.stop();
+        polled.stop();
+
+        System.out.println("\n" + rounds + " rounds, " + events + " events, lost " + lost + ", rescanned " + rescans);
+        System.out.println("rss " + rss + " KiB (" + (rss - baseRss) + " since round " + WARMUP_ROUNDS + "), fds " +
+                           fds + " (baseline " + baseFds + "), heap " + heap + " KiB (" + (heap - baseHeap) + ")");
+        boolean failed = false;
+        if (lost > 0) {
+            System.out.println("❌ " + lost + " events lost");
+            failed = true;
+        }
+        if (fds != baseFds) {
+            System.out.println("❌ " + (fds - baseFds) + " descriptors leaked");
+            failed = true;
+        }
+        if (rss - baseRss > limitKb || heap - baseHeap > limitKb) {
+            System.out.println("❌ memory grew past " + limitKb + " KiB");
+            failed = true;
+        }
+        if (!failed) System.out.println("✅ PASS");
+        System.exit(failed ? 1 : 0);
+    }
+
+    // Create, write and delete every file once
+    private static void churn(File dir, int files) throws IOException {
+        for (int i = 0; i < files; i++) {
+            new FileOutputStream(new File(dir, "f" + i)).close();
+        }
+        byte[] data = { 'x' };
+        for (int i = 0; i < files; i++) {
+            try (FileOutputStream out = new FileOutputStream(new File(dir, "f" + i), true)) {
+                out.write(data);
+            }
+        }
+        for (int i = 0; i < files; i++) {
+            new File(dir, "f" + i).delete();
+        }
+    }
+
+    private static long residentKb() throws IOException {
+        List<String> lines = Files.readAllLines(new File("/proc/self/status").toPath());
+        for (String line : lines) {
+            if (line.startsWith("VmRSS:")) {
+                return Long.parseLong(line.replaceAll("[^0-9]", ""));
+            }
+        }
+        return 0;
+    }
+
+    private static int openFds() {
+        String[] entries = new File("/proc/self/fd").list();
+        return entries != null ? entries.length : -1;
+    }
+}
+
+/**
+ * Minimal FileWatcher class for the soak test
+ * In real usage, this comes from the Kotlin LSP JAR
+ */
+class FileWatcher {
+
+    // Slot of getStats(), matching FileWatcherStat
+    public static final int STAT_STRING_MISSES = 12;
+
+    private long nativePtr;
+
+    public FileWatcher() {
+        this.nativePtr = create();
+        if (this.nativePtr == 0) {
+            throw new RuntimeException("Failed to create native FileWatcher");
+        }
+    }
+
+    public void watch(String path) {
+        if (!watch(nativePtr, path)) {
+            throw new RuntimeException("Failed to add watch for: " + path);
+        }
+    }
+
+    public Event[] nextEvents(int max) {
+        return nextEvents(nativePtr, max);
+    }
+
+    public long[] getStats() {
+        return getStats(nativePtr);
+    }
+
+    public boolean setListener(Listener listener) {
+        return setListener(nativePtr, listener, 256, 0);
+    }
+
+    public void stop() {
+        if (nativePtr != 0) {
+            close(nativePtr);
+            destroy(nativePtr);
+            nativePtr = 0;
+        }
+    }
+
+    // Native methods
+    private static native long create();
+    private static native boolean watch(long ptr, String path);
+    private static native Event[] nextEvents(long ptr, int max);
+    private static native long[] getStats(long ptr);
+    private static native boolean setListener(long ptr, Listener listener, int maxBatch, int maxDelayMs);
+    private static native void close(long ptr);
+    private static native void destroy(long ptr);
+
+    // Receives batches on the native delivery thread set up by setListener()
+    public interface Listener {
+        void onEvents(Event[] events);
+    }
+
+    // Event class
+    public static class Event {
+        private final EventKind kind;
+        private final String path;
+        private final String oldPath;
+
+        public Event(EventKind kind, String path) {
+            this(kind, path, null);
+        }
+
+        public Event(EventKind kind, String path, String oldPath) {
+            this.kind = kind;
+            this.path = path;
+            this.oldPath = oldPath;
+        }
+
+        public EventKind getKind() { return kind; }
+        public String getPath() { return path; }
+        public String getOldPath() { return oldPath; }
+    }
+
+    // EventKind enum
+    public enum EventKind {
+        CREATED, MODIFIED, DELETED, OVERFLOW, MOVED
+    }
+}
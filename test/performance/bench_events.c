@@ -0,0 +1,391 @@
+/**
+ * @file bench_events.c
+ * @brief Native event throughput and latency benchmark
+ *
+ * Drives the watcher core (filewatcher_core.h) against synthetic file
+ * churn, without a JVM. A writer thread generates the churn and timestamps
+ * every operation; the main thread consumes events through the core in the
+ * selected delivery mode and measures the time from each write to its
+ * delivery.
+ *
+ * Modes:
+ *   batch     the consumer parses inotify itself (nextEvents)
+ *   path      a reader thread parses into the ring (startReader)
+ *   coalesce  events folded per path for the window first (setCoalescing)
+ *
+ * Scenarios:
+ *   storm   create, modify and delete files in one directory
+ *   deep    the same churn spread over the leaves of a crawled tree
+ *   rename  rename files within a directory
+ *
+ * A second table reruns storm in the batch and path modes with 1, 4 and
+ * 8 consumer threads polling the same watcher at once, and reports how
+ * often they found the watcher mutex taken.
+ *
+ * Build and run with `make bench` (BENCH_ARGS="-n 20000 -w 50"), or
+ *
+ *   bench_events [-n files] [-d depth] [-f fanout] [-w window_ms] [-o dir] [-F]
+ *
+ * Trees are crawled with inotify unless -F lets them use a fanotify
+ * filesystem mark where permitted.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "filewatcher_core.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BATCH 256
+#define BENCH_PHASES 3
+#define IDLE_MS 200
+#define MAX_CONSUMERS 8
+
+typedef enum { MODE_BATCH, MODE_PATH, MODE_COALESCE, MODE_COUNT } BenchMode;
+typedef enum { SCENARIO_STORM, SCENARIO_DEEP, SCENARIO_RENAME, SCENARIO_COUNT } BenchScenario;
+
+static const char *const mode_names[MODE_COUNT] = { "batch", "path", "coalesce" };
+static const char *const scenario_names[SCENARIO_COUNT] = { "storm", "deep", "rename" };
+
+typedef struct {
+    int files;
+    int depth;
+    int fanout;
+    int window_ms;
+    int fanotify;
+    char root[256];
+} BenchConfig;
+
+// Shared between the writer thread and the consumer
+typedef struct {
+    const BenchConfig *config;
+    BenchScenario scenario;
+    char **dirs;              // Directories the churn is spread over
+    int dir_count;
+    _Atomic uint64_t *op_ns;  // Start time of op (phase * files + i), 0 if not yet run
+    _Atomic int done;
+} Churn;
+
+typedef struct {
+    uint64_t events;
+    uint64_t overflows;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t *latencies;
+    size_t latency_count;
+    size_t latency_capacity;
+} Stats;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static long resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static int remove_tree(const char *path) {
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", path);
+    return system(command);
+}
+
+// Build a tree of depth levels with fanout children each; leaves go to churn->dirs
+static int make_tree(Churn *churn, const char *path, int depth, int fanout) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    if (depth == 0) {
+        churn->dirs[churn->dir_count] = strdup(path);
+        return churn->dirs[churn->dir_count++] ? 0 : -1;
+    }
+    char child[PATH_MAX];
+    for (int i = 0; i < fanout; i++) {
+        snprintf(child, sizeof(child), "%s/d%d", path, i);
+        if (make_tree(churn, child, depth - 1, fanout) != 0) return -1;
+    }
+    return 0;
+}
+
+// Writer thread: one timestamped syscall per op
+static void *churn_main(void *arg) {
+    Churn *churn = arg;
+    int files = churn->config->files;
+    char path[PATH_MAX], target[PATH_MAX];
+
+    for (int phase = 0; phase < BENCH_PHASES; phase++) {
+        if (churn->scenario == SCENARIO_RENAME && phase > 0) break;
+        for (int i = 0; i < files; i++) {
+            const char *dir = churn->dirs[i % churn->dir_count];
+            snprintf(path, sizeof(path), "%s/f%d", dir, i);
+            atomic_store_explicit(&churn->op_ns[phase * files + i], monotonic_ns(), memory_order_release);
+
+            if (churn->scenario == SCENARIO_RENAME) {
+                snprintf(target, sizeof(target), "%s/r%d", dir, i);
+                rename(path, target);
+            } else if (phase == 0) {
+                int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+                if (fd >= 0) close(fd);
+            } else if (phase == 1) {
+                int fd = open(path, O_WRONLY);
+                if (fd >= 0) {
+                    if (write(fd, "x", 1) < 0) perror("write");
+                    close(fd);
+                }
+            } else {
+                unlink(path);
+            }
+        }
+    }
+    atomic_store(&churn->done, 1);
+    return NULL;
+}
+
+static void record_latency(Stats *stats, uint64_t ns) {
+    if (stats->latency_count == stats->latency_capacity) {
+        size_t capacity = stats->latency_capacity ? stats->latency_capacity * 2 : 4096;
+        uint64_t *grown = realloc(stats->latencies, sizeof(uint64_t) * capacity);
+        if (grown == NULL) return;
+        stats->latencies = grown;
+        stats->latency_capacity = capacity;
+    }
+    stats->latencies[stats->latency_count++] = ns;
+}
+
+// Match a delivered event to the op that caused it
+static void deliver(const Churn *churn, Stats *stats, uint8_t kind, const char *path) {
+    uint64_t now = monotonic_ns();
+    stats->events++;
+    if (stats->first_ns == 0) stats->first_ns = now;
+    stats->last_ns = now;
+    if (kind == RING_OVERFLOW) {
+        stats->overflows++;
+        return;
+    }
+
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    int i;
+    if ((base[0] != 'f' && base[0] != 'r') || sscanf(base + 1, "%d", &i) != 1) return;
+    if (i < 0 || i >= churn->config->files) return;
+
+    int phase = 0;
+    if (churn->scenario != SCENARIO_RENAME) {
+        phase = (kind == RING_CREATED) ? 0 : (kind == RING_MODIFIED) ? 1 : 2;
+    }
+    uint64_t start = atomic_load_explicit(&churn->op_ns[phase * churn->config->files + i], memory_order_acquire);
+    if (start != 0 && now >= start) record_latency(stats, now - start);
+}
+
+// One of several consumer threads polling the same watcher
+typedef struct {
+    FileWatcher *watcher;
+    const Churn *churn;
+    Stats stats;
+} Consumer;
+
+// Consumer: runs until the writer is done and the watcher stayed quiet for IDLE_MS
+static void consume(FileWatcher *watcher, const Churn *churn, Stats *stats) {
+    FileWatcherEvent events[BENCH_BATCH];
+    static _Thread_local char buffer[BENCH_BATCH * 128 + FILEWATCHER_MAX_EVENT_BYTES];
+
+    for (;;) {
+        int done = atomic_load(&churn->done);
+        int ready = filewatcher_wait(watcher, done ? IDLE_MS : 50);
+
+        int count;
+        while ((count = filewatcher_poll(watcher, events, BENCH_BATCH, buffer, sizeof(buffer))) > 0) {
+            for (int i = 0; i < count; i++) deliver(churn, stats, events[i].kind, events[i].path);
+        }
+
+        if (!ready && done) break;
+    }
+}
+
+static void *consumer_main(void *arg) {
+    Consumer *consumer = arg;
+    consume(consumer->watcher, consumer->churn, &consumer->stats);
+    return NULL;
+}
+
+// Fold a consumer's results into the total
+static void merge_stats(Stats *total, const Stats *part) {
+    total->events += part->events;
+    total->overflows += part->overflows;
+    if (part->first_ns != 0 && (total->first_ns == 0 || part->first_ns < total->first_ns)) {
+        total->first_ns = part->first_ns;
+    }
+    if (part->last_ns > total->last_ns) total->last_ns = part->last_ns;
+    for (size_t i = 0; i < part->latency_count; i++) record_latency(total, part->latencies[i]);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const Stats *stats, double p) {
+    if (stats->latency_count == 0) return 0.0;
+    size_t index = (size_t)(p * (double)(stats->latency_count - 1));
+    return stats->latencies[index] / 1e3;
+}
+
+static void run(const BenchConfig *config, BenchScenario scenario, BenchMode mode, int consumers) {
+    char root[PATH_MAX / 2];
+    snprintf(root, sizeof(root), "%s/%s-%s-%d", config->root, scenario_names[scenario], mode_names[mode], consumers);
+    remove_tree(root);
+
+    Churn churn = { config, scenario, NULL, 0, NULL, 0 };
+    size_t max_dirs = 1;
+    if (scenario == SCENARIO_DEEP) {
+        for (int i = 0; i < config->depth; i++) max_dirs *= (size_t)config->fanout;
+    }
+    churn.dirs = calloc(max_dirs, sizeof(char *));
+    churn.op_ns = calloc((size_t)config->files * BENCH_PHASES, sizeof(*churn.op_ns));
+    if (churn.dirs == NULL || churn.op_ns == NULL ||
+        make_tree(&churn, root, scenario == SCENARIO_DEEP ? config->depth : 0, config->fanout) != 0) {
+        fprintf(stderr, "cannot create %s: %s\n", root, strerror(errno));
+        exit(1);
+    }
+
+    // Rename needs files to rename; create them before watching
+    if (scenario == SCENARIO_RENAME) {
+        char path[PATH_MAX];
+        for (int i = 0; i < config->files; i++) {
+            snprintf(path, sizeof(path), "%s/f%d", root, i);
+            int fd = open(path, O_CREAT | O_WRONLY, 0644);
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    FileWatcher *watcher = filewatcher_create();
+    if (watcher == NULL) {
+        fprintf(stderr, "inotify: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    filewatcher_set_fanotify(watcher, config->fanotify);
+    CrawlResult crawl;
+    long rss_before = resident_bytes();
+    if (filewatcher_watch_recursive(watcher, root, NULL, 0, &crawl) != 0) {
+        fprintf(stderr, "crawl %s: %s\n", root, strerror(errno));
+        exit(1);
+    }
+    long rss_after = resident_bytes();
+
+    if (mode == MODE_COALESCE) filewatcher_set_coalescing(watcher, (uint32_t)config->window_ms);
+    if (mode == MODE_PATH && filewatcher_start_reader(watcher, 0) != 0) {
+        fprintf(stderr, "cannot start reader thread\n");
+        exit(1);
+    }
+
+    pthread_t writer;
+    pthread_t threads[MAX_CONSUMERS];
+    Consumer others[MAX_CONSUMERS];
+    Stats stats = { 0 };
+    uint64_t start = monotonic_ns();
+    pthread_create(&writer, NULL, churn_main, &churn);
+    for (int i = 1; i < consumers; i++) {
+        others[i] = (Consumer){ watcher, &churn, { 0 } };
+        pthread_create(&threads[i], NULL, consumer_main, &others[i]);
+    }
+    consume(watcher, &churn, &stats);
+    for (int i = 1; i < consumers; i++) {
+        pthread_join(threads[i], NULL);
+        merge_stats(&stats, &others[i].stats);
+        free(others[i].stats.latencies);
+    }
+    pthread_join(writer, NULL);
+
+    qsort(stats.latencies, stats.latency_count, sizeof(uint64_t), compare_u64);
+    double seconds = (stats.last_ns > start) ? (stats.last_ns - start) / 1e9 : 0.0;
+    uint64_t counters[STAT_COUNT];
+    filewatcher_get_stats(watcher, counters);
+    char mode_label[32];
+    if (consumers > 1) {
+        snprintf(mode_label, sizeof(mode_label), "%s/%d", mode_names[mode], consumers);
+    } else {
+        snprintf(mode_label, sizeof(mode_label), "%s", mode_names[mode]);
+    }
+    printf("%-7s %-9s %9llu %11.0f %9.1f %9.1f %9llu %8llu",
+           scenario_names[scenario], mode_label, (unsigned long long)stats.events,
+           seconds > 0 ? stats.events / seconds : 0.0,
+           percentile_us(&stats, 0.50), percentile_us(&stats, 0.99),
+           (unsigned long long)stats.overflows, (unsigned long long)counters[STAT_EVENTS_PER_READ]);
+    if (scenario == SCENARIO_DEEP) {
+        printf("   %u watches, crawl %.1f ms, %.0f B RSS/watch", crawl.watches_added, crawl.elapsed_ns / 1e6,
+               crawl.watches_added ? (double)(rss_after - rss_before) / crawl.watches_added : 0.0);
+    }
+    if (consumers > 1) printf("   %llu lock waits", (unsigned long long)counters[STAT_LOCK_CONTENTION]);
+    printf("\n");
+
+    filewatcher_destroy(watcher);
+    for (int i = 0; i < churn.dir_count; i++) free(churn.dirs[i]);
+    free(churn.dirs);
+    free(churn.op_ns);
+    free(stats.latencies);
+    remove_tree(root);
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config = { 10000, 3, 8, 20, 0, "/tmp/filewatcher_bench_native" };
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:f:w:o:F")) != -1) {
+        switch (opt) {
+            case 'n': config.files = atoi(optarg); break;
+            case 'd': config.depth = atoi(optarg); break;
+            case 'f': config.fanout = atoi(optarg); break;
+            case 'w': config.window_ms = atoi(optarg); break;
+            case 'o': snprintf(config.root, sizeof(config.root), "%s", optarg); break;
+            case 'F': config.fanotify = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n files] [-d depth] [-f fanout] [-w window_ms] [-o dir] [-F]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (config.files <= 0 || config.depth < 0 || config.fanout <= 0 || config.window_ms < 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 2;
+    }
+    if (mkdir(config.root, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "cannot create %s: %s\n", config.root, strerror(errno));
+        return 1;
+    }
+
+    printf("files=%d depth=%d fanout=%d window=%d ms%s\n\n", config.files, config.depth, config.fanout,
+           config.window_ms, config.fanotify ? " fanotify" : "");
+    printf("%-7s %-9s %9s %11s %9s %9s %9s %8s\n", "test", "mode", "events", "events/s", "p50 us", "p99 us",
+           "overflows", "ev/read");
+    for (int s = 0; s < SCENARIO_COUNT; s++) {
+        for (int m = 0; m < MODE_COUNT; m++) run(&config, (BenchScenario)s, (BenchMode)m, 1);
+    }
+
+    // Several threads polling one watcher: the mutex path against the
+    // reader thread's lock-free claims
+    static const int consumer_counts[] = { 1, 4, MAX_CONSUMERS };
+    printf("\n");
+    for (int m = MODE_BATCH; m <= MODE_PATH; m++) {
+        for (size_t c = 0; c < sizeof(consumer_counts) / sizeof(consumer_counts[0]); c++) {
+            run(&config, SCENARIO_STORM, (BenchMode)m, consumer_counts[c]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,576 @@
+/**
+ * @file soak_events.c
+ * @brief Long-running stress test for event loss and resource creep
+ *
+ * Drives the watcher core (filewatcher_core.h) with file churn over a
+ * recursively watched tree for as long as asked, with several consumer
+ * threads polling the same watcher. Each round adds a small subtree,
+ * then runs one phase per kind of operation over every file:
+ *
+ *   mkdir   create the round's subtree, which must gain a watch per directory
+ *   create  create f<i> in the tree's leaves and the subtree's
+ *   modify  append to every f<i>
+ *   rename  rename every f<i> to g<i> in place
+ *   delete  remove every g<i> and the subtree, whose watches must go away
+ *
+ * After each phase the test waits for the watcher to go quiet and checks
+ * that every file got the event its operation should have caused (a
+ * rename may arrive as MOVED or as DELETED + CREATED, and recovered
+ * events count the same as read ones). Every few rounds the consumers
+ * stop polling through the create phase, which then starts by writing
+ * two filler files until every queue on the way is full, so the CREATED
+ * events of the files are dropped and overflow recovery has to rebuild
+ * them. Files missing their event in a phase that delivered a plain
+ * OVERFLOW are counted as rescanned rather than lost, since a client
+ * would rescan there.
+ *
+ * Every other round runs with a coalescing window and rename pairing, so
+ * the coalescer, the rename table and MOVED events are soaked as well as
+ * the plain path, and switching between them mid-run is too.
+ *
+ * Resident memory, open descriptors and active watches are sampled at the
+ * end of every round and printed every interval. The run fails if any
+ * event was lost, a round left watches behind, pairing never produced a
+ * MOVED event, or, against the first rounds after warmup, descriptors
+ * leaked or RSS grew past the limit.
+ *
+ * Build and run with `make soak` (SOAK_ARGS="-t 3600"), or
+ *
+ *   soak_events [-t seconds] [-n files] [-d depth] [-f fanout] [-c consumers]
+ *               [-w window_ms] [-p pair_ms] [-x every] [-i interval] [-W warmup]
+ *               [-g rss_kb] [-o dir] [-R] [-N] [-F] [-S]
+ *
+ * -w and -p set the coalescing window and rename pairing timeout of the
+ * tuned rounds (0 turns either off), -S tunes every round instead of
+ * every other one, -R polls through a reader thread, -N turns overflow
+ * recovery off and -F lets the tree use a fanotify filesystem mark where
+ * permitted; its watches are then only checked for growth after warmup.
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "filewatcher_core.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOAK_BATCH 256
+#define MAX_CONSUMERS 16
+#define IDLE_MS 250
+#define SUBTREE_DEPTH 2
+#define SUBTREE_FANOUT 2
+#define SUBTREE_DIRS 7   // 1 + 2 + 4 directories for the depth and fanout above
+#define SUBTREE_LEAVES 4
+#define REPORT_MISSING 5
+
+typedef enum { PHASE_MKDIR, PHASE_CREATE, PHASE_MODIFY, PHASE_RENAME, PHASE_DELETE, PHASE_COUNT } SoakPhase;
+
+static const char *const phase_names[PHASE_COUNT] = { "mkdir", "create", "modify", "rename", "delete" };
+
+// What was seen for file i in the current phase, as f<i> and as g<i>
+#define SEEN_F_CREATED 0x01
+#define SEEN_F_MODIFIED 0x02
+#define SEEN_F_DELETED 0x04
+#define SEEN_G_SHIFT 3
+
+// Events every file must have seen by the end of each phase
+static const uint8_t phase_needs[PHASE_COUNT] = {
+    0,
+    SEEN_F_CREATED,
+    SEEN_F_MODIFIED,
+    SEEN_F_DELETED | (SEEN_F_CREATED << SEEN_G_SHIFT),
+    SEEN_F_DELETED << SEEN_G_SHIFT,
+};
+
+typedef struct {
+    int seconds;
+    int files;
+    int depth;
+    int fanout;
+    int consumers;
+    int window_ms;
+    int pair_ms;
+    int overflow_every;
+    int interval;
+    int warmup;
+    long rss_limit_kb;
+    int reader;
+    int recovery;
+    int fanotify;
+    int steady;
+    char root[256];
+} SoakConfig;
+
+// Shared between the churn (main thread) and the consumers
+typedef struct {
+    FileWatcher *watcher;
+    int files;
+    _Atomic uint8_t *seen;  // SEEN_* bits per file index
+    _Atomic uint64_t events;
+    _Atomic uint64_t synthesized;
+    _Atomic uint64_t moves;
+    _Atomic uint64_t overflows;
+    _Atomic uint64_t last_event_ns;
+    _Atomic int paused;
+    _Atomic int stop;
+} Soak;
+
+typedef struct {
+    uint64_t ops;
+    uint64_t lost;
+    uint64_t rescanned;
+    uint64_t watch_errors;
+    uint64_t forced_rounds;
+    uint64_t tuned_rounds;
+} Totals;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static long resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Open descriptors, not counting the one used to list them
+static int open_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == NULL) return -1;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+    return count - 1;
+}
+
+static uint64_t active_watches(FileWatcher *watcher) {
+    uint64_t stats[STAT_COUNT];
+    filewatcher_get_stats(watcher, stats);
+    return stats[STAT_ACTIVE_WATCHES];
+}
+
+static int remove_tree(const char *path) {
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", path);
+    return system(command);
+}
+
+// Build a tree of depth levels with fanout children each; leaves are
+// appended to dirs and, if order is given, every directory to it parents first
+static int make_tree(const char *path, int depth, int fanout, char **dirs, int *dir_count, char **order,
+                     int *order_count) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    if (order != NULL && (order[(*order_count)++] = strdup(path)) == NULL) return -1;
+    if (depth == 0) {
+        dirs[*dir_count] = strdup(path);
+        return dirs[(*dir_count)++] ? 0 : -1;
+    }
+    char child[PATH_MAX];
+    for (int i = 0; i < fanout; i++) {
+        snprintf(child, sizeof(child), "%s/d%d", path, i);
+        if (make_tree(child, depth - 1, fanout, dirs, dir_count, order, order_count) != 0) return -1;
+    }
+    return 0;
+}
+
+// Record an event for f<i> or g<i>; anything else (directories) is ignored
+static void mark(Soak *soak, const char *path, uint8_t bit) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    char *end;
+    if (base[0] != 'f' && base[0] != 'g') return;
+    long i = strtol(base + 1, &end, 10);
+    if (end == base + 1 || *end != '\0' || i < 0 || i >= soak->files) return;
+    uint8_t shift = (base[0] == 'g') ? SEEN_G_SHIFT : 0;
+    atomic_fetch_or_explicit(&soak->seen[i], (uint8_t)(bit << shift), memory_order_relaxed);
+}
+
+static void deliver(Soak *soak, const FileWatcherEvent *event) {
+    atomic_fetch_add_explicit(&soak->events, 1, memory_order_relaxed);
+    atomic_store_explicit(&soak->last_event_ns, monotonic_ns(), memory_order_relaxed);
+    if (event->flags & RING_FLAG_SYNTH) atomic_fetch_add_explicit(&soak->synthesized, 1, memory_order_relaxed);
+
+    switch (event->kind) {
+        case RING_CREATED: mark(soak, event->path, SEEN_F_CREATED); break;
+        case RING_MODIFIED: mark(soak, event->path, SEEN_F_MODIFIED); break;
+        case RING_DELETED: mark(soak, event->path, SEEN_F_DELETED); break;
+        case RING_MOVED:
+            atomic_fetch_add_explicit(&soak->moves, 1, memory_order_relaxed);
+            mark(soak, event->old_path, SEEN_F_DELETED);
+            mark(soak, event->path, SEEN_F_CREATED);
+            break;
+        case RING_OVERFLOW: atomic_fetch_add_explicit(&soak->overflows, 1, memory_order_relaxed); break;
+        default: break;
+    }
+}
+
+// Consumer: polls until told to stop, idling while paused
+static void *consumer_main(void *arg) {
+    Soak *soak = arg;
+    FileWatcherEvent events[SOAK_BATCH];
+    static _Thread_local char buffer[SOAK_BATCH * 128 + FILEWATCHER_MAX_EVENT_BYTES];
+
+    while (!atomic_load(&soak->stop)) {
+        if (atomic_load(&soak->paused)) {
+            sleep_ms(10);
+            continue;
+        }
+        filewatcher_wait(soak->watcher, 50);
+        int count;
+        while (!atomic_load(&soak->paused) &&
+               (count = filewatcher_poll(soak->watcher, events, SOAK_BATCH, buffer, sizeof(buffer))) > 0) {
+            for (int i = 0; i < count; i++) deliver(soak, &events[i]);
+        }
+    }
+    return NULL;
+}
+
+// Wait until no event has arrived for quiet_ms since the phase ended
+static void wait_quiet(Soak *soak, uint64_t since_ns, int quiet_ms) {
+    uint64_t quiet_ns = (uint64_t)quiet_ms * 1000000ull;
+    for (;;) {
+        sleep_ms(20);
+        uint64_t last = atomic_load_explicit(&soak->last_event_ns, memory_order_relaxed);
+        if (last < since_ns) last = since_ns;
+        if (monotonic_ns() - last >= quiet_ns) return;
+    }
+}
+
+// One operation of a phase on file i. Returns 1 if it was done.
+static int churn_one(SoakPhase phase, const char *dir, int i) {
+    char path[PATH_MAX], target[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%c%d", dir, phase == PHASE_DELETE ? 'g' : 'f', i);
+    int fd;
+    switch (phase) {
+        case PHASE_CREATE:
+            fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+            if (fd < 0) return 0;
+            close(fd);
+            return 1;
+        case PHASE_MODIFY:
+            fd = open(path, O_WRONLY | O_APPEND);
+            if (fd < 0) return 0;
+            if (write(fd, "x", 1) != 1) perror("write");
+            close(fd);
+            return 1;
+        case PHASE_RENAME:
+            snprintf(target, sizeof(target), "%s/g%d", dir, i);
+            return rename(path, target) == 0;
+        case PHASE_DELETE:
+            return unlink(path) == 0;
+        default:
+            return 0;
+    }
+}
+
+// Events that fit between the kernel and the ring: the kernel queue, a
+// read buffer the reader thread can fill before it stalls, and the inbox
+static int overflow_events(void) {
+    int max_queued = 16384;
+    FILE *f = fopen("/proc/sys/fs/inotify/max_queued_events", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &max_queued) != 1) max_queued = 16384;
+        fclose(f);
+    }
+    return max_queued + ENGINE_INBOX_MAX_EVENTS + (int)(ENGINE_READ_DEFAULT_LIMIT / EVENT_SIZE);
+}
+
+// Queue at least count events by writing the filler files. Returns the writes made.
+static int fill_queue(const char *root, int count) {
+    char path[PATH_MAX];
+    int fds[2];
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/h%d", root, i);
+        fds[i] = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    }
+    // Alternating between two files, since the kernel merges an IN_MODIFY
+    // into the last queued event when they are the same
+    int writes = 0;
+    while (fds[0] >= 0 && fds[1] >= 0 && writes < count && write(fds[writes & 1], "x", 1) == 1) writes++;
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+    return writes;
+}
+
+// Run a phase over every file and check what was delivered for it. With
+// filler > 0 the queue is filled with that many events first.
+static void run_phase(const SoakConfig *config, Soak *soak, SoakPhase phase, const char *root, char **dirs,
+                      int dir_count, int filler, Totals *totals) {
+    for (int i = 0; i < soak->files; i++) atomic_store_explicit(&soak->seen[i], 0, memory_order_relaxed);
+    uint64_t overflows = atomic_load(&soak->overflows);
+
+    if (filler > 0) totals->ops += (uint64_t)fill_queue(root, filler);
+    for (int i = 0; i < soak->files; i++) {
+        if (churn_one(phase, dirs[i % dir_count], i)) totals->ops++;
+    }
+    atomic_store(&soak->paused, 0);
+    wait_quiet(soak, monotonic_ns(), IDLE_MS + config->window_ms);
+
+    uint64_t missing = 0;
+    for (int i = 0; i < soak->files; i++) {
+        uint8_t seen = atomic_load_explicit(&soak->seen[i], memory_order_relaxed);
+        if ((seen & phase_needs[phase]) == phase_needs[phase]) continue;
+        if (missing++ < REPORT_MISSING && atomic_load(&soak->overflows) == overflows) {
+            fprintf(stderr, "%s: no event for %s/%c%d (seen 0x%02x)\n", phase_names[phase], dirs[i % dir_count],
+                    phase == PHASE_DELETE ? 'g' : 'f', i, seen);
+        }
+    }
+    if (atomic_load(&soak->overflows) != overflows) {
+        totals->rescanned += missing;
+    } else {
+        totals->lost += missing;
+    }
+}
+
+static void print_header(void) {
+    printf("%8s %7s %11s %11s %9s %7s %9s %10s %6s %8s %9s\n", "seconds", "rounds", "ops", "events", "synth",
+           "ovfl", "lost", "rss KiB", "fds", "watches", "queue KiB");
+}
+
+static void print_sample(const Soak *soak, const Totals *totals, double seconds, int rounds, long rss, int fds,
+                         uint64_t watches, uint64_t queue_bytes) {
+    printf("%8.0f %7d %11llu %11llu %9llu %7llu %9llu %10ld %6d %8llu %9llu\n", seconds, rounds,
+           (unsigned long long)totals->ops, (unsigned long long)atomic_load(&soak->events),
+           (unsigned long long)atomic_load(&soak->synthesized), (unsigned long long)atomic_load(&soak->overflows),
+           (unsigned long long)totals->lost, rss / 1024, fds, (unsigned long long)watches,
+           (unsigned long long)queue_bytes / 1024);
+    fflush(stdout);
+}
+
+static int run(const SoakConfig *config) {
+    char root[PATH_MAX / 2];
+    snprintf(root, sizeof(root), "%s/tree", config->root);
+    remove_tree(root);
+
+    size_t leaves = 1;
+    for (int i = 0; i < config->depth; i++) leaves *= (size_t)config->fanout;
+    char **dirs = calloc(leaves + SUBTREE_LEAVES, sizeof(char *));
+    int leaf_count = 0;
+    if (dirs == NULL || make_tree(root, config->depth, config->fanout, dirs, &leaf_count, NULL, NULL) != 0) {
+        fprintf(stderr, "cannot create %s: %s\n", root, strerror(errno));
+        return 1;
+    }
+
+    Soak soak = { 0 };
+    soak.files = config->files;
+    soak.seen = calloc((size_t)config->files, sizeof(*soak.seen));
+    soak.watcher = filewatcher_create();
+    if (soak.seen == NULL || soak.watcher == NULL) {
+        fprintf(stderr, "cannot create watcher: %s\n", strerror(errno));
+        return 1;
+    }
+    filewatcher_set_fanotify(soak.watcher, config->fanotify);
+    filewatcher_set_overflow_recovery(soak.watcher, config->recovery);
+    if (filewatcher_watch_recursive(soak.watcher, root, NULL, 0, NULL) != 0) {
+        fprintf(stderr, "crawl %s: %s\n", root, strerror(errno));
+        return 1;
+    }
+    if (config->reader && filewatcher_start_reader(soak.watcher, 0) != 0) {
+        fprintf(stderr, "cannot start reader thread\n");
+        return 1;
+    }
+
+    pthread_t threads[MAX_CONSUMERS];
+    for (int i = 0; i < config->consumers; i++) pthread_create(&threads[i], NULL, consumer_main, &soak);
+
+    // A fanotify root registers directories as their events come in, so
+    // its count is only held against the one reached after warmup
+    int marked = (filewatcher_root_marked(soak.watcher, root) == 1);
+    uint64_t base_watches = active_watches(soak.watcher);
+    int filler = overflow_events();
+    printf("files=%d depth=%d fanout=%d (%d leaves, %llu watches) consumers=%d%s%s%s\n",
+           config->files, config->depth, config->fanout, leaf_count, (unsigned long long)base_watches,
+           config->consumers, config->reader ? " reader" : "", config->recovery ? "" : " no-recovery",
+           marked ? " fanotify" : "");
+    printf("window=%d ms, pairing=%d ms in %s\n", config->window_ms, config->pair_ms,
+           config->steady ? "every round" : "every other round");
+    printf("overflow every %d rounds (%d filler writes), %d s, rss limit %ld KiB after %d warmup rounds\n\n",
+           config->overflow_every, filler, config->seconds, config->rss_limit_kb, config->warmup);
+    print_header();
+
+    Totals totals = { 0 };
+    long base_rss = 0, peak_rss = 0, rss = 0;
+    int base_fds = -1, fds = 0;
+    uint64_t watches = base_watches;
+    uint64_t start = monotonic_ns(), next_report = start + (uint64_t)config->interval * 1000000000ull;
+    uint64_t end = start + (uint64_t)config->seconds * 1000000000ull;
+    int rounds = 0;
+
+    do {
+        // Settings change between rounds, once the last one has gone quiet
+        int tuned = config->steady || rounds % 2 == 0;
+        if (tuned) totals.tuned_rounds++;
+        if (!config->steady || rounds == 0) {
+            filewatcher_set_coalescing(soak.watcher, tuned ? (uint32_t)config->window_ms : 0);
+            filewatcher_set_rename_pairing(soak.watcher, tuned ? (uint32_t)config->pair_ms : 0);
+        }
+
+        // The round's subtree, watched through IN_CREATE of its parents
+        char sub[PATH_MAX], *order[SUBTREE_DIRS];
+        int order_count = 0, dir_count = leaf_count;
+        snprintf(sub, sizeof(sub), "%s/s%d", root, rounds);
+        uint64_t mkdir_ns = monotonic_ns();
+        if (make_tree(sub, SUBTREE_DEPTH, SUBTREE_FANOUT, dirs, &dir_count, order, &order_count) != 0) {
+            fprintf(stderr, "cannot create %s: %s\n", sub, strerror(errno));
+            return 1;
+        }
+        wait_quiet(&soak, mkdir_ns, IDLE_MS + config->window_ms);
+        if (!marked && active_watches(soak.watcher) != base_watches + SUBTREE_DIRS) {
+            fprintf(stderr, "round %d: %llu watches after mkdir, expected %llu\n", rounds,
+                    (unsigned long long)active_watches(soak.watcher),
+                    (unsigned long long)(base_watches + SUBTREE_DIRS));
+            totals.watch_errors++;
+        }
+
+        int forced = (config->overflow_every > 0 && rounds % config->overflow_every == 0);
+        for (int phase = PHASE_CREATE; phase < PHASE_COUNT; phase++) {
+            int fill = 0;
+            if (forced && phase == PHASE_CREATE) {
+                // Nobody reads while the queue fills past its limit
+                atomic_store(&soak.paused, 1);
+                sleep_ms(100);
+                fill = filler;
+                totals.forced_rounds++;
+            }
+            run_phase(config, &soak, (SoakPhase)phase, root, dirs, dir_count, fill, &totals);
+        }
+
+        uint64_t rmdir_ns = monotonic_ns();
+        for (int i = order_count - 1; i >= 0; i--) {
+            if (rmdir(order[i]) == 0) totals.ops++;
+            free(order[i]);
+        }
+        for (int i = leaf_count; i < dir_count; i++) free(dirs[i]);
+        wait_quiet(&soak, rmdir_ns, IDLE_MS + config->window_ms);
+
+        rounds++;
+        watches = active_watches(soak.watcher);
+        if (marked && rounds <= config->warmup) base_watches = watches;
+        if (watches != base_watches) {
+            fprintf(stderr, "round %d: %llu watches left, expected %llu\n", rounds, (unsigned long long)watches,
+                    (unsigned long long)base_watches);
+            totals.watch_errors++;
+        }
+        rss = resident_bytes();
+        fds = open_fds();
+        if (rss > peak_rss) peak_rss = rss;
+        if (rounds == config->warmup || base_fds < 0) {
+            base_rss = rss;
+            base_fds = fds;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (now >= next_report || now >= end) {
+            print_sample(&soak, &totals, (now - start) / 1e9, rounds, rss, fds, watches,
+                         filewatcher_queue_high_water(soak.watcher));
+            next_report = now + (uint64_t)config->interval * 1000000000ull;
+        }
+    } while (monotonic_ns() < end);
+
+    atomic_store(&soak.stop, 1);
+    for (int i = 0; i < config->consumers; i++) pthread_join(threads[i], NULL);
+
+    long growth_kb = (rss - base_rss) / 1024;
+    printf("\n%d rounds (%llu with forced overflows, %llu tuned), %llu ops, %llu events (%llu recovered, %llu moves)\n",
+           rounds, (unsigned long long)totals.forced_rounds, (unsigned long long)totals.tuned_rounds,
+           (unsigned long long)totals.ops,
+           (unsigned long long)atomic_load(&soak.events), (unsigned long long)atomic_load(&soak.synthesized),
+           (unsigned long long)atomic_load(&soak.moves));
+    printf("lost %llu, rescanned after overflow %llu, watch errors %llu\n", (unsigned long long)totals.lost,
+           (unsigned long long)totals.rescanned, (unsigned long long)totals.watch_errors);
+    printf("rss %ld KiB (%+ld KiB since round %d, peak %ld KiB), fds %d (baseline %d), watches %llu (baseline %llu)\n",
+           rss / 1024, growth_kb, config->warmup, peak_rss / 1024, fds, base_fds, (unsigned long long)watches,
+           (unsigned long long)base_watches);
+    if (rounds <= config->warmup) printf("note: run ended before warmup; growth is not meaningful\n");
+
+    int failed = 0;
+    if (totals.lost > 0) failed = printf("FAIL: %llu events lost\n", (unsigned long long)totals.lost);
+    if (totals.watch_errors > 0) failed = printf("FAIL: watch count off in %llu checks\n",
+                                                 (unsigned long long)totals.watch_errors);
+    // fanotify pairs renames only on Linux 5.17+
+    if (config->pair_ms > 0 && totals.tuned_rounds > 0 && atomic_load(&soak.moves) == 0 &&
+        filewatcher_root_marked(soak.watcher, root) != 1) {
+        failed = printf("FAIL: rename pairing produced no MOVED event\n");
+    }
+    if (fds != base_fds) failed = printf("FAIL: %d descriptors leaked\n", fds - base_fds);
+    if (growth_kb > config->rss_limit_kb) failed = printf("FAIL: RSS grew %ld KiB\n", growth_kb);
+    if (!failed) printf("PASS\n");
+
+    filewatcher_destroy(soak.watcher);
+    for (int i = 0; i < leaf_count; i++) free(dirs[i]);
+    free(dirs);
+    free(soak.seen);
+    remove_tree(root);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    SoakConfig config = { 60, 2000, 3, 6, 4, 20, 50, 10, 10, 10, 4096, 0, 1, 0, 0, "/tmp/filewatcher_soak" };
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:d:f:c:w:p:x:i:W:g:o:RNFS")) != -1) {
+        switch (opt) {
+            case 't': config.seconds = atoi(optarg); break;
+            case 'n': config.files = atoi(optarg); break;
+            case 'd': config.depth = atoi(optarg); break;
+            case 'f': config.fanout = atoi(optarg); break;
+            case 'c': config.consumers = atoi(optarg); break;
+            case 'w': config.window_ms = atoi(optarg); break;
+            case 'p': config.pair_ms = atoi(optarg); break;
+            case 'x': config.overflow_every = atoi(optarg); break;
+            case 'i': config.interval = atoi(optarg); break;
+            case 'W': config.warmup = atoi(optarg); break;
+            case 'g': config.rss_limit_kb = atol(optarg); break;
+            case 'o': snprintf(config.root, sizeof(config.root), "%s", optarg); break;
+            case 'R': config.reader = 1; break;
+            case 'N': config.recovery = 0; break;
+            case 'F': config.fanotify = 1; break;
+            case 'S': config.steady = 1; break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-t seconds] [-n files] [-d depth] [-f fanout] [-c consumers] [-w window_ms]\n"
+                        "       [-p pair_ms] [-x every] [-i interval] [-W warmup] [-g rss_kb] [-o dir]\n"
+                        "       [-R] [-N] [-F] [-S]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (config.seconds < 0 || config.files <= 0 || config.depth < 0 || config.fanout <= 0 ||
+        config.consumers <= 0 || config.consumers > MAX_CONSUMERS || config.window_ms < 0 || config.pair_ms < 0 ||
+        config.overflow_every < 0 || config.interval <= 0 || config.warmup < 1 || config.rss_limit_kb < 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 2;
+    }
+    if (mkdir(config.root, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "cannot create %s: %s\n", config.root, strerror(errno));
+        return 1;
+    }
+    return run(&config);
+}
@@ -0,0 +1,284 @@
+/**
+ * @file trace_decode.c
+ * @brief Print a FILEWATCHER_TRACE file, or sum up where events spend their time
+ *
+ * Records are merged across threads in time order. With -s, instead of
+ * printing them, the tool reports how long events took between stages:
+ *
+ *   read->parse     from a batch being read to each of its events parsed
+ *   parse->queue    from an event parsed to its record entering the ring,
+ *                   for records that still carry their watch descriptor
+ *   queue->deliver  from a record entering the ring to a caller taking it,
+ *                   matched by its position in the ring
+ *   parse->deliver  both of the above, for records matched by each
+ *
+ * Records held back by coalescing, settling or rename pairing are sent on
+ * without their watch descriptor, so they count towards queue->deliver
+ * only; their number is listed as "unmatched".
+ *
+ * Build with `make trace-decode`, then
+ *
+ *   trace_decode [-s] trace-file
+ *
+ * @author yamsergey
+ * @version 1.0.0
+ * @date 2025-08-14
+ */
+
+#include "filewatcher_trace.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+typedef enum { SPAN_READ_PARSE, SPAN_PARSE_QUEUE, SPAN_QUEUE_DELIVER, SPAN_PARSE_DELIVER, SPAN_COUNT } Span;
+
+static const char *const span_names[SPAN_COUNT] = { "read->parse", "parse->queue", "queue->deliver", "parse->deliver" };
+
+typedef struct {
+    uint64_t *values;
+    size_t count;
+} Samples;
+
+// What one thread last did, for matching within it
+typedef struct {
+    uint32_t tid;
+    uint64_t read_ns;   // Last batch read, 0 if none
+    int32_t parse_wd;   // wd of the last event parsed
+    uint64_t parse_ns;  // When, 0 once queued, filtered or folded
+} ThreadState;
+
+// A queued record waiting for its delivery, keyed by lane and end position
+typedef struct {
+    uint32_t key_flags;
+    uint32_t key_end;
+    uint64_t queue_ns;  // 0 if the slot is free
+    uint64_t parse_ns;  // 0 if the parse was not matched
+} Pending;
+
+static int compare_time(const void *a, const void *b) {
+    const TraceRecord *x = a, *y = b;
+    if (x->time_ns != y->time_ns) return (x->time_ns > y->time_ns) - (x->time_ns < y->time_ns);
+    return (x->stage > y->stage) - (x->stage < y->stage);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Read the whole file. Returns the records (count in *count), NULL on error.
+static TraceRecord *load(const char *path, size_t *count) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: unsupported version %u (record size %u)\n", path, header.version, header.record_size);
+        fclose(file);
+        return NULL;
+    }
+
+    size_t capacity = 4096, n = 0;
+    TraceRecord *records = malloc(capacity * sizeof(TraceRecord));
+    while (records != NULL) {
+        if (n == capacity) {
+            TraceRecord *grown = realloc(records, 2 * capacity * sizeof(TraceRecord));
+            if (grown == NULL) {
+                free(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
+            capacity *= 2;
+        }
+        size_t got = fread(records + n, sizeof(TraceRecord), capacity - n, file);
+        n += got;
+        if (got == 0) break;
+    }
+    fclose(file);
+    if (records == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return NULL;
+    }
+    *count = n;
+    return records;
+}
+
+static void print_records(const TraceRecord *records, size_t count) {
+    uint64_t start = count > 0 ? records[0].time_ns : 0;
+    printf("%14s %8s %-8s %6s %10s %10s %10s %s\n", "us", "tid", "stage", "wd", "mask", "cookie", "aux", "flags");
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord *r = &records[i];
+        printf("%14.3f %8u %-8s %6d 0x%08x %10u %10u%s\n", (double)(r->time_ns - start) / 1e3, r->tid,
+               filewatcher_trace_stage_name(r->stage), r->wd, r->mask, r->cookie, r->aux,
+               (r->flags & TRACE_FLAG_PRIORITY) ? " priority" : "");
+    }
+}
+
+static ThreadState *thread_state(ThreadState *threads, int *thread_count, uint32_t tid) {
+    for (int i = 0; i < *thread_count; i++) {
+        if (threads[i].tid == tid) return &threads[i];
+    }
+    if (*thread_count == MAX_THREADS) return NULL;
+    ThreadState *state = &threads[(*thread_count)++];
+    memset(state, 0, sizeof(*state));
+    state->tid = tid;
+    return state;
+}
+
+static Pending *find_pending(Pending *table, size_t mask, uint32_t flags, uint32_t end, int insert) {
+    size_t i = ((size_t)end * 2654435761u + flags) & mask;
+    for (;;) {
+        Pending *slot = &table[i];
+        if (slot->queue_ns == 0) return insert ? slot : NULL;
+        if (slot->key_flags == flags && slot->key_end == end) return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+static void take_sample(Samples *samples, uint64_t value) {
+    samples->values[samples->count++] = value;
+}
+
+static double percentile_us(const Samples *samples, double p) {
+    if (samples->count == 0) return 0.0;
+    size_t index = (size_t)(p * (double)(samples->count - 1));
+    return samples->values[index] / 1e3;
+}
+
+static int summarize(const TraceRecord *records, size_t count) {
+    uint64_t stage_counts[TRACE_STAGE_COUNT] = { 0 };
+    uint64_t lost = 0, unmatched = 0, undelivered = 0;
+    Samples spans[SPAN_COUNT];
+    ThreadState threads[MAX_THREADS];
+    int thread_count = 0;
+
+    size_t table_size = 16;
+    while (table_size < 2 * count) table_size *= 2;
+    Pending *pending = calloc(table_size, sizeof(Pending));
+    int ok = pending != NULL;
+    for (int s = 0; s < SPAN_COUNT; s++) {
+        spans[s].count = 0;
+        spans[s].values = malloc((count + 1) * sizeof(uint64_t));
+        if (spans[s].values == NULL) ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord *r = &records[i];
+        if (r->stage < TRACE_STAGE_COUNT) stage_counts[r->stage]++;
+        ThreadState *thread = thread_state(threads, &thread_count, r->tid);
+        switch (r->stage) {
+            case TRACE_READ:
+                if (thread != NULL) thread->read_ns = r->time_ns;
+                break;
+            case TRACE_PARSE:
+                if (thread == NULL) break;
+                if (thread->read_ns != 0) take_sample(&spans[SPAN_READ_PARSE], r->time_ns - thread->read_ns);
+                thread->parse_wd = r->wd;
+                thread->parse_ns = r->time_ns;
+                break;
+            case TRACE_FILTER:
+            case TRACE_COALESCE:
+                if (thread != NULL) thread->parse_ns = 0;
+                break;
+            case TRACE_QUEUE: {
+                Pending *slot = find_pending(pending, table_size - 1, r->flags, r->aux, 1);
+                slot->key_flags = r->flags;
+                slot->key_end = r->aux;
+                slot->queue_ns = r->time_ns;
+                slot->parse_ns = 0;
+                if (thread != NULL && thread->parse_ns != 0 && r->wd >= 0 && r->wd == thread->parse_wd) {
+                    take_sample(&spans[SPAN_PARSE_QUEUE], r->time_ns - thread->parse_ns);
+                    slot->parse_ns = thread->parse_ns;
+                    thread->parse_ns = 0;
+                } else {
+                    unmatched++;
+                }
+                break;
+            }
+            case TRACE_DELIVER: {
+                Pending *slot = find_pending(pending, table_size - 1, r->flags, r->aux, 0);
+                if (slot == NULL) break; // Queued before tracing started
+                take_sample(&spans[SPAN_QUEUE_DELIVER], r->time_ns - slot->queue_ns);
+                if (slot->parse_ns != 0) take_sample(&spans[SPAN_PARSE_DELIVER], r->time_ns - slot->parse_ns);
+                // Free the slot without breaking the probe chains behind it
+                slot->key_flags = UINT32_MAX;
+                slot->key_end = UINT32_MAX;
+                break;
+            }
+            case TRACE_LOST:
+                lost += r->aux;
+                break;
+            default:
+                break;
+        }
+    }
+    for (size_t i = 0; i < table_size; i++) {
+        if (pending[i].queue_ns != 0 && pending[i].key_flags != UINT32_MAX) undelivered++;
+    }
+
+    printf("%zu records over %.3f ms, %d threads\n\n", count,
+           count > 0 ? (double)(records[count - 1].time_ns - records[0].time_ns) / 1e6 : 0.0, thread_count);
+    for (unsigned s = 1; s < TRACE_STAGE_COUNT; s++) {
+        printf("  %-9s %10llu\n", filewatcher_trace_stage_name(s), (unsigned long long)stage_counts[s]);
+    }
+    printf("\n%-15s %10s %10s %10s %10s\n", "span", "events", "p50 us", "p99 us", "max us");
+    for (int s = 0; s < SPAN_COUNT; s++) {
+        qsort(spans[s].values, spans[s].count, sizeof(uint64_t), compare_u64);
+        printf("%-15s %10zu %10.1f %10.1f %10.1f\n", span_names[s], spans[s].count, percentile_us(&spans[s], 0.50),
+               percentile_us(&spans[s], 0.99), percentile_us(&spans[s], 1.0));
+        free(spans[s].values);
+    }
+    printf("\nunmatched %llu, undelivered %llu, lost %llu\n", (unsigned long long)unmatched,
+           (unsigned long long)undelivered, (unsigned long long)lost);
+    free(pending);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int summary = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        switch (opt) {
+            case 's': summary = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-s] trace-file\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-s] trace-file\n", argv[0]);
+        return 2;
+    }
+
+    size_t count;
+    TraceRecord *records = load(argv[optind], &count);
+    if (records == NULL) return 1;
+    qsort(records, count, sizeof(TraceRecord), compare_time);
+
+    int result = 0;
+    if (summary) {
+        result = summarize(records, count);
+    } else {
+        print_records(records, count);
+    }
+    free(records);
+    return result;
+}